@@ -0,0 +1,50 @@
+#pragma once
+#include <compiler.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * FP/SIMD state of a task, q0-q31, FPSR and FPCR. Layout is fixed, because
+ * armv8_fpsimd.S accesses fields by offsets.
+ *
+ * State is switched lazily: on context switch access to FP/SIMD is disabled
+ * through CPACR_EL1.FPEN unless registers already hold state of next task.
+ * First FP/SIMD instruction of a task traps into __armv8_fpsimd_trap, which
+ * saves registers to the context of previous owner, loads them from the
+ * context of current task and makes current task the owner. Tasks, that never
+ * touch FP/SIMD never pay for save and restore.
+ *
+ * Interrupt handlers must not modify FP/SIMD registers, as they run on top of
+ * the state of interrupted task: if the trap is taken in a handler, registers
+ * are loaded with the state of interrupted task and the handler would then
+ * overwrite it. Kernel objects are therefore built with -mgeneral-regs-only,
+ * except CORE_FPSIMD_OBJS in src/Makefile. Routines in armv8_stringlib.S
+ * preserve vector registers they use and are safe to call from anywhere.
+ */
+struct armv8_fpsimd_ctx {
+  uint64_t q[64];
+  uint32_t fpsr;
+  uint32_t fpcr;
+  /* Number of times task trapped on FP/SIMD access, 0 - task never used it */
+  uint32_t num_traps;
+  uint32_t reserved;
+} ALIGNED(16);
+
+STRICT_SIZE(struct armv8_fpsimd_ctx, 528);
+
+/*
+ * Called by scheduler when next task is selected to run, enables FP/SIMD
+ * access only if registers already hold state of 'next'.
+ */
+void armv8_fpsimd_switch(struct armv8_fpsimd_ctx *next);
+
+/*
+ * Called when context is freed, so that registers will not be considered
+ * valid for the task that will reuse it.
+ */
+void armv8_fpsimd_release(struct armv8_fpsimd_ctx *ctx);
+
+static inline bool armv8_fpsimd_is_used(const struct armv8_fpsimd_ctx *ctx)
+{
+  return ctx->num_traps != 0;
+}
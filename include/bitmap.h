@@ -68,3 +68,15 @@ static inline bool bitmap_bit_is_set(struct bitmap *b, int idx)
   BUG_IF(idx >= b->num_entries, "bitmap: out of range");
   return b->data[idx >> BITS_PER_WORD64_LOG] >> (idx % BITS_PER_WORD64);
 }
+
+/* Number of set bits */
+static inline int bitmap_count_set(struct bitmap *b)
+{
+  size_t i;
+  int n = 0;
+
+  for (i = 0; i < bitmap_num_bitwords(b); ++i)
+    n += __builtin_popcountll(b->data[i]);
+
+  return n;
+}
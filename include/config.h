@@ -3,5 +3,11 @@
 #define CONFIG_BCM2835_SDHC_LOG_REG_IO 1
 #undef CONFIG_BCM2835_SDHC_LOG_REG_IO
 #undef CONFIG_SCHED_MON
+#define CONFIG_TRACE 1
+#define CONFIG_PROF 1
+#define CONFIG_SHELL 1
+#define CONFIG_LAT_TEST_ON_BOOT 1
+#undef CONFIG_LAT_TEST_ON_BOOT
 #define CONFIG_CONSOLE_BAUDRATE 230400
+#define CONFIG_TASK_NUM_APP_TASKS 8
 
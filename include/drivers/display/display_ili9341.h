@@ -4,14 +4,71 @@
 #include <graphics.h>
 #include <list.h>
 
+/*
+ * Pixel format of data sent to display RAM, selected by COLMOD command.
+ * RGB666 - 3 bytes per pixel, 6 significant bits in each byte
+ * RGB565 - 2 bytes per pixel, sent big endian (high byte first)
+ */
+enum ili9341_pixel_format {
+  ILI9341_PIXEL_FORMAT_RGB666 = 0,
+  ILI9341_PIXEL_FORMAT_RGB565,
+};
+
 struct spi_dma_xfer_cb {
   int spi_start;
   int tx;
   int rx;
 };
 
+#define ILI9341_MAX_DAMAGE_RECTS 8
+
+/*
+ * Damage - set of rectangles in display coordinates, that have changed and
+ * need to be sent to display. Overlapping and touching rectangles are merged
+ * on insertion.
+ */
+struct ili9341_damage {
+  struct rectangle rects[ILI9341_MAX_DAMAGE_RECTS];
+  int num_rects;
+};
+
+struct ili9341_stats {
+  uint32_t num_full_draws;
+  uint32_t num_partial_draws;
+  /* Number of pixel bytes sent to display over SPI */
+  uint64_t num_bytes_sent;
+};
+
+/*
+ * State of a drawframe buffer in the drawframe mailbox, see
+ * ili9341_frame_acquire / ili9341_frame_submit.
+ */
+typedef enum {
+  ILI9341_FRAME_FREE = 0,
+  ILI9341_FRAME_WRITING,
+  ILI9341_FRAME_READY,
+  ILI9341_FRAME_DISPLAYING,
+} ili9341_frame_state_t;
+
+struct ili9341_frame_stats {
+  uint32_t num_submitted;
+  uint32_t num_presented;
+  /* Frames replaced by a newer one before they were displayed */
+  uint32_t num_dropped;
+  /* Presentation latency, from frame timestamp to end of SPI transfer */
+  uint32_t latency_last_us;
+  uint32_t latency_min_us;
+  uint32_t latency_max_us;
+  uint64_t latency_sum_us;
+};
+
 struct ili9341_per_frame_dma {
   struct list_head draw_tasks;
+  ili9341_frame_state_t state;
+  /* Time in microseconds, when frame was produced */
+  uint64_t timestamp_us;
+  /* Regions to send on next draw, empty for whole drawframe */
+  struct ili9341_damage damage;
   struct spi_dma_xfer_cb *cbs;
   int num_transfers;
   /* DMA control blocks */
@@ -41,9 +98,17 @@ struct ili9341_drawframe {
   uint32_t spi_header_last;
   int num_transfers;
   ili9341_on_dma_done_irq on_dma_done_irq;
+
+  /*
+   * Mailbox slot: latest submitted buffer, that is waiting in draw queue and
+   * has not started displaying yet. Submitting a newer frame replaces it.
+   */
+  struct ili9341_per_frame_dma *mailbox_ready;
+  struct ili9341_frame_stats stats;
 };
 
 int ili9341_init(int gpio_blk, int gpio_dc, int gpio_reset,
+  enum ili9341_pixel_format pixel_format,
   struct ili9341_drawframe *drawframes, int num_drawframes);
 
 void ili9341_draw_bitmap(const uint8_t *data, size_t data_sz,
@@ -54,4 +119,61 @@ int ili9341_drawframe_set_irq(struct ili9341_drawframe *r,
 
 void ili9341_draw_dma_buf(struct ili9341_per_frame_dma *dma_buf);
 
-size_t ili9341_get_frame_byte_size(int frame_width, int frame_height);
+/*
+ * Drawframe mailbox - tear-free triple buffering between a producer and the
+ * display. Producer acquires a free buffer, fills it and submits it. The
+ * display always shows the latest submitted frame: if previous submitted
+ * frame has not started displaying yet, it is dropped and its buffer is
+ * reused, so display lags producer by at most one frame. With 3 buffers
+ * in a drawframe there is always a free one for the producer. Buffers of a
+ * drawframe used with mailbox should not be drawn with ili9341_draw_dma_buf.
+ *
+ * ili9341_frame_acquire returns NULL only if all buffers are busy.
+ * timestamp_us - time the frame was produced (e.g. capture time), used to
+ * calculate presentation latency, if 0, submission time is used.
+ */
+struct ili9341_per_frame_dma *ili9341_frame_acquire(
+  struct ili9341_drawframe *drawframe);
+
+void ili9341_frame_submit(struct ili9341_per_frame_dma *dma_buf,
+  uint64_t timestamp_us);
+
+void ili9341_frame_get_stats(struct ili9341_drawframe *drawframe,
+  struct ili9341_frame_stats *s);
+
+void ili9341_damage_reset(struct ili9341_damage *d);
+
+/*
+ * Adds rectangle to damage, merging it with overlapping or touching ones.
+ * If there is no free slot, it is merged with the rectangle, which bounding
+ * box grows the least.
+ */
+void ili9341_damage_add(struct ili9341_damage *d, const struct rectangle *r);
+
+/*
+ * Same as ili9341_draw_dma_buf, but only pixels from damaged regions of the
+ * drawframe are sent. Falls back to full drawframe update, if damage can not
+ * be expressed with the preallocated DMA chain.
+ */
+void ili9341_draw_dma_buf_damaged(struct ili9341_per_frame_dma *dma_buf,
+  const struct ili9341_damage *d);
+
+void ili9341_get_stats(struct ili9341_stats *s);
+
+size_t ili9341_get_frame_byte_size(enum ili9341_pixel_format pixel_format,
+  int frame_width, int frame_height);
+
+/*
+ * Returns MMAL encoding, that should be set on producer port (ISP output)
+ * to get frames in the format of the display. For RGB565 this is
+ * MMAL_ENCODING_RGB16, which is little endian, so it has to be converted
+ * with ili9341_rgb565_swap_bytes before drawing.
+ */
+uint32_t ili9341_pixel_format_to_mmal_encoding(
+  enum ili9341_pixel_format pixel_format);
+
+/*
+ * In-place conversion of RGB565 pixels between little endian layout produced
+ * by MMAL and big endian layout expected by display. size is in bytes.
+ */
+void ili9341_rgb565_swap_bytes(void *buf, size_t size);
@@ -100,6 +100,12 @@ void bcm2835_dma_release_cb(int cb_idx);
 bool bcm2835_dma_program_cb(const struct bcm2835_dma_request_param *p,
   int cb_handle);
 
+bool bcm2835_dma_program_cb_2d(const struct bcm2835_dma_request_param *p,
+  int cb_handle, uint32_t xlength, uint32_t ylength, int16_t src_stride,
+  int16_t dst_stride);
+
+bool bcm2835_dma_channel_supports_2d(int channel);
+
 bool bcm2835_dma_update_cb_src(int cb_handle, uint32_t src);
 
 #define CB_HANDLE_NEXT_NONE -2
@@ -113,3 +119,6 @@ void bcm2835_dma_activate(int channel);
 
 bool bcm2835_dma_set_irq_callback(int channel, void (*cb)(void));
 void bcm2835_dma_dump_channel(const char *tag, int channel);
+
+/* Prints control block and channel usage, per channel irq and error counts */
+void bcm2835_dma_print_stats(void);
@@ -288,7 +288,8 @@ typedef enum {
 } sdhc_sdcard_mode_t;
 
 struct sdhc_iostats {
-  uint32_t num_bytes_written;
+  /* Since boot, never cleared */
+  uint64_t num_bytes_written;
 };
 
 struct sdhc {
@@ -340,4 +341,8 @@ static inline bool sdhc_in_dma_mode(const struct sdhc *s)
     || s->io_mode == SDHC_IO_MODE_IT_DMA;
 }
 
-void sdhc_iostats_fetch_clear(struct sdhc_iostats *iostats);
+/*
+ * Cumulative counters, readers keep their own previous snapshot and diff,
+ * so that any number of them can look at the same stats.
+ */
+void sdhc_iostats_get(struct sdhc_iostats *iostats);
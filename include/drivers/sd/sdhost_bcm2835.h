@@ -1,5 +1,31 @@
 #pragma once
 #include <drivers/sd/sdhc.h>
+#include <lat_hist.h>
 
 extern struct sdhc_ops bcm_sdhost_ops;
 int bcm_sdhost_set_log_level(int l);
+
+typedef enum {
+  BCM_SDHOST_STAT_CMD17 = 0,
+  BCM_SDHOST_STAT_CMD18,
+  BCM_SDHOST_STAT_CMD24,
+  BCM_SDHOST_STAT_CMD25,
+  BCM_SDHOST_STAT_NUM_CMDS
+} bcm_sdhost_stat_cmd_t;
+
+/* Per command latency histograms, in arm timer counts */
+struct bcm_sdhost_stats {
+  /*
+   * Command written till response. Seen by polling in blocking modes and
+   * by DATA interrupt for single-buffer DMA writes, not measured otherwise
+   */
+  struct lat_hist cmd_resp[BCM_SDHOST_STAT_NUM_CMDS];
+  /* DMA channel activated till DMA done interrupt */
+  struct lat_hist dma_data[BCM_SDHOST_STAT_NUM_CMDS];
+  /* CPU busy-waiting for the card to finish programming written data */
+  struct lat_hist busy_wait[BCM_SDHOST_STAT_NUM_CMDS];
+};
+
+void bcm_sdhost_get_stats(struct bcm_sdhost_stats *s);
+void bcm_sdhost_reset_stats(void);
+void bcm_sdhost_print_stats(void);
@@ -12,5 +12,18 @@ void bcm2835_systimer_start_oneshot(uint32_t usec, timer_callback_t cb,
 
 void bcm2835_systimer_clear_irq(int timer_idx);
 
+/*
+ * Channel 3 is the second channel free for ARM, channel 1 drives scheduler
+ * tick. Compare is absolute: cb is called once, when low 32 bits of the
+ * microsecond counter reach deadline_us.
+ */
+void bcm2835_systimer3_start_at(uint32_t deadline_us, timer_callback_t cb,
+  void *cb_arg);
+
+void bcm2835_systimer3_stop(void);
+
+/* Low 32 bits of free running microsecond counter */
+uint32_t bcm2835_systimer_get_clo(void);
+
 uint64_t bcm2835_systimer_get_time_us(void);
 uint64_t bcm2835_systimer_get_time_us_locked(void);
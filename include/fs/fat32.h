@@ -444,4 +444,29 @@ struct fat_dentry_loc {
 int fat32_lookup(const struct fat32_fs *fs, const char *filepath,
   struct fat_dentry_loc *loc, struct fat_dentry *d);
 
+/*
+ * Cursor for sequential writes at the end of a file. Unlike fat32_write it
+ * does not look the file up and walk its cluster chain on every call, new
+ * clusters are linked right after the last one. File size in directory entry
+ * is only updated by fat32_append_sync.
+ */
+struct fat32_append {
+  const struct fat32_fs *fs;
+  struct fat_dentry_loc loc;
+  uint32_t first_cluster;
+  uint32_t last_cluster;
+  size_t num_clusters;
+  size_t size;
+  /* Size in directory entry */
+  size_t synced_size;
+};
+
+int fat32_append_open(struct fat32_append *a, const struct fat32_fs *fs,
+  const char *filepath);
+
+int fat32_append_write(struct fat32_append *a, const void *data, size_t size);
+
+/* Writes file size and first cluster to directory entry */
+int fat32_append_sync(struct fat32_append *a);
+
 void fat32_init(void);
@@ -1,4 +1,5 @@
 #pragma once
+#include <stdint.h>
 
 #define NUM_IRQS 128
 
@@ -10,10 +11,46 @@
 
 typedef void(*irq_func)(void);
 
+/* Handler times are in arm timer counts */
+struct irq_stats {
+  uint32_t count;
+  uint64_t time;
+  uint64_t max_time;
+};
+
+extern uint64_t irq_total_time;
+
 void __handle_irq(int irqnr);
 
+/*
+ * ARM local interrupt sources of core 0, bit numbers in its source register.
+ * Bit 8 is the GPU interrupt controller, handled by __handle_irq.
+ */
+#define IRQ_LOCAL_CNTPS    0
+#define IRQ_LOCAL_CNTPNS   1
+#define IRQ_LOCAL_CNTHP    2
+#define IRQ_LOCAL_CNTV     3
+#define IRQ_LOCAL_MAILBOX0 4
+#define IRQ_LOCAL_GPU      8
+#define IRQ_LOCAL_PMU      9
+#define IRQ_LOCAL_AXI      10
+#define IRQ_LOCAL_TIMER    11
+#define NUM_IRQS_LOCAL     12
+
+/* sources - pending bits of core 0 local interrupt source register */
+void __handle_irq_local(uint32_t sources);
+
 void irq_init(void);
 
 int irq_set(int irqnr, irq_func func);
 
-int irq_local_set(irq_func func);
+/*
+ * Sets handler of ARM local interrupt source. Only IRQ_LOCAL_PMU is
+ * dispatched, other pending sources are counted and masked at the source.
+ */
+int irq_local_set(int source, irq_func func);
+
+void irq_get_stats(int irqnr, struct irq_stats *s);
+
+/* Prints count, total and max handler time of every IRQ, that has fired */
+void irq_print_stats(void);
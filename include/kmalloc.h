@@ -11,5 +11,9 @@ void dma_memory_init(void);
 void *dma_alloc(size_t sz, bool zero);
 void dma_free(void *);
 
+/* Print used and total chunks per chunk size */
+void kmalloc_print_stats(void);
+void dma_memory_print_stats(void);
+
 uint64_t dma_memory_get_start_addr(void);
 uint64_t dma_memory_get_end_addr(void);
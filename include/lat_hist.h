@@ -0,0 +1,76 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Latency histogram with log2 buckets. Bucket i counts values in range
+ * [2^i, 2^(i+1)), bucket 0 also counts 0. Values are in arm timer counts,
+ * adding a value is a few instructions, so histograms can stay always on.
+ */
+#define LAT_HIST_NUM_BUCKETS 32
+
+struct lat_hist {
+  uint32_t count;
+  uint32_t buckets[LAT_HIST_NUM_BUCKETS];
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+};
+
+static inline int lat_hist_bucket(uint64_t value)
+{
+  int b;
+
+  if (!value)
+    return 0;
+
+  b = 63 - __builtin_clzll(value);
+  return b < LAT_HIST_NUM_BUCKETS ? b : LAT_HIST_NUM_BUCKETS - 1;
+}
+
+static inline void lat_hist_add(struct lat_hist *h, uint64_t value)
+{
+  if (!h->count || value < h->min)
+    h->min = value;
+  h->buckets[lat_hist_bucket(value)]++;
+  h->count++;
+  h->sum += value;
+  if (value > h->max)
+    h->max = value;
+}
+
+static inline void lat_hist_reset(struct lat_hist *h)
+{
+  memset(h, 0, sizeof(*h));
+}
+
+/*
+ * Estimate of value, pct percent of values are below. Bucket holding it is
+ * found exactly, inside the bucket values are assumed to be spread evenly,
+ * result is kept within min and max values seen.
+ */
+static inline uint64_t lat_hist_percentile(const struct lat_hist *h, int pct)
+{
+  uint64_t target, n = 0;
+  uint64_t lo, hi, v;
+  int i;
+
+  if (!h->count)
+    return 0;
+
+  target = ((uint64_t)h->count * pct + 99) / 100;
+  for (i = 0; i < LAT_HIST_NUM_BUCKETS - 1; ++i) {
+    if (n + h->buckets[i] >= target)
+      break;
+    n += h->buckets[i];
+  }
+
+  lo = i ? 1ull << i : 0;
+  hi = 2ull << i;
+  v = h->buckets[i] ? lo + (hi - lo) * (target - n) / h->buckets[i] : hi;
+  if (v > h->max)
+    v = h->max;
+  if (v < h->min)
+    v = h->min;
+  return v;
+}
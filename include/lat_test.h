@@ -0,0 +1,69 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <lat_hist.h>
+
+struct block_device;
+struct ili9341_drawframe;
+
+/* Defaults of shell "lat" command and CONFIG_LAT_TEST_ON_BOOT run */
+#define LAT_TEST_DEFAULT_PERIOD_US 1000
+#define LAT_TEST_DEFAULT_NUM_PERIODS 2000
+#define LAT_TEST_DEFAULT_MAX_WAKEUP_US 1000
+
+/*
+ * Interrupt latency and scheduling jitter self-test, similar to cyclictest.
+ *
+ * Periodic deadlines are armed on systimer channel 3 with absolute compare,
+ * so deadlines do not drift with latency. For each period two latencies are
+ * recorded, both relative to the deadline:
+ * irq    - timer interrupt handler runs
+ * wakeup - measuring task, woken by the handler, runs
+ *
+ * Background load tasks run for the duration of the test, each is optional.
+ */
+struct lat_test_cfg {
+  uint32_t period_us;
+  uint32_t num_periods;
+
+  /* Writes sectors [sd_start_sector, +sd_num_sectors) over and over */
+  struct block_device *sd_bdev;
+  uint64_t sd_start_sector;
+  uint32_t sd_num_sectors;
+
+  /* Resubmits frames of initialized drawframe, keeps SPI DMA busy */
+  struct ili9341_drawframe *display;
+
+  /* Floods logger with records */
+  bool logger_flood;
+
+  /* Test fails, if max wakeup latency is above, 0 - no limit */
+  uint32_t max_wakeup_us;
+};
+
+/* Latencies are in arm timer counts */
+struct lat_test_result {
+  struct lat_hist irq;
+  struct lat_hist wakeup;
+  /* Deadlines, that passed before they could be armed */
+  uint32_t num_missed;
+  /* Periods, where task woke up after the next deadline */
+  uint32_t num_overruns;
+  uint32_t num_sd_writes;
+  uint32_t num_display_frames;
+  uint32_t num_log_records;
+};
+
+/*
+ * Runs the test in the calling task, blocks for about period_us *
+ * num_periods. Returns ERR_TIMEOUT if max_wakeup_us was exceeded or timer
+ * stopped firing.
+ */
+int lat_test_run(const struct lat_test_cfg *cfg, struct lat_test_result *r);
+
+/*
+ * Prints min/avg/p99/max in nanoseconds and "LAT-TEST: PASS" or
+ * "LAT-TEST: FAIL" line, that scripts/lat_test_qemu.sh waits for.
+ */
+void lat_test_print(const struct lat_test_cfg *cfg,
+  const struct lat_test_result *r, int err);
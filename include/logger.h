@@ -3,16 +3,37 @@
 #include <stddef.h>
 #include <compiler.h>
 
-#define LOGGER_MAX_ENTRY_LENGTH 256
+/* Typical record is 40-56 bytes, ring holds over 1000 messages */
+#define LOGGER_RING_SIZE (64 * 1024)
+#define LOGGER_MAX_ARGS 16
+/*
+ * Longest %s argument copied into the record, longer ones are cut and end
+ * with LOGGER_STR_CUT_MARK
+ */
+#define LOGGER_MAX_STR_LEN 128
+#define LOGGER_STR_CUT_MARK "..."
+#define LOGGER_MAX_LINE_LENGTH 256
 
-#define LOGGER_ENT_STATE_FREE 0
-#define LOGGER_ENT_STATE_BUSY 1
-#define LOGGER_ENT_STATE_READY 2
-struct logger_entry {
+#define LOGGER_REC_STATE_BUSY 0
+#define LOGGER_REC_STATE_READY 1
+#define LOGGER_REC_STATE_PAD 2
+
+/*
+ * Binary log record. Message is not formatted by the caller, record keeps
+ * format string pointer and raw arguments, strings are copied after argv and
+ * their argv words hold offset from the start of the record.
+ */
+struct logger_rec {
+  /* Size of the whole record, multiple of 8 */
+  uint16_t size;
   uint8_t state;
-  /* Place to store log text */
-  char buf[LOGGER_MAX_ENTRY_LENGTH];
-} PACKED;
+  uint8_t argc;
+  uint32_t str_mask;
+  /* Timestamp in arm timer counts */
+  uint64_t time;
+  const char *fmt;
+  uint64_t argv[];
+};
 
 int logger_init(void);
 
@@ -0,0 +1,132 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <media/h264.h>
+
+/*
+ * Streaming fragmented MP4 muxer for H.264 encoder output.
+ *
+ * Output file layout:
+ *   ftyp, moov (no samples, mvex)  - written before the first keyframe
+ *   moof, mdat                      - one fragment per GOP
+ *   ...
+ *   mfra                            - keyframe index, written by finish
+ *
+ * Every fragment is self-contained, so if recording is cut by power loss,
+ * file is playable up to the last fragment written. mfra at the end lets
+ * players seek without scanning all fragments.
+ *
+ * Encoder buffers are pushed as they come, frames may span several buffers.
+ * Annex-B start codes are replaced by 4-byte lengths, SPS and PPS are moved
+ * to avcC, AUDs are dropped. Frames before the first keyframe with known SPS
+ * and PPS are dropped.
+ *
+ * Muxer writes sequentially through a callback and does not allocate memory,
+ * all buffers are given by the caller. Sample data of a fragment is
+ * collected in frag_buf; if it fills up before the next keyframe, fragment
+ * is closed early and the next one starts with a non-sync sample.
+ *
+ * VideoCore encoder does not produce B-frames, so decode order is
+ * presentation order and no composition offsets are written.
+ */
+
+#define FMP4_TIMESCALE 90000
+#define FMP4_MAX_FRAGMENT_SAMPLES 128
+#define FMP4_MAX_PARAM_SET_SIZE 128
+#define FMP4_BOX_BUF_SIZE 2048
+
+/* Appends size bytes to output, returns SUCCESS or error code */
+typedef int (*fmp4_write_cb_t)(void *arg, const void *data, size_t size);
+
+/* Output written so far is a playable file, it can be made durable */
+typedef int (*fmp4_sync_cb_t)(void *arg);
+
+struct fmp4_index_entry {
+  /* Decode time of the keyframe in FMP4_TIMESCALE units */
+  uint64_t time;
+  /* Offset of moof, that starts with the keyframe */
+  uint64_t moof_offset;
+};
+
+struct fmp4_config {
+  fmp4_write_cb_t write;
+  /* Called with write_arg after every fragment and the index, may be NULL */
+  fmp4_sync_cb_t sync;
+  void *write_arg;
+
+  /* Sample data of the fragment in progress, should fit a whole GOP */
+  uint8_t *frag_buf;
+  size_t frag_buf_size;
+
+  /* Assembles frames, that come in several buffers, may be NULL */
+  uint8_t *frame_buf;
+  size_t frame_buf_size;
+
+  /* Keyframe index, entries that do not fit are not indexed */
+  struct fmp4_index_entry *index;
+  int index_size;
+
+  /* Duration of the last frame, when it can not be derived from pts */
+  int frame_rate;
+};
+
+struct fmp4_stats {
+  int frames;
+  int keyframes;
+  int fragments;
+  int frames_dropped;
+  uint64_t bytes_written;
+};
+
+struct fmp4_sample {
+  uint32_t size;
+  uint32_t duration;
+  bool sync;
+};
+
+struct fmp4_muxer {
+  struct fmp4_config config;
+  struct fmp4_stats stats;
+
+  uint8_t sps[FMP4_MAX_PARAM_SET_SIZE];
+  size_t sps_size;
+  uint8_t pps[FMP4_MAX_PARAM_SET_SIZE];
+  size_t pps_size;
+  struct h264_sps_info sps_info;
+  bool header_written;
+  bool wait_keyframe;
+  int err;
+
+  /* Frame, that is being assembled in frame_buf */
+  size_t frame_len;
+  bool frame_overflow;
+  bool frame_key;
+  int64_t frame_pts;
+
+  /* Fragment in progress */
+  struct fmp4_sample samples[FMP4_MAX_FRAGMENT_SAMPLES];
+  int num_samples;
+  size_t frag_len;
+  uint64_t frag_time;
+
+  int64_t last_pts;
+  uint32_t default_duration;
+  uint32_t sequence_number;
+  uint64_t offset;
+  int num_index;
+
+  uint8_t box_buf[FMP4_BOX_BUF_SIZE];
+};
+
+int fmp4_muxer_init(struct fmp4_muxer *m, const struct fmp4_config *config);
+
+/*
+ * Pushes one encoder buffer. flags are MMAL_BUFFER_HEADER_FLAG_*, pts is in
+ * microseconds. Buffer with FRAME_END completes the frame.
+ */
+int fmp4_muxer_push(struct fmp4_muxer *m, const void *data, size_t size,
+  uint32_t flags, int64_t pts);
+
+/* Writes last fragment and keyframe index */
+int fmp4_muxer_finish(struct fmp4_muxer *m);
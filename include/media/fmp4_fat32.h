@@ -0,0 +1,19 @@
+#pragma once
+#include <fs/fat32.h>
+
+/* Output of fmp4 muxer into a file on FAT32 partition */
+struct fmp4_fat32_file {
+  struct fat32_append a;
+};
+
+/*
+ * Creates the file, pass fmp4_fat32_write, fmp4_fat32_sync and file as
+ * write_arg to muxer
+ */
+int fmp4_fat32_open(struct fmp4_fat32_file *f, const struct fat32_fs *fs,
+  const char *path);
+
+int fmp4_fat32_write(void *arg, const void *data, size_t size);
+
+/* Makes data written so far part of the file, writes its size */
+int fmp4_fat32_sync(void *arg);
@@ -0,0 +1,106 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <media/fmp4.h>
+
+/*
+ * Pre-event store of encoded video: encoder buffers are kept in a circular
+ * byte buffer of fixed size, whole GOPs are evicted from the oldest end, so
+ * that the ring always starts at a keyframe and covers at least window_ms
+ * of video, or as much as fits the memory.
+ *
+ * On trigger a reader starts at the oldest GOP and follows the writer, so
+ * event file gets video from before the trigger followed by live video,
+ * while encoder output keeps flowing to the ring and to live recording.
+ * Writer never waits for reader:
+ * - record held by reader between gop_ring_read_begin and _end is never
+ *   evicted, if there is no space without it, new buffer is not stored and
+ *   ring waits for the next keyframe.
+ * - other unread records are evicted as usual, reader then skips to the
+ *   oldest GOP left and the gap is counted in stats.
+ *
+ * Writer runs in mmal io loop, reader in a task writing to SD card.
+ */
+
+#define GOP_RING_CONFIG_MAX_SIZE 128
+
+struct gop_ring_record {
+  uint32_t offset;
+  uint32_t size;
+  uint32_t flags;
+  bool gop_start;
+  int64_t pts;
+};
+
+struct gop_ring_stats {
+  int buffers_stored;
+  int gops_evicted;
+  int buffers_dropped;
+  int reader_buffers_lost;
+};
+
+struct gop_ring_buf {
+  const void *data;
+  size_t size;
+  uint32_t flags;
+  int64_t pts;
+};
+
+struct gop_ring {
+  uint8_t *buf;
+  size_t buf_size;
+  size_t head;
+
+  struct gop_ring_record *records;
+  int max_records;
+
+  /* Records are numbered, index in records is seq % max_records */
+  uint64_t first_seq;
+  uint64_t next_seq;
+
+  int64_t window_us;
+  int64_t newest_pts;
+  bool wait_keyframe;
+  bool prev_frame_end;
+
+  /* Last codec config buffer, given to reader before any frames */
+  uint8_t config[GOP_RING_CONFIG_MAX_SIZE];
+  size_t config_size;
+  uint32_t config_flags;
+
+  bool reader_active;
+  bool reader_config_pending;
+  bool reader_busy;
+  uint64_t read_seq;
+
+  struct gop_ring_stats stats;
+};
+
+void gop_ring_init(struct gop_ring *r, void *buf, size_t buf_size,
+  struct gop_ring_record *records, int max_records, int window_ms);
+
+/* Stores encoder buffer, flags are MMAL_BUFFER_HEADER_FLAG_* */
+void gop_ring_push(struct gop_ring *r, const void *data, size_t size,
+  uint32_t flags, int64_t pts);
+
+/* Starts reader at the oldest GOP in the ring */
+void gop_ring_trigger(struct gop_ring *r);
+
+void gop_ring_stop(struct gop_ring *r);
+
+/*
+ * Gets next buffer for reader, it stays valid until gop_ring_read_end.
+ * Returns ERR_NOT_FOUND if reader has caught up with the writer.
+ */
+int gop_ring_read_begin(struct gop_ring *r, struct gop_ring_buf *b);
+
+void gop_ring_read_end(struct gop_ring *r);
+
+/*
+ * Moves up to max_bufs buffers from reader to muxer, returns number of
+ * buffers moved or error of muxer.
+ */
+int gop_ring_drain(struct gop_ring *r, struct fmp4_muxer *m, int max_bufs);
+
+void gop_ring_get_stats(struct gop_ring *r, struct gop_ring_stats *stats);
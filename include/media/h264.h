@@ -0,0 +1,53 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Minimal H.264 Annex-B parsing, enough to split encoder output into NAL
+ * units, recognize access units and keyframes and read stream dimensions
+ * from SPS. Does not depend on the rest of the kernel, so it also builds on
+ * host.
+ */
+
+#define H264_NAL_SLICE 1
+#define H264_NAL_IDR 5
+#define H264_NAL_SEI 6
+#define H264_NAL_SPS 7
+#define H264_NAL_PPS 8
+#define H264_NAL_AUD 9
+
+struct h264_nal {
+  /* NAL unit without start code, starting with NAL header byte */
+  const uint8_t *data;
+  size_t size;
+  int type;
+};
+
+struct h264_sps_info {
+  int profile_idc;
+  int constraint_flags;
+  int level_idc;
+  int chroma_format_idc;
+  int bit_depth_luma;
+  int bit_depth_chroma;
+  int width;
+  int height;
+};
+
+static inline bool h264_nal_is_vcl(int type)
+{
+  return type >= H264_NAL_SLICE && type <= H264_NAL_IDR;
+}
+
+/*
+ * Finds next NAL unit in Annex-B byte stream between *pos and end, advances
+ * *pos past it. Returns false when there are no more NAL units.
+ */
+bool h264_nal_next(const uint8_t **pos, const uint8_t *end,
+  struct h264_nal *nal);
+
+/* True if VCL NAL unit is the first slice of a new picture */
+bool h264_nal_is_first_slice(const struct h264_nal *nal);
+
+int h264_sps_parse(const struct h264_nal *nal, struct h264_sps_info *info);
@@ -2,6 +2,16 @@
 
 #define NARROW_PTR(x) ((uint32_t)((uint64_t)(x)))
 
+/*
+ * Kernel is linked to the upper half of virtual address space, see link.ld.
+ * 32-bit handles passed to VideoCore are kernel pointers with the upper bits
+ * dropped.
+ */
+#define KERNEL_VA_BASE 0xffff000000000000
+#define PTR_TO_HANDLE32(__ptr) ((uint32_t)((uint64_t)(__ptr) & ~KERNEL_VA_BASE))
+#define HANDLE32_TO_PTR(__handle) \
+  ((void *)((uint64_t)(__handle) | KERNEL_VA_BASE))
+
 #define RAM_BASE_PHY          0x00000000
 #define RAM_BASE_BUS_UNCACHED 0xc0000000
 #define RAM_BASE_BUS_CACHED   0x40000000
@@ -15,5 +25,9 @@
 #define PERIPH_ADDR_TO_DMA(__addr) \
   ((NARROW_PTR(__addr) & ~0x3f000000) | 0x7e000000)
 
+/* ARM local peripherals of BCM2837: core timers, mailboxes, PMU routing */
+#define LOCAL_PERIPH_ADDR_START 0x40000000
+#define LOCAL_PERIPH_ADDR_END   0x40040000
+
 #define BCM2835_MEM_PERIPH_BASE PERIPH_BASE_PHY
 #define BCM2835_MEM_GPIO_BASE (PERIPH_BASE_PHY + 0x200000)
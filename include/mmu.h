@@ -5,3 +5,9 @@
 void mmu_print_va(uint64_t addr, int verbose);
 void mmu_init(uint64_t dma_memory_start, uint64_t dma_memory_end);
 bool mmu_get_pddr(uint64_t va, uint64_t *pa);
+
+/*
+ * Unmaps 4K page at va, so that any access to it faults, or maps it back
+ * as normal memory, if guard is false. Used for stack guard pages.
+ */
+int mmu_set_guard_page(uint64_t va, bool guard);
@@ -100,3 +100,25 @@ static inline void os_msgq_get(struct os_msgq *q, void *m)
   restore_irq_flags(irq);
   memcpy(m, slot, q->msg_size);
 }
+
+/* Non-blocking get, returns ERR_BUSY if queue is empty */
+static inline int os_msgq_try_get(struct os_msgq *q, void *m)
+{
+  int irq;
+  const uint8_t *slot;
+
+  disable_irq_save_flags(irq);
+  if (q->wr == q->rd) {
+    restore_irq_flags(irq);
+    return ERR_BUSY;
+  }
+
+  slot = q->queue + q->rd * q->msg_size;
+  q->rd++;
+  if (q->rd == q->queue_size)
+    q->rd = 0;
+
+  restore_irq_flags(irq);
+  memcpy(m, slot, q->msg_size);
+  return SUCCESS;
+}
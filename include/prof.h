@@ -0,0 +1,125 @@
+#pragma once
+#include <config.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * PMU based profiling.
+ *
+ * Markers: PROF_BEGIN/PROF_END around a code region accumulate CPU cycles,
+ * retired instructions, L1 data cache refills and mispredicted branches
+ * into a static marker. Counters are not switched with tasks, so if the
+ * region blocks, the numbers include whatever ran meanwhile.
+ *
+ *   PROF_MARKER(fat32_write);
+ *   ...
+ *   PROF_BEGIN(fat32_write);
+ *   ...
+ *   PROF_END(fat32_write);
+ *
+ * Sampling: PMU counter overflows every period cycles, overflow interrupt
+ * records interrupted PC into a histogram. prof_samples_dump_uart prints
+ * it, scripts/prof2sym.py resolves PCs to functions with the kernel ELF.
+ *
+ * Cycle counter PMCCNTR_EL0 is free running, event counters 0-2 count
+ * marker events, counter 3 drives sampling.
+ */
+
+/* ARMv8 common PMU event numbers */
+#define PROF_PMU_EV_L1D_CACHE_REFILL 0x03
+#define PROF_PMU_EV_INST_RETIRED     0x08
+#define PROF_PMU_EV_BR_MIS_PRED      0x10
+#define PROF_PMU_EV_CPU_CYCLES       0x11
+
+/* Event counters, prof_read_counters reads 0-2 directly */
+#define PROF_PMU_CNT_INSTR      0
+#define PROF_PMU_CNT_L1D_REFILL 1
+#define PROF_PMU_CNT_BR_MISS    2
+#define PROF_PMU_CNT_SAMPLE     3
+
+#define PROF_NUM_SAMPLE_SLOTS 4096
+
+struct prof_counters {
+  uint64_t cycles;
+  uint32_t instructions;
+  uint32_t l1d_refills;
+  uint32_t branch_misses;
+};
+
+struct prof_marker {
+  const char *name;
+  struct prof_marker *next;
+  bool registered;
+  uint32_t count;
+  uint64_t cycles;
+  uint64_t instructions;
+  uint64_t l1d_refills;
+  uint64_t branch_misses;
+  uint64_t max_cycles;
+};
+
+struct prof_sample_stats {
+  uint64_t num_samples;
+  /* Samples, that did not fit into the histogram */
+  uint64_t num_dropped;
+  uint32_t num_slots_used;
+};
+
+#if defined(CONFIG_PROF)
+static inline void prof_read_counters(struct prof_counters *c)
+{
+  uint64_t cycles, instr, refills, br_miss;
+
+  asm volatile(
+    "mrs %0, pmccntr_el0\n"
+    "mrs %1, pmevcntr0_el0\n"
+    "mrs %2, pmevcntr1_el0\n"
+    "mrs %3, pmevcntr2_el0\n"
+    : "=r"(cycles), "=r"(instr), "=r"(refills), "=r"(br_miss));
+
+  c->cycles = cycles;
+  c->instructions = instr;
+  c->l1d_refills = refills;
+  c->branch_misses = br_miss;
+}
+
+void prof_marker_add(struct prof_marker *m, const struct prof_counters *start);
+
+#define PROF_MARKER(__name) \
+  static struct prof_marker prof_marker_ ## __name = { .name = #__name }
+
+#define PROF_BEGIN(__name) \
+  struct prof_counters prof_start_ ## __name; \
+  prof_read_counters(&prof_start_ ## __name)
+
+#define PROF_END(__name) \
+  prof_marker_add(&prof_marker_ ## __name, &prof_start_ ## __name)
+
+/* Prints totals and per call averages of all markers, that were hit */
+void prof_print_markers(void);
+void prof_reset_markers(void);
+
+/* Starts sampling every period CPU cycles, histogram is cleared */
+int prof_sampling_start(uint32_t period);
+void prof_sampling_stop(void);
+void prof_sampling_get_stats(struct prof_sample_stats *s);
+
+/*
+ * Prints "pc count" lines between "PROF-SAMPLES-BEGIN" and
+ * "PROF-SAMPLES-END" markers, sampling is paused while printing
+ */
+void prof_samples_dump_uart(void);
+
+int prof_init(void);
+#else
+#define PROF_MARKER(__name)
+#define PROF_BEGIN(__name)
+#define PROF_END(__name)
+static inline void prof_print_markers(void) {}
+static inline void prof_reset_markers(void) {}
+static inline int prof_sampling_start(uint32_t period) { return 0; }
+static inline void prof_sampling_stop(void) {}
+static inline void prof_sampling_get_stats(struct prof_sample_stats *s) {}
+static inline void prof_samples_dump_uart(void) {}
+static inline int prof_init(void) { return 0; }
+#endif
@@ -4,6 +4,7 @@
 #include <stdint.h>
 
 struct task;
+struct task_stats;
 struct event;
 
 void scheduler_init(void);
@@ -44,3 +45,12 @@ void sched_wait_list_put_current_isr(struct list_head *wait_list);
 uint64_t sched_get_time_us(void);
 
 void __sched_try_reschedule(void);
+
+/* Copies accounting of task t, including time of current run */
+void sched_get_task_stats(struct task *t, struct task_stats *s);
+
+/* Share of time in idle task since scheduler_start */
+int sched_get_idle_percent(void);
+
+/* Prints per-task run time, switches, latency and blocked time */
+void sched_print_stats(void);
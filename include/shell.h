@@ -0,0 +1,44 @@
+#pragma once
+#include <config.h>
+
+/*
+ * Runtime stats shell on the console UART.
+ *
+ * Shell task sleeps on PL011 RX interrupt and only runs, when a command is
+ * typed. Before running a command it waits for SHELL_OUTPUT_SPACE of room in
+ * the UART tx ring. Output beyond that falls back to polling with interrupts
+ * disabled, so commands, that print more, wait for room again between parts
+ * of their output or per line with uart_pl011_tx_wait_space, like "prof dump"
+ * and "trace dump" do. Type "help" for the list of commands.
+ */
+#define SHELL_MAX_ARGS 8
+#define SHELL_MAX_APP_CMDS 16
+#define SHELL_OUTPUT_SPACE 4096
+
+struct shell_cmd {
+  const char *name;
+  const char *help;
+  void (*fn)(int argc, char **argv);
+};
+
+#if defined(CONFIG_SHELL)
+/*
+ * Adds application commands, for stats only application knows about.
+ * cmds should stay valid. Commands run on the shell task stack of
+ * TASK_STACK_SIZE_MIN, so big buffers should be static.
+ */
+int shell_register_cmds(const struct shell_cmd *cmds, int num);
+
+/*
+ * Switches UART receive to interrupt mode and creates shell task. Called
+ * before scheduler_start.
+ */
+int shell_init(void);
+#else
+static inline int shell_register_cmds(const struct shell_cmd *cmds, int num)
+{
+  return 0;
+}
+
+static inline int shell_init(void) { return 0; }
+#endif
@@ -1,5 +1,6 @@
 #pragma once
 #include <stddef.h>
+#include <stdint.h>
 
 /* This trick helps testing scenarios on a host machine, when we should */
 #ifdef TEST_STRING
@@ -37,3 +38,16 @@ int vsprintf(char *dst, const char *fmt, __builtin_va_list *args);
 int vsnprintf(char *dst, size_t n, const char *fmt, __builtin_va_list *args);
 int sprintf(char *dst, const char *fmt, ...);
 int snprintf(char *dst, size_t n, const char *fmt, ...);
+
+/*
+ * Takes arguments of fmt from args without formatting them. Each argument is
+ * stored to argv as 64-bit word, double as its bit pattern, bit N of
+ * str_mask is set if argument N is a string pointer. Returns number of
+ * arguments in fmt, only max_args of them are stored.
+ */
+int vfmt_pack_args(const char *fmt, __builtin_va_list *args, uint64_t *argv,
+  int max_args, uint32_t *str_mask);
+
+/* Formats fmt with arguments, packed by vfmt_pack_args */
+int vsnprintf_packed(char *dst, size_t n, const char *fmt,
+  const uint64_t *argv, int argc);
@@ -1,6 +1,8 @@
 #pragma once
 #include <list.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <event.h>
 
 typedef void (*task_fn)(void);
@@ -11,20 +13,92 @@ typedef void (*task_fn)(void);
 #define TASK_SCHED_RQ_EXIT           (1<<2)
 #define TASK_SCHED_RQ_WAIT_LIST      (1<<3)
 
+/*
+ * Stack sizes. IRQ handlers run on the stack of interrupted task, so even
+ * a lean task needs room for the deepest handler. Stacks of 4K and more
+ * get an unmapped guard page below them, smaller ones are checked for
+ * overflow on every return from IRQ and on task switch.
+ * Stats printing code keeps its snapshots static, so that the shell and
+ * other lean tasks can run with TASK_STACK_SIZE_MIN.
+ *
+ * Capacity: stack pool fits in-tree tasks and CONFIG_TASK_NUM_APP_TASKS
+ * application tasks with TASK_STACK_SIZE_DEFAULT, each taking 8K with its
+ * guard page. Bigger application stacks take that room from the others,
+ * so raise CONFIG_TASK_NUM_APP_TASKS for them. There are at most 32 tasks.
+ */
+#define TASK_STACK_SIZE_MIN     2048
+#define TASK_STACK_SIZE_DEFAULT 4096
+
+/* Reasons a task was blocked, index in task_stats.blocked_time */
+#define TASK_BLOCK_TIMER     0
+#define TASK_BLOCK_EVENT     1
+#define TASK_BLOCK_WAIT_LIST 2
+#define TASK_BLOCK_NUM       3
+
 struct stack;
+struct armv8_fpsimd_ctx;
+
+/* Maintained by scheduler, all times are in arm timer counts */
+struct task_stats {
+  /* Time on CPU, excluding time spent in IRQ handlers */
+  uint64_t run_time;
+  /* Switched out on block, yield or exit */
+  uint32_t num_switches_voluntary;
+  /* Preempted by scheduler tick */
+  uint32_t num_switches_involuntary;
+  /* Max time from wakeup to running */
+  uint64_t max_sched_latency;
+  uint64_t blocked_time[TASK_BLOCK_NUM];
+
+  uint64_t run_start;
+  uint64_t irq_time_at_start;
+  uint64_t blocked_at;
+  /* Time of wakeup, 0 if task was not blocked */
+  uint64_t woken_at;
+  int block_reason;
+};
 
 struct task {
   struct list_head scheduler_list;
   char name[16];
   uint32_t task_id;
   void *cpuctx;
+  struct armv8_fpsimd_ctx *fpsimd_ctx;
   uint64_t next_wakeup_time;
   uint8_t scheduler_request;
   struct event *wait_event;
   struct stack *stack;
   int starvation;
+  struct task_stats stats;
 };
 
 struct task *task_create(task_fn fn, const char *task_name);
+
+/* Same as task_create with stack of stack_size bytes, rounded up to 1K */
+struct task *task_create_ext(task_fn fn, const char *task_name,
+  size_t stack_size);
 void task_delete_isr(struct task *t);
+
+/* Calls fn for every existing task */
+void task_for_each(void (*fn)(struct task *t, void *arg), void *arg);
+
+size_t task_stack_size(const struct task *t);
+
+/* Stack high-water mark in bytes, found by scanning for untouched paint */
+size_t task_stack_max_used(const struct task *t);
+
+/* True if any of the lowest words of the stack is overwritten */
+bool task_stack_is_overflown(const struct task *t);
+
+/*
+ * True if addr is in the guard page of task's stack, for stacks without own
+ * guard page it is the one at the bottom of the stack pool
+ */
+bool task_stack_is_guard_addr(const struct task *t, uint64_t addr);
+
+/* Prints size, high-water mark and guard page presence for all tasks */
+void task_print_stack_usage(void);
+
+/* Returns true if task has executed at least one FP/SIMD instruction */
+bool task_uses_fpsimd(const struct task *t);
 void mem_allocator_init(void);
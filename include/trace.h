@@ -0,0 +1,154 @@
+#pragma once
+#include <config.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Always-on kernel trace. Tracepoints store compact binary records with
+ * arm timer timestamp into a ring, oldest records are overwritten. Each
+ * event belongs to a category, categories are switched at runtime with
+ * trace_set_mask. Disabled tracepoint costs one load and branch, with
+ * CONFIG_TRACE undefined tracepoints are compiled out.
+ */
+
+#define TRACE_CAT_SCHED  (1<<0)
+#define TRACE_CAT_IRQ    (1<<1)
+#define TRACE_CAT_DMA    (1<<2)
+#define TRACE_CAT_SDHC   (1<<3)
+#define TRACE_CAT_SPI    (1<<4)
+#define TRACE_CAT_VCHIQ  (1<<5)
+#define TRACE_CAT_MMAL   (1<<6)
+#define TRACE_CAT_MEDIA  (1<<7)
+#define TRACE_CAT_ALL    0xff
+
+/* Category is in the top byte of event id */
+#define TRACE_EV(__cat, __nr) (((__cat) << 8) | (__nr))
+#define TRACE_EV_CAT(__ev) ((__ev) >> 8)
+
+typedef enum {
+  /* arg0: task id */
+  TRACE_EV_TASK_SWITCH     = TRACE_EV(TRACE_CAT_SCHED, 0),
+  /* arg0: irq number */
+  TRACE_EV_IRQ_ENTER       = TRACE_EV(TRACE_CAT_IRQ, 0),
+  TRACE_EV_IRQ_EXIT        = TRACE_EV(TRACE_CAT_IRQ, 1),
+  /* arg0: channel */
+  TRACE_EV_DMA_START       = TRACE_EV(TRACE_CAT_DMA, 0),
+  TRACE_EV_DMA_END         = TRACE_EV(TRACE_CAT_DMA, 1),
+  /* arg0: number of blocks, arg1: start block */
+  TRACE_EV_SDHC_READ       = TRACE_EV(TRACE_CAT_SDHC, 0),
+  TRACE_EV_SDHC_WRITE      = TRACE_EV(TRACE_CAT_SDHC, 1),
+  /* arg0: error code */
+  TRACE_EV_SDHC_DONE       = TRACE_EV(TRACE_CAT_SDHC, 2),
+  /* arg1: number of bytes */
+  TRACE_EV_SPI_START       = TRACE_EV(TRACE_CAT_SPI, 0),
+  TRACE_EV_SPI_END         = TRACE_EV(TRACE_CAT_SPI, 1),
+  /* arg0: local port, arg1: message type and size */
+  TRACE_EV_VCHIQ_RX        = TRACE_EV(TRACE_CAT_VCHIQ, 0),
+  TRACE_EV_VCHIQ_TX        = TRACE_EV(TRACE_CAT_VCHIQ, 1),
+  /* arg0: port handle, arg1: low 32 bits of pts */
+  TRACE_EV_MMAL_BUF_READY  = TRACE_EV(TRACE_CAT_MMAL, 0),
+  TRACE_EV_MMAL_BUF_DONE   = TRACE_EV(TRACE_CAT_MMAL, 1),
+  TRACE_EV_MMAL_BUF_TO_VC  = TRACE_EV(TRACE_CAT_MMAL, 2),
+  /* arg1: number of bytes */
+  TRACE_EV_FMP4_WRITE      = TRACE_EV(TRACE_CAT_MEDIA, 0),
+} trace_event_t;
+
+/* Packs VCHIQ message type and payload size into arg1 */
+#define TRACE_VCHIQ_ARG(__type, __size) (((__type) << 24) | ((__size) & 0xffffff))
+
+struct trace_rec {
+  /* arm timer counts */
+  uint64_t time;
+  uint16_t ev;
+  uint16_t arg0;
+  uint32_t arg1;
+};
+
+#define TRACE_NUM_RECORDS 16384
+
+/*
+ * Binary dump, all fields little-endian:
+ *   struct trace_dump_header
+ *   struct trace_dump_task[num_tasks]  - names of tasks, that exist at dump
+ *   struct trace_rec[num_records]      - oldest first
+ * Converted to Chrome trace JSON by scripts/trace2json.py
+ */
+#define TRACE_DUMP_MAGIC 0x4352544b
+#define TRACE_DUMP_VERSION 1
+
+struct trace_dump_header {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t rec_size;
+  uint32_t timer_freq;
+  uint32_t num_tasks;
+  uint64_t num_records;
+  /* Records overwritten before the dump */
+  uint64_t num_lost;
+} __attribute__((packed));
+
+struct trace_dump_task {
+  uint32_t task_id;
+  char name[16];
+} __attribute__((packed));
+
+/* Appends size bytes to output, returns SUCCESS or error code */
+typedef int (*trace_dump_write_cb_t)(void *arg, const void *data, size_t size);
+
+struct trace_stats {
+  uint64_t num_records;
+  uint64_t num_overwritten;
+};
+
+#if defined(CONFIG_TRACE)
+extern uint32_t trace_mask;
+
+void __trace_event(int ev, int arg0, uint32_t arg1);
+
+static inline void trace_event(trace_event_t ev, int arg0, uint32_t arg1)
+{
+  if (trace_mask & TRACE_EV_CAT(ev))
+    __trace_event(ev, arg0, arg1);
+}
+
+void trace_set_mask(uint32_t mask);
+
+/*
+ * Copies up to max records starting from sequence number *seq to dst and
+ * advances *seq. Records overwritten before they could be read are skipped,
+ * their number is added to *lost. Returns number of records copied.
+ */
+int trace_read(struct trace_rec *dst, int max, uint64_t *seq, uint64_t *lost);
+
+/* Sequence number of the oldest record still in the ring */
+uint64_t trace_oldest_seq(void);
+
+void trace_get_stats(struct trace_stats *stats);
+
+/*
+ * Writes binary dump of the ring through write callback, for example
+ * fmp4_fat32_write to put it into a file on SD card, followed by
+ * fmp4_fat32_sync. Tracing is paused while dumping.
+ */
+int trace_dump(trace_dump_write_cb_t write, void *arg);
+
+/*
+ * Writes binary dump to console as hex lines between "TRACE-DUMP-BEGIN" and
+ * "TRACE-DUMP-END" markers, console output stops at zero bytes.
+ */
+int trace_dump_uart(void);
+
+int trace_init(void);
+#else
+static inline void trace_event(trace_event_t ev, int arg0, uint32_t arg1) {}
+static inline void trace_set_mask(uint32_t mask) {}
+static inline int trace_read(struct trace_rec *dst, int max, uint64_t *seq,
+  uint64_t *lost) { return 0; }
+static inline uint64_t trace_oldest_seq(void) { return 0; }
+static inline void trace_get_stats(struct trace_stats *stats) {}
+static inline int trace_dump(trace_dump_write_cb_t write, void *arg)
+{ return 0; }
+static inline int trace_dump_uart(void) { return 0; }
+static inline int trace_init(void) { return 0; }
+#endif
@@ -1,7 +1,36 @@
 #pragma once
 #include <stdbool.h>
+#include <stdint.h>
 
 bool uart_pl011_init(int baudrate);
 int uart_pl011_send(const void *buf, int num);
 void uart_pl011_send_char(char c);
+
+/*
+ * Polling mode: spins until num characters are received.
+ * Interrupt mode: sleeps until at least one character is received, returns
+ * number of characters copied, up to num.
+ */
 int uart_pl011_recv(void *buf, int num);
+
+/*
+ * Switches transmit to PL011 TX FIFO interrupt: send only copies characters
+ * to the tx ring. Needs interrupt controller and scheduler to be initialized.
+ */
+void uart_pl011_tx_irq_init(void);
+
+/* Sleeps until tx ring has room for len characters */
+void uart_pl011_tx_wait_space(int len);
+
+/* Sends all queued characters by polling and returns to polling mode */
+void uart_pl011_tx_sync(void);
+
+/*
+ * Switches receive to PL011 RX FIFO and RX timeout interrupts, received
+ * characters are buffered in the rx ring. Needs interrupt controller and
+ * scheduler to be initialized.
+ */
+void uart_pl011_rx_irq_init(void);
+
+/* Characters lost, because rx ring was full */
+uint32_t uart_pl011_rx_num_dropped(void);
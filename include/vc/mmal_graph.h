@@ -0,0 +1,60 @@
+#pragma once
+#include <vc/service_mmal.h>
+
+/*
+ * Declarative builder for MMAL pipelines, like
+ * camera -> isp -> encoder -> (display, recorder).
+ *
+ * Components and links between them are described first, then
+ * mmal_graph_build creates components, negotiates formats and decides for
+ * every output port how its frames travel:
+ * - single VideoCore consumer: port is tunnelled, buffers stay on VideoCore.
+ * - ARM consumers only: port gets a pool of zero-copy buffers, sized from
+ *   port's recommended_buffer, every frame is shared by all sinks.
+ * - several consumers with at least one on VideoCore: video_splitter is
+ *   inserted, each VideoCore consumer gets its own tunnelled splitter output,
+ *   all ARM sinks share one more splitter output with a buffer pool.
+ * This way frames only reach ARM memory where ARM actually reads them.
+ *
+ * Components are added upstream first, links only go from earlier added
+ * component to later one. There is one graph in the system.
+ */
+
+#define MMAL_GRAPH_MAX_NODES 8
+#define MMAL_GRAPH_MAX_OUTPUTS 12
+#define MMAL_GRAPH_MAX_LINKS_PER_OUTPUT 3
+#define MMAL_GRAPH_MAX_SINKS 4
+
+#define MMAL_GRAPH_SPLITTER "vc.ril.video_splitter"
+
+/*
+ * Called in the context of mmal io loop for every frame on output port.
+ * Sink that keeps the buffer after return, e.g. hands it to another task,
+ * takes a reference with mmal_buffer_ref and later drops it with
+ * mmal_port_buffer_consumed_isr. Buffer is given back to VideoCore when all
+ * sinks have released it, no frame data is copied.
+ */
+typedef void (*mmal_graph_sink_cb_t)(struct mmal_port *p, struct mmal_buffer *b,
+  void *arg);
+
+/* Returns node id, or negative error code */
+int mmal_graph_add_component(const char *name);
+
+/*
+ * Requests format of output port. Input ports get their formats from the
+ * output they are linked to.
+ */
+int mmal_graph_set_format(int node, int output, int encoding, int width,
+  int height, int frame_rate, int bitrate);
+
+int mmal_graph_connect(int src_node, int src_output, int dst_node,
+  int dst_input);
+
+int mmal_graph_add_sink(int src_node, int src_output, mmal_graph_sink_cb_t cb,
+  void *arg);
+
+/* Creates and starts all components, takes over mmal io callback */
+int mmal_graph_build(void);
+
+/* Valid after mmal_graph_build */
+struct mmal_component *mmal_graph_get_component(int node);
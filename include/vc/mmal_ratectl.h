@@ -0,0 +1,56 @@
+#pragma once
+#include <vc/service_mmal.h>
+
+/*
+ * Encoder rate control driven by SD card write backpressure.
+ *
+ * Recorder reports how many encoded buffers are waiting for SD write, the
+ * controller compares that with SD write throughput and adjusts encoder
+ * bitrate and max QP at runtime, so that during card stalls (garbage
+ * collection) picture quality drops instead of frames being lost:
+ * - queue at or above queue_high: bitrate is cut to 3/4, but not above 90%
+ *   of what the card actually wrote in the last period.
+ * - queue at or above 2 * queue_high: in addition max QP is raised to
+ *   qp_max_degraded.
+ * - queue at or below queue_low: max QP is restored, after recover_periods
+ *   such updates in a row bitrate grows back by bitrate_step.
+ * After recorder drops a frame, an I-frame is requested as soon as the queue
+ * is below queue_high again, because P-frames after the gap are undecodable.
+ */
+
+struct mmal_ratectl_config {
+  uint32_t bitrate_max;
+  uint32_t bitrate_min;
+  uint32_t bitrate_step;
+  uint32_t qp_min;
+  uint32_t qp_max;
+  uint32_t qp_max_degraded;
+  int queue_low;
+  int queue_high;
+  int recover_periods;
+};
+
+struct mmal_ratectl_stats {
+  uint32_t bitrate;
+  uint32_t qp_max;
+  uint32_t sd_bytes_per_sec;
+  int queue_depth;
+  int num_cuts;
+  int num_frames_dropped;
+  int num_i_frames_requested;
+};
+
+/* SD write rate is measured from sdhc_iostats deltas between updates */
+int mmal_ratectl_init(struct mmal_port *encoder_output,
+  const struct mmal_ratectl_config *config);
+
+/*
+ * Called by recorder periodically, every few hundred milliseconds, with
+ * number of encoder buffers not yet written to SD card.
+ */
+int mmal_ratectl_update(int queue_depth);
+
+/* Called by recorder when it had to drop encoded frame */
+void mmal_ratectl_frame_dropped(void);
+
+void mmal_ratectl_get_stats(struct mmal_ratectl_stats *stats);
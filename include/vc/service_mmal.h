@@ -5,6 +5,19 @@
 #include <vc/service_mmal_protocol.h>
 
 #define MMAL_COMPONENT_MAX_PORTS 4
+#define MMAL_PORT_MAX_BUFFERS 32
+
+/*
+ * Buffer handle, sent to VideoCore as user_data of buffer header and returned
+ * back in BUFFER_TO_HOST. Low bits are index in port's buffer table, high
+ * bits are generation of the table, so that stale handles are detected.
+ */
+#define MMAL_BUFFER_HANDLE_IDX_BITS 8
+#define MMAL_BUFFER_HANDLE_IDX_MASK ((1 << MMAL_BUFFER_HANDLE_IDX_BITS) - 1)
+#define MMAL_BUFFER_HANDLE(__gen, __idx) \
+  (((__gen) << MMAL_BUFFER_HANDLE_IDX_BITS) | (__idx))
+#define MMAL_BUFFER_HANDLE_IDX(__handle) \
+  ((__handle) & MMAL_BUFFER_HANDLE_IDX_MASK)
 
 enum mmal_msg_status {
   MMAL_MSG_STATUS_SUCCESS = 0, /* Success */
@@ -41,6 +54,15 @@ struct mmal_buffer {
 
   uint32_t user_handle;
 
+  /* See MMAL_BUFFER_HANDLE */
+  uint32_t handle;
+
+  /*
+   * Number of ARM consumers holding the buffer. Set to 1 when VideoCore
+   * hands buffer to ARM, buffer goes back to VideoCore when it drops to 0.
+   */
+  int refcount;
+
   unsigned long length;
   uint32_t flags;
   int64_t dts;
@@ -70,6 +92,10 @@ struct mmal_port_buffers {
 
   size_t on_vc;
 
+  /* All buffers of the port, indexed by MMAL_BUFFER_HANDLE_IDX */
+  struct mmal_buffer *table[MMAL_PORT_MAX_BUFFERS];
+  uint32_t table_size;
+  uint32_t generation;
 };
 
 struct mmal_port {
@@ -143,6 +169,7 @@ int mmal_port_enable(struct mmal_port *p);
 int mmal_port_set_format(struct mmal_port *p);
 int mmal_port_init_buffers(struct mmal_port *p, size_t min_buffers);
 int mmal_port_connect(struct mmal_port *src, struct mmal_port *dst);
+int mmal_port_connect_tunnel(struct mmal_port *src, struct mmal_port *dst);
 int mmal_port_set_zero_copy(struct mmal_port *p);
 int mmal_port_get_supp_encodings(struct mmal_port *p, uint32_t *encodings,
   int max_encodings, int *num_encodings);
@@ -155,6 +182,17 @@ int mmal_port_buffer_to_remote(struct mmal_port *p, struct mmal_buffer *b);
 int mmal_port_add_buffer(struct mmal_port *p, void *dma_buf,
   size_t dma_buf_size, uint32_t user_handle);
 
+/*
+ * Takes one more reference on a buffer, that came from VideoCore, so it can
+ * be passed to another consumer without copying. Every reference is dropped
+ * with mmal_port_buffer_consumed_isr.
+ */
+void mmal_buffer_ref(struct mmal_buffer *b);
+
+/*
+ * Drops one reference, the last one queues the buffer back to VideoCore.
+ * Callers that never take extra references call it exactly once per buffer.
+ */
 void mmal_port_buffer_consumed_isr(struct mmal_port *p, struct mmal_buffer *b);
 
 int mmal_port_parameter_set(struct mmal_port *p,
@@ -163,6 +201,9 @@ int mmal_port_parameter_get(struct mmal_port *p, int parameter_id, void *value,
   uint32_t *value_size);
 void mmal_port_dump(const char *tag, const struct mmal_port *p);
 
+/* Prints buffer counts per list of all ports, that have buffers */
+void mmal_print_port_stats(void);
+
 typedef int (*mmal_io_buffer_ready_cb_t)(struct mmal_port *p,
   struct mmal_buffer *b);
 
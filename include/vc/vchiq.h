@@ -36,9 +36,24 @@ struct vchiq_header {
   char data[0];
 };
 
+/*
+ * Called from vchiq loop thread, which also releases VideoCore's slots.
+ * Senders can block until VideoCore recycles ARM's slots, so callbacks should
+ * pass work to other tasks instead of sending messages themselves.
+ */
 typedef int (*vchiq_service_cb_t)(struct vchiq_service *,
   struct vchiq_header *);
 
+/*
+ * Message, passed to service callback, is a view into VideoCore's slot and is
+ * only valid until callback returns. To use it later, callback should hold it
+ * and release when done. Slot is given back to VideoCore, when all messages
+ * in it are released, so messages should not be held for long.
+ */
+void vchiq_msg_hold(struct vchiq_header *h);
+
+void vchiq_msg_release(struct vchiq_header *h);
+
 struct vchiq_service {
   uint32_t service_id;
   bool opened;
@@ -51,8 +66,49 @@ struct vchiq_service {
 void vchiq_msg_prep(int msgid, int srcport, int dstport, void *payload,
   int payload_sz);
 
+/*
+ * Transmit batch. Messages appended to a batch are written to the slots right
+ * away, but tx_pos is published and VideoCore is signalled only once, when
+ * the batch is committed. This way a burst of N messages costs one doorbell
+ * on both sides instead of N.
+ * Appended messages are complete, so if vchiq_msg_prep is called from other
+ * context while batch is open, it just publishes them earlier.
+ */
+struct vchiq_tx_batch {
+  int num_msgs;
+};
+
+void vchiq_tx_batch_begin(struct vchiq_tx_batch *b);
+
+void vchiq_tx_batch_append(struct vchiq_tx_batch *b, int msgid, int srcport,
+  int dstport, const void *payload, int payload_sz);
+
+/* Publishes all appended messages and rings the doorbell, if there are any */
+void vchiq_tx_batch_commit(struct vchiq_tx_batch *b);
+
 int vchiq_init(void);
 
+struct vchiq_tx_stats {
+  /* Number of tx slots, owned by ARM side */
+  int num_slots;
+
+  /* Slots not yet recycled by VideoCore, including one being written */
+  int slots_used;
+
+  /* Most slots ever written, but not yet recycled by VideoCore */
+  int slots_used_max;
+
+  uint32_t slots_recycled;
+
+  /* Sender had to wait for VideoCore to recycle a slot */
+  uint32_t slot_stalls;
+
+  /* Sender had to wait, because its service was over message or slot quota */
+  uint32_t quota_stalls;
+};
+
+void vchiq_get_tx_stats(struct vchiq_tx_stats *stats);
+
 struct vchiq_service *vchiq_service_open(uint32_t service_id, int version_min,
   int version_max, vchiq_service_cb_t service_cb);
 
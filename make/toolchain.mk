@@ -8,3 +8,6 @@ CFLAGS := -g -Werror -Wall
 # Required to implement standard library functions like sprintf and memset
 CFLAGS += -ffreestanding
 
+# Kernel objects are built without FP/SIMD registers, see CORE_FPSIMD_OBJS
+CFLAGS_NO_FPSIMD := -mgeneral-regs-only
+
@@ -0,0 +1,45 @@
+#!/bin/bash
+#
+# Runs kernel image, built with CONFIG_LAT_TEST_ON_BOOT (see include/config.h
+# and include/lat_test.h), in QEMU raspi3b and waits for "LAT-TEST:" result
+# line. On hardware the same test runs with shell "lat" command.
+# Exit status is 0 on PASS, so it can be used as regression gate.
+# QEMU timing is not cycle accurate, limits should be loose there.
+#
+# usage: lat_test_qemu.sh <kernel8.bin> [sdcard.img]
+
+QEMU=${QEMU_PATH:-qemu-system-aarch64}
+TIMEOUT=${LAT_TEST_TIMEOUT:-120}
+
+if [ -z "$1" ]; then
+	echo "usage: $0 <kernel8.bin> [sdcard.img]"
+	exit 2
+fi
+
+SD_ARGS=
+if [ -n "$2" ]; then
+	SD_ARGS="-drive file=$2,if=sd,format=raw"
+fi
+
+LOG=$(mktemp)
+trap 'rm -f $LOG' EXIT
+
+timeout $TIMEOUT $QEMU -kernel $1 \
+	$SD_ARGS \
+	-machine raspi3b \
+	-nographic \
+	-serial stdio \
+	-nodefaults > $LOG &
+QEMU_PID=$!
+
+while kill -0 $QEMU_PID 2>/dev/null; do
+	if grep -q "^LAT-TEST:" $LOG; then
+		kill $QEMU_PID
+		break
+	fi
+	sleep 1
+done
+wait $QEMU_PID 2>/dev/null
+
+tr -d '\r' < $LOG | sed -n '/^lat_test: [0-9]/,/^LAT-TEST:/p'
+grep -q "^LAT-TEST: PASS" $LOG
@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+#
+# Resolves PMU sampling profile (see include/prof.h) to kernel functions.
+#
+# Input is a console log with "pc count" lines between PROF-SAMPLES-BEGIN
+# and PROF-SAMPLES-END, written by prof_samples_dump_uart. Symbols are taken
+# from the kernel ELF with nm, NM environment variable selects the binary.
+#
+# usage: prof2sym.py <kernel.elf> <console.log> [num_lines]
+
+import bisect
+import os
+import subprocess
+import sys
+
+def read_symbols(elf):
+  nm = os.environ.get('NM', 'aarch64-none-elf-nm')
+  out = subprocess.run([nm, '-n', elf], check=True, capture_output=True,
+    text=True).stdout
+  addrs = []
+  names = []
+  for line in out.splitlines():
+    parts = line.split()
+    if len(parts) != 3 or parts[1] not in 'tTwW':
+      continue
+    addrs.append(int(parts[0], 16))
+    names.append(parts[2])
+  return addrs, names
+
+def read_samples(path):
+  samples = []
+  period = None
+  inside = False
+  with open(path, errors='replace') as f:
+    for line in f:
+      line = line.strip()
+      if line.endswith('PROF-SAMPLES-BEGIN'):
+        inside = True
+        samples = []
+      elif line.endswith('PROF-SAMPLES-END'):
+        inside = False
+      elif inside and line.startswith('period'):
+        period = int(line.split()[1])
+      elif inside and line:
+        pc, count = line.split()
+        samples.append((int(pc, 16), int(count)))
+  if not samples:
+    sys.exit('no samples found in ' + path)
+  return period, samples
+
+def main():
+  if len(sys.argv) < 3:
+    sys.exit('usage: %s <kernel.elf> <console.log> [num_lines]' % sys.argv[0])
+
+  addrs, names = read_symbols(sys.argv[1])
+  period, samples = read_samples(sys.argv[2])
+  num_lines = int(sys.argv[3]) if len(sys.argv) > 3 else 40
+
+  funcs = {}
+  total = 0
+  for pc, count in samples:
+    i = bisect.bisect_right(addrs, pc) - 1
+    name = names[i] if i >= 0 else '0x%x' % pc
+    funcs[name] = funcs.get(name, 0) + count
+    total += count
+
+  print('%d samples, period %s cycles' % (total, period))
+  print('%7s %8s  %s' % ('%', 'samples', 'function'))
+  for name, count in sorted(funcs.items(), key=lambda x: -x[1])[:num_lines]:
+    print('%6.2f%% %8d  %s' % (count * 100.0 / total, count, name))
+
+if __name__ == '__main__':
+  main()
@@ -0,0 +1,258 @@
+#!/usr/bin/env python3
+#
+# Converts kernel trace dump (see include/trace.h) to Chrome Trace Event JSON,
+# that opens in chrome://tracing or ui.perfetto.dev.
+#
+# Input is either a binary dump file, written by trace_dump, or a console
+# log with hex dump between TRACE-DUMP-BEGIN and TRACE-DUMP-END lines,
+# written by trace_dump_uart.
+#
+# usage: trace2json.py <dump|console.log> [out.json]
+
+import json
+import struct
+import sys
+
+TRACE_DUMP_MAGIC = 0x4352544b
+HEADER_FMT = '<IHHIIQQ'
+TASK_FMT = '<I16s'
+REC_FMT = '<QHHI'
+
+CAT_SCHED = 1 << 0
+CAT_IRQ = 1 << 1
+CAT_DMA = 1 << 2
+CAT_SDHC = 1 << 3
+CAT_SPI = 1 << 4
+CAT_VCHIQ = 1 << 5
+CAT_MMAL = 1 << 6
+CAT_MEDIA = 1 << 7
+
+def ev(cat, nr):
+  return (cat << 8) | nr
+
+EV_TASK_SWITCH = ev(CAT_SCHED, 0)
+EV_IRQ_ENTER = ev(CAT_IRQ, 0)
+EV_IRQ_EXIT = ev(CAT_IRQ, 1)
+EV_DMA_START = ev(CAT_DMA, 0)
+EV_DMA_END = ev(CAT_DMA, 1)
+EV_SDHC_READ = ev(CAT_SDHC, 0)
+EV_SDHC_WRITE = ev(CAT_SDHC, 1)
+EV_SDHC_DONE = ev(CAT_SDHC, 2)
+EV_SPI_START = ev(CAT_SPI, 0)
+EV_SPI_END = ev(CAT_SPI, 1)
+EV_VCHIQ_RX = ev(CAT_VCHIQ, 0)
+EV_VCHIQ_TX = ev(CAT_VCHIQ, 1)
+EV_MMAL_BUF_READY = ev(CAT_MMAL, 0)
+EV_MMAL_BUF_DONE = ev(CAT_MMAL, 1)
+EV_MMAL_BUF_TO_VC = ev(CAT_MMAL, 2)
+EV_FMP4_WRITE = ev(CAT_MEDIA, 0)
+
+MMAL_EV_NAMES = {
+  EV_MMAL_BUF_READY: 'buffer ready',
+  EV_MMAL_BUF_DONE: 'buffer done',
+  EV_MMAL_BUF_TO_VC: 'buffer to vc',
+}
+
+# Track ids, tasks use their task id
+PID = 1
+TID_IRQ = 1000
+TID_DMA = 1100
+TID_SDHC = 1200
+TID_SPI = 1300
+TID_VCHIQ = 1400
+TID_MMAL = 1500
+TID_MEDIA = 1600
+
+def read_dump(path):
+  with open(path, 'rb') as f:
+    data = f.read()
+
+  if data[:4] == struct.pack('<I', TRACE_DUMP_MAGIC):
+    return data
+
+  # Console log, take hex lines between markers
+  hexdata = []
+  inside = False
+  for line in data.decode('ascii', errors='replace').splitlines():
+    line = line.strip()
+    if line.endswith('TRACE-DUMP-BEGIN'):
+      inside = True
+      hexdata = []
+    elif line.endswith('TRACE-DUMP-END'):
+      inside = False
+    elif inside and line:
+      hexdata.append(line)
+  if not hexdata:
+    sys.exit('no trace dump found in ' + path)
+  return bytes.fromhex(''.join(hexdata))
+
+def parse_dump(data):
+  hdr_size = struct.calcsize(HEADER_FMT)
+  magic, version, rec_size, freq, num_tasks, num_records, num_lost = \
+    struct.unpack_from(HEADER_FMT, data, 0)
+  if magic != TRACE_DUMP_MAGIC:
+    sys.exit('bad magic %08x' % magic)
+  if version != 1 or rec_size != struct.calcsize(REC_FMT):
+    sys.exit('unsupported dump version %d, record size %d' % (version, rec_size))
+
+  pos = hdr_size
+  tasks = {}
+  for _ in range(num_tasks):
+    task_id, name = struct.unpack_from(TASK_FMT, data, pos)
+    tasks[task_id] = name.split(b'\0')[0].decode('ascii', errors='replace')
+    pos += struct.calcsize(TASK_FMT)
+
+  recs = []
+  avail = (len(data) - pos) // rec_size
+  if avail < num_records:
+    print('dump truncated: %d of %d records' % (avail, num_records),
+      file=sys.stderr)
+  for i in range(min(avail, num_records)):
+    recs.append(struct.unpack_from(REC_FMT, data, pos + i * rec_size))
+  return freq, tasks, recs, num_lost
+
+class Converter:
+  def __init__(self, freq, tasks):
+    self.freq = freq
+    self.tasks = tasks
+    self.events = []
+    self.t0 = None
+    self.open = {}
+    self.flows = {}
+    self.current_task = None
+    self.current_task_start = None
+    self.tids = set()
+
+  def us(self, time):
+    if self.t0 is None:
+      self.t0 = time
+    return (time - self.t0) * 1000000.0 / self.freq
+
+  def slice(self, tid, name, ts, end, cat, args=None):
+    e = {'ph': 'X', 'pid': PID, 'tid': tid, 'name': name, 'cat': cat,
+      'ts': ts, 'dur': max(end - ts, 0.01)}
+    if args:
+      e['args'] = args
+    self.events.append(e)
+    self.tids.add(tid)
+
+  def instant(self, tid, name, ts, cat, args=None):
+    e = {'ph': 'i', 's': 't', 'pid': PID, 'tid': tid, 'name': name,
+      'cat': cat, 'ts': ts}
+    if args:
+      e['args'] = args
+    self.events.append(e)
+    self.tids.add(tid)
+
+  def begin(self, key, ts, args=None):
+    self.open[key] = (ts, args)
+
+  def end(self, key, tid, name, ts, cat, args=None):
+    start = self.open.pop(key, None)
+    if start is None:
+      return
+    a = dict(start[1] or {})
+    a.update(args or {})
+    self.slice(tid, name, start[0], ts, cat, a)
+
+  def mmal(self, ev, port, pts, ts):
+    tid = TID_MMAL + port % 100
+    name = MMAL_EV_NAMES[ev]
+    args = {'port': port, 'pts': pts}
+    self.slice(tid, name, ts, ts + 1, 'mmal', args)
+    # Buffers of the same frame share pts, link them with flow arrows
+    if pts == 0:
+      return
+    prev = self.flows.get(pts)
+    if prev is not None:
+      self.events.append({'ph': 's', 'id': pts, 'pid': PID, 'tid': prev[0],
+        'ts': prev[1], 'name': 'frame', 'cat': 'mmal'})
+      self.events.append({'ph': 'f', 'bp': 'e', 'id': pts, 'pid': PID,
+        'tid': tid, 'ts': ts, 'name': 'frame', 'cat': 'mmal'})
+    self.flows[pts] = (tid, ts)
+
+  def switch_task(self, task_id, ts):
+    if self.current_task is not None:
+      name = self.tasks.get(self.current_task, 'task %d' % self.current_task)
+      self.slice(self.current_task, name, self.current_task_start, ts,
+        'sched')
+    self.current_task = task_id
+    self.current_task_start = ts
+
+  def convert(self, recs):
+    for time, ev, arg0, arg1 in recs:
+      ts = self.us(time)
+      if ev == EV_TASK_SWITCH:
+        self.switch_task(arg0, ts)
+      elif ev == EV_IRQ_ENTER:
+        self.begin(('irq',), ts, {'irq': arg0})
+      elif ev == EV_IRQ_EXIT:
+        self.end(('irq',), TID_IRQ, 'irq %d' % arg0, ts, 'irq')
+      elif ev == EV_DMA_START:
+        self.begin(('dma', arg0), ts)
+      elif ev == EV_DMA_END:
+        self.end(('dma', arg0), TID_DMA + arg0, 'dma ch%d' % arg0, ts, 'dma')
+      elif ev in (EV_SDHC_READ, EV_SDHC_WRITE):
+        op = 'read' if ev == EV_SDHC_READ else 'write'
+        self.begin(('sdhc',), ts, {'op': op, 'blocks': arg0, 'start': arg1})
+      elif ev == EV_SDHC_DONE:
+        start = self.open.get(('sdhc',))
+        name = 'sd ' + start[1]['op'] if start else 'sd'
+        self.end(('sdhc',), TID_SDHC, name, ts, 'sdhc',
+          {'err': struct.unpack('<h', struct.pack('<H', arg0))[0]})
+      elif ev == EV_SPI_START:
+        self.begin(('spi',), ts, {'bytes': arg1})
+      elif ev == EV_SPI_END:
+        self.end(('spi',), TID_SPI, 'spi', ts, 'spi')
+      elif ev in (EV_VCHIQ_RX, EV_VCHIQ_TX):
+        name = 'rx' if ev == EV_VCHIQ_RX else 'tx'
+        self.instant(TID_VCHIQ, name, ts, 'vchiq', {'port': arg0,
+          'type': arg1 >> 24, 'size': arg1 & 0xffffff})
+      elif ev in MMAL_EV_NAMES:
+        self.mmal(ev, arg0, arg1, ts)
+      elif ev == EV_FMP4_WRITE:
+        self.instant(TID_MEDIA, 'fmp4 write', ts, 'media', {'bytes': arg1})
+
+    if recs and self.current_task is not None:
+      self.switch_task(None, self.us(recs[-1][0]))
+
+  def metadata(self):
+    names = {TID_IRQ: 'irq', TID_SDHC: 'sdhc', TID_SPI: 'spi',
+      TID_VCHIQ: 'vchiq', TID_MEDIA: 'media'}
+    meta = [{'ph': 'M', 'pid': PID, 'name': 'process_name',
+      'args': {'name': 'cpu0'}}]
+    for tid in sorted(self.tids):
+      if tid in names:
+        name = names[tid]
+      elif TID_DMA <= tid < TID_SDHC:
+        name = 'dma ch%d' % (tid - TID_DMA)
+      elif TID_MMAL <= tid < TID_MEDIA:
+        name = 'mmal port %d' % (tid - TID_MMAL)
+      else:
+        name = '%s (%d)' % (self.tasks.get(tid, 'task'), tid)
+      meta.append({'ph': 'M', 'pid': PID, 'tid': tid, 'name': 'thread_name',
+        'args': {'name': name}})
+      meta.append({'ph': 'M', 'pid': PID, 'tid': tid,
+        'name': 'thread_sort_index', 'args': {'sort_index': tid}})
+    return meta
+
+def main():
+  if len(sys.argv) < 2:
+    sys.exit('usage: %s <dump|console.log> [out.json]' % sys.argv[0])
+
+  freq, tasks, recs, num_lost = parse_dump(read_dump(sys.argv[1]))
+  c = Converter(freq, tasks)
+  c.convert(recs)
+  out = {'traceEvents': c.metadata() + c.events, 'displayTimeUnit': 'ns',
+    'otherData': {'records': len(recs), 'overwritten': num_lost}}
+
+  if len(sys.argv) > 2:
+    with open(sys.argv[2], 'w') as f:
+      json.dump(out, f)
+  else:
+    json.dump(out, sys.stdout)
+  print('%d records, %d overwritten before dump, %d events' % (len(recs),
+    num_lost, len(c.events)), file=sys.stderr)
+
+if __name__ == '__main__':
+  main()
@@ -160,6 +160,8 @@ static inline void dump_exception_context(bool dump_far, const char *exception)
   struct task *t = sched_get_current_task();
   const struct armv8_cpuctx *c;
 
+  /* Interrupts are masked, so anything queued would never be sent */
+  uart_pl011_tx_sync();
   if (!t) {
     printf("aarch64 exception: '%s' no current task");
     return;
@@ -332,6 +334,26 @@ static __attribute__((section(".rodata_nommu"))) armv8_exception_handler_sync_fn
 #define ESR_GET_SYNC_ISS(__value) \
   (__value & ((1<<25) - 1))
 
+static ALIGNED(16) uint64_t armv8_stack_overflow_stack[256];
+uint64_t *const armv8_stack_overflow_stack_top =
+  &armv8_stack_overflow_stack[ARRAY_SIZE(armv8_stack_overflow_stack)];
+
+/* Entered from sync exception vector on spare stack, when sp is unmapped */
+EXCEPTION_VECTOR void armv8_handle_stack_overflow(void)
+{
+  uint64_t far;
+  uint64_t elr;
+  struct task *t = sched_get_current_task();
+
+  aarch64_get_far_el1(far);
+  asm volatile("mrs %0, elr_el1\n" : "=r"(elr));
+  uart_pl011_tx_sync();
+  printf("aarch64 exception: stack overflow, task: %s, pc:%016lx, "
+    "far_el1:%016lx%s\r\n", t ? t->name : "none", elr, far,
+    t && task_stack_is_guard_addr(t, far) ? " (guard page)" : "");
+  panic();
+}
+
 EXCEPTION_VECTOR void armv8_exception_handler_sync(uint64_t esr)
 {
   armv8_exception_handler_sync_fn sync_cb;
@@ -0,0 +1,41 @@
+#include <arch/armv8/fpsimd_armv8.h>
+#include <stddef.h>
+
+#define CPACR_EL1_FPEN (3 << 20)
+
+/* FP/SIMD context of current task, set by scheduler */
+struct armv8_fpsimd_ctx *__fpsimd_current = NULL;
+
+/*
+ * FP/SIMD context, which state is currently held in registers, NULL if
+ * registers do not belong to any task
+ */
+struct armv8_fpsimd_ctx *__fpsimd_owner = NULL;
+
+static inline void armv8_fpsimd_set_access(bool enable)
+{
+  uint64_t cpacr;
+
+  asm volatile("mrs %0, cpacr_el1" : "=r"(cpacr));
+  if (enable == !!(cpacr & CPACR_EL1_FPEN))
+    return;
+
+  if (enable)
+    cpacr |= CPACR_EL1_FPEN;
+  else
+    cpacr &= ~CPACR_EL1_FPEN;
+
+  asm volatile("msr cpacr_el1, %0\nisb" :: "r"(cpacr));
+}
+
+void armv8_fpsimd_switch(struct armv8_fpsimd_ctx *next)
+{
+  __fpsimd_current = next;
+  armv8_fpsimd_set_access(next == __fpsimd_owner);
+}
+
+void armv8_fpsimd_release(struct armv8_fpsimd_ctx *ctx)
+{
+  if (__fpsimd_owner == ctx)
+    __fpsimd_owner = NULL;
+}
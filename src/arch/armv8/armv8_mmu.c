@@ -8,6 +8,7 @@
 #include <stringlib.h>
 #include <printf.h>
 #include <log.h>
+#include <errcode.h>
 
 #define MMU_GRANULE_4K 4096
 #define MMU_GRANULE_16K (1024 * 16)
@@ -19,6 +20,12 @@
 #define KERNEL_RAM0_PADDR_START 0
 #define KERNEL_RAM0_PADDR_END   0x10000000
 
+#define MMU_VIRTUAL_MEM_SIZE 0x40000000
+
+#define MMU_MEMATTR_IDX_NORMAL 0
+#define MMU_MEMATTR_IDX_DEVICE 1
+#define MMU_MEMATTR_IDX_DMA    2
+
 /*
  * We setup 4096 bytes GRANULE.
  *
@@ -254,19 +261,9 @@ static inline NO_MMU uint64_t mmu_make_page_desc(uint64_t page_idx,
 }
 
 
-static NO_MMU void mmu_page_table_init(struct mmu_info *mmui,
-  uint32_t max_mem_size, uint64_t dma_mem_start, uint64_t dma_mem_end)
+/* Computes placement of translation tables of each level */
+static NO_MMU void mmu_info_init(struct mmu_info *mmui, uint32_t max_mem_size)
 {
-  int i;
-  uint64_t desc;
-
-  uint64_t page_idx_ram_0_start = KERNEL_RAM0_PADDR_START / MMU_PAGE_GRANULE;
-  uint64_t page_idx_ram_0_end = dma_mem_start / MMU_PAGE_GRANULE;
-  uint64_t page_idx_dma_start = dma_mem_start / MMU_PAGE_GRANULE;
-  uint64_t page_idx_dma_end = dma_mem_end / MMU_PAGE_GRANULE;
-  uint64_t page_idx_periph_start = PERIPH_ADDR_RANGE_START / MMU_PAGE_GRANULE;
-  uint64_t page_idx_periph_end = PERIPH_ADDR_RANGE_END / MMU_PAGE_GRANULE;
-
   asm volatile ("ldr %0, =__pagetable_start\n" :"=r"(mmui->pagetable_start));
   asm volatile ("ldr %0, =__pagetable_end\n" :"=r"(mmui->pagetable_end));
 
@@ -296,6 +293,31 @@ static NO_MMU void mmu_page_table_init(struct mmu_info *mmui,
     mmui->num_l2_pages * MMU_PAGE_GRANULE / 8;
 
   mmui->page_table_real_end = mmui->l3_pte_base + mmui->num_l3_ptes;
+}
+
+/* Level 1 block descriptor maps 1GB */
+static inline NO_MMU uint64_t mmu_make_l1_block_desc(uint64_t addr,
+  int memattr_idx)
+{
+  uint64_t lower_attributes = ((memattr_idx & 7) << 2) | (1 << 10);
+  uint64_t output_address = addr & ((1ull << 48) - (1ull << 30));
+  return output_address | lower_attributes | 1;
+}
+
+static NO_MMU void mmu_page_table_init(struct mmu_info *mmui,
+  uint32_t max_mem_size, uint64_t dma_mem_start, uint64_t dma_mem_end)
+{
+  int i;
+  uint64_t desc;
+
+  uint64_t page_idx_ram_0_start = KERNEL_RAM0_PADDR_START / MMU_PAGE_GRANULE;
+  uint64_t page_idx_ram_0_end = dma_mem_start / MMU_PAGE_GRANULE;
+  uint64_t page_idx_dma_start = dma_mem_start / MMU_PAGE_GRANULE;
+  uint64_t page_idx_dma_end = dma_mem_end / MMU_PAGE_GRANULE;
+  uint64_t page_idx_periph_start = PERIPH_ADDR_RANGE_START / MMU_PAGE_GRANULE;
+  uint64_t page_idx_periph_end = PERIPH_ADDR_RANGE_END / MMU_PAGE_GRANULE;
+
+  mmu_info_init(mmui, max_mem_size);
 
   if (mmui->page_table_real_end > mmui->pagetable_end)
     while(1);
@@ -323,6 +345,13 @@ static NO_MMU void mmu_page_table_init(struct mmu_info *mmui,
 
   for (i = page_idx_periph_start; i < page_idx_periph_end; ++i)
     mmui->l3_pte_base[i] = mmu_make_page_desc(i, mmui->memattr_idx_device);
+
+  /*
+   * ARM local peripherals are right above the mapped range, they get a
+   * whole 1GB device block, instead of extending page tables
+   */
+  mmui->l1_pte_base[LOCAL_PERIPH_ADDR_START >> 30] = mmu_make_l1_block_desc(
+    LOCAL_PERIPH_ADDR_START, mmui->memattr_idx_device);
 }
 
 NO_MMU int mmu_get_num_paddr_bits(void)
@@ -352,9 +381,9 @@ NO_MMU void mmu_init(uint64_t dma_memory_start, uint64_t dma_memory_end)
 
   int va_size = 48;
 
-  mmu.memattr_idx_normal = 0;
-  mmu.memattr_idx_device = 1;
-  mmu.memattr_idx_dma    = 2;
+  mmu.memattr_idx_normal = MMU_MEMATTR_IDX_NORMAL;
+  mmu.memattr_idx_device = MMU_MEMATTR_IDX_DEVICE;
+  mmu.memattr_idx_dma    = MMU_MEMATTR_IDX_DMA;
 
   mair.memattrs[mmu.memattr_idx_normal] = ARMV8_MAIR_NORMAL_MEM;
   mair.memattrs[mmu.memattr_idx_device] = ARMV8_MAIR_DEVICE_MEM;
@@ -364,7 +393,8 @@ NO_MMU void mmu_init(uint64_t dma_memory_start, uint64_t dma_memory_end)
       "msr mair_el1, %0\n" :: "r"(mair.value)
       );
 
-  mmu_page_table_init(&mmu, 0x40000000, dma_memory_start, dma_memory_end);
+  mmu_page_table_init(&mmu, MMU_VIRTUAL_MEM_SIZE, dma_memory_start,
+    dma_memory_end);
 
   if (va_size > mmu_get_max_va_size())
     while(1);
@@ -385,6 +415,36 @@ NO_MMU void mmu_init(uint64_t dma_memory_start, uint64_t dma_memory_end)
   );
 }
 
+int mmu_set_guard_page(uint64_t va, bool guard)
+{
+  struct mmu_info mmu;
+  uint64_t *pte;
+  uint64_t page_idx;
+
+  /* Kernel VA in upper range maps to the same tables as physical address */
+  page_idx = (va & ((1ull << 48) - 1)) / MMU_PAGE_GRANULE;
+  if (va % MMU_PAGE_GRANULE)
+    return ERR_INVAL;
+
+  mmu_info_init(&mmu, MMU_VIRTUAL_MEM_SIZE);
+  if (page_idx >= mmu.num_l3_ptes)
+    return ERR_INVAL;
+
+  pte = &mmu.l3_pte_base[page_idx];
+  *pte = guard ? 0 : mmu_make_page_desc(page_idx, MMU_MEMATTR_IDX_NORMAL);
+
+  /* Table walks are not cached, push descriptor to memory */
+  asm volatile(
+    "dc civac, %0\n"
+    "dsb ish\n"
+    "tlbi vaae1, %1\n"
+    "dsb ish\n"
+    "isb\n"
+    :: "r"(pte), "r"((va >> 12) & ((1ull << 44) - 1)) : "memory");
+
+  return SUCCESS;
+}
+
 static inline void par_to_string(uint64_t par, char *par_desc,
   int par_desc_len)
 {
@@ -10,11 +10,14 @@
 #include <errcode.h>
 #include <cpu.h>
 #include <drivers/dma/dma_bcm2835.h>
+#include <drivers/timer/timer_bcm2835.h>
 #include <kmalloc.h>
 #include <common.h>
 #include <mmu.h>
 #include <memory_map.h>
 #include <bitops.h>
+#include <vc/service_mmal_protocol.h>
+#include <vc/service_mmal_encoding.h>
 #include "display_ili9341_command.h"
 
 #ifdef DISPLAY_MODE_PORTRAIT
@@ -63,6 +66,29 @@ struct ili9341_spi_tasks {
   struct spi_async_task spi_ramwr_cmd;
 };
 
+/*
+ * Maximum number of SPI DMA transfers in one partial update. Every transfer
+ * holds as many rows of a damaged rectangle as fit into max SPI transfer size
+ */
+#define ILI9341_MAX_PARTIAL_XFERS 16
+
+/*
+ * DMA chain and SPI commands for partial update. Only one draw task is in
+ * progress at a time, so a single set is programmed when partial draw task
+ * starts.
+ */
+struct ili9341_partial {
+  bool supported;
+  struct spi_dma_xfer_cb cbs[ILI9341_MAX_PARTIAL_XFERS];
+  /* SPI DMA header words, one per transfer, read by DMA */
+  uint32_t spi_headers[ILI9341_MAX_PARTIAL_XFERS];
+  struct ili9341_spi_tasks spi_tasks[ILI9341_MAX_DAMAGE_RECTS];
+  /* Index of first transfer of next rectangle, per rectangle */
+  int rect_xfer_end[ILI9341_MAX_DAMAGE_RECTS];
+  int num_rects;
+  int current_rect;
+};
+
 struct ili9341 {
   struct ili9341_gpio gpio;
   struct spi_device spi;
@@ -87,6 +113,14 @@ struct ili9341 {
    */
   int num_dma_xfer_done;
 
+  /* DMA transfers of current draw task, full drawframe or partial */
+  struct spi_dma_xfer_cb *xfer_cbs;
+  int num_xfers;
+  bool is_partial;
+
+  struct ili9341_partial partial;
+  struct ili9341_stats stats;
+
   /* An array of draw frames set once during initialization */
   struct ili9341_drawframe *drawframes;
   /* An array of spi tasks, with same length as drawframes */
@@ -118,21 +152,26 @@ struct ili9341 {
 
   /* SPI register address to be destination for DMA pixel writes */
   uint32_t reg_addr_spi_fifo;
-};
 
-#define BYTES_PER_PIXEL 3
+  enum ili9341_pixel_format pixel_format;
+};
 
-#define BYTES_PER_FRAME(__width, __height) \
-  ((__width) * (__height) * BYTES_PER_PIXEL)
+/* COLMOD argument: DPI[6:4] and DBI[2:0] pixel formats */
+#define ILI9341_COLMOD_RGB666 0x66
+#define ILI9341_COLMOD_RGB565 0x55
 
-/* 230400 */
-#define NUM_BYTES_PER_FRAME BYTES_PER_FRAME(DISPLAY_HEIGHT, DISPLAY_WIDTH)
+static inline int ili9341_bytes_per_pixel(
+  enum ili9341_pixel_format pixel_format)
+{
+  return pixel_format == ILI9341_PIXEL_FORMAT_RGB565 ? 2 : 3;
+}
 
 static struct ili9341 ili9341;
 
 /*
  * Precalculated transfer of image via SPI and DMA:
- * Image dimentions are 320 X 240 X 3 bytes = 230400
+ * Image dimentions are 320 X 240 X 3 bytes = 230400 for RGB666 or
+ * 320 X 240 X 2 bytes = 153600 for RGB565
  * Size of one DMA transfer is limited by how SPI is working in DMA mode.
  * When DMA enabled, SPI treats first word written to SPI FIFO
  * as a 16 bits of transfer length and 8 bits of lower byte of SPI_CS register
@@ -141,7 +180,8 @@ static struct ili9341 ili9341;
  * bytes > maximum 'good' transfer size is:
  * 0xffff & ~(4-1) = 0xffff & ~3 = 0xfffc = 65532
  * Number of 65532 byte transfers we need to transfer 230400 is:
- * roundup(230400 / 65532) = roundup(3.51584) = 4
+ * roundup(230400 / 65532) = roundup(3.51584) = 4 for RGB666
+ * roundup(153600 / 65532) = roundup(2.34389) = 3 for RGB565
  */
 static inline int get_num_transfers(size_t length)
 {
@@ -151,8 +191,7 @@ static inline int get_num_transfers(size_t length)
 static inline void ili9341_start_next_dma_xfer_isr(void)
 {
   struct ili9341 *dev = &ili9341;
-  struct ili9341_per_frame_dma *dma_io = dev->dma_io_current;
-  struct spi_dma_xfer_cb *cbs = &dma_io->cbs[dev->num_dma_xfer_done];
+  struct spi_dma_xfer_cb *cbs = &dev->xfer_cbs[dev->num_dma_xfer_done];
 
   bcm2835_dma_set_cb(dev->dma_ch_tx, cbs->spi_start);
   bcm2835_dma_set_cb(dev->dma_ch_rx, cbs->rx);
@@ -163,6 +202,8 @@ static inline void ili9341_start_next_dma_xfer_isr(void)
   bcm2835_dma_activate(dev->dma_ch_tx);
 }
 
+static int ili9341_partial_prep_isr(struct ili9341_per_frame_dma *dma_io);
+
 static void ili9341_start_draw_task_isr(struct ili9341_per_frame_dma *dma_io)
 {
   struct ili9341 *dev = &ili9341;
@@ -173,12 +214,51 @@ static void ili9341_start_draw_task_isr(struct ili9341_per_frame_dma *dma_io)
     asm volatile ("wfe");
   }
 
-  spi_task = &dev->spi_tasks[dma_io->drawframe_idx];
   dev->num_dma_xfer_done = 0;
   dev->dma_io_current = dma_io;
+
+  if (dma_io->state == ILI9341_FRAME_READY) {
+    dev->drawframes[dma_io->drawframe_idx].mailbox_ready = NULL;
+    dma_io->state = ILI9341_FRAME_DISPLAYING;
+  }
+
+  dev->is_partial = dma_io->damage.num_rects
+    && ili9341_partial_prep_isr(dma_io) == SUCCESS;
+
+  if (dev->is_partial) {
+    dev->partial.current_rect = 0;
+    spi_task = &dev->partial.spi_tasks[0];
+    dev->stats.num_partial_draws++;
+  } else {
+    dev->xfer_cbs = dma_io->cbs;
+    dev->num_xfers = dma_io->num_transfers;
+    spi_task = &dev->spi_tasks[dma_io->drawframe_idx];
+    dev->stats.num_full_draws++;
+    dev->stats.num_bytes_sent += dma_io->buf_size;
+  }
+
   spi_io_async_isr(&spi_task->spi_caset_cmd, ili9341_start_next_dma_xfer_isr);
 }
 
+static void ili9341_frame_presented_isr(struct ili9341_drawframe *drawframe,
+  struct ili9341_per_frame_dma *dma_io)
+{
+  struct ili9341_frame_stats *s = &drawframe->stats;
+  uint64_t now = bcm2835_systimer_get_time_us_locked();
+  uint32_t latency = now > dma_io->timestamp_us ? now - dma_io->timestamp_us
+    : 0;
+
+  s->num_presented++;
+  s->latency_last_us = latency;
+  s->latency_sum_us += latency;
+  if (s->num_presented == 1 || latency < s->latency_min_us)
+    s->latency_min_us = latency;
+  if (latency > s->latency_max_us)
+    s->latency_max_us = latency;
+
+  dma_io->state = ILI9341_FRAME_FREE;
+}
+
 static inline void ili9341_on_draw_task_completed_isr(
   struct ili9341_per_frame_dma *dma_io)
 {
@@ -193,6 +273,9 @@ static inline void ili9341_on_draw_task_completed_isr(
 
   drawframe = &dev->drawframes[dma_io->drawframe_idx];
 
+  if (dma_io->state == ILI9341_FRAME_DISPLAYING)
+    ili9341_frame_presented_isr(drawframe, dma_io);
+
   if (drawframe->on_dma_done_irq)
     drawframe->on_dma_done_irq(dma_io);
 
@@ -212,13 +295,21 @@ static void ili9341_dma_rx_done_irq(void)
 {
   struct ili9341 *dev = &ili9341;
   struct ili9341_per_frame_dma *dma_io = dev->dma_io_current;
+  struct ili9341_partial *p = &dev->partial;
 
   spi_dma_disable();
 
   dev->num_dma_xfer_done++;
 
-  if (dev->num_dma_xfer_done == dma_io->num_transfers)
+  if (dev->num_dma_xfer_done == dev->num_xfers)
     ili9341_on_draw_task_completed_isr(dma_io);
+  else if (dev->is_partial
+    && dev->num_dma_xfer_done == p->rect_xfer_end[p->current_rect]) {
+    /* Next rectangle needs its own CASET / PASET / RAMWR */
+    p->current_rect++;
+    spi_io_async_isr(&p->spi_tasks[p->current_rect].spi_caset_cmd,
+      ili9341_start_next_dma_xfer_isr);
+  }
   else
     ili9341_start_next_dma_xfer_isr();
 }
@@ -268,6 +359,7 @@ void OPTIMIZED ili9341_draw_dma_buf(struct ili9341_per_frame_dma *dma_io)
   int irq;
 
   disable_irq_save_flags(irq);
+  dma_io->damage.num_rects = 0;
   no_task_in_progress = list_empty(&dev->draw_tasks); //dev->dma_io_current == NULL;
   list_add_tail(&dma_io->draw_tasks, &dev->draw_tasks);
   restore_irq_flags(irq);
@@ -277,6 +369,189 @@ void OPTIMIZED ili9341_draw_dma_buf(struct ili9341_per_frame_dma *dma_io)
   }
 }
 
+struct ili9341_per_frame_dma *ili9341_frame_acquire(
+  struct ili9341_drawframe *drawframe)
+{
+  int i;
+  int irq;
+  struct ili9341_per_frame_dma *dma_io = NULL;
+
+  disable_irq_save_flags(irq);
+  for (i = 0; i < drawframe->num_bufs; ++i) {
+    if (drawframe->bufs[i].state == ILI9341_FRAME_FREE) {
+      dma_io = &drawframe->bufs[i];
+      break;
+    }
+  }
+
+  /* Not enough buffers for triple buffering, take back the pending frame */
+  if (!dma_io && drawframe->mailbox_ready) {
+    dma_io = drawframe->mailbox_ready;
+    list_del_init(&dma_io->draw_tasks);
+    drawframe->mailbox_ready = NULL;
+    drawframe->stats.num_dropped++;
+  }
+
+  if (dma_io)
+    dma_io->state = ILI9341_FRAME_WRITING;
+  restore_irq_flags(irq);
+  return dma_io;
+}
+
+void OPTIMIZED ili9341_frame_submit(struct ili9341_per_frame_dma *dma_io,
+  uint64_t timestamp_us)
+{
+  struct ili9341 *dev = &ili9341;
+  struct ili9341_drawframe *drawframe = &dev->drawframes[dma_io->drawframe_idx];
+  struct ili9341_per_frame_dma *old;
+  bool no_task_in_progress = false;
+  int irq;
+
+  disable_irq_save_flags(irq);
+  dma_io->timestamp_us = timestamp_us ? timestamp_us :
+    bcm2835_systimer_get_time_us_locked();
+  dma_io->damage.num_rects = 0;
+  dma_io->state = ILI9341_FRAME_READY;
+  drawframe->stats.num_submitted++;
+
+  old = drawframe->mailbox_ready;
+  if (old) {
+    /* Newer frame takes place of the stale one in draw queue */
+    list_add_head(&dma_io->draw_tasks, &old->draw_tasks);
+    list_del_init(&old->draw_tasks);
+    old->state = ILI9341_FRAME_FREE;
+    drawframe->stats.num_dropped++;
+  } else {
+    no_task_in_progress = list_empty(&dev->draw_tasks);
+    list_add_tail(&dma_io->draw_tasks, &dev->draw_tasks);
+  }
+
+  drawframe->mailbox_ready = dma_io;
+  restore_irq_flags(irq);
+
+  if (no_task_in_progress)
+    ili9341_start_draw_task_isr(dma_io);
+}
+
+void ili9341_frame_get_stats(struct ili9341_drawframe *drawframe,
+  struct ili9341_frame_stats *s)
+{
+  int irq;
+
+  disable_irq_save_flags(irq);
+  *s = drawframe->stats;
+  restore_irq_flags(irq);
+}
+
+void OPTIMIZED ili9341_draw_dma_buf_damaged(
+  struct ili9341_per_frame_dma *dma_io, const struct ili9341_damage *d)
+{
+  struct ili9341 *dev = &ili9341;
+  bool no_task_in_progress;
+  int irq;
+
+  disable_irq_save_flags(irq);
+  dma_io->damage = *d;
+  no_task_in_progress = list_empty(&dev->draw_tasks);
+  list_add_tail(&dma_io->draw_tasks, &dev->draw_tasks);
+  restore_irq_flags(irq);
+
+  if (no_task_in_progress)
+    ili9341_start_draw_task_isr(dma_io);
+}
+
+static inline bool ili9341_rects_touch(const struct rectangle *a,
+  const struct rectangle *b)
+{
+  return a->pos.x <= b->pos.x + b->size.x
+    && b->pos.x <= a->pos.x + a->size.x
+    && a->pos.y <= b->pos.y + b->size.y
+    && b->pos.y <= a->pos.y + a->size.y;
+}
+
+static inline void ili9341_rect_union(struct rectangle *dst,
+  const struct rectangle *r)
+{
+  uint32_t x0 = MIN(dst->pos.x, r->pos.x);
+  uint32_t y0 = MIN(dst->pos.y, r->pos.y);
+  uint32_t x1 = MAX(dst->pos.x + dst->size.x, r->pos.x + r->size.x);
+  uint32_t y1 = MAX(dst->pos.y + dst->size.y, r->pos.y + r->size.y);
+
+  dst->pos.x = x0;
+  dst->pos.y = y0;
+  dst->size.x = x1 - x0;
+  dst->size.y = y1 - y0;
+}
+
+static inline uint32_t ili9341_rect_area(const struct rectangle *r)
+{
+  return r->size.x * r->size.y;
+}
+
+void ili9341_damage_reset(struct ili9341_damage *d)
+{
+  d->num_rects = 0;
+}
+
+static void ili9341_damage_remove(struct ili9341_damage *d, int idx)
+{
+  d->num_rects--;
+  d->rects[idx] = d->rects[d->num_rects];
+}
+
+void ili9341_damage_add(struct ili9341_damage *d, const struct rectangle *r)
+{
+  int i;
+  int best_idx;
+  uint32_t growth;
+  uint32_t best_growth;
+  struct rectangle n = *r;
+  struct rectangle u;
+
+  if (!n.size.x || !n.size.y)
+    return;
+
+  i = 0;
+  while (i < d->num_rects) {
+    if (ili9341_rects_touch(&d->rects[i], &n)) {
+      /* Bounding box might now touch rectangles, that were checked before */
+      ili9341_rect_union(&n, &d->rects[i]);
+      ili9341_damage_remove(d, i);
+      i = 0;
+      continue;
+    }
+
+    i++;
+    if (i == d->num_rects && d->num_rects == ILI9341_MAX_DAMAGE_RECTS) {
+      best_idx = 0;
+      best_growth = UINT32_MAX;
+      for (i = 0; i < d->num_rects; ++i) {
+        u = n;
+        ili9341_rect_union(&u, &d->rects[i]);
+        growth = ili9341_rect_area(&u) - ili9341_rect_area(&d->rects[i]);
+        if (growth < best_growth) {
+          best_growth = growth;
+          best_idx = i;
+        }
+      }
+      ili9341_rect_union(&n, &d->rects[best_idx]);
+      ili9341_damage_remove(d, best_idx);
+      i = 0;
+    }
+  }
+
+  d->rects[d->num_rects++] = n;
+}
+
+void ili9341_get_stats(struct ili9341_stats *s)
+{
+  int irq;
+
+  disable_irq_save_flags(irq);
+  *s = ili9341.stats;
+  restore_irq_flags(irq);
+}
+
 static inline int ili9341_init_gpio(int gpio_blk, int gpio_dc, int gpio_reset)
 {
   struct ili9341 *dev = &ili9341;
@@ -457,6 +732,125 @@ static void ili9341_spi_tasks_init(struct ili9341_spi_tasks *t,
   t->spi_ramwr_cmd.post_cb_isr = ili9341_cmd_dc_set_isr;
 }
 
+static inline void ili9341_partial_program_xfer(struct ili9341_partial *p,
+  int xfer_idx, uint32_t src, uint32_t row_bytes, uint32_t num_rows,
+  uint32_t pitch)
+{
+  struct ili9341 *dev = &ili9341;
+  struct spi_dma_xfer_cb *cbs = &p->cbs[xfer_idx];
+  struct bcm2835_dma_request_param conf;
+  uint32_t len = row_bytes * num_rows;
+
+  p->spi_headers[xfer_idx] = spi_get_dma_word0(len);
+
+  DMA_CB_CONFIG(conf, SPI_TX, DST,
+    RAM_PHY_TO_BUS_UNCACHED(&p->spi_headers[xfer_idx]),
+    dev->reg_addr_spi_fifo, NOINC, NOINC, 4, false);
+  bcm2835_dma_program_cb(&conf, cbs->spi_start);
+
+  /*
+   * Rows of rectangle are not contiguous in drawframe buffer, after each row
+   * source skips the rest of drawframe line.
+   */
+  DMA_CB_CONFIG(conf, SPI_TX, DST, src, dev->reg_addr_spi_fifo, INCREMENT,
+    NOINC, 0, false);
+  bcm2835_dma_program_cb_2d(&conf, cbs->tx, row_bytes, num_rows,
+    pitch - row_bytes, 0);
+
+  DMA_CB_CONFIG(conf, SPI_RX, SRC, dev->reg_addr_spi_fifo,
+    RAM_PHY_TO_BUS_UNCACHED(&dev->dma_rx_dst), NOINC, NOINC, len, true);
+  bcm2835_dma_program_cb(&conf, cbs->rx);
+
+  bcm2835_dma_link_cbs(cbs->spi_start, cbs->tx);
+}
+
+/*
+ * Programs SPI commands and DMA chain for damaged regions of drawframe.
+ * Rectangles are clipped to drawframe and horizontally aligned, so that
+ * every row is a whole number of 32-bit words, as DMA writes to SPI FIFO word
+ * by word.
+ */
+static int OPTIMIZED ili9341_partial_prep_isr(
+  struct ili9341_per_frame_dma *dma_io)
+{
+  struct ili9341 *dev = &ili9341;
+  struct ili9341_partial *p = &dev->partial;
+  const struct rectangle *frame = &dev->drawframes[dma_io->drawframe_idx].frame;
+  const struct rectangle *r;
+  int i;
+  int num_xfers = 0;
+  uint32_t x0, y0, x1, y1;
+  uint32_t bpp = ili9341_bytes_per_pixel(dev->pixel_format);
+  /* Pixels per 4 bytes granularity: 2 for RGB565, 4 for RGB666 */
+  uint32_t align = bpp == 2 ? 2 : 4;
+  uint32_t pitch = frame->size.x * bpp;
+  uint32_t row_bytes;
+  uint32_t rows_left;
+  uint32_t rows_per_xfer;
+  uint32_t num_rows;
+  uint32_t src;
+  uint64_t num_bytes = 0;
+
+  if (!p->supported)
+    return ERR_NOTSUPP;
+
+  p->num_rects = 0;
+
+  for (i = 0; i < dma_io->damage.num_rects; ++i) {
+    r = &dma_io->damage.rects[i];
+
+    /* Clip to drawframe, coordinates relative to drawframe */
+    x0 = MAX(r->pos.x, frame->pos.x) - frame->pos.x;
+    y0 = MAX(r->pos.y, frame->pos.y) - frame->pos.y;
+    x1 = MIN(r->pos.x + r->size.x, frame->pos.x + frame->size.x);
+    y1 = MIN(r->pos.y + r->size.y, frame->pos.y + frame->size.y);
+    if (x1 <= x0 + frame->pos.x || y1 <= y0 + frame->pos.y)
+      continue;
+
+    x1 -= frame->pos.x;
+    y1 -= frame->pos.y;
+
+    x0 &= ~(align - 1);
+    x1 = ROUND_UP_DIV(x1, align) * align;
+    if (x1 > frame->size.x)
+      return ERR_INVAL;
+
+    row_bytes = (x1 - x0) * bpp;
+    rows_per_xfer = spi_get_max_transfer_size() / row_bytes;
+    src = RAM_PHY_TO_BUS_UNCACHED(dma_io->buf) + y0 * pitch + x0 * bpp;
+
+    ili9341_spi_tasks_init(&p->spi_tasks[p->num_rects],
+      frame->pos.x + x0, frame->pos.y + y0,
+      frame->pos.x + x1 - 1, frame->pos.y + y1 - 1);
+
+    rows_left = y1 - y0;
+    while (rows_left) {
+      if (num_xfers == ILI9341_MAX_PARTIAL_XFERS)
+        return ERR_RESOURCE;
+
+      num_rows = MIN(rows_left, rows_per_xfer);
+      ili9341_partial_program_xfer(p, num_xfers, src, row_bytes, num_rows,
+        pitch);
+
+      src += num_rows * pitch;
+      rows_left -= num_rows;
+      num_bytes += num_rows * row_bytes;
+      num_xfers++;
+    }
+
+    p->rect_xfer_end[p->num_rects++] = num_xfers;
+  }
+
+  if (!p->num_rects)
+    return ERR_NOT_FOUND;
+
+  dcache_flush(p->spi_headers, sizeof(p->spi_headers[0]) * num_xfers);
+  dev->xfer_cbs = p->cbs;
+  dev->num_xfers = num_xfers;
+  dev->stats.num_bytes_sent += num_bytes;
+  return SUCCESS;
+}
+
 static void ili9341_drawframe_init(int drawframe_idx,
   struct ili9341_drawframe *fr, struct ili9341_spi_tasks *t)
 {
@@ -491,9 +885,12 @@ static void ili9341_drawframe_init(int drawframe_idx,
   dcache_flush(&fr->spi_header_last, sizeof(fr->spi_header_last));
 
   fr->num_transfers = get_num_transfers(fr->bufs[0].buf_size);
+  fr->mailbox_ready = NULL;
+  memset(&fr->stats, 0, sizeof(fr->stats));
   for (i = 0; i < fr->num_bufs; ++i) {
     dma_io = &fr->bufs[i];
     dma_io->num_transfers = fr->num_transfers;
+    dma_io->state = ILI9341_FRAME_FREE;
     dma_io->drawframe_idx = drawframe_idx;
     dma_io->dma_io_idx = i;
     ili9341_dma_chain_prep(fr, dma_io);
@@ -528,6 +925,19 @@ static int ili9341_setup_dma(struct ili9341_drawframe *drawframes,
 
   dev->spi_tasks = kmalloc(sizeof(struct ili9341_spi_tasks) * num_drawframes);
 
+  /* Partial updates rely on 2D mode to skip pixels outside of rectangles */
+  dev->partial.supported = bcm2835_dma_channel_supports_2d(dev->dma_ch_tx);
+  if (dev->partial.supported) {
+    for (i = 0; i < ILI9341_MAX_PARTIAL_XFERS; ++i) {
+      dev->partial.cbs[i].spi_start = bcm2835_dma_reserve_cb();
+      dev->partial.cbs[i].tx = bcm2835_dma_reserve_cb();
+      dev->partial.cbs[i].rx = bcm2835_dma_reserve_cb();
+    }
+  }
+  else
+    os_log("ili9341: no 2D mode on DMA channel %d, no partial updates\r\n",
+      dev->dma_ch_tx);
+
   for (i = 0; i < num_drawframes; ++i) {
     ili9341_drawframe_init(i, &drawframes[i], &dev->spi_tasks[i]);
   }
@@ -553,13 +963,21 @@ static int ili9341_init_drawframes(struct ili9341_drawframe *drawframe,
 }
 
 int ili9341_init(int gpio_blk, int gpio_dc, int gpio_reset,
+  enum ili9341_pixel_format pixel_format,
   struct ili9341_drawframe *drawframes, int num_drawframes)
 {
   int err;
   struct ili9341 *dev = &ili9341;
   uint8_t data[8];
 
+  if (pixel_format != ILI9341_PIXEL_FORMAT_RGB666
+    && pixel_format != ILI9341_PIXEL_FORMAT_RGB565) {
+    os_log("ili9341: invalid pixel format %d\r\n", pixel_format);
+    return ERR_INVAL;
+  }
+
   INIT_LIST_HEAD(&dev->draw_tasks);
+  dev->pixel_format = pixel_format;
 
   ili9341_init_spi(gpio_blk, gpio_dc, gpio_reset);
 
@@ -578,7 +996,8 @@ int ili9341_init(int gpio_blk, int gpio_dc, int gpio_reset,
   ili9341_write_data_bytes(data, 1);
 
   ili9341_write_command_byte(ILI9341_CMD_COLMOD);
-  data[0] = 0x66;
+  data[0] = pixel_format == ILI9341_PIXEL_FORMAT_RGB565 ?
+    ILI9341_COLMOD_RGB565 : ILI9341_COLMOD_RGB666;
   ili9341_write_data_bytes(data, 1);
 
   ili9341_write_command_byte(ILI9341_CMD_SLEEP_OUT);
@@ -596,7 +1015,35 @@ int ili9341_init(int gpio_blk, int gpio_dc, int gpio_reset,
   return SUCCESS;
 }
 
-size_t ili9341_get_frame_byte_size(int frame_width, int frame_height)
+size_t ili9341_get_frame_byte_size(enum ili9341_pixel_format pixel_format,
+  int frame_width, int frame_height)
+{
+  return frame_width * frame_height * ili9341_bytes_per_pixel(pixel_format);
+}
+
+uint32_t ili9341_pixel_format_to_mmal_encoding(
+  enum ili9341_pixel_format pixel_format)
 {
-  return BYTES_PER_FRAME(frame_width, frame_height);
+  if (pixel_format == ILI9341_PIXEL_FORMAT_RGB565)
+    return MMAL_ENCODING_RGB16;
+
+  return MMAL_ENCODING_RGB24;
+}
+
+void OPTIMIZED ili9341_rgb565_swap_bytes(void *buf, size_t size)
+{
+  uint64_t *p = buf;
+  uint64_t *end = p + size / 8;
+  uint16_t *tail;
+  uint64_t v;
+
+  BUG_IF((uint64_t)buf & 7, "ili9341: rgb565 buffer not 8-byte aligned");
+
+  for (; p < end; ++p) {
+    v = *p;
+    *p = ((v & 0x00ff00ff00ff00ffull) << 8) | ((v >> 8) & 0x00ff00ff00ff00ffull);
+  }
+
+  for (tail = (uint16_t *)p; tail < (uint16_t *)((uint8_t *)buf + size); ++tail)
+    *tail = (*tail << 8) | (*tail >> 8);
 }
@@ -7,6 +7,7 @@
 #include <drivers/intc/intc_bcm2835.h>
 #include <irq.h>
 #include <logger.h>
+#include <trace.h>
 #include "dma_bcm2835_regs.h"
 
 #define BCM2835_DMA_NUM_SCBS 256
@@ -65,6 +66,7 @@ static inline void bcm2835_dma_irq_handler_common(int channel)
 
   *DMA_CS(channel) |= DMA_CS_INT;
 
+  trace_event(TRACE_EV_DMA_END, channel, 0);
   bcm2835_dma.num_dma_irqs[channel]++;
 
   if (*DMA_DEBUG(channel) & DMA_DEBUG_READ_LAST_NOT_SET_ERROR)
@@ -194,6 +196,55 @@ bool bcm2835_dma_program_cb(const struct bcm2835_dma_request_param *p,
   return true;
 }
 
+/*
+ * 2D mode: ylength rows of xlength bytes are transferred, after each row
+ * src_stride and dst_stride are added to source and destination addresses.
+ * p->len is ignored. 2D mode is not supported by DMA LITE channels.
+ */
+bool bcm2835_dma_program_cb_2d(const struct bcm2835_dma_request_param *p,
+  int cb_handle, uint32_t xlength, uint32_t ylength, int16_t src_stride,
+  int16_t dst_stride)
+{
+  struct bcm2835_dma_cb *cb;
+
+  if (cb_handle == -1 || cb_handle >= BCM2835_DMA_NUM_SCBS)
+    return false;
+
+  if (!xlength || xlength > 0xffff || !ylength || ylength > 0x4000)
+    return false;
+
+  cb = &bcm2835_dma.cbs[cb_handle];
+  cb->transfer_info = bcmd2835_dma_gen_ti(
+    p->dreq,
+    p->dreq_type,
+    p->src_type,
+    p->dst_type,
+    true,
+    p->enable_irq) | DMA_TI_TD_MODE;
+
+  cb->source_addr = p->src;
+  cb->dest_addr = p->dst;
+  /* YLENGTH + 1 rows are transferred in 2D mode */
+  cb->transfer_len = DMA_TXFR_LEN_YLENGTH((ylength - 1))
+    | DMA_TXFR_LEN_XLENGTH(xlength);
+  cb->mode_2d_stride = DMA_STRIDE_D_STRIDE((uint16_t)dst_stride)
+    | DMA_STRIDE_S_STRIDE((uint16_t)src_stride);
+  cb->next_cb_addr = 0;
+
+  BCM2835_DMA_LOG("bcm2835_dma_program_cb_2d #%d, %p, %dx%d", cb_handle, cb,
+    xlength, ylength);
+  asm volatile ("dsb sy");
+  return true;
+}
+
+bool bcm2835_dma_channel_supports_2d(int channel)
+{
+  if (channel < 0 || channel >= BCM2835_DMA_NUM_CHANNELS)
+    return false;
+
+  return !(*DMA_DEBUG(channel) & DMA_DEBUG_LITE);
+}
+
 bool bcm2835_dma_update_cb_src(int cb_handle, uint32_t src)
 {
   struct bcm2835_dma_cb *cb;
@@ -222,6 +273,7 @@ void bcm2835_dma_enable(int channel)
 void bcm2835_dma_activate(int channel)
 {
   BCM2835_DMA_LOG("bcm2835_dma_activate, ch:%d", channel);
+  trace_event(TRACE_EV_DMA_START, channel, 0);
   *DMA_CS(channel) |= DMA_CS_ACTIVE;
 }
 
@@ -355,3 +407,22 @@ void bcm2835_dma_dump_channel(const char *tag, int channel)
     paddr = cb->next_cb_addr;
   }
 }
+
+void bcm2835_dma_print_stats(void)
+{
+  int i;
+
+  printf("dma control blocks used: %d/%d, channels used: %d/%d\r\n",
+    bitmap_count_set(&bcm2835_dma.cb_bitmap), BCM2835_DMA_NUM_SCBS,
+    bitmap_count_set(&bcm2835_dma.channel_bitmap), BCM2835_DMA_NUM_CHANNELS);
+  printf("ch active       irqs rd_err fifo_err last_not_set\r\n");
+  for (i = 0; i < BCM2835_DMA_NUM_CHANNELS; ++i) {
+    if (!bcm2835_dma.num_dma_irqs[i] && !(*DMA_CS(i) & DMA_CS_ACTIVE))
+      continue;
+
+    printf("%2d %6d %10d %6d %8d %12d\r\n", i,
+      (*DMA_CS(i) & DMA_CS_ACTIVE) ? 1 : 0, bcm2835_dma.num_dma_irqs[i],
+      bcm2835_dma.num_read_errors[i], bcm2835_dma.num_fifo_errors[i],
+      bcm2835_dma.num_read_last_not_set_errors[i]);
+  }
+}
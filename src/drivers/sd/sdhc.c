@@ -7,6 +7,7 @@
 #include <os_api.h>
 #include <log.h>
 #include <list_fifo.h>
+#include <trace.h>
 
 typedef enum {
   SDHC_OP_READ = 0,
@@ -520,6 +521,8 @@ static OPTIMIZED int sdhc_op(struct sdhc *s, sdhc_op_t op, uint8_t *buf,
 
   s->ops->wait_prev_done(s);
   sdhc_current = s;
+  trace_event(op == SDHC_OP_READ ? TRACE_EV_SDHC_READ : TRACE_EV_SDHC_WRITE,
+    num_blocks, start_block_idx);
 
   /*
    * CMD18 READ_MULTIPLE_BLOCKS or CMD25 WRITE_MULTIPLE_BLOCKS must follow
@@ -546,6 +549,7 @@ static OPTIMIZED int sdhc_op(struct sdhc *s, sdhc_op_t op, uint8_t *buf,
         SDHC_TIMEOUT_DEFAULT_USEC);
   }
 
+  trace_event(TRACE_EV_SDHC_DONE, err, 0);
   if (err)
     SDHC_LOG_ERR("sd op %s failed", sdhc_op_to_str(op));
 
@@ -669,6 +673,8 @@ static int sdhc_write_stream_one(struct sdhc *s, struct write_stream_buf *b)
 
   s->ops->wait_prev_done(s);
   sdhc_current = s;
+  trace_event(TRACE_EV_SDHC_WRITE, num_wr_blocks,
+    s->write_stream_next_block_idx);
 
   if (num_wr_blocks == 1) {
     err = sdhc_cmd24(s, s->write_stream_next_block_idx, NULL,
@@ -685,6 +691,7 @@ static int sdhc_write_stream_one(struct sdhc *s, struct write_stream_buf *b)
     SDHC_CHECK_ERR("Failed to WRITE MULTIPLE BLOCKS to write stream");
   }
 
+  trace_event(TRACE_EV_SDHC_DONE, SUCCESS, 0);
   sdhc_iostats.num_bytes_written += num_wr_blocks * s->block_size;
   s->write_stream_next_block_idx += num_wr_blocks;
   sdhc_write_stream_release_after_wr(s, num_wr_blocks);
@@ -811,12 +818,11 @@ int sdhc_set_io_mode(struct sdhc *sdhc, sdhc_io_mode_t mode,
   return SUCCESS;
 }
 
-void sdhc_iostats_fetch_clear(struct sdhc_iostats *iostats)
+void sdhc_iostats_get(struct sdhc_iostats *iostats)
 {
   int irq;
   disable_irq_save_flags(irq);
   *iostats = sdhc_iostats;
-  sdhc_iostats.num_bytes_written = 0;
   restore_irq_flags(irq);
 }
 
@@ -22,12 +22,8 @@
 #include <irq.h>
 #include <drivers/intc/intc_bcm2835.h>
 #include "sdhost_bcm2835_stat.h"
-#include <stat_fifo.h>
 
-bool cycles_wait_had_data = false;
-uint64_t cycles_wait_start;
-uint32_t wait_cycles_data[400];
-struct stat_ringbuf stat_fifo_wait_cycles;
+struct bcm_sdhost_stat bcm_sdhost_stat = { .cmd = -1 };
 
 /*
  * In manual mode we set CDIV register by calculating required CDIV from
@@ -230,6 +226,7 @@ static void bcm_sdhost_irq(void)
       }
     }
 
+    bcm_sdhost_stat_cmd_resp();
     hcfg &= ~SDHOST_CFG_DATA_IRPT_EN;
     hcfg |= SDHOST_CFG_BLOCK_IRPT_EN;
     ioreg32_write(SDHOST_HCFG, hcfg);
@@ -512,6 +509,7 @@ static void bcm_sdhost_cmd_prep_dma(struct sdhc *s, struct sd_cmd *c,
    * Activates DMA channel, DMA will copy 4byte word each time sdhost asserts
    * DREQ signal
    */
+  bcm_sdhost_stat_dma_start();
   bcm2835_dma_activate(s->io.dma_channel);
 }
 
@@ -597,6 +595,10 @@ static OPTIMIZED int bcm_sdhost_cmd_execute(struct sdhc *s, struct sd_cmd *c,
   reg_cmd |= BIT(SDHOST_CMD_BIT_NEW);
   has_data = reg_cmd & SDHOST_CMD_HAS_DATA_MASK;
 
+  /* ACMD indexes overlap with CMD ones, none of them are tracked */
+  bcm_sdhost_stat.cmd = s->is_acmd_context ? -1
+    : bcm_sdhost_stat_cmd_idx(c->cmd_idx);
+
   if (has_data) {
     ioreg32_write(SDHOST_HBCT, c->block_size);
     ioreg32_write(SDHOST_HBLC, c->num_blocks);
@@ -629,12 +631,8 @@ static OPTIMIZED int bcm_sdhost_cmd_execute(struct sdhc *s, struct sd_cmd *c,
     BCM_SDHOST_LOG_DBG2("CMD: old:%08x,set:0x%08x, ARG:old:0x%08x,new:%08x",
       ioreg32_read(SDHOST_CMD), reg_cmd, ioreg32_read(SDHOST_ARG), c->arg);
 
-  cycles_wait_had_data = has_data;
-  if (cycles_wait_had_data) {
-    cycles_wait_start = arm_timer_get_count();
-  }
-
   ioreg32_write(SDHOST_ARG, c->arg);
+  bcm_sdhost_stat_cmd_start();
   ioreg32_write(SDHOST_CMD, reg_cmd);
 
   if (has_data && s->io_mode == SDHC_IO_MODE_IT_DMA) {
@@ -690,6 +688,7 @@ static OPTIMIZED int bcm_sdhost_cmd_execute(struct sdhc *s, struct sd_cmd *c,
     BCM_SDHOST_LOG_DBG2("wait_new,cmd:%08x,edm:%08x,hsts:%08x",
       reg_cmd, ioreg32_read(SDHOST_EDM), ioreg32_read(SDHOST_HSTS));
   }
+  bcm_sdhost_stat_cmd_resp();
 
   /* Clear possible error state from previous command */
   if (BIT_IS_SET(reg_cmd, SDHOST_CMD_BIT_FAIL)) {
@@ -918,8 +917,6 @@ static int bcm_sdhost_init(void)
 
   os_event_init(&bcm_sdhost_block_done_event);
   os_event_init(&bcm_sdhost_dma_done_event);
-  stat_ringbuf_init(&stat_fifo_wait_cycles, wait_cycles_data,
-    ARRAY_SIZE(wait_cycles_data));
   return SUCCESS;
 }
 
@@ -940,21 +937,20 @@ static int bcm_sdhost_set_io_mode(struct sdhc *s, sdhc_io_mode_t mode,
 
 static void bcm_sdhost_wait_prev_done(struct sdhc *s)
 {
-  uint32_t wait_cycles;
+  uint64_t start;
+
   if (!bcm_sdhost_should_wait_last_io)
     return;
 
   bcm_sdhost_should_wait_last_io = false;
+  start = arm_timer_get_count();
   bcm_sdhost_wait_last_op_complete();
-  if (cycles_wait_had_data) {
-    wait_cycles = (uint32_t)(arm_timer_get_count() - cycles_wait_start);
-    stat_ringbuf_push(&stat_fifo_wait_cycles, wait_cycles);
-    cycles_wait_had_data = false;
-  }
+  bcm_sdhost_stat_busy_wait(start);
 }
 
 static void bcm_sdhost_notify_dma_isr(struct sdhc *s)
 {
+  bcm_sdhost_stat_dma_done();
   os_event_notify_isr(&bcm_sdhost_dma_done_event);
 }
 
@@ -979,3 +975,60 @@ int bcm_sdhost_set_log_level(int l)
   bcm_sdhost_log_level = l;
   return old;
 }
+
+void bcm_sdhost_get_stats(struct bcm_sdhost_stats *s)
+{
+  int irq;
+
+  disable_irq_save_flags(irq);
+  *s = bcm_sdhost_stat.h;
+  restore_irq_flags(irq);
+}
+
+void bcm_sdhost_reset_stats(void)
+{
+  int irq;
+
+  disable_irq_save_flags(irq);
+  memset(&bcm_sdhost_stat.h, 0, sizeof(bcm_sdhost_stat.h));
+  restore_irq_flags(irq);
+}
+
+static struct bcm_sdhost_stats bcm_sdhost_stats_snapshot;
+
+static void bcm_sdhost_print_hist(const char *name, int cmd,
+  const struct lat_hist *h, uint32_t freq)
+{
+  static const int cmd_nums[BCM_SDHOST_STAT_NUM_CMDS] = { 17, 18, 24, 25 };
+  int i;
+
+  if (!h->count)
+    return;
+
+  printf("%s CMD%d: n:%u avg:%lu p50:%lu p99:%lu max:%lu us\r\n", name,
+    cmd_nums[cmd], h->count, h->sum * 1000000 / freq / h->count,
+    lat_hist_percentile(h, 50) * 1000000 / freq,
+    lat_hist_percentile(h, 99) * 1000000 / freq,
+    h->max * 1000000 / freq);
+
+  /* Bucket i holds values below 2^(i+1) counts */
+  for (i = 0; i < LAT_HIST_NUM_BUCKETS; ++i) {
+    if (h->buckets[i])
+      printf("  <%lu us: %u\r\n", (2ull << i) * 1000000 / freq,
+        h->buckets[i]);
+  }
+}
+
+void bcm_sdhost_print_stats(void)
+{
+  int i;
+  uint32_t freq = arm_timer_get_freq();
+  struct bcm_sdhost_stats *s = &bcm_sdhost_stats_snapshot;
+
+  bcm_sdhost_get_stats(s);
+  for (i = 0; i < BCM_SDHOST_STAT_NUM_CMDS; ++i) {
+    bcm_sdhost_print_hist("cmd->resp", i, &s->cmd_resp[i], freq);
+    bcm_sdhost_print_hist("dma->done", i, &s->dma_data[i], freq);
+    bcm_sdhost_print_hist("busy wait", i, &s->busy_wait[i], freq);
+  }
+}
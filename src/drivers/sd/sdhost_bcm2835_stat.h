@@ -1,119 +1,76 @@
 #pragma once
 #include <stdint.h>
-
-struct sdhost_bcm2835_write_stat {
-  int num_blocks;
-  uint64_t cmd_start;
-  int num_block_irqs;
-  uint64_t block_irq[128];
-  uint64_t dma_end;
-  uint64_t wait_start;
-  uint64_t wait_end;
-};
-
-extern uint64_t sdhost_wait_start;
-extern uint64_t sdhost_wait_cycles;
-
-
-#if 0
+#include <cpu.h>
+#include <lat_hist.h>
+#include <drivers/sd/sdhost_bcm2835.h>
+
+/*
+ * Always-on latency histograms of data commands. Timestamps of the command
+ * in flight are kept here, driver calls the hooks below on each stage.
+ * Other commands are not tracked, cmd is -1 for them.
+ */
 struct bcm_sdhost_stat {
-  uint32_t num_irqs;
-  uint32_t num_waits;
-  uint64_t wait_rdy_start_time;
-  uint64_t wait_rdy_end_time;
-  uint64_t total_wait_time;
+  struct bcm_sdhost_stats h;
+  int cmd;
+  uint64_t cmd_start;
+  uint64_t dma_start;
+  bool cmd_resp_done;
 };
 
-static struct bcm_sdhost_stat bcm_sdhost_stat = { 0 };
-static struct sdhost_bcm2835_write_stat sdhost_bcm2835_write_stats[128] = { 0 };
-static int sdhost_bcm2835_write_stat_current_idx = 0;
-static struct sdhost_bcm2835_write_stat *sdhost_bcm2835_write_stat_current = NULL;
-
-static inline void bcm_sdhost_stat_irq(void)
-{
-  bcm_sdhost_stat.num_irqs++;
-}
-
-static inline void bcm_sdhost_stat_wait_rdy_start(void)
-{
-  bcm_sdhost_stat.wait_rdy_start_time = arm_timer_get_count();
-}
+extern struct bcm_sdhost_stat bcm_sdhost_stat;
 
-static inline void bcm_sdhost_stat_wait_rdy_iter(void)
+static inline int bcm_sdhost_stat_cmd_idx(uint32_t cmd_idx)
 {
-  bcm_sdhost_stat.num_waits++;
+  switch (cmd_idx) {
+    case SDHC_CMD17: return BCM_SDHOST_STAT_CMD17;
+    case SDHC_CMD18: return BCM_SDHOST_STAT_CMD18;
+    case SDHC_CMD24: return BCM_SDHOST_STAT_CMD24;
+    case SDHC_CMD25: return BCM_SDHOST_STAT_CMD25;
+    default: return -1;
+  }
 }
 
-static inline void bcm_sdhost_stat_wait_rdy_end(void)
+static inline void bcm_sdhost_stat_cmd_start(void)
 {
-  bcm_sdhost_stat.wait_rdy_end_time = arm_timer_get_count();
-  bcm_sdhost_stat.total_wait_time += bcm_sdhost_stat.wait_rdy_end_time 
-    - bcm_sdhost_stat.wait_rdy_start_time;
+  bcm_sdhost_stat.cmd_start = arm_timer_get_count();
+  bcm_sdhost_stat.cmd_resp_done = false;
 }
 
-static void sdhost_bcm2835_write_stat_new(int num_blocks)
+/* Called once response is seen, by polling or by DATA interrupt */
+static inline void bcm_sdhost_stat_cmd_resp(void)
 {
-  struct sdhost_bcm2835_write_stat *c;
+  struct bcm_sdhost_stat *st = &bcm_sdhost_stat;
 
-  if (sdhost_bcm2835_write_stat_current_idx == 128)
+  if (st->cmd == -1 || st->cmd_resp_done)
     return;
 
-  c = &sdhost_bcm2835_write_stats[sdhost_bcm2835_write_stat_current_idx++];
-  c->num_blocks = num_blocks;
-  c->cmd_start = arm_timer_get_count();
-
-  sdhost_bcm2835_write_stat_current = c;
+  st->cmd_resp_done = true;
+  lat_hist_add(&st->h.cmd_resp[st->cmd],
+    arm_timer_get_count() - st->cmd_start);
 }
 
-#if 0
-static void sdhost_bcm2835_write_stat_block_irq(void)
+static inline void bcm_sdhost_stat_dma_start(void)
 {
-  struct sdhost_bcm2835_write_stat *c = sdhost_bcm2835_write_stat_current;
-  if (!c)
-    return;
-
-  if (c->num_block_irqs >= ARRAY_SIZE(c->block_irq))
-    return;
-
-  c->block_irq[c->num_block_irqs++] = arm_timer_get_count();
+  bcm_sdhost_stat.dma_start = arm_timer_get_count();
 }
-#endif
 
-static void sdhost_bcm2835_write_stat_dma_end(void)
+static inline void bcm_sdhost_stat_dma_done(void)
 {
-  struct sdhost_bcm2835_write_stat *c = sdhost_bcm2835_write_stat_current;
-  if (!c)
-    return;
-
-  c->dma_end = arm_timer_get_count();
-}
+  struct bcm_sdhost_stat *st = &bcm_sdhost_stat;
 
-static void sdhost_bcm2835_write_stat_wait_start(void)
-{
-  struct sdhost_bcm2835_write_stat *c = sdhost_bcm2835_write_stat_current;
-  if (!c)
+  if (st->cmd == -1)
     return;
 
-  c->wait_start = arm_timer_get_count();
+  lat_hist_add(&st->h.dma_data[st->cmd],
+    arm_timer_get_count() - st->dma_start);
 }
 
-static void sdhost_bcm2835_write_stat_wait_end(void)
+static inline void bcm_sdhost_stat_busy_wait(uint64_t start)
 {
-  struct sdhost_bcm2835_write_stat *c = sdhost_bcm2835_write_stat_current;
-  if (!c)
+  struct bcm_sdhost_stat *st = &bcm_sdhost_stat;
+
+  if (st->cmd == -1)
     return;
 
-  c->wait_end = arm_timer_get_count();
-  sdhost_bcm2835_write_stat_current = NULL;
-  if (sdhost_bcm2835_write_stat_current_idx == 128) {
-    for (int i = 0; i < 128; ++i) {
-      c = &sdhost_bcm2835_write_stats[i];
-      printf("%d %ld %d %d ", i, c->cmd_start, c->num_blocks, c->num_block_irqs);
-      for (int ii = 0; ii < c->num_block_irqs; ++ii) {
-        printf(" %ld", c->block_irq[ii]);
-      }
-      printf(" %ld %ld %ld\r\n", c->dma_end, c->wait_start, c->wait_end);
-    }
-  }
+  lat_hist_add(&st->h.busy_wait[st->cmd], arm_timer_get_count() - start);
 }
-#endif
@@ -11,6 +11,7 @@
 #include <event.h>
 #include <printf.h>
 #include <os_api.h>
+#include <trace.h>
 #include <irq.h>
 #include <drivers/intc/intc_bcm2835.h>
 
@@ -633,6 +634,7 @@ void spi_isr(void)
   }
 
   /* Transfer is done */
+  trace_event(TRACE_EV_SPI_END, 0, 0);
   if (async)
     spi_transfer_done_async_isr(cs);
   else
@@ -644,6 +646,7 @@ static inline void OPTIMIZED spi_io_start(struct spi_io *io,
 {
   uint32_t cs;
 
+  trace_event(TRACE_EV_SPI_START, 0, count);
   io->num_bytes = count;
   io->tx = bytestream_tx;
   io->rx = bytestream_rx;
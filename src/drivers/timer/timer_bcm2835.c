@@ -24,6 +24,7 @@ struct bcm2835_systimer {
 };
 
 static struct bcm2835_systimer systimer1;
+static struct bcm2835_systimer systimer3;
 
 static void bcm2835_systimer_clear_irq_1()
 {
@@ -122,11 +123,48 @@ void __irq_routine bcm2835_systimer_irq_handler(void)
     systimer1.cb(systimer1.cb_arg);
 }
 
+void __irq_routine bcm2835_systimer3_irq_handler(void)
+{
+  bcm2835_systimer_clear_irq(3);
+  if (systimer3.cb)
+    systimer3.cb(systimer3.cb_arg);
+}
+
+void bcm2835_systimer3_start_at(uint32_t deadline_us, timer_callback_t cb,
+  void *cb_arg)
+{
+  int flags;
+
+  disable_irq_save_flags(flags);
+  bcm2835_systimer_info_set(&systimer3, cb, cb_arg, 0);
+  bcm2835_systimer_clear_irq(3);
+  ioreg32_write(BCM2835_SYSTIMER_C3, deadline_us);
+  restore_irq_flags(flags);
+}
+
+void bcm2835_systimer3_stop(void)
+{
+  int flags;
+
+  disable_irq_save_flags(flags);
+  bcm2835_systimer_info_reset(&systimer3);
+  bcm2835_systimer_clear_irq(3);
+  restore_irq_flags(flags);
+}
+
+uint32_t bcm2835_systimer_get_clo(void)
+{
+  return ioreg32_read(BCM2835_SYSTIMER_CLO);
+}
+
 void bcm2835_systimer_init(void)
 {
   bcm2835_systimer_info_reset(&systimer1);
+  bcm2835_systimer_info_reset(&systimer3);
   irq_set(BCM2835_IRQNR_SYSTIMER_1, bcm2835_systimer_irq_handler);
   bcm2835_ic_enable_irq(BCM2835_IRQNR_SYSTIMER_1);
+  irq_set(BCM2835_IRQNR_SYSTIMER_3, bcm2835_systimer3_irq_handler);
+  bcm2835_ic_enable_irq(BCM2835_IRQNR_SYSTIMER_3);
 }
 
 uint64_t bcm2835_systimer_get_time_us_locked(void)
@@ -2,6 +2,11 @@
 #include <drivers/gpio/gpio_bcm2835.h>
 #include <drivers/mbox/mbox_bcm2835_props.h>
 #include <drivers/gpio.h>
+#include <drivers/intc/intc_bcm2835.h>
+#include <irq.h>
+#include <os_api.h>
+#include <cpu.h>
+#include <common.h>
 #include <stdint.h>
 #include <assert.h>
 
@@ -30,6 +35,22 @@
 #define PL011_CR_RTSEN_POS 14
 #define PL011_CR_CTSEN_POS 15
 
+#define PL011_FR_BUSY (1<<3)
+#define PL011_FR_RXFE (1<<4)
+#define PL011_FR_TXFF (1<<5)
+
+#define PL011_IFLS_TXIFLSEL_POS 0
+#define PL011_IFLS_RXIFLSEL_POS 3
+#define PL011_IFLS_1_8 0
+#define PL011_IFLS_1_2 2
+
+#define PL011_INT_RX (1<<4)
+#define PL011_INT_TX (1<<5)
+#define PL011_INT_RT (1<<6)
+
+#define UART_TX_RING_SIZE 8192
+#define UART_RX_RING_SIZE 256
+
 
 typedef struct {
   uint32_t dr;
@@ -66,6 +87,42 @@ ASSERT_FIELD_OFFSET(regs_pl011, itcr, 0x80);
 
 #define pl011_uart ((regs_pl011 *)PL011_BASE)
 
+/*
+ * Transmit ring. Until uart_pl011_tx_irq_init, and again after
+ * uart_pl011_tx_sync, characters are written to the FIFO by polling. In
+ * interrupt mode send only copies to the ring and fills the FIFO, TX FIFO
+ * interrupt refills it when it drains to 1/8. Ring is only accessed with
+ * interrupts disabled.
+ */
+struct uart_tx {
+  bool irq_mode;
+  char ring[UART_TX_RING_SIZE];
+  int head;
+  int tail;
+  int count;
+  /* Free space, the sleeping writer waits for, 0 if nobody waits */
+  int space_wanted;
+  struct event space_event;
+};
+
+static struct uart_tx uart_tx = { 0 };
+
+/*
+ * Receive ring, filled by RX FIFO and RX timeout interrupts after
+ * uart_pl011_rx_irq_init. Characters, that do not fit, are dropped.
+ */
+struct uart_rx {
+  bool irq_mode;
+  char ring[UART_RX_RING_SIZE];
+  int head;
+  int tail;
+  int count;
+  uint32_t num_dropped;
+  struct event event;
+};
+
+static struct uart_rx uart_rx = { 0 };
+
 static void pl011_calc_divisor(int baudrate, uint64_t clock_hz, uint32_t *idiv, uint32_t *fdiv)
 {
   /* Calculate integral and fractional parts of divisor, using the formula
@@ -120,7 +177,10 @@ bool uart_pl011_init(int baudrate)
 
   pl011_uart->ibrd = idiv;
   pl011_uart->fbrd = fdiv;
-  pl011_uart->lcrh = (PL011_LCRH_WLEN_8BITS << PL011_LCRH_WLEN_POS);
+  pl011_uart->lcrh = (PL011_LCRH_WLEN_8BITS << PL011_LCRH_WLEN_POS)
+    | (1<<PL011_LCRH_FEN_POS);
+  pl011_uart->ifls = (PL011_IFLS_1_8 << PL011_IFLS_TXIFLSEL_POS)
+    | (PL011_IFLS_1_2 << PL011_IFLS_RXIFLSEL_POS);
   pl011_uart->icr = 0x7ff;
 
   pl011_uart->cr = (1<<PL011_CR_UARTEN_POS)
@@ -130,20 +190,193 @@ bool uart_pl011_init(int baudrate)
   return true;
 }
 
+static inline void uart_pl011_put_sync(char c)
+{
+  while(pl011_uart->fr & PL011_FR_TXFF);
+  pl011_uart->dr = c;
+}
+
+static inline char uart_tx_pop(void)
+{
+  char c = uart_tx.ring[uart_tx.tail];
+  uart_tx.tail = (uart_tx.tail + 1) % UART_TX_RING_SIZE;
+  uart_tx.count--;
+  return c;
+}
+
+/* Moves characters from ring to TX FIFO until it is full */
+static void uart_tx_fill_fifo(void)
+{
+  while(uart_tx.count && !(pl011_uart->fr & PL011_FR_TXFF))
+    pl011_uart->dr = uart_tx_pop();
+}
+
+static void uart_tx_push(char c)
+{
+  /*
+   * Callers, that can not sleep, may fill the ring, then the oldest
+   * characters are sent by polling to keep the order
+   */
+  if (uart_tx.count == UART_TX_RING_SIZE)
+    uart_pl011_put_sync(uart_tx_pop());
+
+  uart_tx.ring[uart_tx.head] = c;
+  uart_tx.head = (uart_tx.head + 1) % UART_TX_RING_SIZE;
+  uart_tx.count++;
+}
+
+static void uart_rx_drain_fifo(void)
+{
+  char c;
+
+  while(!(pl011_uart->fr & PL011_FR_RXFE)) {
+    c = pl011_uart->dr;
+    if (uart_rx.count == UART_RX_RING_SIZE) {
+      uart_rx.num_dropped++;
+      continue;
+    }
+
+    uart_rx.ring[uart_rx.head] = c;
+    uart_rx.head = (uart_rx.head + 1) % UART_RX_RING_SIZE;
+    uart_rx.count++;
+  }
+}
+
+static void __irq_routine uart_pl011_irq(void)
+{
+  uint32_t mis = pl011_uart->mis;
+
+  if (mis & (PL011_INT_RX | PL011_INT_RT)) {
+    pl011_uart->icr = PL011_INT_RX | PL011_INT_RT;
+    uart_rx_drain_fifo();
+    if (uart_rx.count)
+      os_event_notify_isr(&uart_rx.event);
+  }
+
+  if (mis & PL011_INT_TX) {
+    pl011_uart->icr = PL011_INT_TX;
+    uart_tx_fill_fifo();
+    if (uart_tx.space_wanted
+      && UART_TX_RING_SIZE - uart_tx.count >= uart_tx.space_wanted) {
+      uart_tx.space_wanted = 0;
+      os_event_notify_isr(&uart_tx.space_event);
+    }
+  }
+}
+
 int uart_pl011_send(const void *buf, int num)
 {
+  int irqflags;
   const char *ptr = buf;
-  while(*ptr) {
-    while(pl011_uart->fr & (1<<3));
-    pl011_uart->dr = *ptr++;
+
+  if (!uart_tx.irq_mode) {
+    while(*ptr)
+      uart_pl011_put_sync(*ptr++);
+    return ptr - (const char *)buf;
   }
+
+  disable_irq_save_flags(irqflags);
+  while(*ptr)
+    uart_tx_push(*ptr++);
+  uart_tx_fill_fifo();
+  restore_irq_flags(irqflags);
   return ptr - (const char *)buf;
 }
 
 void uart_pl011_send_char(char c)
 {
-  while(pl011_uart->fr & (1<<3));
-  pl011_uart->dr = c;
+  int irqflags;
+
+  if (!uart_tx.irq_mode) {
+    uart_pl011_put_sync(c);
+    return;
+  }
+
+  disable_irq_save_flags(irqflags);
+  uart_tx_push(c);
+  uart_tx_fill_fifo();
+  restore_irq_flags(irqflags);
+}
+
+void uart_pl011_tx_irq_init(void)
+{
+  os_event_init(&uart_tx.space_event);
+  irq_set(BCM2835_IRQNR_UART0, uart_pl011_irq);
+  pl011_uart->icr = PL011_INT_TX;
+  pl011_uart->imsc |= PL011_INT_TX;
+  uart_tx.irq_mode = true;
+  bcm2835_ic_enable_irq(BCM2835_IRQNR_UART0);
+}
+
+void uart_pl011_tx_wait_space(int len)
+{
+  int irqflags;
+
+  len = MIN(len, UART_TX_RING_SIZE);
+
+  disable_irq_save_flags(irqflags);
+  while (uart_tx.irq_mode && UART_TX_RING_SIZE - uart_tx.count < len) {
+    uart_tx.space_wanted = len;
+    os_event_clear(&uart_tx.space_event);
+    restore_irq_flags(irqflags);
+    os_event_wait(&uart_tx.space_event);
+    disable_irq_save_flags(irqflags);
+  }
+  restore_irq_flags(irqflags);
+}
+
+void uart_pl011_tx_sync(void)
+{
+  int irqflags;
+
+  disable_irq_save_flags(irqflags);
+  uart_tx.irq_mode = false;
+  pl011_uart->imsc &= ~PL011_INT_TX;
+  while(uart_tx.count)
+    uart_pl011_put_sync(uart_tx_pop());
+  restore_irq_flags(irqflags);
+}
+
+void uart_pl011_rx_irq_init(void)
+{
+  int irqflags;
+
+  disable_irq_save_flags(irqflags);
+  os_event_init(&uart_rx.event);
+  irq_set(BCM2835_IRQNR_UART0, uart_pl011_irq);
+  uart_rx_drain_fifo();
+  pl011_uart->icr = PL011_INT_RX | PL011_INT_RT;
+  pl011_uart->imsc |= PL011_INT_RX | PL011_INT_RT;
+  uart_rx.irq_mode = true;
+  bcm2835_ic_enable_irq(BCM2835_IRQNR_UART0);
+  restore_irq_flags(irqflags);
+}
+
+uint32_t uart_pl011_rx_num_dropped(void)
+{
+  return uart_rx.num_dropped;
+}
+
+static int uart_pl011_recv_irq(char *ptr, int num)
+{
+  int irqflags;
+  int i;
+
+  disable_irq_save_flags(irqflags);
+  while (!uart_rx.count) {
+    os_event_clear(&uart_rx.event);
+    restore_irq_flags(irqflags);
+    os_event_wait(&uart_rx.event);
+    disable_irq_save_flags(irqflags);
+  }
+
+  for (i = 0; i < num && uart_rx.count; ++i) {
+    ptr[i] = uart_rx.ring[uart_rx.tail];
+    uart_rx.tail = (uart_rx.tail + 1) % UART_RX_RING_SIZE;
+    uart_rx.count--;
+  }
+  restore_irq_flags(irqflags);
+  return i;
 }
 
 int uart_pl011_recv(void *buf, int num)
@@ -151,9 +384,12 @@ int uart_pl011_recv(void *buf, int num)
   int i;
   char *ptr = buf;
 
+  if (uart_rx.irq_mode)
+    return uart_pl011_recv_irq(ptr, num);
+
   for (i = 0; i < num; ++i) {
-    while(pl011_uart->fr & (1<<4));
-    *ptr = pl011_uart->dr;
+    while(pl011_uart->fr & PL011_FR_RXFE);
+    ptr[i] = pl011_uart->dr;
   }
   return num;
 }
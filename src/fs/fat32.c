@@ -1167,17 +1167,24 @@ static int fat_find_child_by_name(const struct fat32_fs *fs,
 typedef fat_iter_fat_sectors_result (*fat_iter_fat_sectors_cb)(
   const struct fat32_fs *fs, size_t sector_idx, void *arg);
 
-static void fat_iter_fat_sectors(const struct fat32_fs *fs,
+/*
+ * Iterates FAT sectors starting from sector 'first' relative to FAT start,
+ * wraps around to FAT start after the last one
+ */
+static void fat_iter_fat_sectors(const struct fat32_fs *fs, size_t first,
   fat_iter_fat_sectors_cb cb, void *arg)
 {
   size_t i;
-  size_t sector_idx_fat_start, sector_idx_fat_end;
+  size_t sector_idx_fat_start;
+  const size_t num_sectors = fat32_get_sectors_per_fat(fs);
 
   sector_idx_fat_start = fat32_get_num_reserved_sectors(fs);
-  sector_idx_fat_end = sector_idx_fat_start + fat32_get_sectors_per_fat(fs);
+  if (first >= num_sectors)
+    first = 0;
 
-  for (i = sector_idx_fat_start; i < sector_idx_fat_end; ++i) {
-    if (cb(fs, i, arg) == FAT_ITER_FAT_SECTORS_STOP)
+  for (i = 0; i < num_sectors; ++i) {
+    if (cb(fs, sector_idx_fat_start + (first + i) % num_sectors, arg)
+      == FAT_ITER_FAT_SECTORS_STOP)
       break;
   }
 }
@@ -1202,7 +1209,9 @@ static void fat_iter_fat_sectors(const struct fat32_fs *fs,
  * fat_alloc_file_cluster grows cluster of chain by 1, exactly:
  * 1. follows the cluster chain staring from cluster 'cluster_idx'
  *    until end of cluster chain is reached (cluster marked with 0xffffffff)
- * 2. it then scans FAT by looking for the first cluster entry marked with 0
+ * 2. it then scans FAT by looking for the first cluster entry marked with 0,
+ *    starting from FAT sector of 'cluster_idx', so that files growing
+ *    cluster by cluster do not rescan the FAT sectors they have filled
  * 3  then marks newly allocated cluster as end of cluster chain by writing
  *    0xffffffff to its entry.
  * 4. It then modifies last cluster entry, previously marked with 0xffffffff,
@@ -1302,7 +1311,8 @@ static int fat_alloc_file_cluster(const struct fat32_fs *fs,
   ctx.prev_last_cluster_idx = cluster_idx;
   ctx.new_last_cluster_idx = 0xffffffff;
 
-  fat_iter_fat_sectors(fs, fat_extend_cluster_chain_fn, &ctx);
+  fat_iter_fat_sectors(fs, cluster_idx / fat32_entries_per_fat_sector(fs),
+    fat_extend_cluster_chain_fn, &ctx);
   if (ctx.err != SUCCESS || ctx.new_last_cluster_idx == 0xffffffff)
     printf("Failed to find free cluster in FAT\n");
   else
@@ -1977,6 +1987,7 @@ int fat32_write(const struct fat32_fs *fs, const char *filepath, size_t offset,
   size_t size_left = size;
   size_t new_cluster_idx;
   size_t io_size;
+  size_t file_size;
   const uint8_t *src = data;
   err = fat32_lookup(fs, filepath, &f.loc, &f.d);
   if (err != SUCCESS) {
@@ -1985,6 +1996,8 @@ int fat32_write(const struct fat32_fs *fs, const char *filepath, size_t offset,
     return err;
   }
 
+  file_size = fat32_get_file_size(&f.d);
+
   fat_file_pos_init(&f.pos);
   err = fat_file_pos_advance(&f, offset);
   if (err != SUCCESS && err != ERR_OUT_OF_RANGE) {
@@ -2032,9 +2045,136 @@ int fat32_write(const struct fat32_fs *fs, const char *filepath, size_t offset,
     }
   }
 
+  /* Position past the last cluster after writing up to its end is fine */
+  if (err == ERR_OUT_OF_RANGE)
+    err = SUCCESS;
+
+  /* Appending writes grow the file */
+  if (offset + size > file_size) {
+    err = fat_dir_entry_mod(fs, &f.loc, fat32_dentry_get_cluster(&f.d),
+      offset + size);
+    if (err != SUCCESS)
+      printf("fat32_write: failed to update file size %d\r\n", err);
+  }
+
+  return err;
+}
+
+static bool fat_append_last_cluster_fn(const struct fat32_fs *fs,
+  size_t cluster_idx, void *arg)
+{
+  struct fat32_append *a = arg;
+
+  a->last_cluster = cluster_idx;
+  a->num_clusters++;
+  return true;
+}
+
+int fat32_append_open(struct fat32_append *a, const struct fat32_fs *fs,
+  const char *filepath)
+{
+  int err;
+  struct fat_dentry d;
+
+  err = fat32_lookup(fs, filepath, &a->loc, &d);
+  if (err != SUCCESS) {
+    printf("fat32_append_open: failed to lookup file %s, %d\r\n",
+      filepath, err);
+    return err;
+  }
+
+  a->fs = fs;
+  a->first_cluster = fat32_dentry_get_cluster(&d);
+  a->last_cluster = 0;
+  a->num_clusters = 0;
+  a->size = fat32_dentry_get_file_size(&d);
+  a->synced_size = a->size;
+
+  /* Chain is walked once here, appends continue from its last cluster */
+  if (a->first_cluster) {
+    err = fat_foreach_cluster(fs, a->first_cluster,
+      fat_append_last_cluster_fn, a);
+    if (err != SUCCESS)
+      printf("fat32_append_open: failed to walk cluster chain %d\r\n", err);
+  }
+
   return err;
 }
 
+int fat32_append_write(struct fat32_append *a, const void *data, size_t size)
+{
+  int err;
+  struct fat_file_pos pos;
+  size_t new_cluster_idx;
+  size_t io_size;
+  size_t in_cluster_offset;
+  size_t num_sectors;
+  const uint8_t *src = data;
+  const struct fat32_fs *fs = a->fs;
+  const size_t bytes_per_cluster = fat32_bytes_per_cluster(fs);
+  const size_t sector_size = fat32_sector_size(fs);
+
+  while (size) {
+    if (a->size == a->num_clusters * bytes_per_cluster) {
+      err = fat_alloc_file_cluster(fs, a->last_cluster, &new_cluster_idx);
+      if (err != SUCCESS) {
+        printf("fat32_append_write: failed to allocate cluster\r\n");
+        return err;
+      }
+
+      if (!a->first_cluster)
+        a->first_cluster = new_cluster_idx;
+      a->last_cluster = new_cluster_idx;
+      a->num_clusters++;
+    }
+
+    in_cluster_offset = a->size % bytes_per_cluster;
+    pos.pos = a->size;
+    pos.cluster_idx = a->last_cluster;
+    pos.sector_idx = in_cluster_offset / sector_size;
+    pos.sector_offset = in_cluster_offset % sector_size;
+
+    /* Whole sectors up to the end of cluster go in one request */
+    io_size = MIN(size, bytes_per_cluster - in_cluster_offset);
+    num_sectors = io_size / sector_size;
+    if (!pos.sector_offset && num_sectors) {
+      io_size = num_sectors * sector_size;
+      err = fs->bdev->ops.write(fs->bdev, src,
+        fat32_cluster_to_sector_idx(fs, pos.cluster_idx) + pos.sector_idx,
+        num_sectors);
+      if (err < 0)
+        printf("fat32_append_write: error write sector, err: %d\r\n", err);
+    } else
+      err = fat32_write_one_sect(fs, &pos, src, size, &io_size);
+
+    if (err != SUCCESS)
+      return err;
+
+    a->size += io_size;
+    src += io_size;
+    size -= io_size;
+  }
+
+  return SUCCESS;
+}
+
+int fat32_append_sync(struct fat32_append *a)
+{
+  int err;
+
+  if (a->size == a->synced_size)
+    return SUCCESS;
+
+  err = fat_dir_entry_mod(a->fs, &a->loc, a->first_cluster, a->size);
+  if (err != SUCCESS) {
+    printf("fat32_append_sync: failed to update file size %d\r\n", err);
+    return err;
+  }
+
+  a->synced_size = a->size;
+  return SUCCESS;
+}
+
 void fat32_init(void)
 {
   fat_scratchbuf_mask = 0;
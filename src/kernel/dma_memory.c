@@ -5,6 +5,7 @@
 #include <stringlib.h>
 #include <log.h>
 #include <cpu.h>
+#include <printf.h>
 #include <list.h>
 
 struct dma_mem_header {
@@ -19,6 +20,8 @@ struct dma_mem_area {
   int num_chunks;
   struct list_head free_list;
   struct list_head busy_list;
+  int num_busy;
+  int max_busy;
 };
 
 #undef DEBUG_DMA_ALLOC
@@ -182,6 +185,8 @@ void *dma_alloc(size_t sz, bool zero)
   c = list_first_entry(&a->free_list, struct dma_mem_header, list);
   list_del(&c->list);
   list_add_tail(&c->list, &a->busy_list);
+  if (++a->num_busy > a->max_busy)
+    a->max_busy = a->num_busy;
 
   if (zero)
     memset(c->addr, 0, sz);
@@ -197,6 +202,7 @@ void dma_free(void *addr)
   BUG_IF(!c, "Failed to find chunk by given address");
   list_del(&c->list);
   list_add_tail(&c->list, &a->free_list);
+  a->num_busy--;
 }
 
 void OPTIMIZED dma_memory_init(void)
@@ -219,6 +225,8 @@ void OPTIMIZED dma_memory_init(void)
 
     INIT_LIST_HEAD(&ca->free_list);
     INIT_LIST_HEAD(&ca->busy_list);
+    ca->num_busy = 0;
+    ca->max_busy = 0;
 
     c = ca->chunks_table;
     c_end = c + ca->num_chunks;
@@ -237,3 +245,16 @@ void OPTIMIZED dma_memory_init(void)
   t = get_boottime_msec() - t;
   os_log("dma_memory_init complete. took %lldms"__endline, t);
 }
+
+void dma_memory_print_stats(void)
+{
+  struct dma_mem_area *a;
+  size_t i;
+
+  printf("dma_alloc chunk_size used/total max_used\r\n");
+  for (i = 0; i < ARRAY_SIZE(dma_chunk_areas); ++i) {
+    a = &dma_chunk_areas[i];
+    printf("%20d %d/%d %d\r\n", 1 << a->chunk_sz_log, a->num_busy,
+      a->num_chunks, a->max_busy);
+  }
+}
@@ -4,13 +4,35 @@
 #include <common.h>
 #include <sections.h>
 #include <sched_mon.h>
+#include <trace.h>
+#include <cpu.h>
+#include <printf.h>
+#include <ioreg.h>
+#include <memory_map.h>
+
+/* Interrupt enable registers of core 0 local sources */
+#define LOCAL_TIMER_CTRL      ((ioreg32_t)(LOCAL_PERIPH_ADDR_START + 0x34))
+#define LOCAL_TIMER_CTRL_INT_EN (1 << 29)
+#define LOCAL_CORE0_TIMER_INT ((ioreg32_t)(LOCAL_PERIPH_ADDR_START + 0x40))
+#define LOCAL_CORE0_MBOX_INT  ((ioreg32_t)(LOCAL_PERIPH_ADDR_START + 0x50))
+#define LOCAL_PMU_ROUTING_CLR ((ioreg32_t)(LOCAL_PERIPH_ADDR_START + 0x14))
+#define LOCAL_AXI_CTRL        ((ioreg32_t)(LOCAL_PERIPH_ADDR_START + 0x2c))
+#define LOCAL_AXI_CTRL_INT_EN (1 << 20)
 
 struct irq_desc {
   irq_func handler;
 };
 
 static BSS_NOMMU struct irq_desc irq_table[NUM_IRQS];
-BSS_NOMMU struct irq_desc irq_local;
+static BSS_NOMMU struct irq_desc irq_local_table[NUM_IRQS_LOCAL];
+
+static struct irq_stats irq_stats[NUM_IRQS];
+
+/* Count includes sources without handler, that were masked */
+static struct irq_stats irq_local_stats[NUM_IRQS_LOCAL];
+
+/* Sum of time in all handlers, scheduler subtracts it from task run time */
+uint64_t irq_total_time;
 
 int irq_set(int irqnr, irq_func func)
 {
@@ -33,9 +55,13 @@ int irq_set(int irqnr, irq_func func)
 EXCEPTION void __handle_irq(int irqnr)
 {
   struct irq_desc *idesc;
+  struct irq_stats *st;
+  uint64_t t0, dt;
 
+  t0 = arm_timer_get_count();
   sched_mon_set_irq_handler_start(irqnr);
-  if (irqnr > NUM_IRQS)
+  trace_event(TRACE_EV_IRQ_ENTER, irqnr, 0);
+  if (irqnr >= NUM_IRQS)
     panic();
 
   idesc = &irq_table[irqnr];
@@ -43,15 +69,125 @@ EXCEPTION void __handle_irq(int irqnr)
   if (idesc->handler)
     idesc->handler();
 
+  trace_event(TRACE_EV_IRQ_EXIT, irqnr, 0);
   sched_mon_set_irq_handler_end(irqnr);
+
+  dt = arm_timer_get_count() - t0;
+  st = &irq_stats[irqnr];
+  st->count++;
+  st->time += dt;
+  if (dt > st->max_time)
+    st->max_time = dt;
+  irq_total_time += dt;
 }
 
-int irq_local_set(irq_func func)
+/* Source without handler would fire again right after return */
+static EXCEPTION void irq_local_mask(int source)
 {
-  struct irq_desc *local;
+  ioreg32_t reg;
+  uint32_t bit;
+
+  if (source <= IRQ_LOCAL_CNTV) {
+    reg = LOCAL_CORE0_TIMER_INT;
+    bit = 1 << source;
+  } else if (source < IRQ_LOCAL_GPU) {
+    reg = LOCAL_CORE0_MBOX_INT;
+    bit = 1 << (source - IRQ_LOCAL_MAILBOX0);
+  } else if (source == IRQ_LOCAL_PMU) {
+    ioreg32_write(LOCAL_PMU_ROUTING_CLR, 1);
+    return;
+  } else if (source == IRQ_LOCAL_AXI) {
+    reg = LOCAL_AXI_CTRL;
+    bit = LOCAL_AXI_CTRL_INT_EN;
+  } else if (source == IRQ_LOCAL_TIMER) {
+    reg = LOCAL_TIMER_CTRL;
+    bit = LOCAL_TIMER_CTRL_INT_EN;
+  } else
+    return;
+
+  ioreg32_write(reg, ioreg32_read(reg) & ~bit);
+}
+
+EXCEPTION void __handle_irq_local(uint32_t sources)
+{
+  int source;
+  struct irq_desc *idesc;
+  struct irq_stats *st;
+  uint64_t t0, dt;
+
+  sources &= ~(1 << IRQ_LOCAL_GPU);
+  while (sources) {
+    source = __builtin_ctz(sources);
+    sources &= ~(1 << source);
+    if (source >= NUM_IRQS_LOCAL)
+      continue;
+
+    t0 = arm_timer_get_count();
+    idesc = &irq_local_table[source];
+    if (source == IRQ_LOCAL_PMU && idesc->handler)
+      idesc->handler();
+    else
+      irq_local_mask(source);
+
+    dt = arm_timer_get_count() - t0;
+    st = &irq_local_stats[source];
+    st->count++;
+    st->time += dt;
+    if (dt > st->max_time)
+      st->max_time = dt;
+    irq_total_time += dt;
+  }
+}
+
+void irq_get_stats(int irqnr, struct irq_stats *s)
+{
+  int flags;
+
+  disable_irq_save_flags(flags);
+  *s = irq_stats[irqnr];
+  restore_irq_flags(flags);
+}
+
+void irq_print_stats(void)
+{
+  int i;
+  int flags;
+  struct irq_stats s;
+  uint32_t freq = arm_timer_get_freq();
+
+  printf("irq      count    total_us   max_us\r\n");
+  for (i = 0; i < NUM_IRQS; ++i) {
+    irq_get_stats(i, &s);
+    if (!s.count)
+      continue;
+    printf("%3d %10u %11lu %8lu\r\n", i, s.count, s.time * 1000000 / freq,
+      s.max_time * 1000000 / freq);
+  }
+
+  for (i = 0; i < NUM_IRQS_LOCAL; ++i) {
+    disable_irq_save_flags(flags);
+    s = irq_local_stats[i];
+    restore_irq_flags(flags);
+    if (!s.count)
+      continue;
+    printf("l%2d %10u %11lu %8lu%s\r\n", i, s.count,
+      s.time * 1000000 / freq, s.max_time * 1000000 / freq,
+      irq_local_table[i].handler ? "" : " masked");
+  }
+}
+
+int irq_local_set(int source, irq_func func)
+{
+  struct irq_desc *table;
+
+  if (source != IRQ_LOCAL_PMU)
+    return ERR_INVAL;
+
+  asm volatile ("ldr %0, =irq_local_table\n" :"=r"(table));
+  if (table[source].handler)
+    return ERR_BUSY;
 
-  asm volatile ("ldr %0, =irq_table\n" :"=r"(local));
-  local->handler = func;
+  table[source].handler = func;
   return SUCCESS;
 }
 
@@ -61,7 +197,10 @@ void irq_init(void)
   struct irq_desc *local;
 
   asm volatile ("ldr %0, =irq_table\n" :"=r"(table));
-  asm volatile ("ldr %0, =irq_local\n" :"=r"(local));
+  asm volatile ("ldr %0, =irq_local_table\n" :"=r"(local));
   memset(table, 0, sizeof(irq_table));
-  local->handler = 0;
+  memset(local, 0, sizeof(irq_local_table));
+  memset(irq_stats, 0, sizeof(irq_stats));
+  memset(irq_local_stats, 0, sizeof(irq_local_stats));
+  irq_total_time = 0;
 }
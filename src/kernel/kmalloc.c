@@ -5,6 +5,7 @@
 #include <common.h>
 #include <bitmap.h>
 #include <stringlib.h>
+#include <printf.h>
 
 extern char __kernel_memory_start;
 extern char __kernel_memory_end;
@@ -160,3 +161,16 @@ void kmalloc_init(void)
     prev_d = d;
   }
 }
+
+void kmalloc_print_stats(void)
+{
+  int i;
+  struct kmalloc_descriptor *d;
+
+  printf("kmalloc chunk_size used/total\r\n");
+  for (i = 0; i < ARRAY_SIZE(kmalloc_all_descriptors); ++i) {
+    d = kmalloc_all_descriptors[i];
+    printf("%18d %d/%ld\r\n", 1 << d->chunk_size_log,
+      bitmap_count_set(&d->bitmap), d->bitmap.num_entries);
+  }
+}
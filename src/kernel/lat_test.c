@@ -0,0 +1,375 @@
+#include <lat_test.h>
+#include <drivers/timer/timer_bcm2835.h>
+#include <drivers/display/display_ili9341.h>
+#include <block_device.h>
+#include <os_api.h>
+#include <task.h>
+#include <kmalloc.h>
+#include <logger.h>
+#include <cpu.h>
+#include <errcode.h>
+#include <common.h>
+#include <printf.h>
+#include <string.h>
+#include <irq.h>
+
+#define LAT_TEST_SD_BUF_SECTORS 32
+#define LAT_TEST_LOG_BURST 32
+
+/* Deadline closer than that to current time is treated as missed */
+#define LAT_TEST_MIN_ARM_US 2
+
+/* Watchdog fails the test, if timer did not fire for that many periods */
+#define LAT_TEST_WDOG_PERIODS 16
+#define LAT_TEST_WDOG_MIN_MS 100
+#define LAT_TEST_WDOG_POLL_MS 10
+
+struct lat_test {
+  const struct lat_test_cfg *cfg;
+  struct lat_test_result *r;
+  struct event ev;
+
+  /* Arm timer count and systimer value, sampled at the same time */
+  uint64_t cnt0;
+  uint32_t clo0;
+  uint32_t freq;
+
+  /* Timer interrupt state */
+  bool running;
+  uint32_t deadline;
+  uint64_t fired_target;
+  volatile uint32_t fired_seq;
+  volatile bool timed_out;
+
+  /* Load tasks state */
+  volatile bool stop_load;
+  volatile int num_loads;
+  uint8_t *sd_buf;
+};
+
+static struct lat_test lat_test;
+
+static inline uint64_t lat_test_deadline_to_count(uint32_t deadline)
+{
+  return lat_test.cnt0 + (uint64_t)(deadline - lat_test.clo0)
+    * lat_test.freq / 1000000;
+}
+
+static inline uint64_t lat_test_count_to_ns(uint64_t count)
+{
+  return count * 1000000000 / lat_test.freq;
+}
+
+static void lat_test_timer_cb(void *arg);
+
+/* Called with interrupts disabled */
+static void lat_test_arm_next(void)
+{
+  uint32_t period = lat_test.cfg->period_us;
+
+  lat_test.deadline += period;
+  while (1) {
+    while ((int32_t)(bcm2835_systimer_get_clo() - lat_test.deadline)
+      > -LAT_TEST_MIN_ARM_US) {
+      lat_test.deadline += period;
+      lat_test.r->num_missed++;
+    }
+
+    bcm2835_systimer3_start_at(lat_test.deadline, lat_test_timer_cb, NULL);
+
+    /*
+     * Compare only matches on equality, deadline passed while arming would
+     * only match after counter wraps, so count it as missed and re-arm.
+     */
+    if ((int32_t)(bcm2835_systimer_get_clo() - lat_test.deadline) < 0)
+      break;
+
+    bcm2835_systimer3_stop();
+    lat_test.deadline += period;
+    lat_test.r->num_missed++;
+  }
+}
+
+static void __irq_routine lat_test_timer_cb(void *arg)
+{
+  uint64_t now = arm_timer_get_count();
+  uint64_t target = lat_test_deadline_to_count(lat_test.deadline);
+
+  lat_hist_add(&lat_test.r->irq, now > target ? now - target : 0);
+  lat_test.fired_target = target;
+  lat_test.fired_seq++;
+  os_event_notify_isr(&lat_test.ev);
+
+  if (lat_test.running)
+    lat_test_arm_next();
+}
+
+static void lat_test_load_exit(void)
+{
+  int irqflags;
+
+  disable_irq_save_flags(irqflags);
+  lat_test.num_loads--;
+  restore_irq_flags(irqflags);
+  os_exit_current_task();
+}
+
+static void lat_test_sd_load_fn(void)
+{
+  const struct lat_test_cfg *cfg = lat_test.cfg;
+  struct block_device *bdev = cfg->sd_bdev;
+  uint32_t pos = 0;
+  uint32_t n;
+  int err;
+
+  while (!lat_test.stop_load) {
+    n = MIN(cfg->sd_num_sectors - pos, LAT_TEST_SD_BUF_SECTORS);
+    err = bdev->ops.write(bdev, lat_test.sd_buf, cfg->sd_start_sector + pos,
+      n);
+    if (err != SUCCESS) {
+      printf("lat_test: sd write failed at %lu, err: %d\r\n",
+        cfg->sd_start_sector + pos, err);
+      break;
+    }
+
+    lat_test.r->num_sd_writes++;
+    pos += n;
+    if (pos == cfg->sd_num_sectors)
+      pos = 0;
+  }
+
+  lat_test_load_exit();
+}
+
+static void lat_test_display_load_fn(void)
+{
+  struct ili9341_per_frame_dma *buf;
+
+  while (!lat_test.stop_load) {
+    buf = ili9341_frame_acquire(lat_test.cfg->display);
+    if (!buf) {
+      os_wait_ms(10);
+      continue;
+    }
+
+    ili9341_frame_submit(buf, 0);
+    lat_test.r->num_display_frames++;
+    os_yield();
+  }
+
+  lat_test_load_exit();
+}
+
+static void lat_test_logger_load_fn(void)
+{
+  uint32_t n = 0;
+
+  while (!lat_test.stop_load) {
+    os_log("lat_test: logger flood %u\r\n", n++);
+    if (!(n % LAT_TEST_LOG_BURST))
+      os_yield();
+  }
+
+  lat_test.r->num_log_records = n;
+  lat_test_load_exit();
+}
+
+/*
+ * There is no event wait with timeout, so if timer stops firing, watchdog
+ * wakes measuring task up instead.
+ */
+static void lat_test_wdog_fn(void)
+{
+  int irqflags;
+  uint32_t seq = 0;
+  uint32_t idle_ms = 0;
+  uint32_t timeout_ms;
+
+  timeout_ms = lat_test.cfg->period_us * LAT_TEST_WDOG_PERIODS / 1000;
+  timeout_ms = MAX(timeout_ms, LAT_TEST_WDOG_MIN_MS);
+
+  while (!lat_test.stop_load) {
+    os_wait_ms(LAT_TEST_WDOG_POLL_MS);
+    if (!lat_test.running || lat_test.fired_seq != seq) {
+      seq = lat_test.fired_seq;
+      idle_ms = 0;
+      continue;
+    }
+
+    idle_ms += LAT_TEST_WDOG_POLL_MS;
+    if (idle_ms >= timeout_ms) {
+      disable_irq_save_flags(irqflags);
+      lat_test.timed_out = true;
+      os_event_notify(&lat_test.ev);
+      restore_irq_flags(irqflags);
+      break;
+    }
+  }
+
+  lat_test_load_exit();
+}
+
+static int lat_test_start_load(task_fn fn, const char *name,
+  size_t stack_size)
+{
+  struct task *t;
+
+  t = task_create_ext(fn, name, stack_size);
+  if (!t)
+    return ERR_MEMALLOC;
+
+  lat_test.num_loads++;
+  os_schedule_task(t);
+  return SUCCESS;
+}
+
+static void lat_test_stop_loads(void)
+{
+  lat_test.stop_load = true;
+  while (lat_test.num_loads)
+    os_wait_ms(10);
+}
+
+static int lat_test_start_loads(const struct lat_test_cfg *cfg)
+{
+  int err;
+
+  lat_test.stop_load = false;
+  lat_test.num_loads = 0;
+
+  err = lat_test_start_load(lat_test_wdog_fn, "lat_wdog",
+    TASK_STACK_SIZE_MIN);
+  if (err != SUCCESS)
+    return err;
+
+  if (cfg->sd_bdev && cfg->sd_num_sectors) {
+    lat_test.sd_buf = dma_alloc(LAT_TEST_SD_BUF_SECTORS * 512, true);
+    if (!lat_test.sd_buf)
+      return ERR_MEMALLOC;
+
+    err = lat_test_start_load(lat_test_sd_load_fn, "lat_sd",
+      TASK_STACK_SIZE_DEFAULT);
+    if (err != SUCCESS)
+      return err;
+  }
+
+  if (cfg->display) {
+    err = lat_test_start_load(lat_test_display_load_fn, "lat_display",
+      TASK_STACK_SIZE_MIN);
+    if (err != SUCCESS)
+      return err;
+  }
+
+  if (cfg->logger_flood) {
+    err = lat_test_start_load(lat_test_logger_load_fn, "lat_logger",
+      TASK_STACK_SIZE_MIN);
+    if (err != SUCCESS)
+      return err;
+  }
+
+  return SUCCESS;
+}
+
+int lat_test_run(const struct lat_test_cfg *cfg, struct lat_test_result *r)
+{
+  int err;
+  int irqflags;
+  uint32_t i;
+  uint32_t seq = 0;
+  uint64_t now;
+  uint64_t target;
+  uint64_t max_wakeup;
+
+  if (!cfg->period_us || !cfg->num_periods
+    || cfg->period_us <= LAT_TEST_MIN_ARM_US)
+    return ERR_INVAL;
+
+  memset(r, 0, sizeof(*r));
+  memset(&lat_test, 0, sizeof(lat_test));
+  lat_test.cfg = cfg;
+  lat_test.r = r;
+  lat_test.freq = arm_timer_get_freq();
+  os_event_init(&lat_test.ev);
+
+  err = lat_test_start_loads(cfg);
+  if (err != SUCCESS)
+    goto out;
+
+  /* Let load tasks get going */
+  os_wait_ms(50);
+
+  disable_irq_save_flags(irqflags);
+  lat_test.clo0 = bcm2835_systimer_get_clo();
+  lat_test.cnt0 = arm_timer_get_count();
+  lat_test.deadline = lat_test.clo0;
+  lat_test.running = true;
+  lat_test_arm_next();
+  restore_irq_flags(irqflags);
+
+  for (i = 0; i < cfg->num_periods; ++i) {
+    os_event_wait(&lat_test.ev);
+    now = arm_timer_get_count();
+    if (lat_test.timed_out) {
+      printf("lat_test: timer did not fire after %u periods\r\n", i);
+      err = ERR_TIMEOUT;
+      break;
+    }
+
+    disable_irq_save_flags(irqflags);
+    os_event_clear(&lat_test.ev);
+    target = lat_test.fired_target;
+    r->num_overruns += lat_test.fired_seq - seq - 1;
+    seq = lat_test.fired_seq;
+    restore_irq_flags(irqflags);
+
+    lat_hist_add(&r->wakeup, now > target ? now - target : 0);
+  }
+
+  disable_irq_save_flags(irqflags);
+  lat_test.running = false;
+  bcm2835_systimer3_stop();
+  restore_irq_flags(irqflags);
+
+  max_wakeup = lat_test_count_to_ns(r->wakeup.max) / 1000;
+  if (err == SUCCESS && cfg->max_wakeup_us
+    && max_wakeup > cfg->max_wakeup_us)
+    err = ERR_TIMEOUT;
+
+out:
+  lat_test_stop_loads();
+  if (lat_test.sd_buf) {
+    dma_free(lat_test.sd_buf);
+    lat_test.sd_buf = NULL;
+  }
+  return err;
+}
+
+static void lat_test_print_hist(const char *name, const struct lat_hist *h)
+{
+  uint64_t avg = h->count ? h->sum / h->count : 0;
+
+  printf("%10lu %10lu %10lu %10lu %s\r\n", lat_test_count_to_ns(h->min),
+    lat_test_count_to_ns(avg),
+    lat_test_count_to_ns(lat_hist_percentile(h, 99)),
+    lat_test_count_to_ns(h->max), name);
+}
+
+void lat_test_print(const struct lat_test_cfg *cfg,
+  const struct lat_test_result *r, int err)
+{
+  lat_test.freq = arm_timer_get_freq();
+
+  printf("lat_test: %u periods of %u us, missed: %u, overruns: %u\r\n",
+    r->wakeup.count, cfg->period_us, r->num_missed, r->num_overruns);
+  printf("lat_test: load sd writes: %u, display frames: %u, log records: %u"
+    "\r\n", r->num_sd_writes, r->num_display_frames, r->num_log_records);
+  printf("    min_ns     avg_ns     p99_ns     max_ns\r\n");
+  lat_test_print_hist("irq", &r->irq);
+  lat_test_print_hist("wakeup", &r->wakeup);
+
+  if (err == SUCCESS)
+    printf("LAT-TEST: PASS\r\n");
+  else
+    printf("LAT-TEST: FAIL err: %d, max wakeup limit: %u us\r\n", err,
+      cfg->max_wakeup_us);
+}
@@ -15,6 +15,10 @@
 #include <sections.h>
 #include <errcode.h>
 #include <logger.h>
+#include <trace.h>
+#include <prof.h>
+#include <shell.h>
+#include <lat_test.h>
 #include <config.h>
 
 EXCEPTION void fiq_handler(void)
@@ -88,12 +92,19 @@ static void kernel_init(void)
   print_mbox_props();
   bcm2835_report_clocks();
   irq_init();
+  trace_init();
+  err = prof_init();
+  if (err != SUCCESS) {
+    printf("Failed to init profiler, err: %d\r\n", err);
+    goto out;
+  }
   bcm2835_systimer_init();
   irq_disable();
   mem_allocator_init();
   scheduler_init();
   debug_led_init();
   bcm2835_dma_init();
+  uart_pl011_tx_irq_init();
   err = logger_init();
   if (err != SUCCESS) {
     printf("Failed to init logger, err: %d\r\n", err);
@@ -110,13 +121,39 @@ out:
 
 extern void app_main(void);
 
+#if defined(CONFIG_LAT_TEST_ON_BOOT)
+/* Image for scripts/lat_test_qemu.sh, runs instead of app_main */
+static void lat_test_boot_fn(void)
+{
+  static const struct lat_test_cfg cfg = {
+    .period_us = LAT_TEST_DEFAULT_PERIOD_US,
+    .num_periods = LAT_TEST_DEFAULT_NUM_PERIODS,
+    .logger_flood = true,
+    .max_wakeup_us = LAT_TEST_DEFAULT_MAX_WAKEUP_US,
+  };
+  static struct lat_test_result r;
+  int err;
+
+  err = lat_test_run(&cfg, &r);
+  lat_test_print(&cfg, &r, err);
+  os_exit_current_task();
+}
+#endif
+
 static void kernel_run(void)
 {
   struct task *t;
-  t = task_create(app_main, "app_main");
+#if defined(CONFIG_LAT_TEST_ON_BOOT)
+  t = task_create(lat_test_boot_fn, "lat_test");
+#else
+  /* FAT32 and MMAL setup run deep call chains */
+  t = task_create_ext(app_main, "app_main", 16 * 1024);
+#endif
   sched_run_task_isr(t);
   t = task_create(blockdev_scheduler_fn, "block-sched");
   sched_run_task_isr(t);
+  if (shell_init() != SUCCESS)
+    printf("Failed to start shell\r\n");
   scheduler_start();
 
   /* not reachable code */
@@ -27,6 +27,7 @@ void reboot(void)
 
 void panic(void)
 {
+  uart_pl011_tx_sync();
   while(!should_reboot)
     asm volatile ("wfe");
   reboot();
@@ -34,6 +35,7 @@ void panic(void)
 
 void panic_with_log(const char *log)
 {
+  uart_pl011_tx_sync();
   printf(log);
   panic_log = log;
   panic();
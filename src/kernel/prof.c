@@ -0,0 +1,273 @@
+#include <prof.h>
+
+#if defined(CONFIG_PROF)
+#include <cpu.h>
+#include <irq.h>
+#include <ioreg.h>
+#include <errcode.h>
+#include <common.h>
+#include <printf.h>
+#include <memory_map.h>
+#include <uart_pl011.h>
+#include <arch/armv8/cpuctx_armv8.h>
+
+/* PMU interrupt routing of ARM local peripherals */
+#define LOCAL_PMU_ROUTING_SET ((ioreg32_t)(LOCAL_PERIPH_ADDR_START + 0x10))
+#define LOCAL_PMU_ROUTING_CLR ((ioreg32_t)(LOCAL_PERIPH_ADDR_START + 0x14))
+#define LOCAL_PMU_ROUTING_CORE0_IRQ (1 << 0)
+
+#define PMCR_E  (1 << 0)
+#define PMCR_P  (1 << 1)
+#define PMCR_C  (1 << 2)
+#define PMCR_LC (1 << 6)
+
+#define PMU_CYCLE_CNT_BIT (1u << 31)
+#define PMU_EVENT_CNT_BITS ((1 << PROF_PMU_CNT_INSTR) \
+  | (1 << PROF_PMU_CNT_L1D_REFILL) \
+  | (1 << PROF_PMU_CNT_BR_MISS) \
+  | (1 << PROF_PMU_CNT_SAMPLE))
+
+#define PROF_SAMPLE_MAX_PROBES 16
+
+/* "%016lx %u\r\n" with 10 digit count */
+#define PROF_DUMP_LINE_SIZE 29
+
+struct prof_sample_slot {
+  uint64_t pc;
+  uint32_t count;
+};
+
+/*
+ * Sample histogram is an open addressing hash table of PCs. A sample, that
+ * finds no slot in PROF_SAMPLE_MAX_PROBES probes, is counted as dropped.
+ */
+struct prof {
+  struct prof_marker *markers;
+  struct prof_sample_slot slots[PROF_NUM_SAMPLE_SLOTS];
+  struct prof_sample_stats stats;
+  uint32_t period;
+  bool sampling;
+};
+
+static struct prof prof;
+
+extern struct armv8_cpuctx *__current_cpuctx;
+
+void prof_marker_add(struct prof_marker *m, const struct prof_counters *start)
+{
+  struct prof_counters now;
+  uint64_t cycles;
+  int irqflags;
+
+  prof_read_counters(&now);
+  cycles = now.cycles - start->cycles;
+
+  disable_irq_save_flags(irqflags);
+  if (!m->registered) {
+    m->next = prof.markers;
+    prof.markers = m;
+    m->registered = true;
+  }
+
+  m->count++;
+  m->cycles += cycles;
+  m->instructions += (uint32_t)(now.instructions - start->instructions);
+  m->l1d_refills += (uint32_t)(now.l1d_refills - start->l1d_refills);
+  m->branch_misses += (uint32_t)(now.branch_misses - start->branch_misses);
+  if (cycles > m->max_cycles)
+    m->max_cycles = cycles;
+  restore_irq_flags(irqflags);
+}
+
+void prof_print_markers(void)
+{
+  struct prof_marker *m;
+  struct prof_marker c;
+  int irqflags;
+
+  printf("     count    avg_cyc    max_cyc   ipc l1d_ref/call br_miss/call"
+    " marker\r\n");
+
+  m = prof.markers;
+  while (m) {
+    disable_irq_save_flags(irqflags);
+    c = *m;
+    restore_irq_flags(irqflags);
+
+    if (c.count && c.cycles)
+      printf("%10u %10lu %10lu %3lu.%02lu %12lu %12lu %s\r\n", c.count,
+        c.cycles / c.count, c.max_cycles, c.instructions / c.cycles,
+        c.instructions * 100 / c.cycles % 100, c.l1d_refills / c.count,
+        c.branch_misses / c.count, c.name);
+    m = c.next;
+  }
+}
+
+void prof_reset_markers(void)
+{
+  struct prof_marker *m;
+  int irqflags;
+
+  disable_irq_save_flags(irqflags);
+  for (m = prof.markers; m; m = m->next) {
+    m->count = 0;
+    m->cycles = m->instructions = m->l1d_refills = m->branch_misses = 0;
+    m->max_cycles = 0;
+  }
+  restore_irq_flags(irqflags);
+}
+
+static inline void prof_sample_counter_reload(uint32_t period)
+{
+  /* 32-bit counter, overflows after period cycles */
+  asm volatile("msr pmevcntr3_el0, %0" :: "r"((uint64_t)(0 - period)));
+}
+
+static void prof_sample_add(uint64_t pc)
+{
+  struct prof_sample_slot *slot;
+  uint32_t idx;
+  int i;
+
+  prof.stats.num_samples++;
+  idx = (uint32_t)((pc >> 2) * 2654435761u);
+  for (i = 0; i < PROF_SAMPLE_MAX_PROBES; ++i) {
+    slot = &prof.slots[(idx + i) % PROF_NUM_SAMPLE_SLOTS];
+    if (slot->pc == pc) {
+      slot->count++;
+      return;
+    }
+
+    if (!slot->count) {
+      slot->pc = pc;
+      slot->count = 1;
+      prof.stats.num_slots_used++;
+      return;
+    }
+  }
+
+  prof.stats.num_dropped++;
+}
+
+static void prof_pmu_irq(void)
+{
+  uint64_t ovs;
+
+  asm volatile("mrs %0, pmovsclr_el0" : "=r"(ovs));
+  asm volatile("msr pmovsclr_el0, %0" :: "r"(ovs));
+
+  if (!(ovs & (1 << PROF_PMU_CNT_SAMPLE)) || !prof.sampling)
+    return;
+
+  /* Context of the interrupted code is already saved */
+  prof_sample_add(__current_cpuctx->pc);
+  prof_sample_counter_reload(prof.period);
+}
+
+static void prof_sampling_enable(bool enable)
+{
+  uint64_t bit = 1 << PROF_PMU_CNT_SAMPLE;
+
+  if (enable)
+    asm volatile("msr pmintenset_el1, %0\nisb" :: "r"(bit));
+  else
+    asm volatile("msr pmintenclr_el1, %0\nisb" :: "r"(bit));
+}
+
+int prof_sampling_start(uint32_t period)
+{
+  int irqflags;
+
+  if (period < 1000)
+    return ERR_INVAL;
+
+  disable_irq_save_flags(irqflags);
+  memset(prof.slots, 0, sizeof(prof.slots));
+  memset(&prof.stats, 0, sizeof(prof.stats));
+  prof.period = period;
+  prof.sampling = true;
+  prof_sample_counter_reload(period);
+  prof_sampling_enable(true);
+  restore_irq_flags(irqflags);
+  return SUCCESS;
+}
+
+void prof_sampling_stop(void)
+{
+  int irqflags;
+
+  disable_irq_save_flags(irqflags);
+  prof_sampling_enable(false);
+  prof.sampling = false;
+  restore_irq_flags(irqflags);
+}
+
+void prof_sampling_get_stats(struct prof_sample_stats *s)
+{
+  int irqflags;
+
+  disable_irq_save_flags(irqflags);
+  *s = prof.stats;
+  restore_irq_flags(irqflags);
+}
+
+void prof_samples_dump_uart(void)
+{
+  int i;
+  bool was_sampling = prof.sampling;
+
+  prof_sampling_stop();
+
+  printf("PROF-SAMPLES-BEGIN\r\n");
+  printf("period %u samples %lu dropped %lu\r\n", prof.period,
+    prof.stats.num_samples, prof.stats.num_dropped);
+  for (i = 0; i < PROF_NUM_SAMPLE_SLOTS; ++i) {
+    if (!prof.slots[i].count)
+      continue;
+
+    uart_pl011_tx_wait_space(PROF_DUMP_LINE_SIZE);
+    printf("%016lx %u\r\n", prof.slots[i].pc, prof.slots[i].count);
+  }
+  printf("PROF-SAMPLES-END\r\n");
+
+  if (was_sampling) {
+    prof.sampling = true;
+    prof_sampling_enable(true);
+  }
+}
+
+int prof_init(void)
+{
+  int err;
+
+  prof.markers = NULL;
+  prof.sampling = false;
+
+  asm volatile(
+    "msr pmcr_el0, %0\n"
+    "msr pmevtyper0_el0, %1\n"
+    "msr pmevtyper1_el0, %2\n"
+    "msr pmevtyper2_el0, %3\n"
+    "msr pmevtyper3_el0, %4\n"
+    "msr pmccfiltr_el0, xzr\n"
+    "msr pmintenclr_el1, %5\n"
+    "msr pmovsclr_el0, %5\n"
+    "msr pmcntenset_el0, %6\n"
+    "isb\n"
+    ::
+    "r"((uint64_t)(PMCR_E | PMCR_P | PMCR_C | PMCR_LC)),
+    "r"((uint64_t)PROF_PMU_EV_INST_RETIRED),
+    "r"((uint64_t)PROF_PMU_EV_L1D_CACHE_REFILL),
+    "r"((uint64_t)PROF_PMU_EV_BR_MIS_PRED),
+    "r"((uint64_t)PROF_PMU_EV_CPU_CYCLES),
+    "r"((uint64_t)0xffffffff),
+    "r"((uint64_t)(PMU_CYCLE_CNT_BIT | PMU_EVENT_CNT_BITS)));
+
+  err = irq_local_set(IRQ_LOCAL_PMU, prof_pmu_irq);
+  if (err != SUCCESS)
+    return err;
+
+  ioreg32_write(LOCAL_PMU_ROUTING_SET, LOCAL_PMU_ROUTING_CORE0_IRQ);
+  return SUCCESS;
+}
+#endif
@@ -5,8 +5,12 @@
 #include <common.h>
 #include <drivers/timer/timer_bcm2835.h>
 #include <arch/armv8/cpuctx_armv8.h>
+#include <arch/armv8/fpsimd_armv8.h>
 #include <printf.h>
 #include <sched_mon.h>
+#include <trace.h>
+#include <irq.h>
+#include <string.h>
 #if 0
 #define SCHED_PRINTF(__fmt, ...) printf(__fmt, ##__VA_ARGS__)
 #else
@@ -42,6 +46,7 @@ struct scheduler {
   struct task *idle_task;
   uint64_t ticks;
   bool needs_resched;
+  uint64_t start_time;
   struct scheduler_stats stats;
 };
 
@@ -107,6 +112,60 @@ static inline void scheduler_insert_to_blocked_on_timer(struct task *t)
   node->prev = &t->scheduler_list;
 }
 
+static inline int sched_block_reason(int scheduler_request)
+{
+  if (scheduler_request == TASK_SCHED_RQ_BLOCK_ON_TIMER)
+    return TASK_BLOCK_TIMER;
+  if (scheduler_request == TASK_SCHED_RQ_BLOCK_ON_EVENT)
+    return TASK_BLOCK_EVENT;
+  if (scheduler_request == TASK_SCHED_RQ_WAIT_LIST)
+    return TASK_BLOCK_WAIT_LIST;
+  return -1;
+}
+
+static inline void sched_mark_woken(struct task *t, uint64_t now)
+{
+  if (t->stats.blocked_at && !t->stats.woken_at)
+    t->stats.woken_at = now;
+}
+
+/* Called before current task is dropped, while scheduler_request is valid */
+static inline void sched_account_out(struct task *t, uint64_t now)
+{
+  struct task_stats *st = &t->stats;
+  int reason;
+
+  st->run_time += now - st->run_start
+    - (irq_total_time - st->irq_time_at_start);
+
+  reason = sched_block_reason(t->scheduler_request);
+  if (reason != -1) {
+    st->block_reason = reason;
+    st->blocked_at = now;
+    st->woken_at = 0;
+  }
+}
+
+static inline void sched_account_in(struct task *t, uint64_t now)
+{
+  struct task_stats *st = &t->stats;
+  uint64_t latency;
+
+  st->run_start = now;
+  st->irq_time_at_start = irq_total_time;
+
+  if (!st->blocked_at)
+    return;
+
+  /* Wakeup was not seen, count it as wakeup at switch time */
+  sched_mark_woken(t, now);
+  st->blocked_time[st->block_reason] += st->woken_at - st->blocked_at;
+  latency = now - st->woken_at;
+  if (latency > st->max_sched_latency)
+    st->max_sched_latency = latency;
+  st->blocked_at = st->woken_at = 0;
+}
+
 static inline void scheduler_drop_current(void)
 {
   struct task *t;
@@ -193,27 +252,61 @@ done:
   asm volatile (
     "ldr x1, =__current_cpuctx\n"
     "str %0, [x1]\n"::"r"(sched.current->cpuctx));
+  armv8_fpsimd_switch(sched.current->fpsimd_ctx);
+}
+
+static inline void sched_check_stack(struct task *t)
+{
+  if (task_stack_is_overflown(t)) {
+    printf("task %s: stack overflow\r\n", t->name);
+    panic();
+  }
 }
 
-static void __schedule(void)
+/*
+ * voluntary - current task gives up CPU by blocking, yielding or exiting,
+ * otherwise it is preempted on return from IRQ.
+ */
+static void __schedule(bool voluntary)
 {
+  struct task *prev = sched.current;
+  int rq = prev->scheduler_request;
+  uint64_t now = arm_timer_get_count();
+
   sched.stats.num_schedules++;
 
   SCHED_PRINTF("__schedule, task:%s\r\n", sched.current->name);
   sched.needs_resched = true;
+  sched_account_out(prev, now);
+  sched_check_stack(prev);
   scheduler_drop_current();
   scheduler_select_next();
   sched_mon_set_current_task(sched.current->task_id);
+  sched_account_in(sched.current, now);
+  if (sched.current != prev) {
+    if (rq != TASK_SCHED_RQ_EXIT) {
+      if (voluntary)
+        prev->stats.num_switches_voluntary++;
+      else
+        prev->stats.num_switches_involuntary++;
+    }
+    trace_event(TRACE_EV_TASK_SWITCH, sched.current->task_id, 0);
+  }
   SCHED_PRINTF("__schedule end, new task:%s\r\n", sched.current->name);
 }
 
 void __sched_try_reschedule(void)
 {
   sched.stats.num_try_resched++;
+
+  /* IRQ handlers have just run on the stack of current task */
+  if (sched.current)
+    sched_check_stack(sched.current);
+
   if (!sched.needs_resched)
     goto out;
 
-  __schedule();
+  __schedule(false);
 
 out:
   sched_mon_restore_ctx();
@@ -221,7 +314,18 @@ out:
 
 static void sched_timer_irq_cb(void *arg)
 {
+  struct task *t;
+  uint64_t now = arm_timer_get_count();
+
   sched.ticks++;
+
+  /* blocked_on_timer is sorted by wakeup time */
+  list_for_each_entry(t, &sched.blocked_on_timer, scheduler_list) {
+    if (t->next_wakeup_time > sched.ticks)
+      break;
+    sched_mark_woken(t, now);
+  }
+
   sched.needs_resched = true;
   bcm2835_systimer_start_oneshot(
     MS_TO_US(SCHED_MS_PER_TICK),
@@ -232,9 +336,12 @@ void NORETURN scheduler_start(void)
 {
   irq_disable();
   sched.current = sched.idle_task;
+  sched.start_time = arm_timer_get_count();
+  sched_account_in(sched.current, sched.start_time);
   asm volatile (
     "ldr x1, =__current_cpuctx\n"
     "str %0, [x1]\n"::"r"(sched.current->cpuctx));
+  armv8_fpsimd_switch(sched.current->fpsimd_ctx);
 
   bcm2835_systimer_start_oneshot(MS_TO_US(SCHED_MS_PER_TICK),
     sched_timer_irq_cb, NULL);
@@ -248,14 +355,14 @@ void sched_exit_current_task_isr(void)
 {
   struct task *t = sched.current;
   t->scheduler_request = TASK_SCHED_RQ_EXIT;
-  __schedule();
+  __schedule(true);
 }
 
 void sched_exit_task_isr(struct task *t)
 {
   if (t == sched.current) {
     t->scheduler_request = TASK_SCHED_RQ_EXIT;
-    __schedule();
+    __schedule(true);
   }
   else {
     list_del(&t->scheduler_list);
@@ -268,7 +375,7 @@ void sched_delay_current_ms_isr(uint64_t ms)
   struct task *t = sched.current;
   t->scheduler_request = TASK_SCHED_RQ_BLOCK_ON_TIMER;
   t->next_wakeup_time = sched.ticks + MS_TO_TICKS(ms);
-  __schedule();
+  __schedule(true);
 }
 
 void sched_event_wait_isr(struct event *ev)
@@ -281,7 +388,7 @@ void sched_event_wait_isr(struct event *ev)
 
   t->scheduler_request = TASK_SCHED_RQ_BLOCK_ON_EVENT;
   t->wait_event = ev;
-  __schedule();
+  __schedule(true);
 }
 
 void sched_event_notify_isr(struct event *ev)
@@ -290,6 +397,7 @@ void sched_event_notify_isr(struct event *ev)
   struct list_head *node;
   struct list_head *tmp;
   struct task *t;
+  uint64_t now = arm_timer_get_count();
 
   ev->ev = 1;
 
@@ -297,6 +405,7 @@ void sched_event_notify_isr(struct event *ev)
     t = container_of(node, struct task, scheduler_list);
     if (t->wait_event == ev) {
       list_move(node, &sched.blocked_on_event);
+      sched_mark_woken(t, now);
       needs_resched = true;
     }
   }
@@ -319,7 +428,7 @@ void sched_wait_list_put_current_isr(struct list_head *wait_list)
   BUG_IF(!t, "Current task is NULL");
   list_add_tail(&t->scheduler_list, wait_list);
   t->scheduler_request = TASK_SCHED_RQ_WAIT_LIST;
-  __schedule();
+  __schedule(true);
 }
 
 void sched_wait_list_wake_one_isr(struct list_head *wait_list)
@@ -333,6 +442,7 @@ void sched_wait_list_wake_one_isr(struct list_head *wait_list)
 
   t = container_of(l, struct task, scheduler_list);
   list_add_tail(&t->scheduler_list, &sched.high_prio_runnable);
+  sched_mark_woken(t, arm_timer_get_count());
   sched.needs_resched = true;
 }
 
@@ -346,13 +456,14 @@ void scheduler_init(void)
   sched.ticks = 0;
 
   /* __current_cpuctx should be initilized before first call to task_create */
-  sched.idle_task = task_create(sched_idle_task_fn, "idle");
+  sched.idle_task = task_create_ext(sched_idle_task_fn, "idle",
+    TASK_STACK_SIZE_MIN);
   BUG_IF(!sched.idle_task, "Faild to add idle task");
 }
 
 void scheduler_yield_isr(void)
 {
-  __schedule();
+  __schedule(true);
 }
 
 uint64_t sched_get_time_us(void)
@@ -364,3 +475,102 @@ uint64_t sched_get_time_us(void)
   restore_irq_flags(flags);
   return result;
 }
+
+static void sched_get_task_stats_isr(struct task *t, struct task_stats *s,
+  uint64_t now)
+{
+  *s = t->stats;
+  if (t == sched.current)
+    s->run_time += now - s->run_start
+      - (irq_total_time - s->irq_time_at_start);
+}
+
+void sched_get_task_stats(struct task *t, struct task_stats *s)
+{
+  int flags;
+
+  disable_irq_save_flags(flags);
+  sched_get_task_stats_isr(t, s, arm_timer_get_count());
+  restore_irq_flags(flags);
+}
+
+int sched_get_idle_percent(void)
+{
+  struct task_stats s;
+  uint64_t total;
+  int flags;
+
+  disable_irq_save_flags(flags);
+  total = arm_timer_get_count() - sched.start_time;
+  sched_get_task_stats_isr(sched.idle_task, &s, sched.start_time + total);
+  restore_irq_flags(flags);
+
+  if (!total)
+    return 0;
+  return s.run_time * 100 / total;
+}
+
+struct sched_stats_snapshot {
+  struct {
+    uint32_t task_id;
+    char name[16];
+    struct task_stats stats;
+  } tasks[32];
+  int num;
+  uint64_t now;
+};
+
+static struct sched_stats_snapshot sched_snapshot;
+
+static void sched_snapshot_task_cb(struct task *t, void *arg)
+{
+  struct sched_stats_snapshot *s = arg;
+
+  if (s->num == ARRAY_SIZE(s->tasks))
+    return;
+
+  s->tasks[s->num].task_id = t->task_id;
+  memcpy(s->tasks[s->num].name, t->name, sizeof(t->name));
+  sched_get_task_stats_isr(t, &s->tasks[s->num].stats, s->now);
+  s->num++;
+}
+
+#define SCHED_COUNTS_TO_US(__c, __freq) ((__c) * 1000000 / (__freq))
+
+void sched_print_stats(void)
+{
+  int i, flags;
+  uint64_t total;
+  uint32_t freq = arm_timer_get_freq();
+  struct task_stats *st;
+  struct sched_stats_snapshot *s = &sched_snapshot;
+
+  disable_irq_save_flags(flags);
+  s->num = 0;
+  s->now = arm_timer_get_count();
+  task_for_each(sched_snapshot_task_cb, s);
+  restore_irq_flags(flags);
+
+  total = s->now - sched.start_time;
+  if (!total)
+    return;
+
+  printf("uptime %lu us, idle %d%%, irq %d%%, schedules %u\r\n",
+    SCHED_COUNTS_TO_US(total, freq), sched_get_idle_percent(),
+    (int)(irq_total_time * 100 / total), sched.stats.num_schedules);
+  printf("id cpu%%     run_us   vol  invol  maxlat_us  timer_us  event_us"
+    "   wait_us name\r\n");
+
+  for (i = 0; i < s->num; ++i) {
+    st = &s->tasks[i].stats;
+    printf("%2d %4d %10lu %5u %6u %10lu %9lu %9lu %9lu %s\r\n",
+      s->tasks[i].task_id, (int)(st->run_time * 100 / total),
+      SCHED_COUNTS_TO_US(st->run_time, freq),
+      st->num_switches_voluntary, st->num_switches_involuntary,
+      SCHED_COUNTS_TO_US(st->max_sched_latency, freq),
+      SCHED_COUNTS_TO_US(st->blocked_time[TASK_BLOCK_TIMER], freq),
+      SCHED_COUNTS_TO_US(st->blocked_time[TASK_BLOCK_EVENT], freq),
+      SCHED_COUNTS_TO_US(st->blocked_time[TASK_BLOCK_WAIT_LIST], freq),
+      s->tasks[i].name);
+  }
+}
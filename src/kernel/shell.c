@@ -0,0 +1,343 @@
+#include <shell.h>
+
+#if defined(CONFIG_SHELL)
+#include <uart_pl011.h>
+#include <task.h>
+#include <sched.h>
+#include <irq.h>
+#include <kmalloc.h>
+#include <trace.h>
+#include <prof.h>
+#include <lat_test.h>
+#include <drivers/dma/dma_bcm2835.h>
+#include <drivers/sd/sdhost_bcm2835.h>
+#include <drivers/sd/sdhc.h>
+#include <vc/vchiq.h>
+#include <vc/service_mmal.h>
+#include <vc/mmal_ratectl.h>
+#include <errcode.h>
+#include <common.h>
+#include <printf.h>
+#include <stringlib.h>
+
+#define SHELL_LINE_SIZE 80
+
+#define SHELL_PROMPT "> "
+
+struct shell {
+  char line[SHELL_LINE_SIZE];
+  int pos;
+  char *argv[SHELL_MAX_ARGS];
+  const struct shell_cmd *app_cmds[SHELL_MAX_APP_CMDS];
+  int num_app_cmds;
+};
+
+static struct shell shell;
+
+static bool shell_parse_uint(const char *s, uint32_t *out)
+{
+  uint32_t base = 10;
+  uint32_t v = 0;
+  uint32_t d;
+
+  if (s[0] == '0' && s[1] == 'x') {
+    base = 16;
+    s += 2;
+  }
+
+  if (!*s)
+    return false;
+
+  for (; *s; s++) {
+    if (*s >= '0' && *s <= '9')
+      d = *s - '0';
+    else if (base == 16 && *s >= 'a' && *s <= 'f')
+      d = *s - 'a' + 10;
+    else
+      return false;
+    v = v * base + d;
+  }
+
+  *out = v;
+  return true;
+}
+
+static void shell_cmd_help(int argc, char **argv);
+
+static void shell_cmd_tasks(int argc, char **argv)
+{
+  /* Both tables together may not fit SHELL_OUTPUT_SPACE */
+  sched_print_stats();
+  uart_pl011_tx_wait_space(SHELL_OUTPUT_SPACE);
+  task_print_stack_usage();
+}
+
+static void shell_cmd_irq(int argc, char **argv)
+{
+  irq_print_stats();
+}
+
+static void shell_cmd_mem(int argc, char **argv)
+{
+  kmalloc_print_stats();
+  dma_memory_print_stats();
+}
+
+static void shell_cmd_dma(int argc, char **argv)
+{
+  bcm2835_dma_print_stats();
+}
+
+static void shell_cmd_sd(int argc, char **argv)
+{
+  struct sdhc_iostats io;
+  struct mmal_ratectl_stats r;
+
+  if (argc > 1 && !strcmp(argv[1], "reset")) {
+    bcm_sdhost_reset_stats();
+    return;
+  }
+
+  bcm_sdhost_print_stats();
+  sdhc_iostats_get(&io);
+  printf("sd bytes written: %lu\r\n", io.num_bytes_written);
+  mmal_ratectl_get_stats(&r);
+  printf("ratectl: sd write %u bytes/sec, queue: %d, frames dropped: %d\r\n",
+    r.sd_bytes_per_sec, r.queue_depth, r.num_frames_dropped);
+}
+
+static void shell_cmd_vchiq(int argc, char **argv)
+{
+  struct vchiq_tx_stats s;
+
+  vchiq_get_tx_stats(&s);
+  printf("tx slots used: %d/%d, max used: %d, recycled: %u\r\n",
+    s.slots_used, s.num_slots, s.slots_used_max, s.slots_recycled);
+  printf("slot stalls: %u, quota stalls: %u\r\n", s.slot_stalls,
+    s.quota_stalls);
+}
+
+static void shell_cmd_mmal(int argc, char **argv)
+{
+  mmal_print_port_stats();
+}
+
+static void shell_cmd_trace(int argc, char **argv)
+{
+  struct trace_stats s;
+  uint32_t mask = TRACE_CAT_ALL;
+
+  if (argc > 1 && !strcmp(argv[1], "start")) {
+    if (argc > 2 && !shell_parse_uint(argv[2], &mask)) {
+      printf("bad mask %s\r\n", argv[2]);
+      return;
+    }
+    trace_set_mask(mask);
+  }
+  else if (argc > 1 && !strcmp(argv[1], "stop"))
+    trace_set_mask(0);
+  else if (argc > 1 && !strcmp(argv[1], "dump"))
+    trace_dump_uart();
+  else {
+    trace_get_stats(&s);
+    printf("trace records: %lu, overwritten: %lu\r\n", s.num_records,
+      s.num_overwritten);
+  }
+}
+
+static void shell_cmd_prof(int argc, char **argv)
+{
+  uint32_t period = 100000;
+
+  if (argc > 1 && !strcmp(argv[1], "reset"))
+    prof_reset_markers();
+  else if (argc > 1 && !strcmp(argv[1], "start")) {
+    if (argc > 2 && !shell_parse_uint(argv[2], &period)) {
+      printf("bad period %s\r\n", argv[2]);
+      return;
+    }
+    if (prof_sampling_start(period) != SUCCESS)
+      printf("failed to start sampling\r\n");
+  }
+  else if (argc > 1 && !strcmp(argv[1], "stop"))
+    prof_sampling_stop();
+  else if (argc > 1 && !strcmp(argv[1], "dump"))
+    prof_samples_dump_uart();
+  else
+    prof_print_markers();
+}
+
+static void shell_cmd_lat(int argc, char **argv)
+{
+  static struct lat_test_cfg cfg;
+  static struct lat_test_result r;
+  int err;
+
+  memset(&cfg, 0, sizeof(cfg));
+  cfg.period_us = LAT_TEST_DEFAULT_PERIOD_US;
+  cfg.num_periods = LAT_TEST_DEFAULT_NUM_PERIODS;
+  cfg.max_wakeup_us = LAT_TEST_DEFAULT_MAX_WAKEUP_US;
+  cfg.logger_flood = true;
+
+  if ((argc > 1 && !shell_parse_uint(argv[1], &cfg.period_us))
+    || (argc > 2 && !shell_parse_uint(argv[2], &cfg.num_periods))
+    || (argc > 3 && !shell_parse_uint(argv[3], &cfg.max_wakeup_us))) {
+    printf("bad arguments\r\n");
+    return;
+  }
+
+  err = lat_test_run(&cfg, &r);
+  if (err == ERR_INVAL) {
+    printf("bad period or number of periods\r\n");
+    return;
+  }
+
+  lat_test_print(&cfg, &r, err);
+}
+
+static const struct shell_cmd shell_cmds[] = {
+  { "help", "list commands", shell_cmd_help },
+  { "tasks", "cpu usage, switches, latency, stack usage", shell_cmd_tasks },
+  { "irq", "per irq count and handler time", shell_cmd_irq },
+  { "mem", "kmalloc and dma_alloc usage", shell_cmd_mem },
+  { "dma", "dma channel and control block usage", shell_cmd_dma },
+  { "sd", "sd command latencies and write rate [reset]", shell_cmd_sd },
+  { "vchiq", "vchiq tx slot usage", shell_cmd_vchiq },
+  { "mmal", "mmal port buffer counts", shell_cmd_mmal },
+  { "trace", "trace [start [mask]|stop|dump]", shell_cmd_trace },
+  { "prof", "prof [reset|start [period]|stop|dump]", shell_cmd_prof },
+  { "lat", "lat [period_us [num_periods [max_wakeup_us]]]", shell_cmd_lat },
+};
+
+static void shell_cmd_help(int argc, char **argv)
+{
+  int i;
+
+  for (i = 0; i < ARRAY_SIZE(shell_cmds); ++i)
+    printf("%s - %s\r\n", shell_cmds[i].name, shell_cmds[i].help);
+
+  for (i = 0; i < shell.num_app_cmds; ++i)
+    printf("%s - %s\r\n", shell.app_cmds[i]->name, shell.app_cmds[i]->help);
+}
+
+static const struct shell_cmd *shell_find_cmd(const char *name)
+{
+  int i;
+
+  for (i = 0; i < ARRAY_SIZE(shell_cmds); ++i)
+    if (!strcmp(shell_cmds[i].name, name))
+      return &shell_cmds[i];
+
+  for (i = 0; i < shell.num_app_cmds; ++i)
+    if (!strcmp(shell.app_cmds[i]->name, name))
+      return shell.app_cmds[i];
+
+  return NULL;
+}
+
+static int shell_split_args(char *line, char **argv)
+{
+  int argc = 0;
+
+  while (*line && argc < SHELL_MAX_ARGS) {
+    while (*line == ' ')
+      *line++ = 0;
+    if (!*line)
+      break;
+
+    argv[argc++] = line;
+    while (*line && *line != ' ')
+      line++;
+  }
+
+  return argc;
+}
+
+static void shell_exec_line(void)
+{
+  const struct shell_cmd *cmd;
+  int argc;
+
+  shell.line[shell.pos] = 0;
+  shell.pos = 0;
+
+  argc = shell_split_args(shell.line, shell.argv);
+  if (!argc)
+    return;
+
+  cmd = shell_find_cmd(shell.argv[0]);
+  if (!cmd) {
+    printf("unknown command %s, try help\r\n", shell.argv[0]);
+    return;
+  }
+
+  uart_pl011_tx_wait_space(SHELL_OUTPUT_SPACE);
+  cmd->fn(argc, shell.argv);
+}
+
+static void shell_input_char(char c)
+{
+  if (c == '\r' || c == '\n') {
+    puts("\r\n");
+    shell_exec_line();
+    puts(SHELL_PROMPT);
+    return;
+  }
+
+  /* Backspace or DEL */
+  if (c == 0x08 || c == 0x7f) {
+    if (shell.pos) {
+      shell.pos--;
+      puts("\b \b");
+    }
+    return;
+  }
+
+  if (!isprint(c) || shell.pos == SHELL_LINE_SIZE - 1)
+    return;
+
+  shell.line[shell.pos++] = c;
+  putc(c);
+}
+
+static void shell_task_fn(void)
+{
+  char buf[16];
+  int i, n;
+
+  puts(SHELL_PROMPT);
+  while (1) {
+    n = uart_pl011_recv(buf, sizeof(buf));
+    for (i = 0; i < n; ++i)
+      shell_input_char(buf[i]);
+  }
+}
+
+int shell_register_cmds(const struct shell_cmd *cmds, int num)
+{
+  int i;
+
+  if (shell.num_app_cmds + num > SHELL_MAX_APP_CMDS)
+    return ERR_RESOURCE;
+
+  for (i = 0; i < num; ++i)
+    shell.app_cmds[shell.num_app_cmds++] = &cmds[i];
+
+  return SUCCESS;
+}
+
+int shell_init(void)
+{
+  struct task *t;
+
+  shell.pos = 0;
+  uart_pl011_rx_irq_init();
+
+  t = task_create_ext(shell_task_fn, "shell", TASK_STACK_SIZE_MIN);
+  if (!t)
+    return ERR_MEMALLOC;
+
+  sched_run_task_isr(t);
+  return SUCCESS;
+}
+#endif
@@ -2,17 +2,72 @@
 #include <common.h>
 #include <string.h>
 #include <logger.h>
+#include <arch/armv8/fpsimd_armv8.h>
+#include <mmu.h>
+#include <errcode.h>
+#include <cpu.h>
+#include <printf.h>
+#include <config.h>
 
 static uint32_t tasks_busymask = 0;
 static int task_id_generator = 0;
 
-#define NUM_STACK_WORDS 512
+/*
+ * Stacks are carved from stack_pool in 1K units. Stacks of page size and
+ * bigger are page aligned and get a guard page right below them, that is
+ * unmapped, so overflow faults at once. They are taken from the top of the
+ * pool.
+ *
+ * Smaller stacks have no guard page, overflow is caught on return from IRQ
+ * and on task switch, when any of STACK_CANARY_WORDS lowest words of the
+ * stack is overwritten. They are taken from the bottom of the pool, which
+ * starts with a guard page, and each has a painted red zone of
+ * STACK_REDZONE_SIZE below it. Overflow in IRQ context runs into the red
+ * zone or the guard page instead of a neighbour stack, until the check
+ * catches it. Stack memory is painted at creation, unpainted words give the
+ * high-water mark.
+ */
+#define STACK_UNIT_SIZE 1024
+#define STACK_PAGE_SIZE 4096
+#define STACK_REDZONE_SIZE 1024
+#define STACK_UNITS_PER_PAGE (STACK_PAGE_SIZE / STACK_UNIT_SIZE)
+#define STACK_PAINT 0x4b415453b0b0b0b0ull
+#define STACK_CANARY_WORDS 8
+
+#define STACK_GUARDED_UNITS(__size) \
+  (((__size) + STACK_PAGE_SIZE) / STACK_UNIT_SIZE)
+#define STACK_SMALL_UNITS \
+  ((TASK_STACK_SIZE_MIN + STACK_REDZONE_SIZE) / STACK_UNIT_SIZE)
+
+/*
+ * Pool size: pool guard page, in-tree tasks with guarded stacks: app_main
+ * 16K, block-sched, three vchiq tasks, mmal and lat_test sd load 4K each,
+ * in-tree tasks with small stacks: idle, logger, shell and three other
+ * lat_test tasks. lat_test boot task runs instead of app_main. The rest is
+ * CONFIG_TASK_NUM_APP_TASKS default stacks for application tasks.
+ */
+#define STACK_POOL_UNITS (STACK_UNITS_PER_PAGE \
+  + STACK_GUARDED_UNITS(16 * 1024) \
+  + 6 * STACK_GUARDED_UNITS(TASK_STACK_SIZE_DEFAULT) \
+  + 6 * STACK_SMALL_UNITS \
+  + CONFIG_TASK_NUM_APP_TASKS * STACK_GUARDED_UNITS(TASK_STACK_SIZE_DEFAULT))
+#define STACK_NUM_UNITS ((STACK_POOL_UNITS + STACK_UNITS_PER_PAGE - 1) \
+  / STACK_UNITS_PER_PAGE * STACK_UNITS_PER_PAGE)
+#define STACK_POOL_SIZE (STACK_NUM_UNITS * STACK_UNIT_SIZE)
+
 struct stack {
-  uint64_t data[NUM_STACK_WORDS];
+  /* Lowest address, stack grows down towards it */
+  uint64_t *base;
+  size_t size;
+  int first_unit;
+  int num_units;
+  bool guarded;
 };
 
 struct cpuctx {
   uint64_t regs[40];
+  /* Only valid, when task uses FP/SIMD, switched lazily by scheduler */
+  struct armv8_fpsimd_ctx fpsimd;
 };
 
 struct cpuctx cpuctx_array[32];
@@ -20,7 +75,10 @@ struct cpuctx cpuctx_array[32];
 static uint32_t stacks_busymask = 0;
 static uint32_t cpuctx_busymask = 0;
 
-ALIGNED(16) struct stack stacks_array[32];
+static ALIGNED(STACK_PAGE_SIZE) uint8_t stack_pool[STACK_POOL_SIZE];
+static uint64_t stack_pool_busy[(STACK_NUM_UNITS + 63) / 64];
+
+struct stack stacks_array[32];
 struct task tasks_array[32];
 struct cpuctx cpuctx_array[32];
 
@@ -40,7 +98,58 @@ static struct cpuctx *cpuctx_alloc(void)
   return NULL;
 }
 
-static struct stack *stack_alloc(void)
+static inline bool stack_unit_is_busy(int unit)
+{
+  return stack_pool_busy[unit / 64] & (1ull << (unit % 64));
+}
+
+static void stack_units_mark(int first, int num, bool busy)
+{
+  int i;
+
+  for (i = first; i < first + num; ++i) {
+    if (busy)
+      stack_pool_busy[i / 64] |= 1ull << (i % 64);
+    else
+      stack_pool_busy[i / 64] &= ~(1ull << (i % 64));
+  }
+}
+
+static bool stack_units_are_free(int first, int num)
+{
+  int i;
+
+  for (i = first; i < first + num; ++i)
+    if (stack_unit_is_busy(i))
+      return false;
+
+  return true;
+}
+
+/*
+ * Page aligned ranges are searched from the top of the pool, others from
+ * the bottom, so that small stacks stay above the pool guard page.
+ */
+static int stack_units_find(int num, bool page_aligned)
+{
+  int first;
+
+  if (page_aligned) {
+    first = (STACK_NUM_UNITS - num) / STACK_UNITS_PER_PAGE
+      * STACK_UNITS_PER_PAGE;
+    for (; first >= 0; first -= STACK_UNITS_PER_PAGE)
+      if (stack_units_are_free(first, num))
+        return first;
+  } else {
+    for (first = 0; first + num <= STACK_NUM_UNITS; ++first)
+      if (stack_units_are_free(first, num))
+        return first;
+  }
+
+  return -1;
+}
+
+static struct stack *stack_desc_alloc(void)
 {
   int i;
   uint32_t bitmap = stacks_busymask;
@@ -56,11 +165,11 @@ static struct stack *stack_alloc(void)
   return NULL;
 }
 
-static void stack_release(struct stack *s)
+static void stack_desc_release(struct stack *s)
 {
   int idx;
 
-  BUG_IF(s < stacks_array || s > stacks_array + ARRAY_SIZE(stacks_array),
+  BUG_IF(s < stacks_array || s >= stacks_array + ARRAY_SIZE(stacks_array),
     "Trying to free invalid stack");
 
   idx = s - &stacks_array[0];
@@ -71,8 +180,77 @@ static void stack_release(struct stack *s)
   stacks_busymask &= ~(1<<idx);
 }
 
+static void stack_paint(uint8_t *p, size_t size)
+{
+  uint64_t *w = (uint64_t *)p;
+  size_t i;
+
+  for (i = 0; i < size / sizeof(uint64_t); ++i)
+    w[i] = STACK_PAINT;
+}
+
+static struct stack *stack_alloc(size_t size)
+{
+  int first, num_units;
+  bool guarded;
+  struct stack *s;
+  uint8_t *base;
+
+  size = MAX(size, TASK_STACK_SIZE_MIN);
+  guarded = size >= STACK_PAGE_SIZE;
+  if (guarded) {
+    size = (size + STACK_PAGE_SIZE - 1) & ~(STACK_PAGE_SIZE - 1);
+    num_units = (size + STACK_PAGE_SIZE) / STACK_UNIT_SIZE;
+  } else {
+    size = (size + STACK_UNIT_SIZE - 1) & ~(STACK_UNIT_SIZE - 1);
+    num_units = (size + STACK_REDZONE_SIZE) / STACK_UNIT_SIZE;
+  }
+
+  s = stack_desc_alloc();
+  if (!s)
+    return NULL;
+
+  first = stack_units_find(num_units, guarded);
+  if (first == -1) {
+    stack_desc_release(s);
+    return NULL;
+  }
+
+  base = stack_pool + first * STACK_UNIT_SIZE;
+  if (guarded) {
+    if (mmu_set_guard_page((uint64_t)base, true) != SUCCESS) {
+      stack_desc_release(s);
+      return NULL;
+    }
+    base += STACK_PAGE_SIZE;
+  } else {
+    stack_paint(base, STACK_REDZONE_SIZE);
+    base += STACK_REDZONE_SIZE;
+  }
+
+  stack_units_mark(first, num_units, true);
+  s->base = (uint64_t *)base;
+  s->size = size;
+  s->first_unit = first;
+  s->num_units = num_units;
+  s->guarded = guarded;
+
+  stack_paint(base, size);
+  return s;
+}
+
+static void stack_release(struct stack *s)
+{
+  if (s->guarded)
+    mmu_set_guard_page((uint64_t)s->base - STACK_PAGE_SIZE, false);
+
+  stack_units_mark(s->first_unit, s->num_units, false);
+  stack_desc_release(s);
+}
+
 static void cpuctx_release(struct cpuctx *ctx)
 {
+  armv8_fpsimd_release(&ctx->fpsimd);
   int cpuctx_idx = ctx - &cpuctx_array[0];
   cpuctx_busymask &= ~(1<<cpuctx_idx);
 }
@@ -112,7 +290,8 @@ void task_init_cpuctx(struct task *t, task_fn fn, uint64_t stack_base)
     (uint64_t)task_return_to_nowhere);
 }
 
-struct task *task_create(task_fn fn, const char *task_name)
+struct task *task_create_ext(task_fn fn, const char *task_name,
+  size_t stack_size)
 {
   struct stack *s;
   struct cpuctx *ctx;
@@ -124,7 +303,7 @@ struct task *task_create(task_fn fn, const char *task_name)
    * value at this address. Stack pointer will then "grow upwards", same as
    * decrement its value towards smaller
    */
-  s = stack_alloc();
+  s = stack_alloc(stack_size);
   if (!s)
     return NULL;
 
@@ -142,19 +321,28 @@ struct task *task_create(task_fn fn, const char *task_name)
     return NULL;
   }
 
-  stack_base = (uint64_t)&s->data[NUM_STACK_WORDS - 2];
+  stack_base = (uint64_t)&s->base[s->size / sizeof(uint64_t) - 2];
   t->stack = s;
   t->scheduler_request = 0;
   t->cpuctx = ctx;
+  t->fpsimd_ctx = &ctx->fpsimd;
+  memset(&ctx->fpsimd, 0, sizeof(ctx->fpsimd));
   t->task_id = task_id_generator++;
   t->starvation = 0;
+  memset(&t->stats, 0, sizeof(t->stats));
   task_init_cpuctx(t, fn, stack_base);
   memset(t->name, 0, sizeof(t->name));
   strncpy(t->name, task_name, sizeof(t->name));
-  os_log("new task: %s, task_id:%d\r\n", t->name, t->task_id);
+  os_log("new task: %s, task_id:%d, stack:%d\r\n", t->name, t->task_id,
+    (int)s->size);
   return t;
 }
 
+struct task *task_create(task_fn fn, const char *task_name)
+{
+  return task_create_ext(fn, task_name, TASK_STACK_SIZE_DEFAULT);
+}
+
 void task_delete_isr(struct task *t)
 {
   stack_release(t->stack);
@@ -162,9 +350,109 @@ void task_delete_isr(struct task *t)
   task_release(t);
 }
 
+void task_for_each(void (*fn)(struct task *t, void *arg), void *arg)
+{
+  int i;
+
+  for (i = 0; i < ARRAY_SIZE(tasks_array); ++i) {
+    if (tasks_busymask & (1<<i))
+      fn(&tasks_array[i], arg);
+  }
+}
+
+size_t task_stack_size(const struct task *t)
+{
+  return t->stack->size;
+}
+
+static size_t stack_max_used(const uint64_t *base, size_t size)
+{
+  size_t i;
+
+  for (i = 0; i < size / sizeof(uint64_t); ++i)
+    if (base[i] != STACK_PAINT)
+      break;
+
+  return size - i * sizeof(uint64_t);
+}
+
+size_t task_stack_max_used(const struct task *t)
+{
+  return stack_max_used(t->stack->base, t->stack->size);
+}
+
+bool task_stack_is_overflown(const struct task *t)
+{
+  const uint64_t *base = t->stack->base;
+  int i;
+
+  for (i = 0; i < STACK_CANARY_WORDS; ++i)
+    if (base[i] != STACK_PAINT)
+      return true;
+
+  return false;
+}
+
+bool task_stack_is_guard_addr(const struct task *t, uint64_t addr)
+{
+  uint64_t guard = (uint64_t)stack_pool;
+
+  if (t->stack->guarded)
+    guard = (uint64_t)t->stack->base - STACK_PAGE_SIZE;
+
+  return addr >= guard && addr < guard + STACK_PAGE_SIZE;
+}
+
+void task_print_stack_usage(void)
+{
+  int i, irqflags;
+  struct task *t;
+  uint32_t task_id;
+  char name[16];
+  const uint64_t *base;
+  size_t size, max_used;
+  bool guarded;
+
+  printf("id  size  max_used   %%  guard name\r\n");
+  for (i = 0; i < ARRAY_SIZE(tasks_array); ++i) {
+    disable_irq_save_flags(irqflags);
+    if (!(tasks_busymask & (1<<i))) {
+      restore_irq_flags(irqflags);
+      continue;
+    }
+
+    t = &tasks_array[i];
+    task_id = t->task_id;
+    memcpy(name, t->name, sizeof(name));
+    base = t->stack->base;
+    size = t->stack->size;
+    guarded = t->stack->guarded;
+    restore_irq_flags(irqflags);
+
+    /*
+     * Paint is scanned with interrupts enabled, if the task exits meanwhile
+     * only its line is wrong
+     */
+    max_used = stack_max_used(base, size);
+    printf("%2d %5d %9d %3d %6s %s\r\n", task_id, (int)size, (int)max_used,
+      (int)(max_used * 100 / size), guarded ? "yes" : "no", name);
+  }
+}
+
+bool task_uses_fpsimd(const struct task *t)
+{
+  return armv8_fpsimd_is_used(t->fpsimd_ctx);
+}
+
 void mem_allocator_init(void)
 {
   tasks_busymask = 0;
   stacks_busymask = 0;
   cpuctx_busymask = 0;
+  memset(stack_pool_busy, 0, sizeof(stack_pool_busy));
+
+  /* Pool guard page, small stacks at the bottom do not overflow below it */
+  BUG_IF(mmu_set_guard_page((uint64_t)stack_pool, true) != SUCCESS,
+    "Failed to set stack pool guard page");
+  stack_units_mark(0, STACK_UNITS_PER_PAGE, true);
 }
@@ -0,0 +1,110 @@
+#include <trace.h>
+
+#if defined(CONFIG_TRACE)
+#include <cpu.h>
+#include <errcode.h>
+#include <common.h>
+
+/*
+ * Ring of TRACE_NUM_RECORDS records, record with sequence number seq is at
+ * seq % TRACE_NUM_RECORDS. Writer takes sequence number and stores record
+ * with interrupts disabled, so readers see only complete records.
+ */
+struct trace {
+  struct trace_rec recs[TRACE_NUM_RECORDS];
+  uint64_t next_seq;
+};
+
+uint32_t trace_mask = TRACE_CAT_ALL;
+
+static struct trace trace;
+
+void __trace_event(int ev, int arg0, uint32_t arg1)
+{
+  int irqflags;
+  struct trace_rec *r;
+
+  disable_irq_save_flags(irqflags);
+  r = &trace.recs[trace.next_seq++ % TRACE_NUM_RECORDS];
+  r->time = arm_timer_get_count();
+  r->ev = ev;
+  r->arg0 = arg0;
+  r->arg1 = arg1;
+  restore_irq_flags(irqflags);
+}
+
+void trace_set_mask(uint32_t mask)
+{
+  trace_mask = mask;
+}
+
+static inline uint64_t trace_oldest_seq_locked(void)
+{
+  if (trace.next_seq < TRACE_NUM_RECORDS)
+    return 0;
+  return trace.next_seq - TRACE_NUM_RECORDS;
+}
+
+uint64_t trace_oldest_seq(void)
+{
+  int irqflags;
+  uint64_t seq;
+
+  disable_irq_save_flags(irqflags);
+  seq = trace_oldest_seq_locked();
+  restore_irq_flags(irqflags);
+  return seq;
+}
+
+/* Records are copied in small chunks to keep interrupts latency low */
+#define TRACE_READ_CHUNK 32
+
+int trace_read(struct trace_rec *dst, int max, uint64_t *seq, uint64_t *lost)
+{
+  int irqflags;
+  int n = 0;
+  int i, chunk;
+  uint64_t oldest;
+
+  while (n < max) {
+    disable_irq_save_flags(irqflags);
+    oldest = trace_oldest_seq_locked();
+    if (*seq < oldest) {
+      *lost += oldest - *seq;
+      *seq = oldest;
+    }
+
+    chunk = MIN(max - n, TRACE_READ_CHUNK);
+    if (trace.next_seq - *seq < chunk)
+      chunk = trace.next_seq - *seq;
+
+    for (i = 0; i < chunk; ++i)
+      dst[n + i] = trace.recs[(*seq + i) % TRACE_NUM_RECORDS];
+    restore_irq_flags(irqflags);
+
+    if (!chunk)
+      break;
+
+    *seq += chunk;
+    n += chunk;
+  }
+
+  return n;
+}
+
+void trace_get_stats(struct trace_stats *stats)
+{
+  int irqflags;
+
+  disable_irq_save_flags(irqflags);
+  stats->num_records = trace.next_seq;
+  stats->num_overwritten = trace_oldest_seq_locked();
+  restore_irq_flags(irqflags);
+}
+
+int trace_init(void)
+{
+  trace.next_seq = 0;
+  return SUCCESS;
+}
+#endif
@@ -0,0 +1,141 @@
+#include <trace.h>
+
+#if defined(CONFIG_TRACE)
+#include <task.h>
+#include <uart_pl011.h>
+#include <cpu.h>
+#include <errcode.h>
+#include <common.h>
+#include <string.h>
+#include <printf.h>
+
+#define TRACE_DUMP_MAX_TASKS 32
+#define TRACE_DUMP_CHUNK 64
+#define TRACE_DUMP_LINE_BYTES 32
+
+struct trace_dump_tasks {
+  struct trace_dump_task tasks[TRACE_DUMP_MAX_TASKS];
+  int num;
+};
+
+static struct trace_dump_tasks trace_dump_tasks;
+static struct trace_rec trace_dump_recs[TRACE_DUMP_CHUNK];
+
+struct trace_dump_uart_line {
+  char buf[TRACE_DUMP_LINE_BYTES * 2 + 3];
+  int pos;
+};
+
+static struct trace_dump_uart_line trace_dump_line;
+
+static void trace_dump_task_cb(struct task *t, void *arg)
+{
+  struct trace_dump_tasks *d = arg;
+  struct trace_dump_task *dt;
+
+  if (d->num == ARRAY_SIZE(d->tasks))
+    return;
+
+  dt = &d->tasks[d->num++];
+  dt->task_id = t->task_id;
+  memcpy(dt->name, t->name, sizeof(dt->name));
+}
+
+int trace_dump(trace_dump_write_cb_t write, void *arg)
+{
+  int err;
+  int n;
+  int irqflags;
+  uint32_t mask;
+  uint64_t seq;
+  uint64_t lost = 0;
+  struct trace_stats stats;
+  struct trace_dump_header h;
+
+  /* Output path is traced too, keep it out of the dump */
+  mask = trace_mask;
+  trace_set_mask(0);
+
+  disable_irq_save_flags(irqflags);
+  trace_get_stats(&stats);
+  trace_dump_tasks.num = 0;
+  task_for_each(trace_dump_task_cb, &trace_dump_tasks);
+  restore_irq_flags(irqflags);
+
+  seq = stats.num_overwritten;
+
+  h.magic = TRACE_DUMP_MAGIC;
+  h.version = TRACE_DUMP_VERSION;
+  h.rec_size = sizeof(struct trace_rec);
+  h.timer_freq = arm_timer_get_freq();
+  h.num_tasks = trace_dump_tasks.num;
+  h.num_records = stats.num_records - stats.num_overwritten;
+  h.num_lost = stats.num_overwritten;
+
+  err = write(arg, &h, sizeof(h));
+  if (err != SUCCESS)
+    goto out;
+
+  err = write(arg, trace_dump_tasks.tasks,
+    trace_dump_tasks.num * sizeof(trace_dump_tasks.tasks[0]));
+  if (err != SUCCESS)
+    goto out;
+
+  while (seq < stats.num_records) {
+    n = MIN(stats.num_records - seq, TRACE_DUMP_CHUNK);
+    n = trace_read(trace_dump_recs, n, &seq, &lost);
+    if (!n)
+      break;
+
+    err = write(arg, trace_dump_recs, n * sizeof(trace_dump_recs[0]));
+    if (err != SUCCESS)
+      goto out;
+  }
+
+out:
+  trace_set_mask(mask);
+  return err;
+}
+
+static void trace_dump_uart_flush(struct trace_dump_uart_line *l)
+{
+  if (!l->pos)
+    return;
+
+  l->buf[l->pos++] = '\r';
+  l->buf[l->pos++] = '\n';
+  l->buf[l->pos] = 0;
+  uart_pl011_tx_wait_space(l->pos);
+  uart_pl011_send(l->buf, l->pos);
+  l->pos = 0;
+}
+
+static int trace_dump_uart_write(void *arg, const void *data, size_t size)
+{
+  static const char hex[] = "0123456789abcdef";
+  struct trace_dump_uart_line *l = arg;
+  const uint8_t *p = data;
+  size_t i;
+
+  for (i = 0; i < size; ++i) {
+    l->buf[l->pos++] = hex[p[i] >> 4];
+    l->buf[l->pos++] = hex[p[i] & 0xf];
+    if (l->pos == TRACE_DUMP_LINE_BYTES * 2)
+      trace_dump_uart_flush(l);
+  }
+
+  return SUCCESS;
+}
+
+int trace_dump_uart(void)
+{
+  int err;
+
+  printf("TRACE-DUMP-BEGIN\r\n");
+  trace_dump_line.pos = 0;
+  err = trace_dump(trace_dump_uart_write, &trace_dump_line);
+  trace_dump_uart_flush(&trace_dump_line);
+  printf("TRACE-DUMP-END\r\n");
+  return err;
+}
+#endif
@@ -5,50 +5,33 @@
 #include <sched.h>
 #include <os_api.h>
 #include <compiler.h>
-#include <bitmap.h>
-#include <mutex.h>
 #include <common.h>
 
-#define LOG_ENTRIES_COUNT 256
-
 /*
  * Logger data structure explained:
- * - there is a contignous array of entries, that form a circular buffer
- * - each entry has a fix-sized buffer, that can be filled with log message
- *   with sprintf
- * - entry is in one of 3 states: FREE,BUSY,READY
- * - because sprintf can be time consuming, in addition to standard 'push' and
- *   'pop' circular buffer has one extra operation 'take'
- * - a thread wishing to log a message, performs 'take' operation to occupy
- *   next free entry in a circular buffer. If there is are no free entries in
- *   a circular, the oldest entry is dropped and given to the caller.
- * - The owning thread now has to sprintf a text buffer in the entry and upon
- *   completion the entry as 'ready' and notify the logging thread.
- * - If multiple threads 'take' several entries in a row, it may take different
- *   amount of time to sprintf each buffer and they might perform 'mark_ready'
- *   in different order than they did the 'take' operation. In that case there
- *   will be a situation when logger thread will be notified that new entry
- *   is ready, but will not be able to progress until the earliest entry
- *   becomes ready. Examples when logger thread wants to write from position 0:
-
- *   | 0:ready | 1:ready | 2:ready |   <- logger thread will write entries
- *   0,1,2 as soon as it wakes up
+ * - log call does not format the message, it stores format string pointer,
+ *   timestamp and raw 64-bit arguments into a binary record, %s strings are
+ *   copied into the record, because they often live on caller's stack.
+ *   Formatting is done only in logger thread.
+ * - records have variable length and are placed one after another in a
+ *   circular byte buffer. If a record does not fit till the end of buffer,
+ *   the rest of buffer is filled with PAD record and the record is placed at
+ *   the start.
+ * - record is in one of 2 states: BUSY, READY. Caller reserves space for a
+ *   record with interrupts disabled, which is just moving the head, fills it
+ *   with interrupts enabled and marks it READY.
+ * - logger thread always takes the oldest record, marks it BUSY, while
+ *   formatting it, and then frees it. If the oldest record is still being
+ *   filled, logger thread sleeps until it becomes ready.
+ * - If there is no space for a new record, the oldest READY record is
+ *   dropped. If the oldest record is BUSY, the new message is skipped.
+ *   Number of skipped and dropped messages is tracked and output to log.
  *
- *   | 0:busy | 1:ready | 2:busy | 3:ready | <- logger thread will
- *   will wake up, see that entry 0 is not ready and will sleep until 0
- *   becomes ready
- * - If all entries are busy, logger thread will block or skip logging 
- *   completely on 'take' operation. Number of skipped and dropped entries is
- *   tracked and output to log
+ * ring: | rec0 | rec1 | rec2 | free ...          | PAD |
+ *         ^tail                ^head
  *
- * Suppose example entries array size is 3 items, initially tail and head
- * point to the start of array, number of items, we also have to
- * ready for writeout is 0
- * 
- * entries array: | 0 | 1 | 2 | nr_ready = 0, start_from=0
- *   ^tail
- *   ^head
- * 
+ * CPU runs kernel on one core, so there is one ring; a reservation is a
+ * few instructions with interrupts masked.
  */
 
 #if 0
@@ -63,100 +46,131 @@
 #define LOGGER_PUTS(__msg) ;
 #endif
 
+#define LOGGER_REC_ALIGN 8
+
 struct logger {
   struct event entry_is_ready_event;
 
-  struct mutex lock;
-
-  struct logger_entry *tail;
-  struct logger_entry *head;
-  struct logger_entry *array;
-  struct logger_entry *array_end;
-  size_t nr_ready;
-  size_t nr_busy;
-  size_t nr_entries;
+  uint8_t *ring;
+  size_t ring_size;
+  size_t head;
+  size_t tail;
+  size_t used;
   size_t nr_dropped;
   size_t nr_dropped_takes;
-  size_t offset;
   bool thread_active;
 };
 
 static struct logger logger = { 0 };
 
-static struct logger_entry *logger_take(void)
+static ALIGNED(LOGGER_REC_ALIGN) uint8_t logger_ring[LOGGER_RING_SIZE];
+
+static inline struct logger_rec *logger_rec_at(size_t offset)
+{
+  return (struct logger_rec *)(logger.ring + offset);
+}
+
+/* Frees the oldest record, skips padding after it */
+static void logger_advance_tail(void)
+{
+  struct logger_rec *r;
+
+  do {
+    r = logger_rec_at(logger.tail);
+    logger.used -= r->size;
+    logger.tail += r->size;
+    if (logger.tail == logger.ring_size)
+      logger.tail = 0;
+  } while (logger.used && logger_rec_at(logger.tail)->state
+    == LOGGER_REC_STATE_PAD);
+}
+
+static bool logger_drop_oldest(void)
 {
-  struct logger_entry *e;
+  if (!logger.used)
+    return false;
+
+  if (logger_rec_at(logger.tail)->state == LOGGER_REC_STATE_BUSY)
+    return false;
+
+  logger.nr_dropped++;
+  logger_advance_tail();
+  return true;
+}
+
+static struct logger_rec *logger_take(size_t size)
+{
+  struct logger_rec *r;
   int irqflag;
 
   disable_irq_save_flags(irqflag);
   LOGGER_PUTS("[logger_take]\r\n");
 
-  /*
-   * Case when all entries are busy - taken by other threads, almost
-   * impossible case
-   */
-  if (logger.nr_busy == logger.nr_entries) {
-    logger.nr_dropped++;
-    LOGGER_PUTS("[logger_take end rejected]\r\n");
-    restore_irq_flags(irqflag);
-    return NULL;
-  }
+  while (1) {
+    if (!logger.used)
+      logger.head = logger.tail = 0;
+
+    if (logger.head >= logger.tail && logger.used < logger.ring_size) {
+      if (logger.ring_size - logger.head >= size)
+        break;
+
+      if (logger.tail >= size) {
+        r = logger_rec_at(logger.head);
+        r->size = logger.ring_size - logger.head;
+        r->state = LOGGER_REC_STATE_PAD;
+        logger.used += r->size;
+        logger.head = 0;
+        break;
+      }
+    } else if (logger.tail - logger.head >= size)
+      break;
 
-  /*
-   * Case when there are no free entries, but not all busy, so READY can be
-   * dropped if it is the next to be taken, otherwise it is BUSY, then we can
-   * only wait or skip the current message
-   */
-  if (logger.nr_busy + logger.nr_ready == logger.nr_entries) {
-    if (logger.tail->state == LOGGER_ENT_STATE_BUSY) {
+    /*
+     * No space and the oldest record is still being written or printed,
+     * almost impossible case
+     */
+    if (!logger_drop_oldest()) {
       logger.nr_dropped_takes++;
-      restore_irq_flags(irqflag);
       LOGGER_PUTS("[logger_take end tail busy]\r\n");
+      restore_irq_flags(irqflag);
       return NULL;
     }
-
-    LOGGER_PUTS("[logger_take last msg dropped]\r\n");
-    logger.nr_ready--;
-    logger.nr_dropped++;
-    logger.tail->state = LOGGER_ENT_STATE_FREE;
-    logger.tail++;
-    if (logger.tail == logger.array_end)
-      logger.tail = logger.array;
-    if (logger.tail > logger.array_end) {
-      LOGGER_PUTS("[logger_take last msg dropped ERROR]\r\n");
-      while(1)
-        asm volatile("wfe");
-    }
   }
 
-  e = logger.head++;
-  if (logger.head == logger.array_end)
-    logger.head = logger.array;
-  logger.nr_busy++;
-  e->state = LOGGER_ENT_STATE_BUSY;
-  LOGGER_PRINTF("[logger_take end good] %p\r\n", e);
+  r = logger_rec_at(logger.head);
+  r->size = size;
+  r->state = LOGGER_REC_STATE_BUSY;
+  logger.head += size;
+  if (logger.head == logger.ring_size)
+    logger.head = 0;
+  logger.used += size;
+  LOGGER_PRINTF("[logger_take end good] %p\r\n", r);
   restore_irq_flags(irqflag);
-  return e;
+  return r;
 }
 
-static void logger_mark_ready(struct logger_entry *e)
+static void logger_mark_ready(struct logger_rec *r)
 {
   int irqflag;
   disable_irq_save_flags(irqflag);
-  LOGGER_PRINTF("[logger_mark_ready e:%p]\r\n", e);
-  logger.nr_ready++;
-  logger.nr_busy--;
-  e->state = LOGGER_ENT_STATE_READY;
+  LOGGER_PRINTF("[logger_mark_ready r:%p]\r\n", r);
+  r->state = LOGGER_REC_STATE_READY;
   os_event_notify(&logger.entry_is_ready_event);
-  LOGGER_PUTS("[logger_mark_ready end]\r\n");
   restore_irq_flags(irqflag);
 }
 
-#define STACK_CANARY 0xff112277
 void OPTIMIZED __os_log(const char *fmt, __builtin_va_list *args)
 {
   int irqflags;
-  struct logger_entry *e;
+  int i, argc;
+  uint32_t str_mask;
+  uint32_t str_cut_mask = 0;
+  uint64_t argv[LOGGER_MAX_ARGS];
+  size_t str_len[LOGGER_MAX_ARGS];
+  size_t size, offset;
+  uint64_t time;
+  const char *s;
+  struct logger_rec *r;
 
   if (!logger.thread_active) {
     disable_irq_save_flags(irqflags);
@@ -166,81 +180,121 @@ void OPTIMIZED __os_log(const char *fmt, __builtin_va_list *args)
     return;
   }
 
-  e = logger_take();
-  if (e) {
-    vsnprintf(e->buf, sizeof(e->buf), fmt, args);
-    logger_mark_ready(e);
+  time = arm_timer_get_count();
+  argc = vfmt_pack_args(fmt, args, argv, LOGGER_MAX_ARGS, &str_mask);
+  argc = MIN(argc, LOGGER_MAX_ARGS);
+  str_mask &= (1u << argc) - 1;
+
+  size = sizeof(*r) + argc * sizeof(argv[0]);
+  for (i = 0; i < argc; ++i) {
+    if (!(str_mask & (1u << i)))
+      continue;
+
+    s = (const char *)argv[i];
+    if (!s)
+      argv[i] = (uint64_t)(s = "(null)");
+
+    str_len[i] = strnlen(s, LOGGER_MAX_STR_LEN + 1);
+    if (str_len[i] > LOGGER_MAX_STR_LEN) {
+      str_len[i] = LOGGER_MAX_STR_LEN;
+      str_cut_mask |= 1u << i;
+    }
+    size += str_len[i] + 1;
   }
+  size = (size + LOGGER_REC_ALIGN - 1) & ~(LOGGER_REC_ALIGN - 1);
+
+  r = logger_take(size);
+  if (!r)
+    return;
+
+  r->argc = argc;
+  r->str_mask = str_mask;
+  r->time = time;
+  r->fmt = fmt;
+  offset = sizeof(*r) + argc * sizeof(argv[0]);
+  for (i = 0; i < argc; ++i) {
+    if (str_mask & (1u << i)) {
+      memcpy((char *)r + offset, (const char *)argv[i], str_len[i]);
+      if (str_cut_mask & (1u << i))
+        memcpy((char *)r + offset + str_len[i] - sizeof(LOGGER_STR_CUT_MARK)
+          + 1, LOGGER_STR_CUT_MARK, sizeof(LOGGER_STR_CUT_MARK) - 1);
+      ((char *)r)[offset + str_len[i]] = 0;
+      r->argv[i] = offset;
+      offset += str_len[i] + 1;
+    } else
+      r->argv[i] = argv[i];
+  }
+
+  logger_mark_ready(r);
 }
 
-static struct logger_entry *logger_pop_next_ready(void)
+static struct logger_rec *logger_pop_next_ready(void)
 {
-  struct logger_entry *e;
+  struct logger_rec *r;
   int irqflag;
-  volatile int canary = STACK_CANARY;
 
   disable_irq_save_flags(irqflag);
   LOGGER_PUTS("[logger_pop_next_ready]\r\n");
   while (1) {
-    if (logger.tail->state == LOGGER_ENT_STATE_READY)
+    r = logger_rec_at(logger.tail);
+    if (logger.used && r->state == LOGGER_REC_STATE_READY)
       break;
 
     os_event_clear(&logger.entry_is_ready_event);
     LOGGER_PUTS("[logger_pop_next_ready wait]\r\n");
     restore_irq_flags(irqflag);
     os_event_wait(&logger.entry_is_ready_event);
-    LOGGER_PRINTF("[logger_pop_next_ready wait end] %p, state:%d\r\n", logger.tail, logger.tail->state);
     disable_irq_save_flags(irqflag);
   }
 
-  e = logger.tail++;
-  if (logger.tail == logger.array_end)
-    logger.tail = logger.array;
-  if (logger.tail > logger.array_end) {
-    printf("!!!!\r\n");
-    while(1)
-    asm volatile("wfe");
-  }
-
-  logger.nr_ready--;
-  logger.nr_busy++;
-  e->state = LOGGER_ENT_STATE_BUSY;
+  /* Keeps writers from dropping the record while it is printed */
+  r->state = LOGGER_REC_STATE_BUSY;
   LOGGER_PUTS("[logger_pop_next_ready end]\r\n");
-  if (canary != STACK_CANARY) {
-    printf("!!!%p,%p,%p\r\n", logger.array, logger.array_end, e);
-    while(1);
-  }
   restore_irq_flags(irqflag);
-  return e;
+  return r;
 }
 
-static void logger_mark_free(struct logger_entry *e)
+static void logger_mark_free(void)
 {
   int irqflag;
 
   disable_irq_save_flags(irqflag);
-  e->state = LOGGER_ENT_STATE_FREE;
-  logger.nr_busy--;
+  logger_advance_tail();
   restore_irq_flags(irqflag);
-  /*
-   * Design idea - we can notify threads that want to log if they want to block
-   * while waiting for next free entry
-   */
-  // os_event_notify(&logger.entry_is_free_event);
 }
 
+/* Returns length of the formatted line */
+static int logger_format(const struct logger_rec *r, char *buf, size_t size)
+{
+  int i, n;
+  uint64_t argv[LOGGER_MAX_ARGS];
+  uint64_t usec;
+  uint32_t freq;
+
+  for (i = 0; i < r->argc; ++i) {
+    argv[i] = r->argv[i];
+    if (r->str_mask & (1u << i))
+      argv[i] = (uint64_t)((const char *)r + argv[i]);
+  }
 
-#define BITMAP_ARR_LEN ROUND_UP(LOG_ENTRIES_COUNT, sizeof(uint64_t))
+  freq = arm_timer_get_freq();
+  usec = (r->time % freq) * 1000000 / freq;
+  n = snprintf(buf, size, "[%5d.%06d] ", (int)(r->time / freq), (int)usec);
+  n = MIN(n, size);
+  n += vsnprintf_packed(buf + n, size - n, r->fmt, argv, r->argc);
+  return MIN(n, size - 1);
+}
 
-static struct logger_entry logger_entries[LOG_ENTRIES_COUNT];
+static char logger_line[LOGGER_MAX_LINE_LENGTH];
 
 static void logger_thread(void)
 {
-  struct logger_entry *e;
+  int len;
+  struct logger_rec *r;
   logger.thread_active = true;
 
   while(1) {
-    e = logger_pop_next_ready();
+    r = logger_pop_next_ready();
     if (logger.nr_dropped) {
       printf("log entries dropped: %d\r\n", logger.nr_dropped);
       logger.nr_dropped = 0;
@@ -250,8 +304,12 @@ static void logger_thread(void)
       logger.nr_dropped_takes = 0;
     }
 
-    puts(e->buf);
-    logger_mark_free(e);
+    len = logger_format(r, logger_line, sizeof(logger_line));
+    logger_mark_free();
+
+    /* Sleeps instead of spinning, while UART drains earlier lines */
+    uart_pl011_tx_wait_space(len);
+    puts(logger_line);
   }
 }
 
@@ -259,16 +317,14 @@ int logger_init(void)
 {
   struct task *t;
 
-  logger.head = logger.tail = logger.array = logger_entries;
-  logger.nr_entries = ARRAY_SIZE(logger_entries);
-  logger.array_end = logger.array + logger.nr_entries;
+  logger.ring = logger_ring;
+  logger.ring_size = sizeof(logger_ring);
+  logger.head = logger.tail = logger.used = 0;
   logger.nr_dropped = 0;
   logger.nr_dropped_takes = 0;
-  logger.nr_busy = 0;
-  logger.nr_ready = 0;
   logger.thread_active = false;
 
-  t = task_create(logger_thread, "logger");
+  t = task_create_ext(logger_thread, "logger", TASK_STACK_SIZE_MIN);
   if (!t) {
     printf("Failed to create logger task\r\n");
     return ERR_GENERIC;
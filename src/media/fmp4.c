@@ -0,0 +1,695 @@
+#include <media/fmp4.h>
+#include <vc/service_mmal_protocol.h>
+#include <errcode.h>
+#include <string.h>
+
+#define FMP4_TRACK_ID 1
+#define FMP4_MOVIE_TIMESCALE 1000
+
+#define FMP4_TFHD_DEFAULT_BASE_IS_MOOF 0x020000
+#define FMP4_TRUN_DATA_OFFSET 0x000001
+#define FMP4_TRUN_SAMPLE_DURATION 0x000100
+#define FMP4_TRUN_SAMPLE_SIZE 0x000200
+#define FMP4_TRUN_SAMPLE_FLAGS 0x000400
+
+/* sample_depends_on = 2 */
+#define FMP4_SAMPLE_FLAGS_SYNC 0x02000000
+/* sample_depends_on = 1, sample_is_non_sync_sample = 1 */
+#define FMP4_SAMPLE_FLAGS_NON_SYNC 0x01010000
+
+/* time, moof_offset, traf_number, trun_number, sample_number */
+#define FMP4_TFRA_ENTRY_SIZE (8 + 8 + 1 + 1 + 1)
+
+struct fmp4_box_writer {
+  uint8_t *buf;
+  size_t size;
+  size_t pos;
+};
+
+static void fmp4_put8(struct fmp4_box_writer *w, uint8_t v)
+{
+  if (w->pos < w->size)
+    w->buf[w->pos] = v;
+  w->pos++;
+}
+
+static void fmp4_put16(struct fmp4_box_writer *w, uint16_t v)
+{
+  fmp4_put8(w, v >> 8);
+  fmp4_put8(w, v);
+}
+
+static void fmp4_put32(struct fmp4_box_writer *w, uint32_t v)
+{
+  fmp4_put16(w, v >> 16);
+  fmp4_put16(w, v);
+}
+
+static void fmp4_put64(struct fmp4_box_writer *w, uint64_t v)
+{
+  fmp4_put32(w, v >> 32);
+  fmp4_put32(w, v);
+}
+
+static void fmp4_put_bytes(struct fmp4_box_writer *w, const void *data,
+  size_t size)
+{
+  const uint8_t *p = data;
+
+  while (size--)
+    fmp4_put8(w, *p++);
+}
+
+static void fmp4_put_zeros(struct fmp4_box_writer *w, size_t size)
+{
+  while (size--)
+    fmp4_put8(w, 0);
+}
+
+static void fmp4_put_fourcc(struct fmp4_box_writer *w, const char *fourcc)
+{
+  fmp4_put_bytes(w, fourcc, 4);
+}
+
+static void fmp4_patch32(struct fmp4_box_writer *w, size_t pos, uint32_t v)
+{
+  if (pos + 4 > w->size)
+    return;
+
+  w->buf[pos] = v >> 24;
+  w->buf[pos + 1] = v >> 16;
+  w->buf[pos + 2] = v >> 8;
+  w->buf[pos + 3] = v;
+}
+
+static size_t fmp4_box_begin(struct fmp4_box_writer *w, const char *type)
+{
+  size_t start = w->pos;
+
+  fmp4_put32(w, 0);
+  fmp4_put_fourcc(w, type);
+  return start;
+}
+
+static size_t fmp4_full_box_begin(struct fmp4_box_writer *w, const char *type,
+  uint8_t version, uint32_t flags)
+{
+  size_t start = fmp4_box_begin(w, type);
+
+  fmp4_put32(w, ((uint32_t)version << 24) | flags);
+  return start;
+}
+
+static void fmp4_box_end(struct fmp4_box_writer *w, size_t start)
+{
+  fmp4_patch32(w, start, w->pos - start);
+}
+
+static void fmp4_put_matrix(struct fmp4_box_writer *w)
+{
+  fmp4_put32(w, 0x00010000);
+  fmp4_put32(w, 0);
+  fmp4_put32(w, 0);
+  fmp4_put32(w, 0);
+  fmp4_put32(w, 0x00010000);
+  fmp4_put32(w, 0);
+  fmp4_put32(w, 0);
+  fmp4_put32(w, 0);
+  fmp4_put32(w, 0x40000000);
+}
+
+static void fmp4_writer_init(struct fmp4_muxer *m, struct fmp4_box_writer *w)
+{
+  w->buf = m->box_buf;
+  w->size = sizeof(m->box_buf);
+  w->pos = 0;
+}
+
+static int fmp4_write(struct fmp4_muxer *m, const void *data, size_t size)
+{
+  int err;
+
+  err = m->config.write(m->config.write_arg, data, size);
+  if (err != SUCCESS) {
+    m->err = err;
+    return err;
+  }
+
+  m->offset += size;
+  m->stats.bytes_written += size;
+  return SUCCESS;
+}
+
+static int fmp4_sync(struct fmp4_muxer *m)
+{
+  int err;
+
+  if (!m->config.sync)
+    return SUCCESS;
+
+  err = m->config.sync(m->config.write_arg);
+  if (err != SUCCESS)
+    m->err = err;
+
+  return err;
+}
+
+static int fmp4_write_box_buf(struct fmp4_muxer *m,
+  const struct fmp4_box_writer *w)
+{
+  if (w->pos > w->size) {
+    m->err = ERR_RESOURCE;
+    return m->err;
+  }
+
+  return fmp4_write(m, w->buf, w->pos);
+}
+
+static void fmp4_put_avcc(struct fmp4_muxer *m, struct fmp4_box_writer *w)
+{
+  size_t avcc = fmp4_box_begin(w, "avcC");
+  const struct h264_sps_info *s = &m->sps_info;
+
+  fmp4_put8(w, 1);
+  fmp4_put8(w, s->profile_idc);
+  fmp4_put8(w, s->constraint_flags);
+  fmp4_put8(w, s->level_idc);
+  /* lengthSizeMinusOne = 3 */
+  fmp4_put8(w, 0xff);
+  /* one SPS */
+  fmp4_put8(w, 0xe1);
+  fmp4_put16(w, m->sps_size);
+  fmp4_put_bytes(w, m->sps, m->sps_size);
+  fmp4_put8(w, 1);
+  fmp4_put16(w, m->pps_size);
+  fmp4_put_bytes(w, m->pps, m->pps_size);
+
+  if (s->profile_idc == 100 || s->profile_idc == 110 || s->profile_idc == 122
+    || s->profile_idc == 144) {
+    fmp4_put8(w, 0xfc | s->chroma_format_idc);
+    fmp4_put8(w, 0xf8 | (s->bit_depth_luma - 8));
+    fmp4_put8(w, 0xf8 | (s->bit_depth_chroma - 8));
+    /* numOfSequenceParameterSetExt */
+    fmp4_put8(w, 0);
+  }
+  fmp4_box_end(w, avcc);
+}
+
+static void fmp4_put_stbl(struct fmp4_muxer *m, struct fmp4_box_writer *w)
+{
+  size_t stbl, stsd, avc1, b;
+
+  stbl = fmp4_box_begin(w, "stbl");
+
+  stsd = fmp4_full_box_begin(w, "stsd", 0, 0);
+  fmp4_put32(w, 1);
+  avc1 = fmp4_box_begin(w, "avc1");
+  fmp4_put_zeros(w, 6);
+  /* data_reference_index */
+  fmp4_put16(w, 1);
+  fmp4_put_zeros(w, 16);
+  fmp4_put16(w, m->sps_info.width);
+  fmp4_put16(w, m->sps_info.height);
+  /* 72 dpi */
+  fmp4_put32(w, 0x00480000);
+  fmp4_put32(w, 0x00480000);
+  fmp4_put32(w, 0);
+  /* frame_count */
+  fmp4_put16(w, 1);
+  /* compressorname */
+  fmp4_put_zeros(w, 32);
+  /* depth */
+  fmp4_put16(w, 0x0018);
+  fmp4_put16(w, 0xffff);
+  fmp4_put_avcc(m, w);
+  fmp4_box_end(w, avc1);
+  fmp4_box_end(w, stsd);
+
+  /* Samples are all in fragments, sample tables are empty */
+  b = fmp4_full_box_begin(w, "stts", 0, 0);
+  fmp4_put32(w, 0);
+  fmp4_box_end(w, b);
+
+  b = fmp4_full_box_begin(w, "stsc", 0, 0);
+  fmp4_put32(w, 0);
+  fmp4_box_end(w, b);
+
+  b = fmp4_full_box_begin(w, "stsz", 0, 0);
+  fmp4_put32(w, 0);
+  fmp4_put32(w, 0);
+  fmp4_box_end(w, b);
+
+  b = fmp4_full_box_begin(w, "stco", 0, 0);
+  fmp4_put32(w, 0);
+  fmp4_box_end(w, b);
+
+  fmp4_box_end(w, stbl);
+}
+
+static void fmp4_put_trak(struct fmp4_muxer *m, struct fmp4_box_writer *w)
+{
+  size_t trak, mdia, minf, dinf, dref, b;
+
+  trak = fmp4_box_begin(w, "trak");
+
+  /* track_enabled | track_in_movie */
+  b = fmp4_full_box_begin(w, "tkhd", 0, 3);
+  fmp4_put32(w, 0);
+  fmp4_put32(w, 0);
+  fmp4_put32(w, FMP4_TRACK_ID);
+  fmp4_put32(w, 0);
+  /* duration */
+  fmp4_put32(w, 0);
+  fmp4_put_zeros(w, 8);
+  /* layer, alternate_group, volume, reserved */
+  fmp4_put_zeros(w, 8);
+  fmp4_put_matrix(w);
+  fmp4_put32(w, (uint32_t)m->sps_info.width << 16);
+  fmp4_put32(w, (uint32_t)m->sps_info.height << 16);
+  fmp4_box_end(w, b);
+
+  mdia = fmp4_box_begin(w, "mdia");
+
+  b = fmp4_full_box_begin(w, "mdhd", 0, 0);
+  fmp4_put32(w, 0);
+  fmp4_put32(w, 0);
+  fmp4_put32(w, FMP4_TIMESCALE);
+  fmp4_put32(w, 0);
+  /* language 'und' */
+  fmp4_put16(w, 0x55c4);
+  fmp4_put16(w, 0);
+  fmp4_box_end(w, b);
+
+  b = fmp4_full_box_begin(w, "hdlr", 0, 0);
+  fmp4_put32(w, 0);
+  fmp4_put_fourcc(w, "vide");
+  fmp4_put_zeros(w, 12);
+  fmp4_put_bytes(w, "VideoHandler", sizeof("VideoHandler"));
+  fmp4_box_end(w, b);
+
+  minf = fmp4_box_begin(w, "minf");
+
+  b = fmp4_full_box_begin(w, "vmhd", 0, 1);
+  fmp4_put_zeros(w, 8);
+  fmp4_box_end(w, b);
+
+  dinf = fmp4_box_begin(w, "dinf");
+  dref = fmp4_full_box_begin(w, "dref", 0, 0);
+  fmp4_put32(w, 1);
+  /* media data is in the same file */
+  b = fmp4_full_box_begin(w, "url ", 0, 1);
+  fmp4_box_end(w, b);
+  fmp4_box_end(w, dref);
+  fmp4_box_end(w, dinf);
+
+  fmp4_put_stbl(m, w);
+
+  fmp4_box_end(w, minf);
+  fmp4_box_end(w, mdia);
+  fmp4_box_end(w, trak);
+}
+
+static int fmp4_write_header(struct fmp4_muxer *m)
+{
+  struct fmp4_box_writer w;
+  size_t moov, mvex, b;
+
+  fmp4_writer_init(m, &w);
+
+  b = fmp4_box_begin(&w, "ftyp");
+  fmp4_put_fourcc(&w, "isom");
+  fmp4_put32(&w, 0x200);
+  fmp4_put_fourcc(&w, "isom");
+  fmp4_put_fourcc(&w, "iso5");
+  fmp4_put_fourcc(&w, "iso6");
+  fmp4_put_fourcc(&w, "avc1");
+  fmp4_put_fourcc(&w, "mp41");
+  fmp4_box_end(&w, b);
+
+  moov = fmp4_box_begin(&w, "moov");
+
+  b = fmp4_full_box_begin(&w, "mvhd", 0, 0);
+  fmp4_put32(&w, 0);
+  fmp4_put32(&w, 0);
+  fmp4_put32(&w, FMP4_MOVIE_TIMESCALE);
+  fmp4_put32(&w, 0);
+  /* rate 1.0, volume 1.0 */
+  fmp4_put32(&w, 0x00010000);
+  fmp4_put16(&w, 0x0100);
+  fmp4_put_zeros(&w, 10);
+  fmp4_put_matrix(&w);
+  fmp4_put_zeros(&w, 24);
+  /* next_track_ID */
+  fmp4_put32(&w, FMP4_TRACK_ID + 1);
+  fmp4_box_end(&w, b);
+
+  fmp4_put_trak(m, &w);
+
+  mvex = fmp4_box_begin(&w, "mvex");
+  b = fmp4_full_box_begin(&w, "trex", 0, 0);
+  fmp4_put32(&w, FMP4_TRACK_ID);
+  /* default_sample_description_index */
+  fmp4_put32(&w, 1);
+  fmp4_put32(&w, 0);
+  fmp4_put32(&w, 0);
+  fmp4_put32(&w, 0);
+  fmp4_box_end(&w, b);
+  fmp4_box_end(&w, mvex);
+
+  fmp4_box_end(&w, moov);
+
+  return fmp4_write_box_buf(m, &w);
+}
+
+static int fmp4_write_fragment(struct fmp4_muxer *m)
+{
+  int err;
+  int i;
+  struct fmp4_box_writer w;
+  size_t moof, traf, trun, data_offset_pos, b;
+  uint64_t moof_offset = m->offset;
+  uint64_t duration = 0;
+  const struct fmp4_sample *s;
+
+  fmp4_writer_init(m, &w);
+
+  moof = fmp4_box_begin(&w, "moof");
+
+  b = fmp4_full_box_begin(&w, "mfhd", 0, 0);
+  fmp4_put32(&w, ++m->sequence_number);
+  fmp4_box_end(&w, b);
+
+  traf = fmp4_box_begin(&w, "traf");
+
+  b = fmp4_full_box_begin(&w, "tfhd", 0, FMP4_TFHD_DEFAULT_BASE_IS_MOOF);
+  fmp4_put32(&w, FMP4_TRACK_ID);
+  fmp4_box_end(&w, b);
+
+  b = fmp4_full_box_begin(&w, "tfdt", 1, 0);
+  fmp4_put64(&w, m->frag_time);
+  fmp4_box_end(&w, b);
+
+  trun = fmp4_full_box_begin(&w, "trun", 0, FMP4_TRUN_DATA_OFFSET
+    | FMP4_TRUN_SAMPLE_DURATION | FMP4_TRUN_SAMPLE_SIZE
+    | FMP4_TRUN_SAMPLE_FLAGS);
+  fmp4_put32(&w, m->num_samples);
+  data_offset_pos = w.pos;
+  fmp4_put32(&w, 0);
+  for (i = 0; i < m->num_samples; ++i) {
+    s = &m->samples[i];
+    fmp4_put32(&w, s->duration);
+    fmp4_put32(&w, s->size);
+    fmp4_put32(&w, s->sync ? FMP4_SAMPLE_FLAGS_SYNC
+      : FMP4_SAMPLE_FLAGS_NON_SYNC);
+    duration += s->duration;
+  }
+  fmp4_box_end(&w, trun);
+  fmp4_box_end(&w, traf);
+  fmp4_box_end(&w, moof);
+
+  /* Sample data starts right after mdat header */
+  fmp4_patch32(&w, data_offset_pos, w.pos - moof + 8);
+
+  fmp4_put32(&w, m->frag_len + 8);
+  fmp4_put_fourcc(&w, "mdat");
+
+  err = fmp4_write_box_buf(m, &w);
+  if (err != SUCCESS)
+    return err;
+
+  err = fmp4_write(m, m->config.frag_buf, m->frag_len);
+  if (err != SUCCESS)
+    return err;
+
+  if (m->samples[0].sync && m->num_index < m->config.index_size) {
+    m->config.index[m->num_index].time = m->frag_time;
+    m->config.index[m->num_index].moof_offset = moof_offset;
+    m->num_index++;
+  }
+
+  m->stats.fragments++;
+  m->frag_time += duration;
+  m->num_samples = 0;
+  m->frag_len = 0;
+  return fmp4_sync(m);
+}
+
+static int fmp4_write_index(struct fmp4_muxer *m)
+{
+  int err;
+  int i;
+  struct fmp4_box_writer w;
+  const struct fmp4_index_entry *e;
+  uint32_t tfra_size = 24 + m->num_index * FMP4_TFRA_ENTRY_SIZE;
+  uint32_t mfra_size = 8 + tfra_size + 16;
+
+  fmp4_writer_init(m, &w);
+  fmp4_put32(&w, mfra_size);
+  fmp4_put_fourcc(&w, "mfra");
+  fmp4_put32(&w, tfra_size);
+  fmp4_put_fourcc(&w, "tfra");
+  fmp4_put32(&w, 0x01000000);
+  fmp4_put32(&w, FMP4_TRACK_ID);
+  /* 1-byte traf, trun and sample numbers */
+  fmp4_put32(&w, 0);
+  fmp4_put32(&w, m->num_index);
+
+  for (i = 0; i < m->num_index; ++i) {
+    if (w.pos + FMP4_TFRA_ENTRY_SIZE > w.size) {
+      err = fmp4_write_box_buf(m, &w);
+      if (err != SUCCESS)
+        return err;
+      fmp4_writer_init(m, &w);
+    }
+
+    e = &m->config.index[i];
+    fmp4_put64(&w, e->time);
+    fmp4_put64(&w, e->moof_offset);
+    fmp4_put8(&w, 1);
+    fmp4_put8(&w, 1);
+    fmp4_put8(&w, 1);
+  }
+
+  if (w.pos + 16 > w.size) {
+    err = fmp4_write_box_buf(m, &w);
+    if (err != SUCCESS)
+      return err;
+    fmp4_writer_init(m, &w);
+  }
+
+  fmp4_put32(&w, 16);
+  fmp4_put_fourcc(&w, "mfro");
+  fmp4_put32(&w, 0);
+  fmp4_put32(&w, mfra_size);
+  return fmp4_write_box_buf(m, &w);
+}
+
+static void fmp4_store_param_set(uint8_t *dst, size_t *dst_size,
+  const struct h264_nal *nal)
+{
+  if (nal->size > FMP4_MAX_PARAM_SET_SIZE)
+    return;
+
+  memcpy(dst, nal->data, nal->size);
+  *dst_size = nal->size;
+}
+
+static inline bool fmp4_nal_in_sample(int type)
+{
+  return type != H264_NAL_SPS && type != H264_NAL_PPS && type != H264_NAL_AUD;
+}
+
+static inline int64_t fmp4_pts_to_time(int64_t pts)
+{
+  return pts * FMP4_TIMESCALE / 1000000;
+}
+
+static void fmp4_frame_dropped(struct fmp4_muxer *m)
+{
+  /* Following frames reference the lost one, wait for the next keyframe */
+  m->stats.frames_dropped++;
+  m->wait_keyframe = true;
+}
+
+/* Adds complete Annex-B frame as a sample */
+static int fmp4_add_frame(struct fmp4_muxer *m, const uint8_t *data,
+  size_t size, bool key, int64_t pts)
+{
+  int err;
+  const uint8_t *pos = data;
+  const uint8_t *end = data + size;
+  struct h264_nal nal;
+  struct h264_sps_info sps_info;
+  struct fmp4_sample *s;
+  size_t sample_size = 0;
+  int64_t duration;
+  uint8_t *dst;
+
+  while (h264_nal_next(&pos, end, &nal)) {
+    if (nal.type == H264_NAL_SPS) {
+      if (h264_sps_parse(&nal, &sps_info) == SUCCESS && !m->header_written) {
+        m->sps_info = sps_info;
+        fmp4_store_param_set(m->sps, &m->sps_size, &nal);
+      }
+    } else if (nal.type == H264_NAL_PPS) {
+      if (!m->header_written)
+        fmp4_store_param_set(m->pps, &m->pps_size, &nal);
+    } else if (nal.type == H264_NAL_IDR) {
+      key = true;
+    }
+
+    if (fmp4_nal_in_sample(nal.type))
+      sample_size += 4 + nal.size;
+  }
+
+  if (!sample_size)
+    return SUCCESS;
+
+  if (sample_size > m->config.frag_buf_size) {
+    fmp4_frame_dropped(m);
+    return SUCCESS;
+  }
+
+  if (m->wait_keyframe) {
+    if (!key || !m->sps_size || !m->pps_size) {
+      m->stats.frames_dropped++;
+      return SUCCESS;
+    }
+
+    if (!m->header_written) {
+      err = fmp4_write_header(m);
+      if (err != SUCCESS)
+        return err;
+      m->header_written = true;
+    }
+    m->wait_keyframe = false;
+  }
+
+  if (m->num_samples) {
+    if (pts >= 0 && m->last_pts >= 0) {
+      duration = fmp4_pts_to_time(pts) - fmp4_pts_to_time(m->last_pts);
+      if (duration > 0)
+        m->samples[m->num_samples - 1].duration = duration;
+    }
+
+    if (key || m->num_samples == FMP4_MAX_FRAGMENT_SAMPLES
+      || m->frag_len + sample_size > m->config.frag_buf_size) {
+      err = fmp4_write_fragment(m);
+      if (err != SUCCESS)
+        return err;
+    }
+  }
+
+  dst = m->config.frag_buf + m->frag_len;
+  pos = data;
+  while (h264_nal_next(&pos, end, &nal)) {
+    if (!fmp4_nal_in_sample(nal.type))
+      continue;
+
+    dst[0] = nal.size >> 24;
+    dst[1] = nal.size >> 16;
+    dst[2] = nal.size >> 8;
+    dst[3] = nal.size;
+    memcpy(dst + 4, nal.data, nal.size);
+    dst += 4 + nal.size;
+  }
+
+  s = &m->samples[m->num_samples++];
+  s->size = sample_size;
+  s->duration = m->default_duration;
+  s->sync = key;
+  m->frag_len += sample_size;
+  m->last_pts = pts;
+
+  m->stats.frames++;
+  if (key)
+    m->stats.keyframes++;
+  return SUCCESS;
+}
+
+int fmp4_muxer_init(struct fmp4_muxer *m, const struct fmp4_config *config)
+{
+  if (!config->write || !config->frag_buf || !config->frag_buf_size
+    || config->frame_rate <= 0)
+    return ERR_INVAL;
+
+  memset(m, 0, sizeof(*m));
+  m->config = *config;
+  m->default_duration = FMP4_TIMESCALE / config->frame_rate;
+  m->last_pts = -1;
+  m->wait_keyframe = true;
+  return SUCCESS;
+}
+
+int fmp4_muxer_push(struct fmp4_muxer *m, const void *data, size_t size,
+  uint32_t flags, int64_t pts)
+{
+  int err;
+  bool key = flags & MMAL_BUFFER_HEADER_FLAG_KEYFRAME;
+
+  if (m->err)
+    return m->err;
+
+  /* Codec config carries only SPS and PPS */
+  if (flags & MMAL_BUFFER_HEADER_FLAG_CONFIG)
+    return fmp4_add_frame(m, data, size, false, pts);
+
+  /* Frame in a single buffer is taken directly from it */
+  if (!m->frame_len && !m->frame_overflow && (flags & MMAL_BUFFER_HEADER_FLAG_FRAME_END))
+    return fmp4_add_frame(m, data, size, key, pts);
+
+  if (!m->frame_len && !m->frame_overflow) {
+    m->frame_key = false;
+    m->frame_pts = pts;
+  }
+  m->frame_key |= key;
+
+  if (!m->frame_overflow) {
+    if (m->config.frame_buf
+      && m->frame_len + size <= m->config.frame_buf_size) {
+      memcpy(m->config.frame_buf + m->frame_len, data, size);
+      m->frame_len += size;
+    } else {
+      /* Frame does not fit, drop it when it ends */
+      m->frame_overflow = true;
+    }
+  }
+
+  if (!(flags & MMAL_BUFFER_HEADER_FLAG_FRAME_END))
+    return SUCCESS;
+
+  if (m->frame_overflow) {
+    m->frame_overflow = false;
+    m->frame_len = 0;
+    fmp4_frame_dropped(m);
+    return SUCCESS;
+  }
+
+  err = fmp4_add_frame(m, m->config.frame_buf, m->frame_len, m->frame_key,
+    m->frame_pts);
+  m->frame_len = 0;
+  return err;
+}
+
+int fmp4_muxer_finish(struct fmp4_muxer *m)
+{
+  int err;
+
+  if (m->err)
+    return m->err;
+
+  if (m->num_samples) {
+    err = fmp4_write_fragment(m);
+    if (err != SUCCESS)
+      return err;
+  }
+
+  if (!m->offset)
+    return SUCCESS;
+
+  err = fmp4_write_index(m);
+  if (err != SUCCESS)
+    return err;
+
+  return fmp4_sync(m);
+}
@@ -0,0 +1,36 @@
+#include <media/fmp4_fat32.h>
+#include <errcode.h>
+#include <trace.h>
+
+int fmp4_fat32_open(struct fmp4_fat32_file *f, const struct fat32_fs *fs,
+  const char *path)
+{
+  int err;
+
+  err = fat32_create(fs, path, false, false);
+  if (err != SUCCESS)
+    return err;
+
+  return fat32_append_open(&f->a, fs, path);
+}
+
+/*
+ * Data goes to clusters right after the last one written, file size in
+ * directory entry is only updated by fmp4_fat32_sync, that muxer calls once
+ * per fragment. After power loss the file ends at the last complete
+ * fragment.
+ */
+int fmp4_fat32_write(void *arg, const void *data, size_t size)
+{
+  struct fmp4_fat32_file *f = arg;
+
+  trace_event(TRACE_EV_FMP4_WRITE, 0, size);
+  return fat32_append_write(&f->a, data, size);
+}
+
+int fmp4_fat32_sync(void *arg)
+{
+  struct fmp4_fat32_file *f = arg;
+
+  return fat32_append_sync(&f->a);
+}
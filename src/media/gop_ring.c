@@ -0,0 +1,291 @@
+#include <media/gop_ring.h>
+#include <vc/service_mmal_protocol.h>
+#include <errcode.h>
+#include <string.h>
+#include <cpu.h>
+
+static inline struct gop_ring_record *gop_ring_rec(struct gop_ring *r,
+  uint64_t seq)
+{
+  return &r->records[seq % r->max_records];
+}
+
+static inline int gop_ring_count(const struct gop_ring *r)
+{
+  return r->next_seq - r->first_seq;
+}
+
+/* Returns sequence number of the GOP start following the oldest one */
+static uint64_t gop_ring_next_gop(struct gop_ring *r)
+{
+  uint64_t seq = r->first_seq + 1;
+
+  while (seq < r->next_seq && !gop_ring_rec(r, seq)->gop_start)
+    seq++;
+  return seq;
+}
+
+/* Evicts oldest GOP, fails if reader holds one of its records */
+static bool gop_ring_evict_gop(struct gop_ring *r)
+{
+  uint64_t seq;
+
+  if (!gop_ring_count(r))
+    return false;
+
+  seq = gop_ring_next_gop(r);
+  if (r->reader_active && r->read_seq < seq) {
+    if (r->reader_busy && !r->reader_config_pending)
+      return false;
+
+    r->stats.reader_buffers_lost += seq - r->read_seq;
+    r->read_seq = seq;
+  }
+
+  r->first_seq = seq;
+  r->stats.gops_evicted++;
+  if (!gop_ring_count(r))
+    r->head = 0;
+  return true;
+}
+
+/*
+ * Finds place for size bytes after the newest record. Free space is never
+ * filled completely, so head == tail only when the ring is empty.
+ */
+static bool gop_ring_alloc(struct gop_ring *r, size_t size, uint32_t *offset)
+{
+  size_t tail;
+
+  if (!gop_ring_count(r)) {
+    *offset = 0;
+    return size < r->buf_size;
+  }
+
+  tail = gop_ring_rec(r, r->first_seq)->offset;
+  if (r->head >= tail) {
+    if (r->head + size <= r->buf_size) {
+      *offset = r->head;
+      return true;
+    }
+
+    if (size < tail) {
+      *offset = 0;
+      return true;
+    }
+    return false;
+  }
+
+  if (r->head + size < tail) {
+    *offset = r->head;
+    return true;
+  }
+  return false;
+}
+
+/* Keeps the newest GOP, that starts at least window_us before newest frame */
+static void gop_ring_apply_window(struct gop_ring *r)
+{
+  uint64_t seq;
+  const struct gop_ring_record *rec;
+
+  while (1) {
+    seq = gop_ring_next_gop(r);
+    if (seq == r->next_seq)
+      break;
+
+    rec = gop_ring_rec(r, seq);
+    if (rec->pts < 0 || r->newest_pts - rec->pts < r->window_us)
+      break;
+
+    if (!gop_ring_evict_gop(r))
+      break;
+  }
+}
+
+void gop_ring_init(struct gop_ring *r, void *buf, size_t buf_size,
+  struct gop_ring_record *records, int max_records, int window_ms)
+{
+  memset(r, 0, sizeof(*r));
+  r->buf = buf;
+  r->buf_size = buf_size;
+  r->records = records;
+  r->max_records = max_records;
+  r->window_us = (int64_t)window_ms * 1000;
+  r->wait_keyframe = true;
+  r->prev_frame_end = true;
+}
+
+void gop_ring_push(struct gop_ring *r, const void *data, size_t size,
+  uint32_t flags, int64_t pts)
+{
+  int irqflags;
+  uint32_t offset;
+  bool gop_start;
+  struct gop_ring_record *rec;
+
+  disable_irq_save_flags(irqflags);
+
+  if (flags & MMAL_BUFFER_HEADER_FLAG_CONFIG) {
+    /* Reader may be giving out the config right now */
+    if (size <= sizeof(r->config)
+      && !(r->reader_busy && r->reader_config_pending)) {
+      memcpy(r->config, data, size);
+      r->config_size = size;
+      r->config_flags = flags;
+    }
+    goto out;
+  }
+
+  gop_start = r->prev_frame_end && (flags & MMAL_BUFFER_HEADER_FLAG_KEYFRAME);
+  r->prev_frame_end = flags & MMAL_BUFFER_HEADER_FLAG_FRAME_END;
+
+  if (!size)
+    goto out;
+
+  if (r->wait_keyframe) {
+    if (!gop_start) {
+      r->stats.buffers_dropped++;
+      goto out;
+    }
+    r->wait_keyframe = false;
+  }
+
+  while (gop_ring_count(r) == r->max_records
+    || !gop_ring_alloc(r, size, &offset)) {
+    /* Without older GOPs the rest of current GOP is useless */
+    if (!gop_ring_evict_gop(r) || (!gop_ring_count(r) && !gop_start)) {
+      r->stats.buffers_dropped++;
+      r->wait_keyframe = true;
+      goto out;
+    }
+  }
+
+  r->head = offset + size;
+  restore_irq_flags(irqflags);
+
+  /*
+   * Reserved space is not visible to reader until the record is published,
+   * so data is copied with interrupts enabled.
+   */
+  memcpy(r->buf + offset, data, size);
+
+  disable_irq_save_flags(irqflags);
+  rec = gop_ring_rec(r, r->next_seq);
+  rec->offset = offset;
+  rec->size = size;
+  rec->flags = flags;
+  rec->gop_start = gop_start;
+  rec->pts = pts;
+  r->next_seq++;
+  r->stats.buffers_stored++;
+
+  if (pts >= 0) {
+    r->newest_pts = pts;
+    gop_ring_apply_window(r);
+  }
+
+out:
+  restore_irq_flags(irqflags);
+}
+
+void gop_ring_trigger(struct gop_ring *r)
+{
+  int irqflags;
+
+  disable_irq_save_flags(irqflags);
+  r->reader_active = true;
+  r->reader_busy = false;
+  r->reader_config_pending = r->config_size > 0;
+  r->read_seq = r->first_seq;
+  restore_irq_flags(irqflags);
+}
+
+void gop_ring_stop(struct gop_ring *r)
+{
+  int irqflags;
+
+  disable_irq_save_flags(irqflags);
+  r->reader_active = false;
+  r->reader_busy = false;
+  restore_irq_flags(irqflags);
+}
+
+int gop_ring_read_begin(struct gop_ring *r, struct gop_ring_buf *b)
+{
+  int err = SUCCESS;
+  int irqflags;
+  const struct gop_ring_record *rec;
+
+  disable_irq_save_flags(irqflags);
+  if (!r->reader_active) {
+    err = ERR_INVAL;
+    goto out;
+  }
+
+  if (r->reader_config_pending) {
+    b->data = r->config;
+    b->size = r->config_size;
+    b->flags = r->config_flags;
+    b->pts = (int64_t)MMAL_TIME_UNKNOWN;
+    r->reader_busy = true;
+    goto out;
+  }
+
+  if (r->read_seq == r->next_seq) {
+    err = ERR_NOT_FOUND;
+    goto out;
+  }
+
+  rec = gop_ring_rec(r, r->read_seq);
+  b->data = r->buf + rec->offset;
+  b->size = rec->size;
+  b->flags = rec->flags;
+  b->pts = rec->pts;
+  r->reader_busy = true;
+
+out:
+  restore_irq_flags(irqflags);
+  return err;
+}
+
+void gop_ring_read_end(struct gop_ring *r)
+{
+  int irqflags;
+
+  disable_irq_save_flags(irqflags);
+  if (r->reader_config_pending)
+    r->reader_config_pending = false;
+  else
+    r->read_seq++;
+  r->reader_busy = false;
+  restore_irq_flags(irqflags);
+}
+
+int gop_ring_drain(struct gop_ring *r, struct fmp4_muxer *m, int max_bufs)
+{
+  int err;
+  int n;
+  struct gop_ring_buf b;
+
+  for (n = 0; n < max_bufs; ++n) {
+    if (gop_ring_read_begin(r, &b) != SUCCESS)
+      break;
+
+    err = fmp4_muxer_push(m, b.data, b.size, b.flags, b.pts);
+    gop_ring_read_end(r);
+    if (err != SUCCESS)
+      return err;
+  }
+
+  return n;
+}
+
+void gop_ring_get_stats(struct gop_ring *r, struct gop_ring_stats *stats)
+{
+  int irqflags;
+
+  disable_irq_save_flags(irqflags);
+  *stats = r->stats;
+  restore_irq_flags(irqflags);
+}
@@ -0,0 +1,263 @@
+#include <media/h264.h>
+#include <errcode.h>
+
+/*
+ * Reads RBSP bits of NAL unit, skipping emulation prevention bytes
+ * (00 00 03) on the fly.
+ */
+struct h264_bit_reader {
+  const uint8_t *data;
+  size_t size;
+  size_t byte_pos;
+  int bit_pos;
+  int num_zeros;
+  bool overrun;
+};
+
+static void h264_br_init(struct h264_bit_reader *br, const uint8_t *data,
+  size_t size)
+{
+  br->data = data;
+  br->size = size;
+  br->byte_pos = 0;
+  br->bit_pos = 0;
+  br->num_zeros = 0;
+  br->overrun = false;
+}
+
+static int h264_br_bit(struct h264_bit_reader *br)
+{
+  int bit;
+
+  if (!br->bit_pos) {
+    if (br->byte_pos < br->size && br->num_zeros >= 2
+      && br->data[br->byte_pos] == 3) {
+      br->byte_pos++;
+      br->num_zeros = 0;
+    }
+
+    if (br->byte_pos >= br->size) {
+      br->overrun = true;
+      return 0;
+    }
+
+    if (br->data[br->byte_pos])
+      br->num_zeros = 0;
+    else
+      br->num_zeros++;
+  }
+
+  bit = (br->data[br->byte_pos] >> (7 - br->bit_pos)) & 1;
+  if (++br->bit_pos == 8) {
+    br->bit_pos = 0;
+    br->byte_pos++;
+  }
+  return bit;
+}
+
+static uint32_t h264_br_bits(struct h264_bit_reader *br, int n)
+{
+  uint32_t v = 0;
+
+  while (n--)
+    v = (v << 1) | h264_br_bit(br);
+  return v;
+}
+
+/* Exp-Golomb unsigned */
+static uint32_t h264_br_ue(struct h264_bit_reader *br)
+{
+  int leading_zeros = 0;
+
+  while (!h264_br_bit(br)) {
+    if (br->overrun || ++leading_zeros > 31) {
+      br->overrun = true;
+      return 0;
+    }
+  }
+
+  return (1u << leading_zeros) - 1 + h264_br_bits(br, leading_zeros);
+}
+
+/* Exp-Golomb signed */
+static int32_t h264_br_se(struct h264_bit_reader *br)
+{
+  uint32_t v = h264_br_ue(br);
+
+  return (v & 1) ? (int32_t)((v + 1) / 2) : -(int32_t)(v / 2);
+}
+
+bool h264_nal_next(const uint8_t **pos, const uint8_t *end,
+  struct h264_nal *nal)
+{
+  const uint8_t *p = *pos;
+  const uint8_t *start;
+
+  /* Find start code 00 00 01 */
+  while (p + 3 <= end && (p[0] || p[1] || p[2] != 1))
+    p++;
+
+  if (p + 3 >= end) {
+    *pos = end;
+    return false;
+  }
+
+  start = p + 3;
+  p = start;
+
+  /* NAL unit ends at next 00 00 00 or 00 00 01 */
+  while (p + 3 <= end && (p[0] || p[1] || p[2] > 1))
+    p++;
+
+  if (p + 3 > end)
+    p = end;
+
+  *pos = p;
+
+  /* Drop trailing_zero_8bits */
+  while (p > start && !p[-1])
+    p--;
+
+  nal->data = start;
+  nal->size = p - start;
+  nal->type = start[0] & 0x1f;
+  return nal->size > 0;
+}
+
+bool h264_nal_is_first_slice(const struct h264_nal *nal)
+{
+  /* first_mb_in_slice is ue(v), value 0 is coded as a single 1 bit */
+  return nal->size > 1 && (nal->data[1] & 0x80);
+}
+
+static void h264_skip_scaling_list(struct h264_bit_reader *br, int size)
+{
+  int i;
+  int last_scale = 8;
+  int next_scale = 8;
+
+  for (i = 0; i < size; ++i) {
+    if (next_scale)
+      next_scale = (last_scale + h264_br_se(br) + 256) % 256;
+    if (next_scale)
+      last_scale = next_scale;
+  }
+}
+
+static bool h264_profile_has_chroma_info(int profile_idc)
+{
+  switch (profile_idc) {
+    case 100: case 110: case 122: case 244: case 44: case 83: case 86:
+    case 118: case 128: case 138: case 139: case 134: case 135:
+      return true;
+    default:
+      return false;
+  }
+}
+
+int h264_sps_parse(const struct h264_nal *nal, struct h264_sps_info *info)
+{
+  struct h264_bit_reader br;
+  uint32_t i, n;
+  uint32_t width_mbs, height_map_units;
+  uint32_t frame_mbs_only;
+  uint32_t crop_left = 0, crop_right = 0, crop_top = 0, crop_bottom = 0;
+  int crop_unit_x, crop_unit_y;
+  bool separate_colour_plane = false;
+
+  if (nal->type != H264_NAL_SPS || nal->size < 4)
+    return ERR_INVAL;
+
+  h264_br_init(&br, nal->data + 1, nal->size - 1);
+  info->profile_idc = h264_br_bits(&br, 8);
+  info->constraint_flags = h264_br_bits(&br, 8);
+  info->level_idc = h264_br_bits(&br, 8);
+  info->chroma_format_idc = 1;
+  info->bit_depth_luma = 8;
+  info->bit_depth_chroma = 8;
+
+  /* seq_parameter_set_id */
+  h264_br_ue(&br);
+
+  if (h264_profile_has_chroma_info(info->profile_idc)) {
+    info->chroma_format_idc = h264_br_ue(&br);
+    if (info->chroma_format_idc == 3)
+      separate_colour_plane = h264_br_bit(&br);
+
+    info->bit_depth_luma = h264_br_ue(&br) + 8;
+    info->bit_depth_chroma = h264_br_ue(&br) + 8;
+
+    /* qpprime_y_zero_transform_bypass_flag */
+    h264_br_bit(&br);
+
+    if (h264_br_bit(&br)) {
+      n = info->chroma_format_idc != 3 ? 8 : 12;
+      for (i = 0; i < n; ++i)
+        if (h264_br_bit(&br))
+          h264_skip_scaling_list(&br, i < 6 ? 16 : 64);
+    }
+  }
+
+  /* log2_max_frame_num_minus4 */
+  h264_br_ue(&br);
+
+  switch (h264_br_ue(&br)) {
+    case 0:
+      /* log2_max_pic_order_cnt_lsb_minus4 */
+      h264_br_ue(&br);
+      break;
+    case 1:
+      /* delta_pic_order_always_zero_flag */
+      h264_br_bit(&br);
+      /* offset_for_non_ref_pic, offset_for_top_to_bottom_field */
+      h264_br_se(&br);
+      h264_br_se(&br);
+      n = h264_br_ue(&br);
+      for (i = 0; i < n && !br.overrun; ++i)
+        h264_br_se(&br);
+      break;
+    default:
+      break;
+  }
+
+  /* max_num_ref_frames, gaps_in_frame_num_value_allowed_flag */
+  h264_br_ue(&br);
+  h264_br_bit(&br);
+
+  width_mbs = h264_br_ue(&br) + 1;
+  height_map_units = h264_br_ue(&br) + 1;
+  frame_mbs_only = h264_br_bit(&br);
+  if (!frame_mbs_only)
+    /* mb_adaptive_frame_field_flag */
+    h264_br_bit(&br);
+
+  /* direct_8x8_inference_flag */
+  h264_br_bit(&br);
+
+  if (h264_br_bit(&br)) {
+    crop_left = h264_br_ue(&br);
+    crop_right = h264_br_ue(&br);
+    crop_top = h264_br_ue(&br);
+    crop_bottom = h264_br_ue(&br);
+  }
+
+  if (br.overrun)
+    return ERR_INVAL;
+
+  if (!info->chroma_format_idc || separate_colour_plane) {
+    crop_unit_x = 1;
+    crop_unit_y = 2 - frame_mbs_only;
+  } else {
+    crop_unit_x = info->chroma_format_idc == 3 ? 1 : 2;
+    crop_unit_y = (info->chroma_format_idc == 1 ? 2 : 1) * (2 - frame_mbs_only);
+  }
+
+  info->width = width_mbs * 16 - crop_unit_x * (crop_left + crop_right);
+  info->height = (2 - frame_mbs_only) * height_map_units * 16
+    - crop_unit_y * (crop_top + crop_bottom);
+
+  if (info->width <= 0 || info->height <= 0)
+    return ERR_INVAL;
+
+  return SUCCESS;
+}
@@ -40,6 +40,22 @@ struct printf_ctx {
 
   double arg_double;
   unsigned long long arg;
+
+  /*
+   * Arguments are taken from va_list, or, for binary log records, from
+   * argv array of 64-bit words, see vfmt_pack_args.
+   */
+  int args_mode;
+  uint64_t *argv;
+  int argc;
+  int argc_max;
+  uint32_t str_mask;
+};
+
+enum {
+  FMT_ARGS_VA     = 0,
+  FMT_ARGS_PACK   = 1,
+  FMT_ARGS_UNPACK = 2
 };
 
 struct print_num_spec {
@@ -121,15 +137,7 @@ static const char *__mem_find_any_byte_of_2(const char *start_addr,
 static inline const char *__find_special_or_null(const char *pos,
   const char *end)
 {
-  while(1) {
-    pos = __mem_find_any_byte_of_2(pos, end, ('%' << 8) | ('\0' << 0));
-    if (*pos && *(pos+1) != '%')
-      break;
-    if (!*pos)
-      break;
-    pos += 1;
-  }
-  return pos;
+  return __mem_find_any_byte_of_2(pos, end, ('%' << 8) | ('\0' << 0));
 }
 
 #define FMT_FETCH_SPECIAL() \
@@ -146,12 +154,40 @@ static inline const char *__find_special_or_null(const char *pos,
     } \
   } while(0)
 
+static inline uint64_t fmt_argv_pop(struct printf_ctx *c)
+{
+  if (c->argc == c->argc_max)
+    return 0;
+  return c->argv[c->argc++];
+}
+
+static inline void fmt_argv_push(struct printf_ctx *c, uint64_t value)
+{
+  if (c->argc < c->argc_max)
+    c->argv[c->argc] = value;
+  c->argc++;
+}
+
+static inline int fmt_fetch_int_arg(struct printf_ctx *c,
+  __builtin_va_list *args)
+{
+  int value;
+
+  if (c->args_mode == FMT_ARGS_UNPACK)
+    return (int)fmt_argv_pop(c);
+
+  value = __builtin_va_arg(*args, int);
+  if (c->args_mode == FMT_ARGS_PACK)
+    fmt_argv_push(c, value);
+  return value;
+}
+
 #define FMT_HANDLE_STAR_OR_DIGIT(digit_var, args) \
   do { \
     digit_var = -1; \
     if (special == '*') { \
       /* digit in next argument */ \
-      digit_var = __builtin_va_arg(args, int); \
+      digit_var = fmt_fetch_int_arg(c, args); \
       FMT_FETCH_SPECIAL(); \
     } else if (IS_DIGIT(special)) { \
       /* digit in fmt as decimal */ \
@@ -551,22 +587,50 @@ void fmt_print_type(struct printf_ctx *c)
  * Returns NULL if reached zero termination or any format specifier,
  * after % in case it was not %%, ex 'string%p' returns 'p'
  * c->fmt points at position where return value wat taken.
+ * Text before it is copied to dst, "%%" is copied as single '%'.
  */
 static inline char fmt_skip_to_special(struct printf_ctx *c)
 {
   char special = 0;
   const char *fmt_pos;
 
-  fmt_pos = __find_special_or_null(c->fmt, c->fmt + 512);
+  while(1) {
+    fmt_pos = __find_special_or_null(c->fmt, c->fmt + 512);
+
+    if (c->args_mode != FMT_ARGS_PACK)
+      DST_MEMCPY(c->fmt, fmt_pos - c->fmt);
+    c->fmt = fmt_pos;
 
-  DST_MEMCPY(c->fmt, fmt_pos - c->fmt);
-  c->fmt = fmt_pos;
+    special = *c->fmt;
+    if (!special)
+      return 0;
+
+    /* Search limit reached in the middle of text */
+    if (special != '%')
+      continue;
 
-  special = *c->fmt;
-  if (special == '%')
     special = *(++(c->fmt));
+    if (special != '%')
+      return special;
 
-  return special;
+    if (c->args_mode != FMT_ARGS_PACK)
+      DST_APPEND_C('%');
+    c->fmt++;
+  }
+}
+
+static inline double fmt_u64_to_double(uint64_t value)
+{
+  double d;
+  memcpy(&d, &value, sizeof(d));
+  return d;
+}
+
+static inline uint64_t fmt_double_to_u64(double d)
+{
+  uint64_t value;
+  memcpy(&value, &d, sizeof(value));
+  return value;
 }
 
 static inline int fmt_parse_token(struct printf_ctx *c,
@@ -587,10 +651,21 @@ static inline int fmt_parse_token(struct printf_ctx *c,
   // This is to disable compiler warning
   if (c->flag_left_align);
 
-  FMT_HANDLE_STAR_OR_DIGIT(c->width, *args);
-  FMT_HANDLE_STAR_OR_DIGIT(c->precision, *args);
+  FMT_HANDLE_STAR_OR_DIGIT(c->width, args);
+  FMT_HANDLE_STAR_OR_DIGIT(c->precision, args);
   FMT_HANDLE_SIZE();
 
+  c->type = special;
+  c->fmt++;
+
+  if (c->args_mode == FMT_ARGS_UNPACK) {
+    if (c->size == FMT_SIZE_DOUBLE)
+      c->arg_double = fmt_u64_to_double(fmt_argv_pop(c));
+    else
+      c->arg = fmt_argv_pop(c);
+    return 0;
+  }
+
   switch(c->size) {
     case FMT_SIZE_SIZE_T:
       c->arg = __builtin_va_arg(*args, size_t);
@@ -608,16 +683,22 @@ static inline int fmt_parse_token(struct printf_ctx *c,
       c->arg = __builtin_va_arg(*args, int);
       break;
   }
-  c->type = special;
-  c->fmt++;
+
+  if (c->args_mode == FMT_ARGS_PACK) {
+    if (c->size == FMT_SIZE_DOUBLE)
+      fmt_argv_push(c, fmt_double_to_u64(c->arg_double));
+    else {
+      if (special == 's' && c->argc < 32)
+        c->str_mask |= 1u << c->argc;
+      fmt_argv_push(c, c->arg);
+    }
+  }
   return 0;
 }
 
-int /*optimized*/ __vsnprintf(char *dst, size_t dst_len, const char *fmt,
-  __builtin_va_list *args)
+static int __vsnprintf_ctx(struct printf_ctx *c, char *dst, size_t dst_len,
+  const char *fmt, __builtin_va_list *args)
 {
-  struct printf_ctx ctx = { 0 };
-  struct printf_ctx *c = &ctx;
   c->fmt = fmt;
   c->dst = dst;
 
@@ -653,6 +734,43 @@ int /*optimized*/ __vsnprintf(char *dst, size_t dst_len, const char *fmt,
   return c->dst_virt - dst;
 }
 
+int /*optimized*/ __vsnprintf(char *dst, size_t dst_len, const char *fmt,
+  __builtin_va_list *args)
+{
+  struct printf_ctx ctx = { 0 };
+
+  return __vsnprintf_ctx(&ctx, dst, dst_len, fmt, args);
+}
+
+int vfmt_pack_args(const char *fmt, __builtin_va_list *args, uint64_t *argv,
+  int max_args, uint32_t *str_mask)
+{
+  struct printf_ctx ctx = { 0 };
+  struct printf_ctx *c = &ctx;
+
+  /* Without destination text is skipped, nothing is formatted */
+  c->fmt = fmt;
+  c->args_mode = FMT_ARGS_PACK;
+  c->argv = argv;
+  c->argc_max = max_args;
+
+  while(*c->fmt && !fmt_parse_token(c, args));
+
+  *str_mask = c->str_mask;
+  return c->argc;
+}
+
+int vsnprintf_packed(char *dst, size_t dst_len, const char *fmt,
+  const uint64_t *argv, int argc)
+{
+  struct printf_ctx ctx = { 0 };
+
+  ctx.args_mode = FMT_ARGS_UNPACK;
+  ctx.argv = (uint64_t *)argv;
+  ctx.argc_max = argc;
+  return __vsnprintf_ctx(&ctx, dst, dst_len, fmt, NULL);
+}
+
 int /*optimized*/ vsnprintf(char *dst, size_t dst_len, const char *fmt,
   __builtin_va_list *args)
 {
@@ -17,17 +17,6 @@ int strcmp(const char *s1, const char *s2)
   return *s1 - *s2;
 }
 
-int memcmp(const void *a, const void *b, size_t n)
-{
-  const char *p1 = a;
-  const char *p2 = b;
-  while(n--) {
-    if (*p1 != *p2)
-      return *p1 - *p2;
-  }
-  return 0;
-}
-
 int strncmp(const char *s1, const char *s2, size_t n)
 {
   while (n && *s1 && *s2 && *s1 == *s2) {
@@ -40,15 +29,6 @@ int strncmp(const char *s1, const char *s2, size_t n)
   return *s1 - *s2;
 }
 
-size_t strlen(const char* ptr)
-{
-  size_t res;
-  res = 0;
-  while(*ptr++)
-    res++;
-  return res;
-}
-
 size_t strnlen(const char* ptr, size_t n)
 {
   size_t res;
@@ -83,62 +63,48 @@ char *strncpy(char *dst, const char *src, size_t n)
   return res;
 }
 
-void *memset(void *dst, int value, long unsigned int n)
+/*
+ * On ARMv8 memcpy, memset, memcmp and strlen come from armv8_stringlib.S,
+ * generic versions below are for host builds of stringlib tests.
+ */
+#ifndef __aarch64__
+int memcmp(const void *a, const void *b, size_t n)
 {
-  char *ptr = (char *)dst;
-  while (n--) {
-    *ptr++ = value;
+  const unsigned char *p1 = a;
+  const unsigned char *p2 = b;
+  while(n--) {
+    if (*p1 != *p2)
+      return *p1 - *p2;
+    p1++;
+    p2++;
   }
-  return dst;
+  return 0;
 }
 
-#define IS_ALIGNED(addr, sz) (!((unsigned long)addr % sz))
-#define IS_8_ALIGNED(addr) IS_ALIGNED(addr, 8)
-#define IS_4_ALIGNED(addr) IS_ALIGNED(addr, 4)
-
-#define TYPEBYIDX(typ, addr, idx) (((typ*)addr)[i])
-#define CPY_ARRAY_EL(type, dst, src, idx) TYPEBYIDX(type, dst, idx) = TYPEBYIDX(type, src, idx)
-
-#define CPY_CHAR_EL(dst, src, idx) CPY_ARRAY_EL(char, dst, src, idx)
-#define CPY_INT_EL(dst, src, idx) CPY_ARRAY_EL(int, dst, src, idx)
-#define CPY_LONG_EL(dst, src, idx) CPY_ARRAY_EL(long, dst, src, idx)
-
-void *OPTIMIZED memcpy_8aligned(void *dst, const void *src, size_t n)
+size_t strlen(const char* ptr)
 {
-  int i;
-#ifndef TEST_STRING
-  if (!IS_8_ALIGNED(dst) || !IS_8_ALIGNED(src) || n % 8)
-    panic_with_log("memcpy not aligned");
-#endif
-
-  for (i = 0; i < n / 8; ++i)
-    CPY_LONG_EL(dst, src, i);
+  size_t res;
+  res = 0;
+  while(*ptr++)
+    res++;
+  return res;
+}
 
+void *memset(void *dst, int value, long unsigned int n)
+{
+  char *ptr = (char *)dst;
+  while (n--) {
+    *ptr++ = value;
+  }
   return dst;
 }
 
-void *OPTIMIZED memcpy(void *dst, const void *src, size_t n)
+void *memcpy(void *dst, const void *src, size_t n)
 {
-  unsigned int i, imax;
-  if (!IS_8_ALIGNED(dst) || !IS_8_ALIGNED(src)) {
-    if (!IS_4_ALIGNED(dst) || !IS_4_ALIGNED(src)) {
-      /* copy 1 byte */
-      for (i = 0; i < n; i++)
-        CPY_CHAR_EL(dst, src, i);
-    }
-    /* copy 4 bytes aligned */
-    else {
-      imax = (n / 4) * 4;
-      for (i = 0; i < imax / 4; ++i)
-        CPY_INT_EL(dst, src, i);
-      for (i = (n / 4) * 4; i < n; ++i)
-        CPY_CHAR_EL(dst, src, i);
-    }
-  }
-  else {
-    memcpy_8aligned(dst, src, (n / 8) * 8);
-    for (i = (n / 8) * 8; i < n; ++i)
-      CPY_CHAR_EL(dst, src, i);
-  }
+  char *d = dst;
+  const char *s = src;
+  while (n--)
+    *d++ = *s++;
   return dst;
 }
+#endif
@@ -0,0 +1,415 @@
+#include <vc/mmal_graph.h>
+#include <vc/service_mmal.h>
+#include <errcode.h>
+#include <common.h>
+
+#define MODULE_UNIT_TAG "mmal_graph"
+#include <module_common.h>
+
+struct mmal_graph_node {
+  const char *name;
+  struct mmal_component *c;
+};
+
+struct mmal_graph_link {
+  int node;
+  int input;
+};
+
+struct mmal_graph_sink {
+  mmal_graph_sink_cb_t cb;
+  void *arg;
+};
+
+struct mmal_graph_output {
+  int node;
+  int index;
+
+  bool has_format;
+  int encoding;
+  int width;
+  int height;
+  int frame_rate;
+  int bitrate;
+
+  /* VideoCore consumers */
+  struct mmal_graph_link links[MMAL_GRAPH_MAX_LINKS_PER_OUTPUT];
+  int num_links;
+
+  /* ARM consumers */
+  struct mmal_graph_sink sinks[MMAL_GRAPH_MAX_SINKS];
+  int num_sinks;
+
+  /* Splitter, inserted by mmal_graph_build if needed */
+  struct mmal_component *splitter;
+
+  /* Port, that delivers frames to sinks, set by mmal_graph_build */
+  struct mmal_port *host_port;
+};
+
+static struct mmal_graph {
+  struct mmal_graph_node nodes[MMAL_GRAPH_MAX_NODES];
+  int num_nodes;
+
+  struct mmal_graph_output outputs[MMAL_GRAPH_MAX_OUTPUTS];
+  int num_outputs;
+
+  bool built;
+} graph;
+
+static inline bool mmal_graph_node_valid(int node)
+{
+  return node >= 0 && node < graph.num_nodes;
+}
+
+static struct mmal_graph_output *mmal_graph_output_get(int node, int index)
+{
+  int i;
+  struct mmal_graph_output *o;
+
+  for (i = 0; i < graph.num_outputs; ++i) {
+    o = &graph.outputs[i];
+    if (o->node == node && o->index == index)
+      return o;
+  }
+
+  if (graph.num_outputs == MMAL_GRAPH_MAX_OUTPUTS) {
+    MODULE_ERR("too many outputs in graph");
+    return NULL;
+  }
+
+  o = &graph.outputs[graph.num_outputs++];
+  o->node = node;
+  o->index = index;
+  return o;
+}
+
+int mmal_graph_add_component(const char *name)
+{
+  if (graph.built)
+    return ERR_BUSY;
+
+  if (graph.num_nodes == MMAL_GRAPH_MAX_NODES) {
+    MODULE_ERR("too many components in graph");
+    return ERR_RESOURCE;
+  }
+
+  graph.nodes[graph.num_nodes].name = name;
+  return graph.num_nodes++;
+}
+
+int mmal_graph_set_format(int node, int output, int encoding, int width,
+  int height, int frame_rate, int bitrate)
+{
+  struct mmal_graph_output *o;
+
+  if (graph.built || !mmal_graph_node_valid(node))
+    return ERR_INVAL;
+
+  o = mmal_graph_output_get(node, output);
+  if (!o)
+    return ERR_RESOURCE;
+
+  o->has_format = true;
+  o->encoding = encoding;
+  o->width = width;
+  o->height = height;
+  o->frame_rate = frame_rate;
+  o->bitrate = bitrate;
+  return SUCCESS;
+}
+
+static bool mmal_graph_input_linked(int node, int input)
+{
+  int i, j;
+  const struct mmal_graph_output *o;
+
+  for (i = 0; i < graph.num_outputs; ++i) {
+    o = &graph.outputs[i];
+    for (j = 0; j < o->num_links; ++j)
+      if (o->links[j].node == node && o->links[j].input == input)
+        return true;
+  }
+  return false;
+}
+
+int mmal_graph_connect(int src_node, int src_output, int dst_node,
+  int dst_input)
+{
+  struct mmal_graph_output *o;
+
+  if (graph.built || !mmal_graph_node_valid(src_node)
+    || !mmal_graph_node_valid(dst_node))
+    return ERR_INVAL;
+
+  if (src_node >= dst_node) {
+    MODULE_ERR("link should go downstream: %d->%d", src_node, dst_node);
+    return ERR_INVAL;
+  }
+
+  if (mmal_graph_input_linked(dst_node, dst_input)) {
+    MODULE_ERR("input %d of %s is already linked", dst_input,
+      graph.nodes[dst_node].name);
+    return ERR_EXISTS;
+  }
+
+  o = mmal_graph_output_get(src_node, src_output);
+  if (!o)
+    return ERR_RESOURCE;
+
+  if (o->num_links == MMAL_GRAPH_MAX_LINKS_PER_OUTPUT)
+    return ERR_RESOURCE;
+
+  o->links[o->num_links].node = dst_node;
+  o->links[o->num_links].input = dst_input;
+  o->num_links++;
+  return SUCCESS;
+}
+
+int mmal_graph_add_sink(int src_node, int src_output, mmal_graph_sink_cb_t cb,
+  void *arg)
+{
+  struct mmal_graph_output *o;
+
+  if (graph.built || !mmal_graph_node_valid(src_node) || !cb)
+    return ERR_INVAL;
+
+  o = mmal_graph_output_get(src_node, src_output);
+  if (!o)
+    return ERR_RESOURCE;
+
+  if (o->num_sinks == MMAL_GRAPH_MAX_SINKS)
+    return ERR_RESOURCE;
+
+  o->sinks[o->num_sinks].cb = cb;
+  o->sinks[o->num_sinks].arg = arg;
+  o->num_sinks++;
+  return SUCCESS;
+}
+
+struct mmal_component *mmal_graph_get_component(int node)
+{
+  if (!graph.built || !mmal_graph_node_valid(node))
+    return NULL;
+
+  return graph.nodes[node].c;
+}
+
+static int mmal_graph_buffer_ready(struct mmal_port *p, struct mmal_buffer *b)
+{
+  int i, j;
+  const struct mmal_graph_output *o;
+
+  for (i = 0; i < graph.num_outputs; ++i) {
+    o = &graph.outputs[i];
+    if (o->host_port != p)
+      continue;
+
+    for (j = 0; j < o->num_sinks; ++j)
+      o->sinks[j].cb(p, b, o->sinks[j].arg);
+    break;
+  }
+
+  if (i == graph.num_outputs)
+    MODULE_ERR("buffer from port %s not in graph", p->name);
+
+  /* Sinks that still need the buffer have taken their own references */
+  mmal_port_buffer_consumed_isr(p, b);
+  return SUCCESS;
+}
+
+/*
+ * Buffer pool of a port, that delivers frames to ARM, is sized from what
+ * port recommends, but never below its minimum.
+ */
+static int mmal_graph_route_to_host(struct mmal_port *p,
+  struct mmal_graph_output *o)
+{
+  int err;
+
+  p->current_buffer.num = MAX(p->recommended_buffer.num,
+    p->minimum_buffer.num);
+  p->current_buffer.size = MAX(p->recommended_buffer.size,
+    p->minimum_buffer.size);
+
+  err = mmal_port_set_format(p);
+  CHECK_ERR("failed to set buffer requirements on %s", p->name);
+
+  err = mmal_port_set_zero_copy(p);
+  CHECK_ERR("failed to set zero copy on %s", p->name);
+
+  err = mmal_port_enable(p);
+  CHECK_ERR("failed to enable %s", p->name);
+
+  o->host_port = p;
+  err = mmal_port_init_buffers(p, p->current_buffer.num);
+  CHECK_ERR("failed to init buffers on %s", p->name);
+
+  MODULE_INFO("%s: %d sinks, %d buffers of %d bytes", p->name, o->num_sinks,
+    p->current_buffer.num, p->current_buffer.size);
+
+out_err:
+  return err;
+}
+
+static struct mmal_port *mmal_graph_link_port(
+  const struct mmal_graph_link *l)
+{
+  struct mmal_component *c = graph.nodes[l->node].c;
+
+  if (l->input >= c->inputs) {
+    MODULE_ERR("%s has no input %d", c->name, l->input);
+    return NULL;
+  }
+  return &c->input[l->input];
+}
+
+static int mmal_graph_route_via_splitter(struct mmal_port *p,
+  struct mmal_graph_output *o)
+{
+  int err, i;
+  int num_outputs = o->num_links + (o->num_sinks ? 1 : 0);
+  struct mmal_component *s;
+  struct mmal_port *dst;
+
+  s = mmal_component_create(MMAL_GRAPH_SPLITTER);
+  if (!s)
+    return ERR_GENERIC;
+
+  o->splitter = s;
+  if (s->outputs < num_outputs) {
+    MODULE_ERR("splitter has %d outputs, %d needed", s->outputs,
+      num_outputs);
+    return ERR_RESOURCE;
+  }
+
+  err = mmal_port_connect_tunnel(p, &s->input[0]);
+  CHECK_ERR("failed to tunnel %s to splitter", p->name);
+
+  for (i = 0; i < num_outputs; ++i) {
+    mmal_format_set(&s->output[i].format, p->format.encoding,
+      p->format.encoding_variant, p->es.video.width, p->es.video.height,
+      p->es.video.frame_rate.num, p->format.bitrate);
+    err = mmal_port_set_format(&s->output[i]);
+    CHECK_ERR("failed to set format on %s", s->output[i].name);
+  }
+
+  err = mmal_component_enable(s);
+  CHECK_ERR("failed to enable splitter");
+
+  for (i = 0; i < o->num_links; ++i) {
+    dst = mmal_graph_link_port(&o->links[i]);
+    if (!dst)
+      return ERR_INVAL;
+
+    err = mmal_port_connect_tunnel(&s->output[i], dst);
+    CHECK_ERR("failed to tunnel splitter to %s", dst->name);
+  }
+
+  if (o->num_sinks)
+    err = mmal_graph_route_to_host(&s->output[o->num_links], o);
+
+out_err:
+  return err;
+}
+
+static int mmal_graph_route_output(struct mmal_graph_output *o)
+{
+  struct mmal_component *c = graph.nodes[o->node].c;
+  struct mmal_port *p = &c->output[o->index];
+  struct mmal_port *dst;
+
+  if (!o->num_links && !o->num_sinks)
+    return SUCCESS;
+
+  if (o->num_links == 1 && !o->num_sinks) {
+    dst = mmal_graph_link_port(&o->links[0]);
+    if (!dst)
+      return ERR_INVAL;
+
+    MODULE_INFO("tunnel %s -> %s", p->name, dst->name);
+    return mmal_port_connect_tunnel(p, dst);
+  }
+
+  if (!o->num_links)
+    return mmal_graph_route_to_host(p, o);
+
+  MODULE_INFO("%s: %d links, %d sinks, inserting splitter", p->name,
+    o->num_links, o->num_sinks);
+  return mmal_graph_route_via_splitter(p, o);
+}
+
+static int mmal_graph_apply_format(struct mmal_graph_output *o)
+{
+  struct mmal_component *c = graph.nodes[o->node].c;
+  struct mmal_port *p = &c->output[o->index];
+
+  mmal_format_set(&p->format, o->encoding, 0, o->width, o->height,
+    o->frame_rate, o->bitrate);
+  return mmal_port_set_format(p);
+}
+
+/*
+ * Nodes are processed in the order they were added. By the time node is
+ * processed, all links into its inputs were created and input formats are
+ * known, so its requested output formats can be applied.
+ */
+int mmal_graph_build(void)
+{
+  int err, i, j;
+  struct mmal_graph_node *n;
+  struct mmal_graph_output *o;
+
+  if (graph.built)
+    return ERR_BUSY;
+
+  for (i = 0; i < graph.num_nodes; ++i) {
+    n = &graph.nodes[i];
+    n->c = mmal_component_create(n->name);
+    if (!n->c) {
+      MODULE_ERR("failed to create %s", n->name);
+      return ERR_GENERIC;
+    }
+  }
+
+  for (i = 0; i < graph.num_outputs; ++i) {
+    o = &graph.outputs[i];
+    if (o->index >= graph.nodes[o->node].c->outputs) {
+      MODULE_ERR("%s has no output %d", graph.nodes[o->node].name, o->index);
+      return ERR_INVAL;
+    }
+  }
+
+  mmal_register_io_cb(mmal_graph_buffer_ready);
+
+  for (i = 0; i < graph.num_nodes; ++i) {
+    for (j = 0; j < graph.num_outputs; ++j) {
+      o = &graph.outputs[j];
+      if (o->node != i || !o->has_format)
+        continue;
+
+      err = mmal_graph_apply_format(o);
+      CHECK_ERR("failed to set format on %s output %d", graph.nodes[i].name,
+        o->index);
+    }
+
+    err = mmal_component_enable(graph.nodes[i].c);
+    CHECK_ERR("failed to enable %s", graph.nodes[i].name);
+
+    for (j = 0; j < graph.num_outputs; ++j) {
+      o = &graph.outputs[j];
+      if (o->node != i)
+        continue;
+
+      err = mmal_graph_route_output(o);
+      CHECK_ERR("failed to route %s output %d", graph.nodes[i].name,
+        o->index);
+    }
+  }
+
+  graph.built = true;
+  return SUCCESS;
+
+out_err:
+  return err;
+}
@@ -0,0 +1,211 @@
+#include <vc/mmal_ratectl.h>
+#include <vc/service_mmal_param.h>
+#include <drivers/sd/sdhc.h>
+#include <cpu.h>
+#include <string.h>
+#include <errcode.h>
+#include <common.h>
+
+#define MODULE_UNIT_TAG "ratectl"
+#include <module_common.h>
+
+static struct mmal_ratectl {
+  struct mmal_port *p;
+  struct mmal_ratectl_config config;
+  struct mmal_ratectl_stats stats;
+  uint64_t last_update_ms;
+  /* sdhc_iostats snapshot of the last update */
+  uint64_t last_bytes_written;
+  int calm_periods;
+  bool i_frame_pending;
+} ratectl;
+
+static int mmal_ratectl_set_u32(uint32_t param, uint32_t value)
+{
+  return mmal_port_parameter_set(ratectl.p, param, &value, sizeof(value));
+}
+
+static int mmal_ratectl_set_bitrate(uint32_t bitrate)
+{
+  int err;
+
+  if (bitrate == ratectl.stats.bitrate)
+    return SUCCESS;
+
+  err = mmal_ratectl_set_u32(MMAL_PARAM_VIDEO_BIT_RATE, bitrate);
+  CHECK_ERR("failed to set bitrate %d", bitrate);
+
+  MODULE_INFO("bitrate %d -> %d, queue %d, sd %d B/s", ratectl.stats.bitrate,
+    bitrate, ratectl.stats.queue_depth, ratectl.stats.sd_bytes_per_sec);
+  ratectl.stats.bitrate = bitrate;
+
+out_err:
+  return err;
+}
+
+static int mmal_ratectl_set_qp_max(uint32_t qp_max)
+{
+  int err;
+
+  if (qp_max == ratectl.stats.qp_max)
+    return SUCCESS;
+
+  err = mmal_ratectl_set_u32(MMAL_PARAM_VIDEO_ENCODE_MAX_QUANT, qp_max);
+  CHECK_ERR("failed to set max qp %d", qp_max);
+
+  MODULE_INFO("max qp %d -> %d", ratectl.stats.qp_max, qp_max);
+  ratectl.stats.qp_max = qp_max;
+
+out_err:
+  return err;
+}
+
+int mmal_ratectl_init(struct mmal_port *encoder_output,
+  const struct mmal_ratectl_config *config)
+{
+  int err;
+  struct sdhc_iostats iostats;
+
+  if (!config->bitrate_min || config->bitrate_min > config->bitrate_max
+    || config->queue_low >= config->queue_high)
+    return ERR_INVAL;
+
+  ratectl.p = encoder_output;
+  ratectl.config = *config;
+  ratectl.calm_periods = 0;
+  ratectl.i_frame_pending = false;
+  memset(&ratectl.stats, 0, sizeof(ratectl.stats));
+
+  err = mmal_ratectl_set_u32(MMAL_PARAM_VIDEO_ENCODE_MIN_QUANT,
+    config->qp_min);
+  CHECK_ERR("failed to set min qp");
+
+  err = mmal_ratectl_set_qp_max(config->qp_max);
+  if (err != SUCCESS)
+    goto out_err;
+
+  err = mmal_ratectl_set_bitrate(config->bitrate_max);
+  if (err != SUCCESS)
+    goto out_err;
+
+  sdhc_iostats_get(&iostats);
+  ratectl.last_bytes_written = iostats.num_bytes_written;
+  ratectl.last_update_ms = get_boottime_msec();
+
+out_err:
+  return err;
+}
+
+void mmal_ratectl_frame_dropped(void)
+{
+  int irqflags;
+
+  disable_irq_save_flags(irqflags);
+  ratectl.stats.num_frames_dropped++;
+  ratectl.i_frame_pending = true;
+  restore_irq_flags(irqflags);
+}
+
+static int mmal_ratectl_request_i_frame(void)
+{
+  int err;
+  int irqflags;
+  bool pending;
+
+  disable_irq_save_flags(irqflags);
+  pending = ratectl.i_frame_pending;
+  ratectl.i_frame_pending = false;
+  restore_irq_flags(irqflags);
+
+  if (!pending)
+    return SUCCESS;
+
+  err = mmal_ratectl_set_u32(MMAL_PARAM_VIDEO_REQUEST_I_FRAME, 1);
+  if (err != SUCCESS) {
+    ratectl.i_frame_pending = true;
+    MODULE_ERR("failed to request I-frame");
+    return err;
+  }
+
+  ratectl.stats.num_i_frames_requested++;
+  return SUCCESS;
+}
+
+/*
+ * Bitrate is cut multiplicatively and restored additively, so that short
+ * card stalls cost little quality and the encoder does not oscillate
+ * around the card's throughput.
+ */
+int mmal_ratectl_update(int queue_depth)
+{
+  int err;
+  struct sdhc_iostats iostats;
+  const struct mmal_ratectl_config *c = &ratectl.config;
+  uint64_t now_ms = get_boottime_msec();
+  uint64_t period_ms = now_ms - ratectl.last_update_ms;
+  uint32_t bitrate = ratectl.stats.bitrate;
+  uint32_t sd_bitrate;
+  uint32_t qp_max = c->qp_max;
+
+  if (!ratectl.p)
+    return ERR_INVAL;
+
+  if (!period_ms)
+    return SUCCESS;
+
+  sdhc_iostats_get(&iostats);
+  ratectl.last_update_ms = now_ms;
+  ratectl.stats.queue_depth = queue_depth;
+  ratectl.stats.sd_bytes_per_sec = (iostats.num_bytes_written
+    - ratectl.last_bytes_written) * 1000 / period_ms;
+  ratectl.last_bytes_written = iostats.num_bytes_written;
+
+  if (queue_depth >= c->queue_high) {
+    ratectl.calm_periods = 0;
+    bitrate = bitrate / 4 * 3;
+
+    /* Card has written something, encoder should not produce more */
+    sd_bitrate = (uint64_t)ratectl.stats.sd_bytes_per_sec * 8 * 9 / 10;
+    if (sd_bitrate)
+      bitrate = MIN(bitrate, sd_bitrate);
+
+    bitrate = MAX(bitrate, c->bitrate_min);
+    if (bitrate < ratectl.stats.bitrate)
+      ratectl.stats.num_cuts++;
+
+    if (queue_depth >= c->queue_high * 2)
+      qp_max = c->qp_max_degraded;
+    else
+      qp_max = ratectl.stats.qp_max;
+  } else if (queue_depth <= c->queue_low) {
+    if (++ratectl.calm_periods >= c->recover_periods) {
+      ratectl.calm_periods = 0;
+      bitrate = MIN(bitrate + c->bitrate_step, c->bitrate_max);
+    }
+  } else {
+    ratectl.calm_periods = 0;
+    qp_max = ratectl.stats.qp_max;
+  }
+
+  err = mmal_ratectl_set_qp_max(qp_max);
+  if (err != SUCCESS)
+    return err;
+
+  err = mmal_ratectl_set_bitrate(bitrate);
+  if (err != SUCCESS)
+    return err;
+
+  if (queue_depth < c->queue_high)
+    return mmal_ratectl_request_i_frame();
+
+  return SUCCESS;
+}
+
+void mmal_ratectl_get_stats(struct mmal_ratectl_stats *stats)
+{
+  int irqflags;
+
+  disable_irq_save_flags(irqflags);
+  *stats = ratectl.stats;
+  restore_irq_flags(irqflags);
+}
@@ -15,6 +15,7 @@
 #include <kmalloc.h>
 #include <write_stream_buffer.h>
 #include <os_msgq.h>
+#include <trace.h>
 
 #define MODULE_UNIT_TAG "mmal"
 #include <module_common.h>
@@ -44,6 +45,8 @@ struct mmal_msg_context {
     struct {
       int msg_type;
       struct event completion_waitflag;
+      /* Reply, held in VideoCore's slot until released by the waiter */
+      struct vchiq_header *rheader;
       struct mmal_msg *rmsg;
       int rmsg_size;
     } sync;
@@ -129,16 +132,18 @@ static uint8_t mmal_io_msgq_buffer[MMAL_IO_MSGQ_BUF_SIZE];
 
 static struct os_msgq mmal_io_msgq;
 
+static uint32_t mmal_buffer_generation;
+
 static mmal_io_buffer_ready_cb_t mmal_io_buffer_ready_cb = NULL;
 
 static struct mmal_msg_context *mmal_msg_context_from_handle(uint32_t handle)
 {
-  return (struct mmal_msg_context *)(uint64_t)(handle | 0xffff000000000000);
+  return HANDLE32_TO_PTR(handle);
 }
 
 static uint32_t mmal_msg_context_to_handle(const struct mmal_msg_context *ctx)
 {
-  return (uint32_t)((uint64_t)ctx & ~0xffff000000000000);
+  return PTR_TO_HANDLE32(ctx);
 }
 
 static void mmal_msg_fill_header(struct vchiq_service *service,
@@ -171,25 +176,38 @@ static inline void *mmal_msg_check_reply(struct mmal_msg *rmsg,
     _ms->remoteport, &msg, sizeof(struct mmal_msg_header) + sizeof(*m)); \
   vchiq_event_signal_trigger();
 
+/* Same as COMMUNICATE_ASYNC, but VideoCore is signalled on batch commit */
+#define VCHIQ_MMAL_MSG_BATCH_APPEND(__batch) \
+  mmal_msg_fill_header(_ms, ctx.u.sync.msg_type, &msg, &ctx); \
+  vchiq_tx_batch_append(__batch, VCHIQ_MSG_DATA, _ms->localport, \
+    _ms->remoteport, &msg, sizeof(struct mmal_msg_header) + sizeof(*m));
+
 #define VCHIQ_MMAL_MSG_COMMUNICATE_SYNC() \
   VCHIQ_MMAL_MSG_COMMUNICATE_ASYNC(); \
   os_event_wait(&ctx.u.sync.completion_waitflag); \
   os_event_clear(&ctx.u.sync.completion_waitflag); \
   r = mmal_msg_check_reply(ctx.u.sync.rmsg, ctx.u.sync.msg_type); \
   if (!r) { \
+    VCHIQ_MMAL_MSG_RELEASE_REPLY(); \
     MODULE_ERR("invalid reply");\
     return ERR_GENERIC; \
   } \
   if (r->status != MMAL_MSG_STATUS_SUCCESS) { \
     MODULE_ERR("status not success: %d", r->status); \
+    VCHIQ_MMAL_MSG_RELEASE_REPLY(); \
     return ERR_GENERIC; \
   }
 
+/* Reply 'r' can not be accessed after it is released */
+#define VCHIQ_MMAL_MSG_RELEASE_REPLY() \
+  vchiq_msg_release(ctx.u.sync.rheader)
+
 #define MMAL_MSG_CONTEXT_INIT_SYNC(__msg_type) \
 { \
   .u.sync = { \
     .msg_type = MMAL_MSG_TYPE_ ## __msg_type,\
     .completion_waitflag = EVENT_INIT,\
+    .rheader = NULL, \
     .rmsg = NULL \
   }\
 }
@@ -222,7 +240,7 @@ static void mmal_format_print(const char *action, const char *name,
 }
 
 static int mmal_send_msg_buffer_from_host(struct mmal_port *p,
-  struct mmal_buffer *b)
+  struct mmal_buffer *b, struct vchiq_tx_batch *batch)
 {
   /*
    * Kernel code in bcm2835-camera.c states this is only possible for enabled
@@ -239,13 +257,13 @@ static int mmal_send_msg_buffer_from_host(struct mmal_port *p,
   m->drvbuf.magic = MMAL_MAGIC;
   m->drvbuf.component_handle = p->component->handle;
   m->drvbuf.port_handle = p->handle;
-  m->drvbuf.client_context = (uint32_t)((uint64_t)b & ~0xffff000000000000);
+  m->drvbuf.client_context = PTR_TO_HANDLE32(b);
 
   m->is_zero_copy = p->zero_copy;
   m->buffer_header.next = 0;
   m->buffer_header.priv = 0;
   m->buffer_header.cmd = 0;
-  m->buffer_header.user_data = NARROW_PTR(b);
+  m->buffer_header.user_data = b->handle;
   if (p->zero_copy)
     m->buffer_header.data = b->vcsm_handle;
   else
@@ -270,7 +288,7 @@ static int mmal_send_msg_buffer_from_host(struct mmal_port *p,
     sizeof(m->buffer_header_type_specific));
   m->payload_in_message = 0;
 
-  VCHIQ_MMAL_MSG_COMMUNICATE_ASYNC();
+  VCHIQ_MMAL_MSG_BATCH_APPEND(batch);
   p->bufs.on_vc++;
   return SUCCESS;
 }
@@ -315,6 +333,7 @@ static int mmal_port_info_get(struct mmal_port *p)
 
   p->format.extradata_size = r->format.extradata_size;
   memcpy(p->format.extradata, r->extradata, p->format.extradata_size);
+  VCHIQ_MMAL_MSG_RELEASE_REPLY();
 
   mmal_format_print("actual", p->name, &p->format);
   MODULE_INFO(" ena:%d,min:%dx%d,rec:%dx%d,curr:%dx%d", p->enabled,
@@ -332,7 +351,9 @@ int OPTIMIZED mmal_port_buffers_to_remote(struct mmal_port *p,
   int irqflags;
   int err = SUCCESS;
   struct mmal_buffer *b;
+  struct vchiq_tx_batch batch;
 
+  vchiq_tx_batch_begin(&batch);
   disable_irq_save_flags(irqflags);
   while (!list_empty(l)) {
     b = list_first_entry(l, struct mmal_buffer, list);
@@ -340,11 +361,16 @@ int OPTIMIZED mmal_port_buffers_to_remote(struct mmal_port *p,
     list_add_tail(&b->list, &p->bufs.remote_side);
     restore_irq_flags(irqflags);
 
-    err = mmal_send_msg_buffer_from_host(p, b);
-    CHECK_ERR("Failed to submit buffer");
+    err = mmal_send_msg_buffer_from_host(p, b, &batch);
     disable_irq_save_flags(irqflags);
+    if (err != SUCCESS)
+      break;
   }
 
+  /* Buffers appended before failure should still reach VideoCore */
+  vchiq_tx_batch_commit(&batch);
+  CHECK_ERR("Failed to submit buffer");
+
   if (report_result) {
     err = mmal_port_info_get(p);
     CHECK_ERR("failed to get port info");
@@ -365,23 +391,26 @@ int mmal_port_set_zero_copy(struct mmal_port *p)
     sizeof(zero_copy));
 }
 
+/*
+ * Buffer table is only modified when buffers are added to the port, before
+ * they are sent to VideoCore, so no locking is needed for lookup.
+ */
 static inline struct mmal_buffer *mmal_port_get_buffer_from_header(
-  struct mmal_port *p, struct list_head *buffers, uint32_t handle)
+  struct mmal_port *p, uint32_t handle)
 {
-  int irqflags;
-  struct mmal_buffer *b;
+  struct mmal_buffer *b = NULL;
+  uint32_t idx = MMAL_BUFFER_HANDLE_IDX(handle);
 
-  disable_irq_save_flags(irqflags);
-  list_for_each_entry(b, buffers, list) {
-    if (handle == b->vcsm_handle) {
-      restore_irq_flags(irqflags);
-      return b;
-    }
+  if (idx < p->bufs.table_size)
+    b = p->bufs.table[idx];
+
+  if (!b || b->handle != handle) {
+    MODULE_ERR("buffer not found for handle: %08x on port:%s", handle,
+      p->name);
+    return NULL;
   }
 
-  restore_irq_flags(irqflags);
-  MODULE_ERR("buffer not found for handle: %08x on port:%s", handle, p->name);
-  return NULL;
+  return b;
 }
 
 static inline void mmal_print_supported_encodings(uint32_t *encodings, int num)
@@ -476,6 +505,7 @@ static int mmal_port_info_set(struct mmal_port *p)
   m->format.extradata_size = p->format.extradata_size;
   memcpy(&m->extradata, p->format.extradata, p->format.extradata_size);
   VCHIQ_MMAL_MSG_COMMUNICATE_SYNC();
+  VCHIQ_MMAL_MSG_RELEASE_REPLY();
   return SUCCESS;
 }
 
@@ -517,6 +547,55 @@ void mmal_port_dump(const char *tag, const struct mmal_port *p)
   printf("%s: es:%p\r\n", tag);
 }
 
+static int mmal_list_len(const struct list_head *l)
+{
+  const struct list_head *node;
+  int n = 0;
+
+  for (node = l->next; node != l; node = node->next)
+    n++;
+
+  return n;
+}
+
+static void mmal_port_print_stats(const char *component,
+  const struct mmal_port *p)
+{
+  int irqflags;
+  int free, consumable, in_process, remote;
+
+  if (!p->bufs.table_size)
+    return;
+
+  disable_irq_save_flags(irqflags);
+  free = mmal_list_len(&p->bufs.os_side_free);
+  consumable = mmal_list_len(&p->bufs.os_side_consumable);
+  in_process = mmal_list_len(&p->bufs.os_side_in_process);
+  remote = mmal_list_len(&p->bufs.remote_side);
+  restore_irq_flags(irqflags);
+
+  printf("%4d %5d %4d %10d %10d %6d %s:%s\r\n", p->handle, p->enabled,
+    free, consumable, in_process, remote, component, p->name);
+}
+
+void mmal_print_port_stats(void)
+{
+  struct mmal_component *c;
+  struct list_head *components = vchiq_get_components_list();
+  uint32_t i;
+
+  printf("port enbl free consumable in_process remote name\r\n");
+  list_for_each_entry(c, components, list) {
+    if (!c->in_use)
+      continue;
+
+    for (i = 0; i < c->inputs && i < MMAL_COMPONENT_MAX_PORTS; ++i)
+      mmal_port_print_stats(c->name, &c->input[i]);
+    for (i = 0; i < c->outputs && i < MMAL_COMPONENT_MAX_PORTS; ++i)
+      mmal_port_print_stats(c->name, &c->output[i]);
+  }
+}
+
 static inline void mmal_buf_fifo_push(struct list_head *l,
   struct mmal_buffer *b)
 {
@@ -584,8 +663,7 @@ static inline int mmal_buffer_to_host_msg_to_port(
     return ERR_NOT_FOUND;
   }
 
-  b = mmal_port_get_buffer_from_header(p, &p->bufs.remote_side,
-    m->buffer_header.data);
+  b = mmal_port_get_buffer_from_header(p, m->buffer_header.user_data);
 
   if (!b || !b->buffer) {
     os_log("Bad buffer %p->%p\r\n", b, b ? b->buffer : NULL);
@@ -608,12 +686,15 @@ static inline void mmal_port_buffer_to_host_cb(struct mmal_port *p,
   list_del_init(&b->list);
   b->length = m->buffer_header.length;
   b->flags = m->buffer_header.flags;
+  b->dts = m->buffer_header.dts;
+  b->pts = m->buffer_header.pts;
   mmal_buf_fifo_push(&p->bufs.os_side_consumable, b);
   restore_irq_flags(irqflags);
+  trace_event(TRACE_EV_MMAL_BUF_READY, p->handle, b->pts);
 }
 
-int OPTIMIZED  mmal_port_buffer_to_remote(struct mmal_port *p,
-  struct mmal_buffer *b)
+static int OPTIMIZED mmal_port_buffer_to_remote_batched(struct mmal_port *p,
+  struct mmal_buffer *b, struct vchiq_tx_batch *batch)
 {
   int irqflags;
 
@@ -621,7 +702,20 @@ int OPTIMIZED  mmal_port_buffer_to_remote(struct mmal_port *p,
   list_del_init(&b->list);
   list_add_tail(&b->list, &p->bufs.remote_side);
   restore_irq_flags(irqflags);
-  return mmal_send_msg_buffer_from_host(p, b);
+  trace_event(TRACE_EV_MMAL_BUF_TO_VC, p->handle, b->pts);
+  return mmal_send_msg_buffer_from_host(p, b, batch);
+}
+
+int OPTIMIZED  mmal_port_buffer_to_remote(struct mmal_port *p,
+  struct mmal_buffer *b)
+{
+  int err;
+  struct vchiq_tx_batch batch;
+
+  vchiq_tx_batch_begin(&batch);
+  err = mmal_port_buffer_to_remote_batched(p, b, &batch);
+  vchiq_tx_batch_commit(&batch);
+  return err;
 }
 
 static int OPTIMIZED mmal_buffer_to_host_cb(const struct mmal_msg *m)
@@ -637,14 +731,20 @@ static int OPTIMIZED mmal_buffer_to_host_cb(const struct mmal_msg *m)
   }
 
   p->bufs.on_vc--;
+  b->refcount = 1;
   if (p->bufs.acks_count < p->bufs.total_count) {
     if (b->length || b->flags) {
       MODULE_ERR("non-0 buf during ack %d/%d", p->bufs.acks_count,
         p->bufs.total_count);
     }
     p->bufs.acks_count++;
-    err = mmal_port_buffer_to_remote(p, b);
-    CHECK_ERR("Failed to re-send acknowledged buffer to vc");
+
+    /*
+     * Sending from here could block vchiq loop thread on tx flow control,
+     * while VideoCore may in turn wait for this thread to release its slots,
+     * so the buffer is re-sent by io loop.
+     */
+    mmal_port_buffer_consumed_isr(p, b);
     return SUCCESS;
   }
 
@@ -668,6 +768,7 @@ static int mmal_port_action_port(struct mmal_component *c, struct mmal_port *p,
   mmal_port_to_msg(p, &m->port);
 
   VCHIQ_MMAL_MSG_COMMUNICATE_SYNC();
+  VCHIQ_MMAL_MSG_RELEASE_REPLY();
   return SUCCESS;
 }
 
@@ -747,6 +848,7 @@ int mmal_port_parameter_set(struct mmal_port *p, uint32_t parameter_id,
   memcpy(&m->value, value, value_size);
 
   VCHIQ_MMAL_MSG_COMMUNICATE_SYNC();
+  VCHIQ_MMAL_MSG_RELEASE_REPLY();
   if (parameter_id == MMAL_PARAM_ZERO_COPY)
     p->zero_copy = 1;
   return SUCCESS;
@@ -769,6 +871,7 @@ int mmal_port_parameter_get(struct mmal_port *p, int parameter_id, void *value,
 
   memcpy(value, r->value, MIN(r->size, *value_size));
   *value_size = r->size;
+  VCHIQ_MMAL_MSG_RELEASE_REPLY();
   return SUCCESS;
 }
 
@@ -783,6 +886,7 @@ int mmal_port_connect(struct mmal_port *src, struct mmal_port *dst)
   m->connect_component_handle = dst->component->handle;
   m->connect_port_handle = dst->handle;
   VCHIQ_MMAL_MSG_COMMUNICATE_SYNC();
+  VCHIQ_MMAL_MSG_RELEASE_REPLY();
   return SUCCESS;
 }
 
@@ -809,40 +913,39 @@ out_err:
   return err;
 }
 
-static __attribute__((unused)) int create_port_connection(
-  struct mmal_port *in, struct mmal_port *out,
-  struct mmal_port *out2)
+/*
+ * Tunnels src output port to dst input port, buffers between them are managed
+ * by VideoCore and never reach ARM. Format of src is copied to dst.
+ */
+int mmal_port_connect_tunnel(struct mmal_port *src, struct mmal_port *dst)
 {
   int err;
-  out->format.encoding = in->format.encoding;
-  out->format.encoding_variant = in->format.encoding_variant;
-  out->es.video.width = in->es.video.width;
-  out->es.video.height = in->es.video.height;
-  out->es.video.crop.x = in->es.video.crop.x;
-  out->es.video.crop.y = in->es.video.crop.y;
-  out->es.video.crop.width = in->es.video.crop.width;
-  out->es.video.crop.height = in->es.video.crop.height;
-  out->es.video.frame_rate.num = in->es.video.frame_rate.num;
-  out->es.video.frame_rate.den = in->es.video.frame_rate.den;
-  err = mmal_port_set_format(out);
+  dst->format.encoding = src->format.encoding;
+  dst->format.encoding_variant = src->format.encoding_variant;
+  dst->es.video.width = src->es.video.width;
+  dst->es.video.height = src->es.video.height;
+  dst->es.video.crop.x = src->es.video.crop.x;
+  dst->es.video.crop.y = src->es.video.crop.y;
+  dst->es.video.crop.width = src->es.video.crop.width;
+  dst->es.video.crop.height = src->es.video.crop.height;
+  dst->es.video.frame_rate.num = src->es.video.frame_rate.num;
+  dst->es.video.frame_rate.den = src->es.video.frame_rate.den;
+  err = mmal_port_set_format(dst);
   CHECK_ERR("Failed to change destination port format");
-  if (out->recommended_buffer.num != in->recommended_buffer.num) {
-    MODULE_ERR("Buffer info mismatch on connection recommended num %d vs %d",
-      out->recommended_buffer.num, in->recommended_buffer.num);
-    return ERR_GENERIC;
+  if (dst->recommended_buffer.num != src->recommended_buffer.num
+    || dst->recommended_buffer.size != src->recommended_buffer.size) {
+    MODULE_INFO("tunnel %s->%s buffer recommendation differs %dx%d vs %dx%d",
+      src->name, dst->name,
+      src->recommended_buffer.num, src->recommended_buffer.size,
+      dst->recommended_buffer.num, dst->recommended_buffer.size);
   }
 
-  if (out->recommended_buffer.size != in->recommended_buffer.size) {
-    MODULE_ERR("Buffer info mismatch on connection recommended size %d vs %d",
-      out->recommended_buffer.size, in->recommended_buffer.size);
-    return ERR_GENERIC;
-  }
-
-  err = mmal_port_connect(in, out);
+  err = mmal_port_connect(src, dst);
   CHECK_ERR("Failed to connect ports");
 
-  err = mmal_port_enable(in);
+  err = mmal_port_enable(src);
   CHECK_ERR("Failed to enable source port");
+  src->connected = dst;
 
 out_err:
   return err;
@@ -854,6 +957,11 @@ int mmal_port_add_buffer(struct mmal_port *p, void *dma_buf,
   int err;
   struct mmal_buffer *buf;
 
+  if (p->bufs.table_size == MMAL_PORT_MAX_BUFFERS) {
+    MODULE_ERR("too many buffers on port %s", p->name);
+    return ERR_RESOURCE;
+  }
+
   buf = kzalloc(sizeof(*buf));
   if (!buf) {
     MODULE_ERR("Failed to allocate buffer");
@@ -866,6 +974,13 @@ int mmal_port_add_buffer(struct mmal_port *p, void *dma_buf,
   buf->user_handle = user_handle;
   err = smem_import_dmabuf(buf->buffer, buf->buffer_size, &buf->vcsm_handle);
   CHECK_ERR("failed to import dmabuf");
+
+  /* Every new table gets its own generation, starting from 1 */
+  if (!p->bufs.table_size)
+    p->bufs.generation = ++mmal_buffer_generation;
+
+  buf->handle = MMAL_BUFFER_HANDLE(p->bufs.generation, p->bufs.table_size);
+  p->bufs.table[p->bufs.table_size++] = buf;
   list_add_tail(&buf->list, &p->bufs.os_side_free);
 
 out_err:
@@ -974,6 +1089,8 @@ static OPTIMIZED int mmal_service_cb(struct vchiq_service *s,
     return ERR_INVAL;
   }
 
+  vchiq_msg_hold(h);
+  msg_ctx->u.sync.rheader = h;
   msg_ctx->u.sync.rmsg = rmsg;
   msg_ctx->u.sync.rmsg_size = h->size;
   os_event_notify(&msg_ctx->u.sync.completion_waitflag);
@@ -998,6 +1115,7 @@ static int mmal_msg_component_create(struct vchiq_service *mmal_service,
   c->inputs = r->input_num;
   c->outputs = r->output_num;
   c->clocks = r->clock_num;
+  VCHIQ_MMAL_MSG_RELEASE_REPLY();
   return SUCCESS;
 }
 
@@ -1008,6 +1126,7 @@ static int mmal_msg_component_enable(struct mmal_component *c)
 
   m->component_handle = c->handle;
   VCHIQ_MMAL_MSG_COMMUNICATE_SYNC();
+  VCHIQ_MMAL_MSG_RELEASE_REPLY();
   return SUCCESS;
 }
 
@@ -1088,14 +1207,38 @@ err_component_destroy:
   return NULL;
 }
 
+void mmal_buffer_ref(struct mmal_buffer *b)
+{
+  int irqflags;
+
+  disable_irq_save_flags(irqflags);
+  b->refcount++;
+  restore_irq_flags(irqflags);
+}
+
 void mmal_port_buffer_consumed_isr(struct mmal_port *p, struct mmal_buffer *b)
 {
+  int irqflags;
+  int refcount;
   struct mmal_msgq_msg m = {
     .id = MMAL_IO_BUF_CONSUMED,
     .port = p,
     .buffer = b
   };
 
+  disable_irq_save_flags(irqflags);
+  refcount = --b->refcount;
+  restore_irq_flags(irqflags);
+
+  if (refcount > 0)
+    return;
+
+  if (refcount < 0) {
+    MODULE_ERR("buffer %08x released too many times", b->handle);
+    return;
+  }
+
+  trace_event(TRACE_EV_MMAL_BUF_DONE, p->handle, b->pts);
   os_msgq_put_isr(&mmal_io_msgq, &m);
 }
 
@@ -1104,21 +1247,33 @@ static void mmal_io_loop(void)
   int err;
 
   struct mmal_msgq_msg m;
+  struct vchiq_tx_batch batch;
 
   while(1) {
     os_msgq_get(&mmal_io_msgq, &m);
-    if (m.id == MMAL_IO_BUF_READY) {
-      err = mmal_io_buffer_ready_cb(m.port, m.buffer);
-      if (err != SUCCESS) {
-        printf("PROBLEM\r\n");
+
+    /*
+     * Drain everything that is queued by now and send all consumed buffers
+     * back to VideoCore as one batch with a single doorbell.
+     */
+    vchiq_tx_batch_begin(&batch);
+    do {
+      if (m.id == MMAL_IO_BUF_READY) {
+        /* Do not hold back consumed buffers while callback runs */
+        vchiq_tx_batch_commit(&batch);
+        err = mmal_io_buffer_ready_cb(m.port, m.buffer);
+        if (err != SUCCESS) {
+          printf("PROBLEM\r\n");
+        }
       }
-    }
-    else if (m.id == MMAL_IO_BUF_CONSUMED) {
-      err = mmal_port_buffer_to_remote(m.port, m.buffer);
-      if (err != SUCCESS) {
-        MODULE_ERR("Failed to submit buffer");
+      else if (m.id == MMAL_IO_BUF_CONSUMED) {
+        err = mmal_port_buffer_to_remote_batched(m.port, m.buffer, &batch);
+        if (err != SUCCESS) {
+          MODULE_ERR("Failed to submit buffer");
+        }
       }
-    }
+    } while (os_msgq_try_get(&mmal_io_msgq, &m) == SUCCESS);
+    vchiq_tx_batch_commit(&batch);
   }
 }
 
@@ -1147,6 +1302,7 @@ int mmal_get_version(void)
 
   os_event_wait(&ctx.u.sync.completion_waitflag);
   os_event_clear(&ctx.u.sync.completion_waitflag);
+  vchiq_msg_release(ctx.u.sync.rheader);
 #if 0
   //r = mmal_msg_check_reply(ctx.u.sync.rmsg, ctx.u.sync.msg_type);
   if (!r) {
@@ -1179,6 +1335,7 @@ int mmal_component_disable(struct mmal_component *c)
   m->component_handle = c->handle;
 
   VCHIQ_MMAL_MSG_COMMUNICATE_SYNC();
+  VCHIQ_MMAL_MSG_RELEASE_REPLY();
   c->enabled = false;
   MODULE_INFO("mmal_component_disable, name:%s, handle:%d",
     c->name, c->handle);
@@ -1195,6 +1352,7 @@ int mmal_component_destroy(struct mmal_component *c)
   m->component_handle = c->handle;
 
   VCHIQ_MMAL_MSG_COMMUNICATE_SYNC();
+  VCHIQ_MMAL_MSG_RELEASE_REPLY();
   MODULE_INFO("vchiq_mmal_handmade_component_destroy, name:%s, handle:%d",
     c->name, c->handle);
   kfree(c);
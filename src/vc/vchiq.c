@@ -10,8 +10,11 @@
 #include <kmalloc.h>
 #include <errcode.h>
 #include <os_api.h>
+#include <cpu.h>
 #include <drivers/mbox/mbox_bcm2835_props.h>
 #include <task.h>
+#include <trace.h>
+#include <prof.h>
 #include "vchiq_priv.h"
 #include "vchiq_doorbell.h"
 
@@ -22,7 +25,7 @@ static bool vchiq_ready = false;
 
 static struct vchiq_state vchiq_state;
 
-static struct vchiq_service *vchiq_service_map[10];
+static struct vchiq_service *vchiq_service_map[VCHIQ_MAX_SERVICES];
 
 static inline void vchiq_event_init(struct vchiq_event *ev)
 {
@@ -87,12 +90,21 @@ static void vchiq_state_init(struct vchiq_slot_zero *slot_zero)
   os_event_init(&s->ev_sync_trigger);
   os_event_init(&s->ev_sync_release);
   os_event_init(&s->ev_ack);
+  os_event_init(&s->ev_slot_avail);
   INIT_LIST_HEAD(&s->components);
   s->slot_queue_avail = 0;
 
   for (i = local->slot_first; i <= local->slot_last; i++)
     local->slot_queue[s->slot_queue_avail++] = i;
 
+  s->num_slots = s->slot_queue_avail;
+  s->rx_slot = -1;
+  s->tx_stats.num_slots = s->num_slots;
+
+  /* Same defaults as upstream vchiq_init_state */
+  s->default_slot_quota = s->num_slots / 2;
+  s->default_message_quota = s->default_slot_quota * 256;
+
   vchiq_event_init(&local->trigger);
   local->tx_pos = 0;
 
@@ -155,11 +167,6 @@ static void vchiq_irq_handler(void)
   vchiq_event_check_isr(&vchiq_state.ev_sync_release, &local->sync_release);
 }
 
-static int vchiq_tx_header_to_slot_idx(struct vchiq_state *s)
-{
-  return s->remote->slot_queue[(s->rx_pos / VCHIQ_SLOT_SIZE) & VCHIQ_SLOT_QUEUE_MASK];
-}
-
 struct vchiq_header *vchiq_get_next_header_rx(struct vchiq_state *state)
 {
   struct vchiq_header *h;
@@ -178,6 +185,23 @@ next_header:
   return h;
 }
 
+static void vchiq_service_quota_init(struct vchiq_service_quota *q)
+{
+  q->slot_quota = vchiq_state.default_slot_quota;
+  q->message_quota = vchiq_state.default_message_quota;
+  q->slot_use_count = 0;
+  q->message_use_count = 0;
+  q->previous_tx_index = -1;
+  os_event_init(&q->quota_event);
+}
+
+static inline struct vchiq_service_quota *vchiq_port_to_quota(int localport)
+{
+  BUG_IF(localport < 1 || localport > VCHIQ_MAX_SERVICES,
+    "invalid vchiq localport");
+  return &vchiq_state.service_quotas[localport - 1];
+}
+
 static struct vchiq_service *vchiq_service_alloc(void)
 {
   struct vchiq_service *service;
@@ -202,6 +226,7 @@ static struct vchiq_service *vchiq_service_alloc(void)
 
   /* ser localport to non zero value or vchiq will assign something */
   service->localport = i + 1;
+  vchiq_service_quota_init(&vchiq_state.service_quotas[i]);
   vchiq_wmb();
   vchiq_service_map[i] = service;
   return service;
@@ -265,6 +290,8 @@ static inline int OPTIMIZED vchiq_parse_rx_dispatch(struct vchiq_state *s,
   msg_type = VCHIQ_MSG_TYPE(h->msgid);
   localport = VCHIQ_MSG_DSTPORT(h->msgid);
   remoteport = VCHIQ_MSG_SRCPORT(h->msgid);
+  trace_event(TRACE_EV_VCHIQ_RX, localport,
+    TRACE_VCHIQ_ARG(msg_type, h->size));
   switch(msg_type) {
     case VCHIQ_MSG_CONNECT:
       s->is_connected = true;
@@ -293,6 +320,22 @@ static void vchiq_event_signal(struct vchiq_event *event)
     vchiq_doorbell_trigger();
 }
 
+static inline struct vchiq_slot_info *vchiq_slot_info_get(
+  struct vchiq_state *s, int slot_index)
+{
+  return &((struct vchiq_slot_zero *)s->slots)->slots[slot_index];
+}
+
+static inline int vchiq_header_to_slot_index(struct vchiq_state *s,
+  const struct vchiq_header *h)
+{
+  return ((const char *)h - (const char *)s->slots) / VCHIQ_SLOT_SIZE;
+}
+
+/*
+ * Gives remote slot back to VideoCore. Caller signals remote recycle event,
+ * so that several slots could be given back with one doorbell.
+ */
 static void vchiq_release_slot(struct vchiq_state *s, int slot_index)
 {
   int slot_queue_recycle;
@@ -300,34 +343,100 @@ static void vchiq_release_slot(struct vchiq_state *s, int slot_index)
   slot_queue_recycle = s->remote->slot_queue_recycle;
   vchiq_rmb();
   s->remote->slot_queue[slot_queue_recycle & VCHIQ_SLOT_QUEUE_MASK] = slot_index;
+  vchiq_wmb();
   s->remote->slot_queue_recycle = slot_queue_recycle + 1;
-  vchiq_event_signal(&s->remote->recycle);
 }
 
+/*
+ * Drops one reference to remote slot. Parser holds one reference while it
+ * reads messages from the slot, every message held by a service holds
+ * another one. Returns true if slot was given back to VideoCore.
+ */
+static bool vchiq_slot_put(struct vchiq_state *s, int slot_index)
+{
+  int irq;
+  bool released = false;
+  struct vchiq_slot_info *info = vchiq_slot_info_get(s, slot_index);
+
+  disable_irq_save_flags(irq);
+  BUG_IF(info->release_count >= info->use_count, "vchiq slot over-release");
+  info->release_count++;
+  if (info->release_count == info->use_count) {
+    vchiq_release_slot(s, slot_index);
+    released = true;
+  }
+  restore_irq_flags(irq);
+  return released;
+}
+
+void vchiq_msg_hold(struct vchiq_header *h)
+{
+  int irq;
+  struct vchiq_state *s = &vchiq_state;
+  struct vchiq_slot_info *info;
+
+  info = vchiq_slot_info_get(s, vchiq_header_to_slot_index(s, h));
+
+  disable_irq_save_flags(irq);
+  info->use_count++;
+  restore_irq_flags(irq);
+}
+
+void vchiq_msg_release(struct vchiq_header *h)
+{
+  struct vchiq_state *s = &vchiq_state;
+
+  if (vchiq_slot_put(s, vchiq_header_to_slot_index(s, h)))
+    vchiq_event_signal(&s->remote->recycle);
+}
+
+PROF_MARKER(vchiq_parse_rx);
+
 static int OPTIMIZED vchiq_parse_rx(struct vchiq_state *s)
 {
   int err = SUCCESS;
   int rx_slot;
+  int num_released = 0;
   struct vchiq_header *h;
-  int prev_rx_slot = vchiq_tx_header_to_slot_idx(s);
+  struct vchiq_slot_info *info;
+  PROF_BEGIN(vchiq_parse_rx);
 
   while(s->rx_pos != s->remote->tx_pos) {
     int old_rx_pos = s->rx_pos;
     h = vchiq_get_next_header_rx(s);
     MODULE_DEBUG2("msg received: %p, rx_pos: %d, size: %d", h, old_rx_pos,
       VCHIQ_MSG_TOTAL_SIZE(h->size));
+
+    rx_slot = vchiq_header_to_slot_index(s, h);
+    if (rx_slot != s->rx_slot) {
+      /*
+       * Entering next slot. If previous one ended with padding, parser still
+       * holds it.
+       */
+      if (s->rx_slot != -1 && vchiq_slot_put(s, s->rx_slot))
+        num_released++;
+
+      info = vchiq_slot_info_get(s, rx_slot);
+      info->use_count = 1;
+      info->release_count = 0;
+      s->rx_slot = rx_slot;
+    }
+
     err = vchiq_parse_rx_dispatch(s, h);
     CHECK_ERR("failed to parse message from remote");
 
-    rx_slot = vchiq_tx_header_to_slot_idx(s);
-    if (rx_slot != prev_rx_slot) {
-      vchiq_release_slot(s, prev_rx_slot);
-      prev_rx_slot = rx_slot;
+    /* Parser is done with the slot, it is released when no messages held */
+    if (!(s->rx_pos & VCHIQ_SLOT_MASK)) {
+      if (vchiq_slot_put(s, s->rx_slot))
+        num_released++;
+      s->rx_slot = -1;
     }
   }
-  return SUCCESS;
 
 out_err:
+  if (num_released)
+    vchiq_event_signal(&s->remote->recycle);
+  PROF_END(vchiq_parse_rx);
   return err;
 }
 
@@ -336,8 +445,14 @@ static void vchiq_event_wait(struct event *ev, struct vchiq_event *event)
   if (!event->fired) {
     event->armed = 1;
     vchiq_dsb();
-    os_event_wait(ev);
-    os_event_clear(ev);
+    /*
+     * Remote could have fired the event before it saw it armed, in that case
+     * there will be no doorbell to wake us up.
+     */
+    if (!event->fired) {
+      os_event_wait(ev);
+      os_event_clear(ev);
+    }
     event->armed = 0;
     vchiq_wmb();
   }
@@ -350,14 +465,16 @@ static void vchiq_event_wait(struct event *ev, struct vchiq_event *event)
  * done with some particular slot of our messages and signals
  * recylce event to us, so that we can reuse these slots.
  *
- * In original code there is a lot of bookkeeping in this func
- * but it seems it's not needed critically right now.
+ * Every DATA message in recycled slot is released from its service quota,
+ * senders, blocked on quota or on free slot are woken up.
  */
 static void vchiq_process_free_queue(struct vchiq_state *s)
 {
-  int slot_queue_avail, pos, slot_index;
+  int slot_queue_avail, pos, slot_index, localport, irq;
+  uint32_t services_found, services_notify;
   char *slots;
   struct vchiq_header *h;
+  struct vchiq_service_quota *q;
 
   slot_queue_avail = s->slot_queue_avail;
 
@@ -370,17 +487,51 @@ static void vchiq_process_free_queue(struct vchiq_state *s)
 
     vchiq_rmb();
 
+    services_found = 0;
+    services_notify = 0;
+
+    disable_irq_save_flags(irq);
     pos = 0;
     while (pos < VCHIQ_SLOT_SIZE) {
       h = (struct vchiq_header *)(slots + pos);
 
+      if (VCHIQ_MSG_TYPE(h->msgid) == VCHIQ_MSG_DATA) {
+        localport = VCHIQ_MSG_SRCPORT(h->msgid);
+        q = vchiq_port_to_quota(localport);
+        BUG_IF(!q->message_use_count, "vchiq message quota underflow");
+        if (q->message_use_count-- == q->message_quota)
+          services_notify |= 1 << (localport - 1);
+        services_found |= 1 << (localport - 1);
+      }
+
       pos += VCHIQ_MSG_TOTAL_SIZE(h->size);
       BUG_IF(pos > VCHIQ_SLOT_SIZE, "wrong vchiq header");
     }
 
+    for (localport = 1; services_found; localport++) {
+      if (!(services_found & (1 << (localport - 1))))
+        continue;
+
+      services_found &= ~(1 << (localport - 1));
+      q = vchiq_port_to_quota(localport);
+      BUG_IF(!q->slot_use_count, "vchiq slot quota underflow");
+      if (q->slot_use_count-- == q->slot_quota)
+        services_notify |= 1 << (localport - 1);
+    }
+    s->tx_stats.slots_recycled++;
+    restore_irq_flags(irq);
+
     vchiq_mb();
 
     s->slot_queue_avail = slot_queue_avail;
+
+    for (localport = 1; services_notify; localport++) {
+      if (services_notify & (1 << (localport - 1))) {
+        services_notify &= ~(1 << (localport - 1));
+        os_event_notify(&vchiq_port_to_quota(localport)->quota_event);
+      }
+    }
+    os_event_notify(&s->ev_slot_avail);
   }
 }
 
@@ -446,6 +597,56 @@ out_err:
   return err;
 }
 
+static void vchiq_tx_publish(void)
+{
+  vchiq_wmb();
+
+  /* Make the new tx_pos visible to the peer. */
+  vchiq_state.local->tx_pos = vchiq_state.local_tx_pos;
+  vchiq_wmb();
+}
+
+/*
+ * Makes everything, written to slots so far, visible to VideoCore. Called
+ * before sender is blocked on slot or quota, as VideoCore can only recycle
+ * slots with the messages it has already seen.
+ */
+static void vchiq_tx_flush(void)
+{
+  if (vchiq_state.local->tx_pos == vchiq_state.local_tx_pos)
+    return;
+
+  vchiq_tx_publish();
+  vchiq_event_signal(&vchiq_state.remote->trigger);
+}
+
+/*
+ * Blocks until slot at slot_queue_index is free. All slots, starting at
+ * slot_queue_avail are written but not yet recycled by VideoCore.
+ */
+static void vchiq_tx_wait_slot(int slot_queue_index)
+{
+  struct vchiq_state *s = &vchiq_state;
+  int slots_used;
+
+  if (slot_queue_index >= s->slot_queue_avail) {
+    s->tx_stats.slot_stalls++;
+    vchiq_tx_flush();
+
+    while (1) {
+      os_event_clear(&s->ev_slot_avail);
+      vchiq_rmb();
+      if (slot_queue_index < s->slot_queue_avail)
+        break;
+      os_event_wait(&s->ev_slot_avail);
+    }
+  }
+
+  slots_used = slot_queue_index - (s->slot_queue_avail - s->num_slots) + 1;
+  if (slots_used > s->tx_stats.slots_used_max)
+    s->tx_stats.slots_used_max = slots_used;
+}
+
 static struct vchiq_header *vchiq_msg_prep_next_header_tx(size_t msg_size)
 {
   int tx_pos, slot_queue_index, slot_index;
@@ -468,8 +669,11 @@ static struct vchiq_header *vchiq_msg_prep_next_header_tx(size_t msg_size)
    * Because we already have calculated the value for the new tx_pos here,
    * we cache in s->local_tx_pos, the caller of this function will fill the
    * message and update tx_pos from this s->local_tx_pos
+   * Next header is allocated after s->local_tx_pos, not s->local->tx_pos,
+   * this way several messages of a tx batch can be written before any of
+   * them is published.
    */
-  tx_pos = vchiq_state.local->tx_pos;
+  tx_pos = vchiq_state.local_tx_pos;
   msg_full_size = VCHIQ_MSG_TOTAL_SIZE(msg_size);
 
   /*
@@ -502,6 +706,9 @@ static struct vchiq_header *vchiq_msg_prep_next_header_tx(size_t msg_size)
     slot_queue_index++;
   }
 
+  if (!(tx_pos & VCHIQ_SLOT_MASK))
+    vchiq_tx_wait_slot(slot_queue_index);
+
   slot_index = vchiq_state.local->slot_queue[slot_queue_index & VCHIQ_SLOT_QUEUE_MASK];
   slot = (char *)&vchiq_state.slots[slot_index];
 
@@ -618,23 +825,102 @@ struct vchiq_service *vchiq_service_open(uint32_t service_id, int version_min,
   return vchiq_open_service(service_id, version_max, version_min, service_cb);
 }
 
-void vchiq_msg_prep(int msgid, int srcport, int dstport, void *payload,
-  int payload_sz)
+/*
+ * Blocks until service on localport has room for one more message, that will
+ * end in slot tx_index, then accounts this message to the service.
+ */
+static void vchiq_service_quota_take(int localport, int tx_index)
+{
+  int irq;
+  bool stalled = false;
+  struct vchiq_service_quota *q = vchiq_port_to_quota(localport);
+
+  while (1) {
+    os_event_clear(&q->quota_event);
+    disable_irq_save_flags(irq);
+    if (q->message_use_count < q->message_quota
+      && (tx_index == q->previous_tx_index
+      || q->slot_use_count < q->slot_quota)) {
+      break;
+    }
+    restore_irq_flags(irq);
+
+    if (!stalled) {
+      stalled = true;
+      vchiq_state.tx_stats.quota_stalls++;
+      vchiq_tx_flush();
+    }
+    os_event_wait(&q->quota_event);
+  }
+
+  q->message_use_count++;
+  if (tx_index != q->previous_tx_index) {
+    q->previous_tx_index = tx_index;
+    q->slot_use_count++;
+  }
+  restore_irq_flags(irq);
+}
+
+static void vchiq_msg_write(int msgid, int srcport, int dstport,
+  const void *payload, int payload_sz)
 {
   struct vchiq_header *h;
-  int old_tx_pos = vchiq_state.local->tx_pos;
+  int tx_end_pos;
+
+  if (msgid == VCHIQ_MSG_DATA) {
+    tx_end_pos = vchiq_state.local_tx_pos
+      + VCHIQ_MSG_TOTAL_SIZE(payload_sz) - 1;
+    vchiq_service_quota_take(srcport, tx_end_pos / VCHIQ_SLOT_SIZE);
+  }
 
+  trace_event(TRACE_EV_VCHIQ_TX, srcport,
+    TRACE_VCHIQ_ARG(msgid, payload_sz));
   h = vchiq_msg_prep_next_header_tx(payload_sz);
   h->msgid = VCHIQ_MAKE_MSG(msgid, srcport, dstport);
   h->size = payload_sz;
   memcpy(h->data, payload, payload_sz);
-  vchiq_wmb();
+  MODULE_DEBUG("msg written: %p, tx_pos: %d, size: %d", h,
+    vchiq_state.local_tx_pos, VCHIQ_MSG_TOTAL_SIZE(h->size));
+}
 
-  /* Make the new tx_pos visible to the peer. */
-  vchiq_state.local->tx_pos = vchiq_state.local_tx_pos;
-  vchiq_wmb();
-  MODULE_DEBUG("msg sent: %p, tx_pos: %d, size: %d", h, old_tx_pos,
-    VCHIQ_MSG_TOTAL_SIZE(h->size));
+void vchiq_msg_prep(int msgid, int srcport, int dstport, void *payload,
+  int payload_sz)
+{
+  vchiq_msg_write(msgid, srcport, dstport, payload, payload_sz);
+  vchiq_tx_publish();
+}
+
+void vchiq_tx_batch_begin(struct vchiq_tx_batch *b)
+{
+  b->num_msgs = 0;
+}
+
+void vchiq_tx_batch_append(struct vchiq_tx_batch *b, int msgid, int srcport,
+  int dstport, const void *payload, int payload_sz)
+{
+  vchiq_msg_write(msgid, srcport, dstport, payload, payload_sz);
+  b->num_msgs++;
+}
+
+void vchiq_tx_batch_commit(struct vchiq_tx_batch *b)
+{
+  if (!b->num_msgs)
+    return;
+
+  vchiq_tx_publish();
+  vchiq_event_signal(&vchiq_state.remote->trigger);
+  MODULE_DEBUG("tx batch committed: %d msgs, tx_pos: %d", b->num_msgs,
+    vchiq_state.local_tx_pos);
+  b->num_msgs = 0;
+}
+
+void vchiq_get_tx_stats(struct vchiq_tx_stats *stats)
+{
+  struct vchiq_state *s = &vchiq_state;
+
+  *stats = s->tx_stats;
+  stats->slots_used = s->local_tx_pos / VCHIQ_SLOT_SIZE
+    - (s->slot_queue_avail - s->num_slots) + 1;
 }
 
 void vchiq_event_signal_trigger(void)
@@ -662,7 +948,7 @@ int vchiq_init(void)
   fragment_size = 2 * 64;
   /* Allocate space for the channels in coherent memory */
   /* TOTAL_SLOTS */
-  slot_mem_size = 16 * VCHIQ_SLOT_SIZE;
+  slot_mem_size = VCHIQ_NUM_SLOTS * VCHIQ_SLOT_SIZE;
   frag_mem_size = fragment_size * VCHIQ_MAX_FRAGMENTS;
 
   slot_mem = dma_alloc(slot_mem_size + frag_mem_size, 1);
@@ -56,6 +56,15 @@
 
 #define VCHIQ_SLOT_SIZE 4096
 
+/*
+ * Total number of slots in slot memory, including slot zero and sync slots.
+ * Use vchiq_get_tx_stats to check how many of ARM's slots are actually
+ * used under load before changing this.
+ */
+#define VCHIQ_NUM_SLOTS 16
+
+#define VCHIQ_MAX_SERVICES 10
+
 #define VCHIQ_NUM_CURRENT_BULKS 32
 #define VCHIQ_NUM_SERVICE_BULKS 4
 
@@ -174,6 +183,24 @@ struct vchiq_slot_zero {
   struct vchiq_slot_info slots[VCHIQ_MAX_SLOTS];
 };
 
+/*
+ * Limits how much of the ARM's tx slots a single service can occupy, so that
+ * one busy service can not starve others. Message is accounted to the service
+ * when it is written and released when VideoCore recycles the slot it is in.
+ */
+struct vchiq_service_quota {
+  unsigned short slot_quota;
+  unsigned short slot_use_count;
+  unsigned short message_quota;
+  unsigned short message_use_count;
+
+  /* Notified when use counts drop below quota */
+  struct event quota_event;
+
+  /* slot_queue index of the last slot this service has written to */
+  int previous_tx_index;
+};
+
 struct vchiq_state {
   bool is_connected;
 
@@ -204,6 +231,12 @@ struct vchiq_state {
   ** remote->slot_queue. */
   int rx_pos;
 
+  /*
+   * Remote slot, that is being parsed and is referenced by the parser, -1 if
+   * parser is at slot boundary.
+   */
+  int rx_slot;
+
   /* A cached copy of local->tx_pos. Only write to local->tx_pos, and read
     from remote->tx_pos. */
   int local_tx_pos;
@@ -211,6 +244,18 @@ struct vchiq_state {
   /* The slot_queue index of the slot to become available next. */
   int slot_queue_avail;
 
+  /* Number of slots owned by ARM side */
+  int num_slots;
+
+  /* Notified by recycle thread, when slot_queue_avail is advanced */
+  struct event ev_slot_avail;
+
+  unsigned short default_slot_quota;
+  unsigned short default_message_quota;
+  struct vchiq_service_quota service_quotas[VCHIQ_MAX_SERVICES];
+
+  struct vchiq_tx_stats tx_stats;
+
   struct list_head components;
 };
 
@@ -0,0 +1,231 @@
+/*
+ * Host microbenchmark of stringlib memcpy, memset, memcmp and strlen against
+ * the C library. On aarch64 hosts it is linked with armv8_stringlib.S, so
+ * the same code that runs on target is measured. Every measured call is also
+ * checked against the C library result. On other hosts the C fallback of
+ * stringlib.c is measured, 'make bench_qemu' cross builds the assembly and
+ * verifies it under qemu-aarch64 user mode emulation.
+ *
+ * Usage: ./bench_string [-v] [min_size [max_size]]
+ * -v - verify only, skip measurements
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+void *_memcpy(void *dst, const void *src, size_t n);
+void *_memset(void *dst, int value, long unsigned int n);
+int _memcmp(const void *a, const void *b, size_t n);
+size_t _strlen(const char *ptr);
+
+#define MIN_SIZE 8
+#define MAX_SIZE (1024 * 1024)
+/* Each measurement moves at least this many bytes */
+#define BYTES_PER_RUN (64 * 1024 * 1024)
+
+static uint8_t *buf_a;
+static uint8_t *buf_b;
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void fail(const char *fn, size_t n, int dst_off, int src_off)
+{
+  printf("FAIL: %s size:%zu dst offset:%d src offset:%d\n", fn, n, dst_off,
+    src_off);
+  exit(1);
+}
+
+static int sign(int v)
+{
+  return v < 0 ? -1 : v > 0;
+}
+
+/*
+ * Both offsets are varied, so that aligned, equally misaligned and mutually
+ * misaligned src/dst pairs go through every head and tail path.
+ */
+static void verify(size_t n, int dst_off, int src_off)
+{
+  uint8_t *dst = buf_b + dst_off;
+  uint8_t *src = buf_a + src_off;
+  size_t i;
+
+  for (i = 0; i < n + 64; ++i)
+    buf_a[i] = rand();
+
+  memset(buf_b, 0x5a, n + 64);
+  _memcpy(dst, src, n);
+  if (memcmp(dst, src, n) || buf_b[dst_off + n] != 0x5a
+    || (dst_off && buf_b[dst_off - 1] != 0x5a))
+    fail("memcpy", n, dst_off, src_off);
+
+  if (_memcmp(dst, src, n))
+    fail("memcmp", n, dst_off, src_off);
+
+  if (n) {
+    i = rand() % n;
+    dst[i] ^= 0x81;
+    if (sign(_memcmp(dst, src, n)) != sign(memcmp(dst, src, n)))
+      fail("memcmp", n, dst_off, src_off);
+    if (sign(_memcmp(src, dst, n)) != sign(memcmp(src, dst, n)))
+      fail("memcmp", n, dst_off, src_off);
+  }
+
+  _memset(dst, 0xa5, n);
+  for (i = 0; i < n; ++i)
+    if (dst[i] != 0xa5)
+      fail("memset", n, dst_off, src_off);
+  if (buf_b[dst_off + n] != 0x5a)
+    fail("memset", n, dst_off, src_off);
+
+  dst[n] = 0;
+  if (_strlen((char *)dst) != n)
+    fail("strlen", n, dst_off, src_off);
+}
+
+typedef void (*bench_fn)(size_t n, int offset);
+
+static void run_memcpy(size_t n, int offset) { _memcpy(buf_b + offset, buf_a, n); }
+static void libc_memcpy(size_t n, int offset) { memcpy(buf_b + offset, buf_a, n); }
+static void run_memset(size_t n, int offset) { _memset(buf_b + offset, 0, n); }
+static void libc_memset(size_t n, int offset) { memset(buf_b + offset, 0, n); }
+static void run_memcmp(size_t n, int offset)
+{
+  if (_memcmp(buf_b + offset, buf_a, n))
+    abort();
+}
+
+static void libc_memcmp(size_t n, int offset)
+{
+  if (memcmp(buf_b + offset, buf_a, n))
+    abort();
+}
+
+static void run_strlen(size_t n, int offset)
+{
+  if (_strlen((char *)buf_b + offset) != n)
+    abort();
+}
+
+static void libc_strlen(size_t n, int offset)
+{
+  if (strlen((char *)buf_b + offset) != n)
+    abort();
+}
+
+/* Returns throughput in MB/s */
+static double measure(bench_fn fn, size_t n, int offset)
+{
+  uint64_t start, elapsed;
+  size_t i, iters = BYTES_PER_RUN / n;
+
+  fn(n, offset);
+  start = now_ns();
+  for (i = 0; i < iters; ++i) {
+    fn(n, offset);
+    __asm__ volatile("" ::: "memory");
+  }
+  elapsed = now_ns() - start;
+  if (!elapsed)
+    elapsed = 1;
+  return (double)iters * n * 1000.0 / elapsed;
+}
+
+static void prepare(const char *name, size_t n, int offset)
+{
+  if (!strcmp(name, "memcpy") || !strcmp(name, "memset"))
+    return;
+
+  memcpy(buf_b + offset, buf_a, n);
+  if (!strcmp(name, "strlen")) {
+    memset(buf_b + offset, 'a', n);
+    buf_b[offset + n] = 0;
+  }
+}
+
+struct bench {
+  const char *name;
+  bench_fn fn;
+  bench_fn libc_fn;
+};
+
+static const struct bench benches[] = {
+  { "memcpy", run_memcpy, libc_memcpy },
+  { "memset", run_memset, libc_memset },
+  { "memcmp", run_memcmp, libc_memcmp },
+  { "strlen", run_strlen, libc_strlen },
+};
+
+int main(int argc, char **argv)
+{
+  size_t n, i;
+  int offset, src_off;
+  int verify_only = 0;
+  size_t min_size = MIN_SIZE;
+  size_t max_size = MAX_SIZE;
+  size_t buf_size;
+  const struct bench *b;
+  double ours, libc;
+
+  if (argc > 1 && !strcmp(argv[1], "-v")) {
+    verify_only = 1;
+    argc--;
+    argv++;
+  }
+
+  if (argc > 1)
+    min_size = strtoul(argv[1], NULL, 0);
+  if (argc > 2)
+    max_size = strtoul(argv[2], NULL, 0);
+
+#ifdef __aarch64__
+  printf("measuring armv8_stringlib.S\n");
+#else
+  printf("measuring stringlib.c, use 'make bench_qemu' for the assembly\n");
+#endif
+
+  /* room for verification sizes, offsets and the tail guard byte */
+  buf_size = (max_size + 1024 + 63) & ~63ul;
+  buf_a = aligned_alloc(64, buf_size);
+  buf_b = aligned_alloc(64, buf_size);
+  if (!buf_a || !buf_b)
+    return 1;
+
+  for (n = 0; n < 600; ++n)
+    for (offset = 0; offset < 16; ++offset)
+      for (src_off = 0; src_off < 16; ++src_off)
+        verify(n, offset, src_off);
+
+  for (n = min_size; n <= max_size; n *= 2)
+    for (offset = 0; offset < 16; ++offset)
+      for (src_off = 0; src_off < 16; src_off += 5)
+        verify(n, offset, src_off);
+
+  printf("verification done\n");
+  if (verify_only)
+    return 0;
+
+  printf("%-8s %8s %6s %12s %12s %7s\n", "func", "size", "offset", "MB/s",
+    "libc MB/s", "ratio");
+
+  for (i = 0; i < sizeof(benches) / sizeof(benches[0]); ++i) {
+    b = &benches[i];
+    for (n = min_size; n <= max_size; n *= 2) {
+      for (offset = 0; offset < 8; offset += 3) {
+        prepare(b->name, n, offset);
+        ours = measure(b->fn, n, offset);
+        libc = measure(b->libc_fn, n, offset);
+        printf("%-8s %8zu %6d %12.1f %12.1f %7.2f\n", b->name, n, offset,
+          ours, libc, ours / libc);
+      }
+    }
+  }
+  return 0;
+}
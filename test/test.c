@@ -1,7 +1,15 @@
-#include <stringlib.h>
+/*
+ * C library headers go before stringlib.h, which renames stringlib functions
+ * for TEST_STRING. vsprintf and vsnprintf take va_list by pointer there,
+ * so their declarations clash with the C library if renamed in stdio.h.
+ */
 #include <stdio.h>
 #include <stdlib.h>
-// #include <string.h>
+#include <stringlib.h>
+
+/* Expected output comes from the C library */
+#undef vsprintf
+#undef vsnprintf
 
 void test_sprintf(const char *fmt, ...)
 {
@@ -10,7 +18,7 @@ void test_sprintf(const char *fmt, ...)
   char expected[256];
   __builtin_va_list args;
   __builtin_va_start(args, fmt);
-  _vsprintf(actual, fmt, args);
+  _vsprintf(actual, fmt, &args);
   __builtin_va_start(args, fmt);
   vsprintf(expected, fmt, args);
   if (strcmp(actual, expected)) {
@@ -28,8 +36,10 @@ void test_snprintf(int n, const char *fmt, ...)
   char buf1[256];
   char buf2[256];
   __builtin_va_list args;
+  /* Nothing is written with n == 0 */
+  buf1[0] = buf2[0] = 0;
   __builtin_va_start(args, fmt);
-  n1 = _vsnprintf(buf1, n, fmt, args);
+  n1 = _vsnprintf(buf1, n, fmt, &args);
   __builtin_va_start(args, fmt);
   n2 = vsnprintf(buf2, n, fmt, args);
   if (n1 != n2) {
@@ -43,6 +53,27 @@ void test_snprintf(int n, const char *fmt, ...)
   printf("success: '%s'\n", buf1);
 }
 
+void test_packed(const char *fmt, ...)
+{
+  int argc;
+  uint32_t str_mask;
+  uint64_t argv[8];
+  char actual[256];
+  char expected[256];
+  __builtin_va_list args;
+  __builtin_va_start(args, fmt);
+  argc = vfmt_pack_args(fmt, &args, argv, 8, &str_mask);
+  vsnprintf_packed(actual, sizeof(actual), fmt, argv, argc);
+  __builtin_va_start(args, fmt);
+  vsnprintf(expected, sizeof(expected), fmt, args);
+  if (strcmp(actual, expected)) {
+    printf("assertion! strings not equal: expected: '%s', got '%s'\n",
+      expected, actual);
+    exit(1);
+  }
+  printf("success: '%s' (%d args, str_mask %x)\n", actual, argc, str_mask);
+}
+
 void run_cases_sprintf()
 {
   test_sprintf("%p", 1234);
@@ -84,6 +115,18 @@ void run_cases_sprintf()
   test_snprintf(3, "%016llx", 0x2000);
   test_snprintf(4, "%016llx", 0x2000);
   test_snprintf(20, "%016llx", 0x2000);
+
+  test_sprintf("100%%");
+  test_sprintf("%%d %d%%", 5);
+  test_sprintf("uptime %lu us, idle %d%%, irq %d%%, schedules %u",
+    123456789ul, 40, 7, 1000);
+  test_sprintf("%%%%%d%%%%", 1);
+
+  test_packed("no args");
+  test_packed("%d %x %lld", -1234, 0x80000000, -5ll);
+  test_packed("[%s] state:%d %s", "tag", 3, "ready");
+  test_packed("%08x|%*d|%p", 0x1234, 6, 42, 1234);
+  test_packed("%s %d%% %u", "cpu", 40, 7);
 }
 
 int main()
@@ -0,0 +1 @@
+../src/media/fmp4.c
\ No newline at end of file
@@ -0,0 +1 @@
+../src/media/gop_ring.c
\ No newline at end of file
@@ -0,0 +1,348 @@
+/*
+ * Host test of pre-event GOP ring (src/media/gop_ring.c).
+ *
+ * Usage: ./gop_ring_test
+ *
+ * Frames are pushed the way encoder delivers them, each frame is one buffer
+ * filled with its frame number, so reader can check it got the right data.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errcode.h>
+#include <vc/service_mmal_protocol.h>
+#include <media/gop_ring.h>
+
+#define FAIL(__fmt, ...) \
+  do { \
+    printf("FAIL: %s:%d: " __fmt "\n", __func__, __LINE__, ##__VA_ARGS__); \
+    exit(1); \
+  } while(0)
+
+#define EXPECT(__cond, __fmt, ...) \
+  do { if (!(__cond)) FAIL(__fmt, ##__VA_ARGS__); } while(0)
+
+#define TEST_BUF_SIZE 1000
+#define TEST_MAX_RECORDS 16
+#define TEST_FRAME_US 100000
+/* Window longer than any test, so only memory limits what is kept */
+#define TEST_NO_WINDOW 1000000
+
+static struct gop_ring ring;
+static uint8_t ring_buf[TEST_BUF_SIZE];
+static struct gop_ring_record ring_records[TEST_MAX_RECORDS];
+static uint8_t frame_data[TEST_BUF_SIZE];
+
+static void init(int max_records, int window_ms)
+{
+  memset(ring_buf, 0xee, sizeof(ring_buf));
+  gop_ring_init(&ring, ring_buf, sizeof(ring_buf), ring_records, max_records,
+    window_ms);
+}
+
+/* Pushes frame number n as one buffer of given size */
+static void push(int n, size_t size, bool key)
+{
+  uint32_t flags = MMAL_BUFFER_HEADER_FLAG_FRAME_END;
+
+  if (key)
+    flags |= MMAL_BUFFER_HEADER_FLAG_KEYFRAME;
+
+  memset(frame_data, n, size);
+  gop_ring_push(&ring, frame_data, size, flags, (int64_t)n * TEST_FRAME_US);
+}
+
+static struct gop_ring_stats stats(void)
+{
+  struct gop_ring_stats s;
+
+  gop_ring_get_stats(&ring, &s);
+  return s;
+}
+
+static int count(void)
+{
+  return ring.next_seq - ring.first_seq;
+}
+
+/* Reads next buffer and checks it is frame n of given size */
+static void read_expect_frame(int n, size_t size)
+{
+  struct gop_ring_buf b;
+  size_t i;
+
+  EXPECT(gop_ring_read_begin(&ring, &b) == SUCCESS, "no frame %d", n);
+  EXPECT(b.size == size, "frame %d size %zu, expected %zu", n, b.size, size);
+  EXPECT(b.pts == (int64_t)n * TEST_FRAME_US, "frame %d pts %ld", n,
+    (long)b.pts);
+  for (i = 0; i < size; ++i)
+    EXPECT(((const uint8_t *)b.data)[i] == n, "frame %d corrupt at %zu", n,
+      i);
+  gop_ring_read_end(&ring);
+}
+
+static void read_expect_empty(void)
+{
+  struct gop_ring_buf b;
+
+  EXPECT(gop_ring_read_begin(&ring, &b) == ERR_NOT_FOUND,
+    "reader should have caught up");
+}
+
+static void test_wait_keyframe(void)
+{
+  init(TEST_MAX_RECORDS, TEST_NO_WINDOW);
+
+  /* Nothing is stored until the first keyframe */
+  push(0, 100, false);
+  push(1, 100, false);
+  EXPECT(count() == 0 && stats().buffers_dropped == 2, "count %d", count());
+
+  push(2, 100, true);
+  push(3, 100, false);
+  EXPECT(count() == 2, "count %d", count());
+
+  /* Keyframe split in two buffers starts GOP only with the first one */
+  gop_ring_push(&ring, frame_data, 10, MMAL_BUFFER_HEADER_FLAG_KEYFRAME,
+    4 * TEST_FRAME_US);
+  gop_ring_push(&ring, frame_data, 10, MMAL_BUFFER_HEADER_FLAG_KEYFRAME
+    | MMAL_BUFFER_HEADER_FLAG_FRAME_END, 4 * TEST_FRAME_US);
+  EXPECT(ring_records[2].gop_start, "no gop start at frame start");
+  EXPECT(!ring_records[3].gop_start, "gop start in the middle of a frame");
+  push(5, 100, true);
+  EXPECT(ring_records[4].gop_start, "no gop start after frame end");
+  printf("success: wait_keyframe\n");
+}
+
+static void test_alloc_wrap(void)
+{
+  init(TEST_MAX_RECORDS, TEST_NO_WINDOW);
+
+  /* GOP 0: frames 0-2 at 0-600, GOP 1: frames 3-5 at 600-1000 */
+  push(0, 200, true);
+  push(1, 200, false);
+  push(2, 200, false);
+  push(3, 200, true);
+  push(4, 200, false);
+  EXPECT(ring.head == TEST_BUF_SIZE, "head %zu", ring.head);
+
+  /* No room at the end, GOP 0 is evicted and frame wraps to 0 */
+  push(5, 200, false);
+  EXPECT(stats().gops_evicted == 1, "evicted %d", stats().gops_evicted);
+  EXPECT(ring_records[5].offset == 0, "offset %u", ring_records[5].offset);
+
+  /* Gap before the oldest record is never filled completely */
+  push(6, 200, false);
+  EXPECT(ring_records[6].offset == 200, "offset %u", ring_records[6].offset);
+  push(7, 199, false);
+  EXPECT(ring_records[7].offset == 400, "offset %u", ring_records[7].offset);
+  EXPECT(count() == 5, "count %d", count());
+
+  /* Only current GOP left, frame 8 can not go anywhere */
+  push(8, 2, false);
+  EXPECT(count() == 0 && ring.wait_keyframe, "count %d", count());
+  EXPECT(stats().buffers_dropped == 1, "dropped %d", stats().buffers_dropped);
+
+  push(9, 100, false);
+  push(10, 900, true);
+  EXPECT(count() == 1 && ring_records[0].offset == 0, "count %d", count());
+
+  /* Buffer that can never fit is dropped, not stored over the ring */
+  push(11, TEST_BUF_SIZE, true);
+  EXPECT(count() == 0, "count %d", count());
+
+  push(12, 300, true);
+  gop_ring_trigger(&ring);
+  read_expect_frame(12, 300);
+  read_expect_empty();
+  printf("success: alloc_wrap\n");
+}
+
+static void test_wrap_data(void)
+{
+  int i;
+  int first;
+
+  init(TEST_MAX_RECORDS, TEST_NO_WINDOW);
+
+  /* GOPs of 4 frames with odd sizes, going around the ring several times */
+  for (i = 0; i < 64; ++i)
+    push(i, 70 + i % 5, !(i % 4));
+
+  /* Whole GOPs are kept and their data is intact */
+  first = 64 - count();
+  EXPECT(!(first % 4), "ring starts at frame %d", first);
+  gop_ring_trigger(&ring);
+  for (i = first; i < 64; ++i)
+    read_expect_frame(i, 70 + i % 5);
+  read_expect_empty();
+  printf("success: wrap_data\n");
+}
+
+static void test_max_records(void)
+{
+  int i;
+
+  init(4, TEST_NO_WINDOW);
+
+  for (i = 0; i < 4; ++i)
+    push(i, 10, !(i % 2));
+  EXPECT(count() == 4, "count %d", count());
+
+  /* Record table is full, oldest GOP goes */
+  push(4, 10, true);
+  EXPECT(count() == 3 && ring.first_seq == 2, "count %d", count());
+  gop_ring_trigger(&ring);
+  read_expect_frame(2, 10);
+  read_expect_frame(3, 10);
+  read_expect_frame(4, 10);
+  printf("success: max_records\n");
+}
+
+static void test_reader_lost(void)
+{
+  init(TEST_MAX_RECORDS, TEST_NO_WINDOW);
+
+  /* GOP 0: frames 0-2, GOP 1: frames 3-4 */
+  push(0, 300, true);
+  push(1, 300, false);
+  push(2, 300, false);
+  push(3, 50, true);
+  push(4, 50, false);
+
+  gop_ring_trigger(&ring);
+  read_expect_frame(0, 300);
+
+  /* Reader is not holding anything, GOP 0 is evicted under it */
+  push(5, 200, false);
+  EXPECT(stats().reader_buffers_lost == 2, "lost %d",
+    stats().reader_buffers_lost);
+  read_expect_frame(3, 50);
+  read_expect_frame(4, 50);
+  read_expect_frame(5, 200);
+  read_expect_empty();
+
+  /* Reader that has caught up loses nothing */
+  push(6, 500, true);
+  read_expect_frame(6, 500);
+  push(7, 500, true);
+  EXPECT(stats().reader_buffers_lost == 2, "lost %d",
+    stats().reader_buffers_lost);
+  read_expect_frame(7, 500);
+  printf("success: reader_lost\n");
+}
+
+static void test_reader_holds(void)
+{
+  struct gop_ring_buf b;
+
+  init(TEST_MAX_RECORDS, TEST_NO_WINDOW);
+
+  push(0, 400, true);
+  push(1, 400, false);
+
+  gop_ring_trigger(&ring);
+  EXPECT(gop_ring_read_begin(&ring, &b) == SUCCESS, "read");
+
+  /* GOP 0 is held by reader, new GOP does not fit and is dropped */
+  push(2, 400, true);
+  push(3, 100, false);
+  EXPECT(count() == 2 && stats().buffers_dropped == 2, "count %d, dropped %d",
+    count(), stats().buffers_dropped);
+  EXPECT(ring.wait_keyframe, "should wait for keyframe");
+  EXPECT(((const uint8_t *)b.data)[0] == 0 && b.size == 400,
+    "held record overwritten");
+
+  /* Small frames still fit, but not without a keyframe */
+  push(4, 100, false);
+  EXPECT(count() == 2, "count %d", count());
+  gop_ring_read_end(&ring);
+
+  /*
+   * Released, next keyframe recovers. Reader was in the middle of GOP 0, so
+   * its second frame is lost
+   */
+  push(5, 400, true);
+  EXPECT(count() == 1 && !ring.wait_keyframe, "count %d", count());
+  EXPECT(stats().reader_buffers_lost == 1, "lost %d",
+    stats().reader_buffers_lost);
+  read_expect_frame(5, 400);
+  read_expect_empty();
+  printf("success: reader_holds\n");
+}
+
+static void test_config(void)
+{
+  static const uint8_t cfg[] = { 0, 0, 0, 1, 0x67, 0x42 };
+  struct gop_ring_buf b;
+
+  init(TEST_MAX_RECORDS, TEST_NO_WINDOW);
+
+  gop_ring_push(&ring, cfg, sizeof(cfg), MMAL_BUFFER_HEADER_FLAG_CONFIG, -1);
+  push(0, 400, true);
+  push(1, 400, false);
+
+  gop_ring_trigger(&ring);
+  EXPECT(gop_ring_read_begin(&ring, &b) == SUCCESS, "read");
+  EXPECT(b.size == sizeof(cfg) && !memcmp(b.data, cfg, sizeof(cfg))
+    && (b.flags & MMAL_BUFFER_HEADER_FLAG_CONFIG), "config expected first");
+
+  /* Holding config does not pin the oldest GOP */
+  push(2, 400, true);
+  EXPECT(count() == 1 && stats().reader_buffers_lost == 2, "count %d",
+    count());
+  gop_ring_read_end(&ring);
+  read_expect_frame(2, 400);
+  printf("success: config\n");
+}
+
+static void test_window(void)
+{
+  int i;
+  uint64_t seq;
+  int64_t oldest, newest;
+
+  /* 5 frame GOPs of 100ms, 1 second window, memory for all of it */
+  init(TEST_MAX_RECORDS, 1000);
+
+  for (i = 0; i < 40; ++i) {
+    push(i, 10, !(i % 5));
+
+    newest = (int64_t)i * TEST_FRAME_US;
+    oldest = ring_records[ring.first_seq % TEST_MAX_RECORDS].pts;
+    EXPECT(ring_records[ring.first_seq % TEST_MAX_RECORDS].gop_start,
+      "ring does not start at GOP");
+
+    /* Ring covers the window, unless there is not that much video yet */
+    EXPECT(newest - oldest >= 1000000 || oldest == 0,
+      "frame %d: only %ld us kept", i, (long)(newest - oldest));
+
+    /* But the next GOP would not cover it */
+    for (seq = ring.first_seq + 1; seq < ring.next_seq; ++seq) {
+      if (ring_records[seq % TEST_MAX_RECORDS].gop_start) {
+        EXPECT(newest - ring_records[seq % TEST_MAX_RECORDS].pts < 1000000,
+          "frame %d: GOP at %lu should have been evicted", i,
+          (unsigned long)seq);
+        break;
+      }
+    }
+  }
+
+  /* Frame 39 is newest, GOP at 25 is the last one starting 1s before */
+  EXPECT(ring.first_seq == 25, "ring starts at %lu",
+    (unsigned long)ring.first_seq);
+  printf("success: window\n");
+}
+
+int main(void)
+{
+  test_wait_keyframe();
+  test_alloc_wrap();
+  test_wrap_data();
+  test_max_records();
+  test_reader_lost();
+  test_reader_holds();
+  test_config();
+  test_window();
+  return 0;
+}
@@ -0,0 +1 @@
+../src/media/h264.c
\ No newline at end of file
@@ -0,0 +1,5 @@
+#pragma once
+
+/* Host replacement for cpu.h, tests are single threaded */
+#define disable_irq_save_flags(__flags) do { (__flags) = 0; } while(0)
+#define restore_irq_flags(__flags) do { (void)(__flags); } while(0)
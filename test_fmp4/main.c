@@ -0,0 +1,676 @@
+/*
+ * Host test of H.264 indexer and fragmented MP4 muxer (src/media).
+ *
+ * Usage: ./fmp4_test                      - run self test on synthetic stream
+ *        ./fmp4_test in.h264 out.mp4 [fps] - mux captured Annex-B file
+ *
+ * Self test generates a stream with known SPS, GOP structure and payloads,
+ * pushes it to the muxer the way MMAL encoder delivers buffers and checks
+ * the resulting box structure, sample data and keyframe index.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errcode.h>
+#include <vc/service_mmal_protocol.h>
+#include <media/h264.h>
+#include <media/fmp4.h>
+
+#define TEST_WIDTH 1920
+#define TEST_HEIGHT 1080
+#define TEST_FPS 30
+#define TEST_GOP 15
+#define TEST_FRAMES 100
+#define TEST_MAX_FRAMES 256
+#define TEST_OUT_SIZE (8 * 1024 * 1024)
+
+#define FAIL(__fmt, ...) \
+  do { \
+    printf("FAIL: %s:%d: " __fmt "\n", __func__, __LINE__, ##__VA_ARGS__); \
+    exit(1); \
+  } while(0)
+
+#define EXPECT(__cond, __fmt, ...) \
+  do { if (!(__cond)) FAIL(__fmt, ##__VA_ARGS__); } while(0)
+
+struct out_buf {
+  uint8_t *data;
+  size_t size;
+  size_t len;
+};
+
+static int out_write(void *arg, const void *data, size_t size)
+{
+  struct out_buf *o = arg;
+
+  if (o->len + size > o->size)
+    return ERR_RESOURCE;
+
+  memcpy(o->data + o->len, data, size);
+  o->len += size;
+  return SUCCESS;
+}
+
+static int file_write(void *arg, const void *data, size_t size)
+{
+  return fwrite(data, 1, size, arg) == size ? SUCCESS : ERR_IO;
+}
+
+static uint32_t rd32(const uint8_t *p)
+{
+  return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static uint64_t rd64(const uint8_t *p)
+{
+  return ((uint64_t)rd32(p) << 32) | rd32(p + 4);
+}
+
+/* Bit writer for generating SPS */
+struct bit_writer {
+  uint8_t buf[64];
+  int bits;
+};
+
+static void bw_bit(struct bit_writer *w, int bit)
+{
+  if (bit)
+    w->buf[w->bits / 8] |= 0x80 >> (w->bits % 8);
+  w->bits++;
+}
+
+static void bw_bits(struct bit_writer *w, uint32_t v, int n)
+{
+  while (n--)
+    bw_bit(w, (v >> n) & 1);
+}
+
+static void bw_ue(struct bit_writer *w, uint32_t v)
+{
+  int len = 0;
+
+  while ((v + 1) >> (len + 1))
+    len++;
+  bw_bits(w, 0, len);
+  bw_bits(w, v + 1, len + 1);
+}
+
+/* Generated stream */
+struct test_frame {
+  size_t offset;
+  size_t size;
+  bool key;
+  int64_t pts;
+  /* Sum of bytes of NAL units, that should end up in the sample */
+  uint32_t payload_sum;
+  uint32_t payload_size;
+};
+
+struct test_stream {
+  uint8_t *data;
+  size_t size;
+  struct test_frame frames[TEST_MAX_FRAMES];
+  int num_frames;
+  uint8_t sps[64];
+  size_t sps_size;
+};
+
+static void stream_put(struct test_stream *s, const void *data, size_t size)
+{
+  memcpy(s->data + s->size, data, size);
+  s->size += size;
+}
+
+static void stream_put_nal(struct test_stream *s, struct test_frame *f,
+  const uint8_t *nal, size_t size, bool in_sample)
+{
+  static const uint8_t start_code[] = { 0, 0, 0, 1 };
+  size_t i;
+
+  stream_put(s, start_code, sizeof(start_code));
+  stream_put(s, nal, size);
+  if (!in_sample)
+    return;
+
+  for (i = 0; i < size; ++i)
+    f->payload_sum += nal[i];
+  f->payload_size += 4 + size;
+}
+
+static void stream_gen_sps(struct test_stream *s)
+{
+  struct bit_writer w = { 0 };
+
+  /* nal header, profile_idc 100, constraints, level_idc 40 */
+  bw_bits(&w, 0x67, 8);
+  bw_bits(&w, 100, 8);
+  bw_bits(&w, 0, 8);
+  bw_bits(&w, 40, 8);
+  /* sps_id, chroma_format_idc, bit depths, qpprime, no scaling matrix */
+  bw_ue(&w, 0);
+  bw_ue(&w, 1);
+  bw_ue(&w, 0);
+  bw_ue(&w, 0);
+  bw_bit(&w, 0);
+  bw_bit(&w, 0);
+  /* log2_max_frame_num_minus4, poc type 2, max_num_ref_frames, gaps */
+  bw_ue(&w, 0);
+  bw_ue(&w, 2);
+  bw_ue(&w, 1);
+  bw_bit(&w, 0);
+  /* 120 x 68 macroblocks, frame_mbs_only, direct_8x8 */
+  bw_ue(&w, TEST_WIDTH / 16 - 1);
+  bw_ue(&w, (TEST_HEIGHT + 15) / 16 - 1);
+  bw_bit(&w, 1);
+  bw_bit(&w, 1);
+  /* crop 8 lines at the bottom, crop unit is 2 */
+  bw_bit(&w, 1);
+  bw_ue(&w, 0);
+  bw_ue(&w, 0);
+  bw_ue(&w, 0);
+  bw_ue(&w, (16 - TEST_HEIGHT % 16) % 16 / 2);
+  /* no VUI, rbsp trailing bits */
+  bw_bit(&w, 0);
+  bw_bit(&w, 1);
+
+  memcpy(s->sps, w.buf, (w.bits + 7) / 8);
+  s->sps_size = (w.bits + 7) / 8;
+}
+
+static void stream_gen(struct test_stream *s, int num_frames, int gop,
+  bool inline_headers)
+{
+  static const uint8_t aud[] = { 0x09, 0xf0 };
+  static const uint8_t pps[] = { 0x68, 0xee, 0x3c, 0x80 };
+  uint8_t slice[4096];
+  size_t slice_size;
+  size_t j, last_ep;
+  int i;
+  struct test_frame *f;
+
+  memset(s, 0, offsetof(struct test_stream, sps));
+  s->data = malloc(num_frames * (sizeof(slice) + 256));
+  stream_gen_sps(s);
+
+  srand(1);
+  for (i = 0; i < num_frames; ++i) {
+    f = &s->frames[s->num_frames++];
+    f->offset = s->size;
+    f->key = !(i % gop);
+    f->pts = (int64_t)i * 1000000 / TEST_FPS;
+
+    stream_put_nal(s, f, aud, sizeof(aud), false);
+    if (f->key && (inline_headers || !i)) {
+      stream_put_nal(s, f, s->sps, s->sps_size, false);
+      stream_put_nal(s, f, pps, sizeof(pps), false);
+    }
+
+    slice_size = f->key ? 3000 + rand() % 1000 : 200 + rand() % 1500;
+    slice[0] = f->key ? 0x65 : 0x41;
+    /* first_mb_in_slice = 0 */
+    slice[1] = 0x88;
+    last_ep = 0;
+    for (j = 2; j < slice_size; ++j) {
+      slice[j] = rand();
+      /* Emulation prevention sequences must pass through untouched */
+      if (j >= last_ep + 5 && !(rand() % 64)) {
+        slice[j - 2] = 0;
+        slice[j - 1] = 0;
+        slice[j] = 3;
+        last_ep = j;
+      } else if (!slice[j]) {
+        slice[j] = 1;
+      }
+    }
+    stream_put_nal(s, f, slice, slice_size, true);
+    f->size = s->size - f->offset;
+  }
+}
+
+/*
+ * Pushes stream to muxer, every frame in num_chunks buffers, like encoder
+ * with small output buffers would deliver it.
+ */
+static void stream_mux(const struct test_stream *s, struct fmp4_muxer *m,
+  int num_chunks)
+{
+  int i, c;
+  int err;
+  uint32_t flags;
+  size_t chunk, pos;
+  const struct test_frame *f;
+
+  for (i = 0; i < s->num_frames; ++i) {
+    f = &s->frames[i];
+    chunk = f->size / num_chunks + 1;
+    for (c = 0, pos = 0; pos < f->size; ++c, pos += chunk) {
+      flags = f->key ? MMAL_BUFFER_HEADER_FLAG_KEYFRAME : 0;
+      if (!pos)
+        flags |= MMAL_BUFFER_HEADER_FLAG_FRAME_START;
+      if (pos + chunk >= f->size)
+        flags |= MMAL_BUFFER_HEADER_FLAG_FRAME_END;
+
+      err = fmp4_muxer_push(m, s->data + f->offset + pos,
+        pos + chunk >= f->size ? f->size - pos : chunk, flags, f->pts);
+      EXPECT(err == SUCCESS, "push frame %d failed: %d", i, err);
+    }
+  }
+
+  err = fmp4_muxer_finish(m);
+  EXPECT(err == SUCCESS, "finish failed: %d", err);
+}
+
+static const uint8_t *box_find(const uint8_t *p, const uint8_t *end,
+  const char *type)
+{
+  while (p + 8 <= end) {
+    if (!memcmp(p + 4, type, 4))
+      return p;
+    p += rd32(p);
+  }
+  return NULL;
+}
+
+/* Finds box by path like "trak/mdia/minf", returns pointer to box header */
+static const uint8_t *box_path(const uint8_t *box, const char *path)
+{
+  const uint8_t *p = box;
+  char type[5] = { 0 };
+
+  while (*path && p) {
+    memcpy(type, path, 4);
+    p = box_find(p + 8, p + rd32(p), type);
+    path += path[4] ? 5 : 4;
+  }
+  return p;
+}
+
+static int64_t pts_to_ticks(int64_t pts)
+{
+  return pts * FMP4_TIMESCALE / 1000000;
+}
+
+/* Duration lasts until the next frame, that was not dropped */
+static uint32_t expected_duration(const struct test_stream *s, int frame)
+{
+  int i;
+
+  for (i = frame + 1; i < s->num_frames; ++i)
+    if (s->frames[i].payload_size)
+      return pts_to_ticks(s->frames[i].pts) - pts_to_ticks(s->frames[frame].pts);
+
+  return FMP4_TIMESCALE / TEST_FPS;
+}
+
+struct check_result {
+  int fragments;
+  int frames;
+  int sync_fragments;
+  uint64_t moof_offsets[TEST_MAX_FRAMES];
+  uint64_t moof_times[TEST_MAX_FRAMES];
+};
+
+/* Checks that NAL units in sample match the frame that was pushed */
+static void check_sample(const uint8_t *p, uint32_t size,
+  const struct test_frame *f, int idx)
+{
+  uint32_t nal_size, i;
+  uint32_t sum = 0;
+  const uint8_t *end = p + size;
+  int type;
+
+  EXPECT(size == f->payload_size, "sample %d size %u, expected %u", idx, size,
+    f->payload_size);
+
+  while (p < end) {
+    EXPECT(p + 4 <= end, "sample %d: truncated length", idx);
+    nal_size = rd32(p);
+    p += 4;
+    EXPECT(nal_size && p + nal_size <= end, "sample %d: bad nal size %u", idx,
+      nal_size);
+    type = p[0] & 0x1f;
+    EXPECT(type != H264_NAL_SPS && type != H264_NAL_PPS
+      && type != H264_NAL_AUD, "sample %d: nal type %d in sample", idx, type);
+    for (i = 0; i < nal_size; ++i)
+      sum += p[i];
+    p += nal_size;
+  }
+  EXPECT(sum == f->payload_sum, "sample %d payload differs", idx);
+}
+
+static void check_file(const uint8_t *data, size_t size,
+  const struct test_stream *s, struct check_result *r)
+{
+  const uint8_t *p = data;
+  const uint8_t *end = data + size;
+  const uint8_t *moov, *b, *trun, *mdat, *sample;
+  uint32_t i, n, flags, data_offset;
+  uint32_t duration, sample_size, sample_flags;
+  uint64_t time = 0, offset;
+  int frame = 0;
+
+  memset(r, 0, sizeof(*r));
+
+  EXPECT(!memcmp(p + 4, "ftyp", 4), "no ftyp");
+  p += rd32(p);
+  moov = p;
+  EXPECT(!memcmp(p + 4, "moov", 4), "no moov after ftyp");
+  p += rd32(p);
+
+  b = box_path(moov, "trak/tkhd");
+  EXPECT(b, "no tkhd");
+  EXPECT(rd32(b + 84) >> 16 == TEST_WIDTH && rd32(b + 88) >> 16 == TEST_HEIGHT,
+    "tkhd size %ux%u", rd32(b + 84) >> 16, rd32(b + 88) >> 16);
+
+  b = box_path(moov, "trak/mdia/minf/stbl/stsd");
+  EXPECT(b, "no stsd");
+  b = box_find(b + 16 + 8 + 78, b + rd32(b), "avcC");
+  EXPECT(b && b[8] == 1 && b[9] == 100 && b[11] == 40, "bad avcC");
+  EXPECT(((b[14] << 8) | b[15]) == s->sps_size
+    && !memcmp(b + 16, s->sps, s->sps_size), "avcC SPS differs");
+  EXPECT(box_path(moov, "mvex/trex"), "no trex");
+
+  while (p + 8 <= end && !memcmp(p + 4, "moof", 4)) {
+    offset = p - data;
+    EXPECT(rd32(box_path(p, "mfhd") + 12) == r->fragments + 1,
+      "bad sequence number");
+
+    b = box_path(p, "traf/tfdt");
+    EXPECT(b && rd64(b + 12) == time, "fragment %d: tfdt %lu, expected %lu",
+      r->fragments, rd64(b + 12), time);
+
+    trun = box_path(p, "traf/trun");
+    EXPECT(trun, "no trun");
+    flags = rd32(trun + 8) & 0xffffff;
+    EXPECT(flags == 0x701, "trun flags %x", flags);
+    n = rd32(trun + 12);
+    data_offset = rd32(trun + 16);
+    EXPECT(n > 0, "empty fragment");
+
+    mdat = p + rd32(p);
+    EXPECT(!memcmp(mdat + 4, "mdat", 4), "no mdat after moof");
+    EXPECT(data_offset == mdat + 8 - p, "data_offset %u", data_offset);
+
+    sample = mdat + 8;
+    for (i = 0; i < n; ++i) {
+      duration = rd32(trun + 20 + i * 12);
+      sample_size = rd32(trun + 24 + i * 12);
+      sample_flags = rd32(trun + 28 + i * 12);
+
+      EXPECT(frame < s->num_frames, "more samples than frames");
+      while (s->frames[frame].payload_size == 0)
+        frame++;
+      EXPECT(!!(sample_flags & 0x10000) == !s->frames[frame].key,
+        "sample %d sync flag", frame);
+      EXPECT(duration == expected_duration(s, frame), "sample %d duration %u",
+        frame, duration);
+      check_sample(sample, sample_size, &s->frames[frame], frame);
+
+      sample += sample_size;
+      time += duration;
+      frame++;
+      r->frames++;
+    }
+    EXPECT(sample == mdat + rd32(mdat), "mdat size mismatch");
+
+    if (!(rd32(trun + 28) & 0x10000)) {
+      r->moof_offsets[r->sync_fragments] = offset;
+      r->moof_times[r->sync_fragments] = rd64(box_path(p, "traf/tfdt") + 12);
+      r->sync_fragments++;
+    }
+    r->fragments++;
+    p = mdat + rd32(mdat);
+  }
+
+  EXPECT(p + 8 <= end && !memcmp(p + 4, "mfra", 4), "no mfra at the end");
+  b = box_find(p + 8, p + rd32(p), "tfra");
+  EXPECT(b, "no tfra");
+  n = rd32(b + 20);
+  EXPECT(n == r->sync_fragments, "tfra has %u entries, expected %d", n,
+    r->sync_fragments);
+  for (i = 0; i < n; ++i) {
+    EXPECT(rd64(b + 24 + i * 19) == r->moof_times[i], "tfra time %u", i);
+    EXPECT(rd64(b + 32 + i * 19) == r->moof_offsets[i], "tfra offset %u", i);
+  }
+  b = p + rd32(p) - 16;
+  EXPECT(!memcmp(b + 4, "mfro", 4) && rd32(b + 12) == rd32(p), "bad mfro");
+  EXPECT(p + rd32(p) == end, "garbage after mfra");
+}
+
+static struct fmp4_muxer muxer;
+static struct fmp4_index_entry index_entries[TEST_MAX_FRAMES];
+static uint8_t frag_buf[1024 * 1024];
+static uint8_t frame_buf[64 * 1024];
+
+static void muxer_init(struct out_buf *o, size_t frag_size, size_t frame_size)
+{
+  struct fmp4_config c = {
+    .write = out_write,
+    .write_arg = o,
+    .frag_buf = frag_buf,
+    .frag_buf_size = frag_size,
+    .frame_buf = frame_buf,
+    .frame_buf_size = frame_size,
+    .index = index_entries,
+    .index_size = TEST_MAX_FRAMES,
+    .frame_rate = TEST_FPS,
+  };
+
+  o->len = 0;
+  EXPECT(fmp4_muxer_init(&muxer, &c) == SUCCESS, "init failed");
+}
+
+static void test_sps(const struct test_stream *s)
+{
+  struct h264_nal nal = { s->sps, s->sps_size, H264_NAL_SPS };
+  struct h264_sps_info info;
+
+  EXPECT(h264_sps_parse(&nal, &info) == SUCCESS, "sps parse failed");
+  EXPECT(info.width == TEST_WIDTH && info.height == TEST_HEIGHT,
+    "sps size %dx%d", info.width, info.height);
+  EXPECT(info.profile_idc == 100 && info.level_idc == 40, "sps profile");
+  printf("success: sps %dx%d\n", info.width, info.height);
+}
+
+static void test_nal_split(const struct test_stream *s)
+{
+  const uint8_t *pos = s->data;
+  struct h264_nal nal;
+  int num_nals = 0;
+  int num_pictures = 0;
+
+  while (h264_nal_next(&pos, s->data + s->size, &nal)) {
+    num_nals++;
+    if (h264_nal_is_vcl(nal.type) && h264_nal_is_first_slice(&nal))
+      num_pictures++;
+  }
+
+  EXPECT(num_pictures == s->num_frames, "%d pictures", num_pictures);
+  printf("success: %d nals, %d pictures\n", num_nals, num_pictures);
+}
+
+static void test_mux(const struct test_stream *s, struct out_buf *o,
+  int num_chunks, size_t frag_size, const char *name)
+{
+  struct check_result r;
+  int expected_fragments = (s->num_frames + TEST_GOP - 1) / TEST_GOP;
+
+  muxer_init(o, frag_size, sizeof(frame_buf));
+  stream_mux(s, &muxer, num_chunks);
+  check_file(o->data, o->len, s, &r);
+
+  EXPECT(r.frames == s->num_frames, "%d frames muxed", r.frames);
+  EXPECT(r.sync_fragments == expected_fragments, "%d fragments start with "
+    "keyframe, expected %d", r.sync_fragments, expected_fragments);
+  EXPECT(frag_size < sizeof(frag_buf) || r.fragments == expected_fragments,
+    "%d fragments", r.fragments);
+  EXPECT(muxer.stats.frames_dropped == 0, "frames dropped");
+  printf("success: %s, %d fragments, %zu bytes\n", name, r.fragments, o->len);
+}
+
+/*
+ * Keyframe, that does not fit frame_buf, is dropped together with the rest
+ * of its GOP, because those frames can not be decoded without it.
+ */
+static void test_drop(const struct test_stream *s, struct out_buf *o)
+{
+  static struct test_stream t;
+  struct check_result r;
+  const size_t frame_buf_size = 3500;
+  int i, num_dropped = 0;
+  bool gop_dropped = false;
+
+  muxer_init(o, sizeof(frag_buf), frame_buf_size);
+  stream_mux(s, &muxer, 3);
+
+  t = *s;
+  for (i = 0; i < t.num_frames; ++i) {
+    if (t.frames[i].key)
+      gop_dropped = t.frames[i].size > frame_buf_size;
+    if (gop_dropped || t.frames[i].size > frame_buf_size) {
+      t.frames[i].payload_size = 0;
+      num_dropped++;
+    }
+  }
+
+  EXPECT(num_dropped > 0 && num_dropped < t.num_frames,
+    "bad test stream, %d frames dropped", num_dropped);
+  EXPECT(muxer.stats.frames_dropped == num_dropped, "%d frames dropped, "
+    "expected %d", muxer.stats.frames_dropped, num_dropped);
+
+  check_file(o->data, o->len, &t, &r);
+  EXPECT(r.frames == t.num_frames - num_dropped, "%d frames muxed", r.frames);
+  printf("success: %d frames dropped on frame_buf overflow\n", num_dropped);
+}
+
+static void test_truncated(const struct test_stream *s, struct out_buf *o)
+{
+  /* Muxer stops on write error and reports it on every later call */
+  struct out_buf small = { o->data, 10000, 0 };
+  struct fmp4_config c = {
+    .write = out_write,
+    .write_arg = &small,
+    .frag_buf = frag_buf,
+    .frag_buf_size = sizeof(frag_buf),
+    .frame_rate = TEST_FPS,
+  };
+  int i, err = SUCCESS;
+
+  EXPECT(fmp4_muxer_init(&muxer, &c) == SUCCESS, "init failed");
+  for (i = 0; i < s->num_frames && err == SUCCESS; ++i)
+    err = fmp4_muxer_push(&muxer, s->data + s->frames[i].offset,
+      s->frames[i].size, MMAL_BUFFER_HEADER_FLAG_FRAME_END, s->frames[i].pts);
+
+  EXPECT(err == ERR_RESOURCE, "write error not reported: %d", err);
+  EXPECT(fmp4_muxer_finish(&muxer) == ERR_RESOURCE, "finish after error");
+  printf("success: write error reported after %d frames\n", i);
+}
+
+static int self_test(void)
+{
+  static struct test_stream s;
+  static struct test_stream s_config;
+  struct out_buf o = { malloc(TEST_OUT_SIZE), TEST_OUT_SIZE, 0 };
+
+  stream_gen(&s, TEST_FRAMES, TEST_GOP, true);
+  stream_gen(&s_config, TEST_FRAMES, TEST_GOP, false);
+
+  test_sps(&s);
+  test_nal_split(&s);
+  test_mux(&s, &o, 1, sizeof(frag_buf), "one buffer per frame");
+  test_mux(&s, &o, 3, sizeof(frag_buf), "frames split in 3 buffers");
+  test_mux(&s_config, &o, 1, sizeof(frag_buf), "SPS/PPS only in first frame");
+  test_mux(&s, &o, 2, 16 * 1024, "fragments closed early");
+  test_drop(&s, &o);
+  test_truncated(&s, &o);
+  return 0;
+}
+
+/* Splits captured Annex-B stream into frames and muxes it */
+static int mux_file(const char *in_path, const char *out_path, int fps)
+{
+  static uint8_t frame[4 * 1024 * 1024];
+  struct fmp4_config c = {
+    .write = file_write,
+    .frag_buf = malloc(16 * 1024 * 1024),
+    .frag_buf_size = 16 * 1024 * 1024,
+    .index = index_entries,
+    .index_size = TEST_MAX_FRAMES,
+    .frame_rate = fps,
+  };
+  FILE *in = fopen(in_path, "rb");
+  FILE *out = fopen(out_path, "wb");
+  uint8_t *data;
+  long size;
+  const uint8_t *pos, *frame_start = NULL, *nal_start;
+  struct h264_nal nal;
+  bool vcl_seen = false;
+  int64_t frame_idx = 0;
+  int err;
+
+  if (!in || !out) {
+    printf("failed to open files\n");
+    return 1;
+  }
+
+  fseek(in, 0, SEEK_END);
+  size = ftell(in);
+  fseek(in, 0, SEEK_SET);
+  data = malloc(size);
+  if (fread(data, 1, size, in) != (size_t)size) {
+    printf("failed to read %s\n", in_path);
+    return 1;
+  }
+
+  c.write_arg = out;
+  fmp4_muxer_init(&muxer, &c);
+
+  pos = data;
+  while (1) {
+    nal_start = pos;
+    if (!h264_nal_next(&pos, data + size, &nal))
+      nal_start = data + size;
+
+    /* New access unit starts at AUD, SPS, PPS, SEI or first slice */
+    if (frame_start && vcl_seen && (nal_start == data + size
+      || !h264_nal_is_vcl(nal.type) || h264_nal_is_first_slice(&nal))) {
+      memcpy(frame, frame_start, nal_start - frame_start);
+      err = fmp4_muxer_push(&muxer, frame, nal_start - frame_start,
+        MMAL_BUFFER_HEADER_FLAG_FRAME_END, frame_idx * 1000000 / fps);
+      if (err != SUCCESS) {
+        printf("mux failed: %d\n", err);
+        return 1;
+      }
+      frame_idx++;
+      frame_start = NULL;
+      vcl_seen = false;
+    }
+
+    if (nal_start == data + size)
+      break;
+
+    if (!frame_start)
+      frame_start = nal_start;
+    vcl_seen |= h264_nal_is_vcl(nal.type);
+  }
+
+  err = fmp4_muxer_finish(&muxer);
+  fclose(out);
+  printf("%d frames, %d keyframes, %d fragments, %d dropped, %lu bytes: %d\n",
+    muxer.stats.frames, muxer.stats.keyframes, muxer.stats.fragments,
+    muxer.stats.frames_dropped, muxer.stats.bytes_written, err);
+  return err != SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc == 1)
+    return self_test();
+
+  if (argc < 3) {
+    printf("Usage: %s [in.h264 out.mp4 [fps]]\n", argv[0]);
+    return 1;
+  }
+
+  return mux_file(argv[1], argv[2], argc > 3 ? atoi(argv[3]) : 30);
+}
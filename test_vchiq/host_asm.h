@@ -0,0 +1,10 @@
+#pragma once
+/*
+ * Kernel sources use a few AArch64 instructions in inline assembly. When
+ * building for other hosts they are defined as assembler macros with the
+ * nearest equivalent.
+ */
+#ifndef __aarch64__
+asm(".macro dsb arg\n mfence\n.endm\n"
+    ".macro wfe\n pause\n.endm\n");
+#endif
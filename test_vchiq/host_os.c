@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <kmalloc.h>
+#include <os_api.h>
+#include <vc/service_smem.h>
+#include <memory_map.h>
+#include <errcode.h>
+#include "host_os.h"
+
+#define HOST_ARENA_SIZE (256 * 1024 * 1024)
+#define HOST_ARENA_HINT ((void *)0x10000000)
+#define HOST_TASK_STACK_SIZE (256 * 1024)
+
+struct host_task {
+  struct task t;
+  task_fn fn;
+  pthread_t thread;
+};
+
+static pthread_mutex_t cpu_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cpu_cond = PTHREAD_COND_INITIALIZER;
+
+static void (*irq_handler)(void);
+static uint64_t irq_count;
+
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *arena;
+static size_t arena_used;
+
+static int task_id_next;
+
+void host_cpu_lock(void)
+{
+  pthread_mutex_lock(&cpu_lock);
+}
+
+void host_cpu_unlock(void)
+{
+  pthread_mutex_unlock(&cpu_lock);
+}
+
+void host_cpu_wait(void)
+{
+  pthread_cond_wait(&cpu_cond, &cpu_lock);
+}
+
+void host_cpu_wake(void)
+{
+  pthread_cond_broadcast(&cpu_cond);
+}
+
+void host_irq_set(void (*handler)(void))
+{
+  irq_handler = handler;
+}
+
+/* Called from VideoCore peer thread */
+void host_irq_raise(void)
+{
+  host_cpu_lock();
+  irq_count++;
+  if (irq_handler)
+    irq_handler();
+  host_cpu_unlock();
+}
+
+uint64_t host_irq_count(void)
+{
+  return irq_count;
+}
+
+void *host_mem_alloc(size_t size)
+{
+  void *p;
+
+  pthread_mutex_lock(&arena_lock);
+  if (!arena) {
+    arena = mmap(HOST_ARENA_HINT, HOST_ARENA_SIZE, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (arena == MAP_FAILED
+      || (uint64_t)arena + HOST_ARENA_SIZE > 0x100000000ull) {
+      fprintf(stderr, "failed to map memory below 4GB\n");
+      exit(1);
+    }
+  }
+
+  size = (size + 63) & ~63ul;
+  if (arena_used + size > HOST_ARENA_SIZE) {
+    pthread_mutex_unlock(&arena_lock);
+    return NULL;
+  }
+
+  p = arena + arena_used;
+  arena_used += size;
+  pthread_mutex_unlock(&arena_lock);
+  return p;
+}
+
+uint64_t host_time_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+void *kmalloc(size_t sz)
+{
+  return host_mem_alloc(sz);
+}
+
+void *kzalloc(size_t sz)
+{
+  void *p = host_mem_alloc(sz);
+
+  if (p)
+    memset(p, 0, sz);
+  return p;
+}
+
+/* Arena memory is never reused, benchmark runs are short */
+void kfree(void *p)
+{
+}
+
+void *dma_alloc(size_t sz, bool zero)
+{
+  return zero ? kzalloc(sz) : kmalloc(sz);
+}
+
+void dma_free(void *p)
+{
+}
+
+void __os_log(const char *fmt, __builtin_va_list *args)
+{
+  vprintf(fmt, *args);
+}
+
+void panic_with_log(const char *msg)
+{
+  fprintf(stderr, "PANIC: %s\n", msg);
+  abort();
+}
+
+void panic(void)
+{
+  panic_with_log("panic");
+}
+
+/*
+ * SMEM service is not emulated, VideoCore handle of imported buffer is its
+ * address, which is what vc_peer expects to find in zero-copy buffer headers.
+ */
+int smem_import_dmabuf(void *addr, uint32_t size, uint32_t *vcsm_handle)
+{
+  *vcsm_handle = NARROW_PTR(addr);
+  return SUCCESS;
+}
+
+static void *host_task_entry(void *arg)
+{
+  struct host_task *ht = arg;
+
+  host_cpu_lock();
+  ht->fn();
+  host_cpu_unlock();
+  return NULL;
+}
+
+struct task *task_create(task_fn fn, const char *task_name)
+{
+  struct host_task *ht = kzalloc(sizeof(*ht));
+
+  if (!ht)
+    return NULL;
+
+  ht->fn = fn;
+  ht->t.task_id = task_id_next++;
+  strncpy(ht->t.name, task_name, sizeof(ht->t.name) - 1);
+  return &ht->t;
+}
+
+static pthread_t host_task_start(struct host_task *ht)
+{
+  pthread_attr_t attr;
+  void *stack = host_mem_alloc(HOST_TASK_STACK_SIZE);
+
+  if (!stack) {
+    fprintf(stderr, "failed to allocate stack for task %s\n", ht->t.name);
+    exit(1);
+  }
+
+  pthread_attr_init(&attr);
+  pthread_attr_setstack(&attr, stack, HOST_TASK_STACK_SIZE);
+  if (pthread_create(&ht->thread, &attr, host_task_entry, ht)) {
+    fprintf(stderr, "failed to start task %s\n", ht->t.name);
+    exit(1);
+  }
+  pthread_attr_destroy(&attr);
+  return ht->thread;
+}
+
+void os_schedule_task(struct task *t)
+{
+  struct host_task *ht = container_of(t, struct host_task, t);
+
+  pthread_detach(host_task_start(ht));
+}
+
+void host_start_boot_task(task_fn fn)
+{
+  struct task *t = task_create(fn, "boot");
+
+  if (!t) {
+    fprintf(stderr, "failed to create boot task\n");
+    exit(1);
+  }
+
+  os_schedule_task(t);
+}
+
+void os_yield(void)
+{
+  host_cpu_unlock();
+  sched_yield();
+  host_cpu_lock();
+}
+
+void os_wait_ms(uint32_t ms)
+{
+  host_cpu_unlock();
+  usleep(ms * 1000);
+  host_cpu_lock();
+}
+
+void os_event_init(struct event *ev)
+{
+  ev->ev = 0;
+}
+
+void os_event_clear(struct event *ev)
+{
+  ev->ev = 0;
+}
+
+void os_event_wait(struct event *ev)
+{
+  while (ev->ev != 1)
+    host_cpu_wait();
+}
+
+void os_event_notify(struct event *ev)
+{
+  ev->ev = 1;
+  host_cpu_wake();
+}
+
+void os_event_notify_isr(struct event *ev)
+{
+  os_event_notify(ev);
+}
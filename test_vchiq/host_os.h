@@ -0,0 +1,39 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <task.h>
+
+/*
+ * Host emulation of the ARM side kernel services used by vchiq.c and
+ * service_mmal.c.
+ *
+ * All tasks run on a single virtual ARM core: a task holds the core lock
+ * while it runs and gives it up only when it blocks or yields. Interrupts
+ * raised by the VideoCore peer are delivered on the core as well, so code
+ * that runs with IRQs disabled on target is never interrupted here either.
+ *
+ * Kernel pointers are passed to VideoCore as 32-bit handles, so all memory
+ * that can be referenced this way, heap, DMA buffers and task stacks, is
+ * allocated below 4GB.
+ */
+
+/* Acquire / release virtual ARM core */
+void host_cpu_lock(void);
+void host_cpu_unlock(void);
+
+/* Block current task on the core until host_cpu_wake is called */
+void host_cpu_wait(void);
+void host_cpu_wake(void);
+
+/* Interrupt line from VideoCore to ARM, see vchiq_doorbell.h */
+void host_irq_set(void (*handler)(void));
+void host_irq_raise(void);
+uint64_t host_irq_count(void);
+
+/* Allocate memory below 4GB */
+void *host_mem_alloc(size_t size);
+
+uint64_t host_time_us(void);
+
+/* Starts fn as the first task on the virtual ARM core */
+void host_start_boot_task(task_fn fn);
@@ -0,0 +1,28 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Host replacement for cpu.h. Interrupts are only delivered while no task
+ * holds the virtual ARM core, see host_os.h, so masking them is a no-op.
+ */
+#define disable_irq_save_flags(__flags) do { (__flags) = 0; } while(0)
+#define restore_irq_flags(__flags) do { (void)(__flags); } while(0)
+
+/* Arm timer runs at 1MHz on host, counted from host_time_us */
+uint64_t host_time_us(void);
+
+static inline uint64_t arm_timer_get_count(void)
+{
+  return host_time_us();
+}
+
+static inline uint32_t arm_timer_get_freq(void)
+{
+  return 1000000;
+}
+
+static inline uint64_t get_boottime_msec(void)
+{
+  return host_time_us() / 1000;
+}
@@ -0,0 +1,3 @@
+#pragma once
+/* Kernel event.h is shadowed by system headers of the same name */
+#include "../../include/event.h"
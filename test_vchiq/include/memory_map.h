@@ -0,0 +1,16 @@
+#pragma once
+#include <stdint.h>
+
+/*
+ * Host replacement for memory_map.h. All memory shared with the VideoCore
+ * peer lives below 4GB and bus addresses are the same as host addresses.
+ */
+#define NARROW_PTR(x) ((uint32_t)((uint64_t)(x)))
+
+#define KERNEL_VA_BASE 0
+#define PTR_TO_HANDLE32(__ptr) NARROW_PTR(__ptr)
+#define HANDLE32_TO_PTR(__handle) ((void *)(uint64_t)(__handle))
+
+#define RAM_BASE_BUS_UNCACHED 0
+#define RAM_PHY_TO_BUS_UNCACHED(x) NARROW_PTR(x)
+#define PADDR_UNCACHED_TO_PTR(__paddr) ((void *)(uint64_t)(__paddr))
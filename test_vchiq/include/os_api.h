@@ -0,0 +1,18 @@
+#pragma once
+#include <stdint.h>
+#include <event.h>
+
+/* Host replacement for os_api.h, implemented in host_os.c */
+void os_wait_ms(uint32_t ms);
+void os_yield(void);
+
+void os_event_init(struct event *ev);
+void os_event_clear(struct event *ev);
+void os_event_wait(struct event *ev);
+
+struct task;
+
+void os_schedule_task(struct task *t);
+
+void os_event_notify(struct event *ev);
+void os_event_notify_isr(struct event *ev);
@@ -0,0 +1,84 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <errcode.h>
+#include "../host_os.h"
+
+/*
+ * Host replacement for os_msgq.h with the same circular buffer logic, tasks
+ * waiting for messages block on the virtual ARM core.
+ */
+struct os_msgq {
+  uint8_t *queue;
+  size_t msg_size;
+  unsigned int queue_size;
+  unsigned int wr;
+  unsigned int rd;
+};
+
+static inline void os_msgq_init(struct os_msgq *q, void *queue_addr,
+  size_t msg_size, size_t num_msg)
+{
+  q->queue = queue_addr;
+  q->queue_size = num_msg;
+  q->msg_size = msg_size;
+  q->wr = 0;
+  q->rd = 0;
+}
+
+static inline int os_msgq_put_isr(struct os_msgq *q, const void *m)
+{
+  uint8_t *slot;
+
+  if (q->wr < q->rd && q->rd - q->wr == 1)
+    return ERR_BUSY;
+
+  if (!q->rd && q->wr == q->queue_size - 1)
+    return ERR_BUSY;
+
+  slot = q->queue + q->wr * q->msg_size;
+
+  q->wr++;
+  if (q->wr == q->queue_size)
+    q->wr = 0;
+
+  memcpy(slot, m, q->msg_size);
+  host_cpu_wake();
+  return SUCCESS;
+}
+
+static inline void os_msgq_put(struct os_msgq *q, const void *m)
+{
+  os_msgq_put_isr(q, m);
+}
+
+static inline void os_msgq_get(struct os_msgq *q, void *m)
+{
+  const uint8_t *slot;
+
+  while (q->wr == q->rd)
+    host_cpu_wait();
+
+  slot = q->queue + q->rd * q->msg_size;
+  q->rd++;
+  if (q->rd == q->queue_size)
+    q->rd = 0;
+
+  memcpy(m, slot, q->msg_size);
+}
+
+static inline int os_msgq_try_get(struct os_msgq *q, void *m)
+{
+  const uint8_t *slot;
+
+  if (q->wr == q->rd)
+    return ERR_BUSY;
+
+  slot = q->queue + q->rd * q->msg_size;
+  q->rd++;
+  if (q->rd == q->queue_size)
+    q->rd = 0;
+
+  memcpy(m, slot, q->msg_size);
+  return SUCCESS;
+}
@@ -0,0 +1,5 @@
+#pragma once
+/* No PMU on host */
+#define PROF_MARKER(__name)
+#define PROF_BEGIN(__name)
+#define PROF_END(__name)
@@ -0,0 +1,344 @@
+/*
+ * Host benchmark of VCHIQ / MMAL message path. Kernel vchiq.c and
+ * service_mmal.c run against fake VideoCore peer (vc_peer.c), which streams
+ * frames from one MMAL output port the same way camera or encoder would do.
+ *
+ * Usage: ./vchiq_bench [-f fps] [-n frames] [-b buffers] [-s frame_size]
+ *                      [-t timeout_sec] [-d max_doorbells_per_frame] [-g]
+ *
+ * With -g pipeline is set up with mmal_graph: camera tunnelled to encoder,
+ * encoder output shared by two ARM sinks, one of which holds each frame until
+ * the next one arrives. Buffer count is then chosen by
+ * the graph and -b is ignored.
+ *
+ * Returns non-zero if not all frames arrived before timeout, or if more
+ * doorbells per frame than given by -d were needed, so it can be used as a
+ * regression test.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errcode.h>
+#include <os_api.h>
+#include <vc/vchiq.h>
+#include <vc/service_mmal.h>
+#include <vc/service_mmal_encoding.h>
+#include <vc/mmal_graph.h>
+#include "host_os.h"
+#include "vc_peer.h"
+
+struct bench_config {
+  int fps;
+  int num_frames;
+  int num_buffers;
+  uint32_t frame_size;
+  int timeout_sec;
+  double max_doorbells_per_frame;
+  bool graph;
+};
+
+struct bench_result {
+  bool done;
+  int err;
+  int frames;
+  uint64_t start_us;
+  uint64_t end_us;
+  uint64_t bytes;
+  struct vc_peer_latency delivery;
+  int sink_frames;
+  struct event ev_done;
+};
+
+static struct bench_config config = {
+  .fps = 0,
+  .num_frames = 10000,
+  .num_buffers = 4,
+  .frame_size = 64 * 1024,
+  .timeout_sec = 30,
+  .max_doorbells_per_frame = 0,
+};
+
+static struct bench_result result;
+
+static struct vc_peer_stats stats_start;
+static struct vc_peer_stats stats_end;
+
+static void latency_add(struct vc_peer_latency *l, uint64_t us)
+{
+  if (!l->count || us < l->min_us)
+    l->min_us = us;
+  if (us > l->max_us)
+    l->max_us = us;
+  l->sum_us += us;
+  l->count++;
+}
+
+static void bench_frame(struct mmal_buffer *b)
+{
+  const struct vc_peer_frame_stamp *stamp = b->buffer;
+  uint64_t now = host_time_us();
+
+  if (b->length >= sizeof(*stamp) && stamp->magic == VC_PEER_FRAME_MAGIC)
+    latency_add(&result.delivery, now - stamp->emit_time_us);
+
+  if (!result.frames) {
+    result.start_us = now;
+    vc_peer_get_stats(&stats_start);
+  } else {
+    result.bytes += b->length;
+  }
+
+  result.frames++;
+  if (result.frames == config.num_frames + 1) {
+    result.end_us = now;
+    vc_peer_get_stats(&stats_end);
+    os_event_notify(&result.ev_done);
+  }
+}
+
+/* Called in context of mmal_io_loop task */
+static int bench_buffer_ready(struct mmal_port *p, struct mmal_buffer *b)
+{
+  bench_frame(b);
+  mmal_port_buffer_consumed_isr(p, b);
+  return SUCCESS;
+}
+
+static void bench_sink_stats(struct mmal_port *p, struct mmal_buffer *b,
+  void *arg)
+{
+  bench_frame(b);
+}
+
+/* Holds every frame until the next one arrives, like a recorder would */
+static void bench_sink_count(struct mmal_port *p, struct mmal_buffer *b,
+  void *arg)
+{
+  static struct mmal_buffer *held;
+
+  mmal_buffer_ref(b);
+  if (held)
+    mmal_port_buffer_consumed_isr(p, held);
+  held = b;
+  result.sink_frames++;
+}
+
+static int bench_setup_graph(void)
+{
+  int err;
+  int camera, encoder;
+
+  camera = mmal_graph_add_component("vc.ril.camera");
+  encoder = mmal_graph_add_component("vc.ril.video_encode");
+  if (camera < 0 || encoder < 0)
+    return ERR_RESOURCE;
+
+  err = mmal_graph_set_format(camera, 0, MMAL_ENCODING_I420, 1920, 1080,
+    config.fps, 0);
+  if (err != SUCCESS)
+    return err;
+
+  err = mmal_graph_set_format(encoder, 0, MMAL_ENCODING_H264, 1920, 1080,
+    config.fps, 0);
+  if (err != SUCCESS)
+    return err;
+
+  err = mmal_graph_connect(camera, 0, encoder, 0);
+  if (err != SUCCESS)
+    return err;
+
+  err = mmal_graph_add_sink(encoder, 0, bench_sink_stats, NULL);
+  if (err != SUCCESS)
+    return err;
+
+  err = mmal_graph_add_sink(encoder, 0, bench_sink_count, NULL);
+  if (err != SUCCESS)
+    return err;
+
+  return mmal_graph_build();
+}
+
+static int bench_setup(void)
+{
+  int err;
+  struct mmal_component *c;
+  struct mmal_port *p;
+
+  err = vchiq_init();
+  if (err != SUCCESS)
+    return err;
+
+  err = mmal_init();
+  if (err != SUCCESS)
+    return err;
+
+  if (config.graph)
+    return bench_setup_graph();
+
+  mmal_register_io_cb(bench_buffer_ready);
+
+  c = mmal_component_create("vc.ril.video_encode");
+  if (!c)
+    return ERR_GENERIC;
+
+  p = &c->output[0];
+  mmal_format_set(&p->format, MMAL_ENCODING_H264, 0, 1920, 1080, config.fps,
+    0);
+  p->current_buffer.num = config.num_buffers;
+  p->current_buffer.size = config.frame_size;
+  err = mmal_port_set_format(p);
+  if (err != SUCCESS)
+    return err;
+
+  err = mmal_port_set_zero_copy(p);
+  if (err != SUCCESS)
+    return err;
+
+  err = mmal_component_enable(c);
+  if (err != SUCCESS)
+    return err;
+
+  err = mmal_port_enable(p);
+  if (err != SUCCESS)
+    return err;
+
+  return mmal_port_init_buffers(p, config.num_buffers);
+}
+
+static void bench_boot_task(void)
+{
+  os_event_init(&result.ev_done);
+  result.err = bench_setup();
+  if (result.err != SUCCESS)
+    return;
+
+  os_event_wait(&result.ev_done);
+  result.done = true;
+}
+
+static void print_latency(const char *name, const struct vc_peer_latency *l)
+{
+  if (!l->count) {
+    printf("%-24s n/a\n", name);
+    return;
+  }
+
+  printf("%-24s min %lu avg %lu max %lu us\n", name, l->min_us,
+    l->sum_us / l->count, l->max_us);
+}
+
+static int print_report(void)
+{
+  const struct vc_peer_stats *s = &stats_end;
+  struct vchiq_tx_stats tx;
+  double sec, frames, doorbells_per_frame;
+
+  vchiq_get_tx_stats(&tx);
+
+  frames = config.num_frames;
+  sec = (result.end_us - result.start_us) / 1000000.0;
+  doorbells_per_frame = (s->doorbells_rx - stats_start.doorbells_rx) / frames;
+
+  printf("frames:                  %d in %.3f s, %.1f fps, %.1f MB/s\n",
+    config.num_frames, sec, frames / sec, result.bytes / sec / 1000000.0);
+  printf("vchiq msgs arm->vc:      %lu, %.0f/s, %.2f/frame\n",
+    s->msgs_rx - stats_start.msgs_rx, (s->msgs_rx - stats_start.msgs_rx) / sec,
+    (s->msgs_rx - stats_start.msgs_rx) / frames);
+  printf("vchiq msgs vc->arm:      %lu, %.0f/s, %.2f/frame\n",
+    s->msgs_tx - stats_start.msgs_tx, (s->msgs_tx - stats_start.msgs_tx) / sec,
+    (s->msgs_tx - stats_start.msgs_tx) / frames);
+  printf("doorbells arm->vc:       %lu, %.2f/frame\n",
+    s->doorbells_rx - stats_start.doorbells_rx, doorbells_per_frame);
+  printf("doorbell irqs vc->arm:   %lu, %.2f/frame\n",
+    s->irqs_tx - stats_start.irqs_tx,
+    (s->irqs_tx - stats_start.irqs_tx) / frames);
+  printf("slots released/recycled: %lu/%lu, vc tx stalls: %lu\n",
+    s->slots_released, s->slots_recycled, s->tx_stalls);
+  printf("arm tx slots used:       %d of %d, recycled: %u\n",
+    tx.slots_used_max, tx.num_slots, tx.slots_recycled);
+  printf("arm tx stalls:           slot %u, quota %u\n", tx.slot_stalls,
+    tx.quota_stalls);
+  printf("frames dropped on vc:    %lu\n",
+    s->frames_dropped - stats_start.frames_dropped);
+  print_latency("buffer round trip:", &s->round_trip);
+  print_latency("frame delivery:", &result.delivery);
+
+  if (config.graph && result.sink_frames != result.frames) {
+    printf("FAIL: sinks saw %d and %d frames\n", result.frames,
+      result.sink_frames);
+    return 1;
+  }
+
+  if (config.max_doorbells_per_frame
+    && doorbells_per_frame > config.max_doorbells_per_frame) {
+    printf("FAIL: %.2f doorbells per frame, expected at most %.2f\n",
+      doorbells_per_frame, config.max_doorbells_per_frame);
+    return 1;
+  }
+  return 0;
+}
+
+static void usage(const char *prog)
+{
+  printf("Usage: %s [-f fps] [-n frames] [-b buffers] [-s frame_size]"
+    " [-t timeout_sec] [-d max_doorbells_per_frame] [-g]\n", prog);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  struct vc_peer_config peer_config;
+  int opt;
+  int i;
+
+  while ((opt = getopt(argc, argv, "f:n:b:s:t:d:g")) != -1) {
+    switch (opt) {
+      case 'f': config.fps = atoi(optarg); break;
+      case 'n': config.num_frames = atoi(optarg); break;
+      case 'b': config.num_buffers = atoi(optarg); break;
+      case 's': config.frame_size = strtoul(optarg, NULL, 0); break;
+      case 't': config.timeout_sec = atoi(optarg); break;
+      case 'd': config.max_doorbells_per_frame = atof(optarg); break;
+      case 'g': config.graph = true; break;
+      default: usage(argv[0]);
+    }
+  }
+
+  if (config.num_frames <= 0 || config.num_buffers <= 0)
+    usage(argv[0]);
+
+  peer_config.fps = config.fps;
+  peer_config.frame_size = config.frame_size;
+  peer_config.keyframe_period = 30;
+  vc_peer_init(&peer_config);
+
+  /*
+   * Boot task returns when all frames have arrived, run it in background
+   * to be able to bail out on timeout.
+   */
+  host_start_boot_task(bench_boot_task);
+
+  for (i = 0; i < config.timeout_sec * 10; ++i) {
+    host_cpu_lock();
+    if (result.done || result.err) {
+      host_cpu_unlock();
+      break;
+    }
+    host_cpu_unlock();
+    usleep(100000);
+  }
+
+  if (result.err) {
+    printf("FAIL: setup failed: %d\n", result.err);
+    return 1;
+  }
+
+  if (!result.done) {
+    printf("FAIL: timeout, %d of %d frames received\n",
+      result.frames ? result.frames - 1 : 0, config.num_frames);
+    return 1;
+  }
+
+  return print_report();
+}
@@ -0,0 +1 @@
+../src/vc/mmal_graph.c
\ No newline at end of file
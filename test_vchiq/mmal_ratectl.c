@@ -0,0 +1 @@
+../src/vc/mmal_ratectl.c
\ No newline at end of file
@@ -0,0 +1,272 @@
+/*
+ * Host test of encoder rate control (mmal_ratectl.c). Encoder port, SD
+ * iostats and time are stubbed, each case feeds queue depth and bytes
+ * written by the card and checks what was set on the encoder.
+ *
+ * Usage: ./ratectl_test
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errcode.h>
+#include <vc/mmal_ratectl.h>
+#include <vc/service_mmal_param.h>
+#include <drivers/sd/sdhc.h>
+
+#define FAIL(__fmt, ...) \
+  do { \
+    printf("FAIL: %s:%d: " __fmt "\n", __func__, __LINE__, ##__VA_ARGS__); \
+    exit(1); \
+  } while(0)
+
+#define EXPECT(__cond, __fmt, ...) \
+  do { if (!(__cond)) FAIL(__fmt, ##__VA_ARGS__); } while(0)
+
+#define PERIOD_MS 250
+
+static const struct mmal_ratectl_config test_config = {
+  .bitrate_max = 10000000,
+  .bitrate_min = 1000000,
+  .bitrate_step = 1000000,
+  .qp_min = 10,
+  .qp_max = 30,
+  .qp_max_degraded = 45,
+  .queue_low = 2,
+  .queue_high = 8,
+  .recover_periods = 3,
+};
+
+static struct {
+  uint64_t now_us;
+  /* Written by the card since the last look at iostats */
+  uint32_t bytes_written;
+  uint64_t total_bytes_written;
+  uint32_t bitrate;
+  uint32_t qp_min;
+  uint32_t qp_max;
+  int num_i_frames;
+  int num_sets;
+  /* Next parameter_set fails */
+  bool fail_next;
+} stub;
+
+static struct mmal_port *test_port = (struct mmal_port *)&stub;
+
+void __os_log(const char *fmt, __builtin_va_list *args)
+{
+}
+
+uint64_t host_time_us(void)
+{
+  return stub.now_us;
+}
+
+void sdhc_iostats_get(struct sdhc_iostats *iostats)
+{
+  stub.total_bytes_written += stub.bytes_written;
+  stub.bytes_written = 0;
+  iostats->num_bytes_written = stub.total_bytes_written;
+}
+
+int mmal_port_parameter_set(struct mmal_port *p,
+  uint32_t parameter_id, const void *value, int value_size)
+{
+  uint32_t v;
+
+  if (p != test_port || value_size != sizeof(v))
+    FAIL("unexpected port or value size %d", value_size);
+
+  if (stub.fail_next) {
+    stub.fail_next = false;
+    return ERR_IO;
+  }
+
+  memcpy(&v, value, sizeof(v));
+  stub.num_sets++;
+  switch (parameter_id) {
+  case MMAL_PARAM_VIDEO_BIT_RATE: stub.bitrate = v; break;
+  case MMAL_PARAM_VIDEO_ENCODE_MIN_QUANT: stub.qp_min = v; break;
+  case MMAL_PARAM_VIDEO_ENCODE_MAX_QUANT: stub.qp_max = v; break;
+  case MMAL_PARAM_VIDEO_REQUEST_I_FRAME: stub.num_i_frames++; break;
+  default: FAIL("unexpected parameter %d", parameter_id);
+  }
+  return SUCCESS;
+}
+
+/* One update period, in which the card wrote sd_bytes */
+static int update(int queue_depth, uint32_t sd_bytes)
+{
+  stub.now_us += PERIOD_MS * 1000;
+  stub.bytes_written += sd_bytes;
+  return mmal_ratectl_update(queue_depth);
+}
+
+static void init(void)
+{
+  memset(&stub, 0, sizeof(stub));
+  stub.now_us = 1000000;
+  /* Written before init, must not count for the first period */
+  stub.bytes_written = 12345678;
+  EXPECT(mmal_ratectl_init(test_port, &test_config) == SUCCESS, "init");
+  EXPECT(stub.bitrate == test_config.bitrate_max, "bitrate %u", stub.bitrate);
+  EXPECT(stub.qp_min == test_config.qp_min, "qp_min %u", stub.qp_min);
+  EXPECT(stub.qp_max == test_config.qp_max, "qp_max %u", stub.qp_max);
+}
+
+static void test_queue_high(void)
+{
+  struct mmal_ratectl_stats s;
+  int num_cuts;
+
+  init();
+
+  /* Below queue_high nothing changes */
+  EXPECT(update(test_config.queue_high - 1, 1000000) == SUCCESS, "update");
+  EXPECT(stub.bitrate == 10000000, "bitrate %u", stub.bitrate);
+
+  /*
+   * 3/4 of 10M is 7.5M, but card wrote 1000000 bytes/sec and 90% of that
+   * is 7.2M bits/sec
+   */
+  EXPECT(update(test_config.queue_high, 250000) == SUCCESS, "update");
+  mmal_ratectl_get_stats(&s);
+  EXPECT(s.sd_bytes_per_sec == 1000000, "sd rate %u", s.sd_bytes_per_sec);
+  EXPECT(s.queue_depth == test_config.queue_high, "queue %d", s.queue_depth);
+  EXPECT(stub.bitrate == 7200000, "bitrate %u", stub.bitrate);
+  EXPECT(stub.qp_max == test_config.qp_max, "qp_max %u", stub.qp_max);
+  EXPECT(s.num_cuts == 1, "cuts %d", s.num_cuts);
+
+  /* Card stalled, nothing written, only 3/4 cut applies */
+  EXPECT(update(test_config.queue_high, 0) == SUCCESS, "update");
+  EXPECT(stub.bitrate == 5400000, "bitrate %u", stub.bitrate);
+
+  /* Never below bitrate_min, update at the floor is not a cut */
+  while (stub.bitrate > test_config.bitrate_min)
+    EXPECT(update(test_config.queue_high, 0) == SUCCESS, "update");
+
+  mmal_ratectl_get_stats(&s);
+  num_cuts = s.num_cuts;
+  EXPECT(update(test_config.queue_high, 0) == SUCCESS, "update");
+  mmal_ratectl_get_stats(&s);
+  EXPECT(stub.bitrate == test_config.bitrate_min, "bitrate %u", stub.bitrate);
+  EXPECT(s.num_cuts == num_cuts, "cuts %d, expected %d", s.num_cuts,
+    num_cuts);
+  printf("success: queue_high\n");
+}
+
+static void test_queue_high_x2(void)
+{
+  init();
+
+  EXPECT(update(test_config.queue_high * 2, 0) == SUCCESS, "update");
+  EXPECT(stub.bitrate == 7500000, "bitrate %u", stub.bitrate);
+  EXPECT(stub.qp_max == test_config.qp_max_degraded, "qp_max %u",
+    stub.qp_max);
+
+  /* Degraded QP stays while queue is between low and high */
+  EXPECT(update(test_config.queue_high, 0) == SUCCESS, "update");
+  EXPECT(stub.qp_max == test_config.qp_max_degraded, "qp_max %u",
+    stub.qp_max);
+  EXPECT(update(test_config.queue_low + 1, 0) == SUCCESS, "update");
+  EXPECT(stub.qp_max == test_config.qp_max_degraded, "qp_max %u",
+    stub.qp_max);
+  EXPECT(stub.bitrate == 5625000, "bitrate %u", stub.bitrate);
+
+  /* And is restored with the first calm period */
+  EXPECT(update(test_config.queue_low, 0) == SUCCESS, "update");
+  EXPECT(stub.qp_max == test_config.qp_max, "qp_max %u", stub.qp_max);
+  printf("success: queue_high_x2\n");
+}
+
+static void test_calm_recovery(void)
+{
+  int i;
+
+  init();
+
+  EXPECT(update(test_config.queue_high, 0) == SUCCESS, "update");
+  EXPECT(update(test_config.queue_high, 0) == SUCCESS, "update");
+  EXPECT(stub.bitrate == 5625000, "bitrate %u", stub.bitrate);
+
+  /* Bitrate grows by one step per recover_periods calm updates */
+  for (i = 1; i < test_config.recover_periods; ++i) {
+    EXPECT(update(0, 0) == SUCCESS, "update");
+    EXPECT(stub.bitrate == 5625000, "bitrate %u", stub.bitrate);
+  }
+  EXPECT(update(0, 0) == SUCCESS, "update");
+  EXPECT(stub.bitrate == 6625000, "bitrate %u", stub.bitrate);
+
+  /* Busy period in between restarts counting */
+  EXPECT(update(0, 0) == SUCCESS, "update");
+  EXPECT(update(test_config.queue_low + 1, 0) == SUCCESS, "update");
+  for (i = 1; i < test_config.recover_periods; ++i)
+    EXPECT(update(0, 0) == SUCCESS, "update");
+  EXPECT(stub.bitrate == 6625000, "bitrate %u", stub.bitrate);
+
+  /* Up to bitrate_max, but never above */
+  for (i = 0; i < test_config.recover_periods * 10; ++i)
+    EXPECT(update(0, 0) == SUCCESS, "update");
+  EXPECT(stub.bitrate == test_config.bitrate_max, "bitrate %u", stub.bitrate);
+  printf("success: calm_recovery\n");
+}
+
+static void test_dropped_frame(void)
+{
+  struct mmal_ratectl_stats s;
+
+  init();
+
+  /* No dropped frames, no I-frame requests */
+  EXPECT(update(0, 0) == SUCCESS, "update");
+  EXPECT(stub.num_i_frames == 0, "i-frames %d", stub.num_i_frames);
+
+  /* I-frame is not requested while the queue is still full */
+  mmal_ratectl_frame_dropped();
+  mmal_ratectl_frame_dropped();
+  EXPECT(update(test_config.queue_high, 0) == SUCCESS, "update");
+  EXPECT(stub.num_i_frames == 0, "i-frames %d", stub.num_i_frames);
+
+  /* One request for both drops, once the queue is below queue_high */
+  EXPECT(update(test_config.queue_high - 1, 0) == SUCCESS, "update");
+  EXPECT(stub.num_i_frames == 1, "i-frames %d", stub.num_i_frames);
+  EXPECT(update(0, 0) == SUCCESS, "update");
+  EXPECT(stub.num_i_frames == 1, "i-frames %d", stub.num_i_frames);
+
+  /* Failed request is retried on the next update */
+  mmal_ratectl_frame_dropped();
+  stub.fail_next = true;
+  EXPECT(update(0, 0) != SUCCESS, "update should fail");
+  EXPECT(stub.num_i_frames == 1, "i-frames %d", stub.num_i_frames);
+  EXPECT(update(0, 0) == SUCCESS, "update");
+  EXPECT(stub.num_i_frames == 2, "i-frames %d", stub.num_i_frames);
+
+  mmal_ratectl_get_stats(&s);
+  EXPECT(s.num_frames_dropped == 3, "dropped %d", s.num_frames_dropped);
+  EXPECT(s.num_i_frames_requested == 2, "requested %d",
+    s.num_i_frames_requested);
+  printf("success: dropped_frame\n");
+}
+
+static void test_no_time_passed(void)
+{
+  int num_sets;
+
+  init();
+
+  /* Update in the same millisecond as init does nothing */
+  num_sets = stub.num_sets;
+  EXPECT(mmal_ratectl_update(test_config.queue_high * 2) == SUCCESS,
+    "update");
+  EXPECT(stub.num_sets == num_sets, "parameters set %d", stub.num_sets);
+  printf("success: no_time_passed\n");
+}
+
+int main(void)
+{
+  test_queue_high();
+  test_queue_high_x2();
+  test_calm_recovery();
+  test_dropped_frame();
+  test_no_time_passed();
+  return 0;
+}
@@ -0,0 +1 @@
+../src/vc/service_mmal.c
\ No newline at end of file
@@ -0,0 +1 @@
+../src/kernel/trace.c
\ No newline at end of file
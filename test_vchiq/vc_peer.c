@@ -0,0 +1,864 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <event.h>
+#include <errcode.h>
+#include <memory_map.h>
+#include <vc/vchiq.h>
+#include <vc/service_mmal.h>
+#include <vc/service_mmal_param.h>
+#include <vc/service_mmal_encoding.h>
+#include <drivers/mbox/mbox_bcm2835_props.h>
+#include "vchiq_priv.h"
+#include "host_os.h"
+#include "vc_peer.h"
+
+#define VC_PEER_MAX_COMPONENTS 8
+#define VC_PEER_MAX_BUFFERS 64
+
+#define VC_PEER_PORT_CONTROL 0
+#define VC_PEER_PORT_INPUT   1
+#define VC_PEER_PORT_OUTPUT  2
+#define VC_PEER_NUM_PORTS    3
+
+#define VC_PEER_MMAL_MAGIC MMAL_FOURCC('m', 'm', 'a', 'l')
+#define VC_PEER_MMAL_SERVICE_ID VCHIQ_SERVICE_NAME_TO_ID("mmal")
+#define VC_PEER_MMAL_PORT 1
+
+/* Port requirements reported to ARM */
+#define VC_PEER_BUFFER_NUM_MIN 1
+#define VC_PEER_BUFFER_NUM_RECOMMENDED 3
+
+struct vc_peer_buffer {
+  /* buffer_header.data, handle or bus address of the buffer */
+  uint32_t data;
+  bool emitted;
+  uint64_t emit_time_us;
+};
+
+struct vc_peer_queued_buffer {
+  struct mmal_msg_header h;
+  struct mmal_msg_buffer_from_host b;
+};
+
+struct vc_peer_port {
+  uint32_t handle;
+  uint32_t type;
+  uint32_t index;
+  bool enabled;
+  uint32_t buffer_num;
+  uint32_t buffer_size;
+  struct mmal_es_format format;
+  union mmal_es_specific_format es;
+
+  /* Every buffer ever seen on the port, first sighting is acknowledged */
+  struct vc_peer_buffer seen[VC_PEER_MAX_BUFFERS];
+  int num_seen;
+
+  /* Output buffers waiting for a frame */
+  struct vc_peer_queued_buffer queue[VC_PEER_MAX_BUFFERS];
+  int queue_rd;
+  int queue_len;
+};
+
+struct vc_peer_component {
+  bool used;
+  bool enabled;
+  uint32_t handle;
+  struct vc_peer_port ports[VC_PEER_NUM_PORTS];
+};
+
+struct vc_peer {
+  struct vc_peer_config config;
+
+  struct vchiq_slot *slots;
+
+  /* VideoCore is the master side of slot memory */
+  struct vchiq_shared_state *local;
+  struct vchiq_shared_state *remote;
+
+  int rx_pos;
+  int tx_pos;
+  int num_slots;
+
+  /* Messages were written since remote trigger was last signalled */
+  bool tx_pending;
+
+  bool connected;
+  int mmal_remoteport;
+
+  struct vc_peer_component components[VC_PEER_MAX_COMPONENTS];
+
+  uint64_t next_frame_us;
+  uint32_t frame_seq;
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  bool doorbell;
+  bool stop;
+
+  struct vc_peer_stats stats;
+};
+
+static struct vc_peer vc = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void vc_peer_event_signal(struct vchiq_event *event)
+{
+  __sync_synchronize();
+  event->fired = 1;
+  __sync_synchronize();
+  if (event->armed) {
+    vc.stats.irqs_tx++;
+    host_irq_raise();
+  }
+}
+
+static void vc_peer_wait_doorbell(void)
+{
+  pthread_mutex_lock(&vc.lock);
+  while (!vc.doorbell && !vc.stop)
+    pthread_cond_wait(&vc.cond, &vc.lock);
+  vc.doorbell = false;
+  pthread_mutex_unlock(&vc.lock);
+}
+
+static inline char *vc_peer_slot_data(int slot_index)
+{
+  return (char *)&vc.slots[slot_index];
+}
+
+/*
+ * Blocks until slot at slot queue index is given back to us by ARM.
+ * ARM recycles our slots after it has parsed all messages in them, so
+ * everything written so far is signalled before waiting.
+ */
+static void vc_peer_tx_wait_slot(int slot_queue_index)
+{
+  bool stalled = false;
+
+  while (1) {
+    __sync_synchronize();
+    if (slot_queue_index < vc.local->slot_queue_recycle)
+      break;
+
+    if (!stalled) {
+      vc.stats.tx_stalls++;
+      stalled = true;
+    }
+
+    if (vc.tx_pending) {
+      vc.tx_pending = false;
+      vc_peer_event_signal(&vc.remote->trigger);
+    }
+    vc.local->recycle.fired = 0;
+    vc_peer_wait_doorbell();
+    if (vc.stop)
+      return;
+  }
+}
+
+static void vc_peer_msg_send(int type, int srcport, int dstport,
+  const void *payload, size_t payload_sz)
+{
+  struct vchiq_header *h;
+  int slot_space, slot_queue_index;
+  size_t msg_full_size = VCHIQ_MSG_TOTAL_SIZE(payload_sz);
+
+  slot_space = VCHIQ_SLOT_SIZE - (vc.tx_pos & VCHIQ_SLOT_MASK);
+  if (slot_space < msg_full_size) {
+    slot_queue_index = vc.tx_pos / VCHIQ_SLOT_SIZE;
+    h = (struct vchiq_header *)(vc_peer_slot_data(
+      vc.local->slot_queue[slot_queue_index & VCHIQ_SLOT_QUEUE_MASK])
+      + (vc.tx_pos & VCHIQ_SLOT_MASK));
+    h->msgid = VCHIQ_MSGID_PADDING;
+    h->size = slot_space - sizeof(*h);
+    vc.tx_pos += slot_space;
+  }
+
+  slot_queue_index = vc.tx_pos / VCHIQ_SLOT_SIZE;
+  vc_peer_tx_wait_slot(slot_queue_index);
+
+  h = (struct vchiq_header *)(vc_peer_slot_data(
+    vc.local->slot_queue[slot_queue_index & VCHIQ_SLOT_QUEUE_MASK])
+    + (vc.tx_pos & VCHIQ_SLOT_MASK));
+  h->msgid = VCHIQ_MAKE_MSG(type, srcport, dstport);
+  h->size = payload_sz;
+  memcpy(h->data, payload, payload_sz);
+  vc.tx_pos += msg_full_size;
+
+  __sync_synchronize();
+  vc.local->tx_pos = vc.tx_pos;
+  vc.tx_pending = true;
+  vc.stats.msgs_tx++;
+}
+
+static void vc_peer_release_slot(int slot_index)
+{
+  int recycle = vc.remote->slot_queue_recycle;
+
+  vc.remote->slot_queue[recycle & VCHIQ_SLOT_QUEUE_MASK] = slot_index;
+  __sync_synchronize();
+  vc.remote->slot_queue_recycle = recycle + 1;
+  vc.stats.slots_released++;
+  vc_peer_event_signal(&vc.remote->recycle);
+}
+
+static struct vc_peer_component *vc_peer_component_get(uint32_t handle)
+{
+  if (!handle || handle > VC_PEER_MAX_COMPONENTS)
+    return NULL;
+
+  if (!vc.components[handle - 1].used)
+    return NULL;
+
+  return &vc.components[handle - 1];
+}
+
+static struct vc_peer_port *vc_peer_port_get(uint32_t component_handle,
+  uint32_t port_handle)
+{
+  struct vc_peer_component *c = vc_peer_component_get(component_handle);
+  int i;
+
+  if (!c)
+    return NULL;
+
+  for (i = 0; i < VC_PEER_NUM_PORTS; ++i)
+    if (c->ports[i].handle == port_handle)
+      return &c->ports[i];
+
+  return NULL;
+}
+
+static struct vc_peer_port *vc_peer_port_get_by_type(uint32_t component_handle,
+  uint32_t type, uint32_t index)
+{
+  struct vc_peer_component *c = vc_peer_component_get(component_handle);
+
+  if (!c || index)
+    return NULL;
+
+  switch (type) {
+    case MMAL_PORT_TYPE_CONTROL: return &c->ports[VC_PEER_PORT_CONTROL];
+    case MMAL_PORT_TYPE_INPUT: return &c->ports[VC_PEER_PORT_INPUT];
+    case MMAL_PORT_TYPE_OUTPUT: return &c->ports[VC_PEER_PORT_OUTPUT];
+    default: return NULL;
+  }
+}
+
+static void vc_peer_mmal_reply(const struct mmal_msg *req, struct mmal_msg *r,
+  size_t payload_sz)
+{
+  r->h.magic = VC_PEER_MMAL_MAGIC;
+  r->h.type = req->h.type;
+  r->h.control_service = req->h.control_service;
+  r->h.context = req->h.context;
+  r->h.status = MMAL_MSG_STATUS_SUCCESS;
+  r->h.padding = 0;
+  vc_peer_msg_send(VCHIQ_MSG_DATA, VC_PEER_MMAL_PORT, vc.mmal_remoteport, r,
+    sizeof(r->h) + payload_sz);
+}
+
+static void vc_peer_component_create(const struct mmal_msg *m,
+  struct mmal_msg *r)
+{
+  struct mmal_msg_component_create_reply *cr = &r->u.component_create_reply;
+  struct vc_peer_component *c = NULL;
+  struct vc_peer_port *p;
+  int i;
+
+  for (i = 0; i < VC_PEER_MAX_COMPONENTS; ++i) {
+    if (!vc.components[i].used) {
+      c = &vc.components[i];
+      break;
+    }
+  }
+
+  if (!c) {
+    cr->status = MMAL_MSG_STATUS_ENOMEM;
+    return;
+  }
+
+  memset(c, 0, sizeof(*c));
+  c->used = true;
+  c->handle = i + 1;
+  for (i = 0; i < VC_PEER_NUM_PORTS; ++i) {
+    p = &c->ports[i];
+    p->handle = c->handle * 16 + i;
+    p->index = 0;
+    p->buffer_num = VC_PEER_BUFFER_NUM_RECOMMENDED;
+    p->buffer_size = vc.config.frame_size;
+    p->format.type = 1;
+    p->format.encoding = MMAL_ENCODING_H264;
+    p->es.video.width = 1920;
+    p->es.video.height = 1080;
+    p->es.video.frame_rate.num = vc.config.fps;
+    p->es.video.frame_rate.den = 1;
+  }
+  c->ports[VC_PEER_PORT_CONTROL].type = MMAL_PORT_TYPE_CONTROL;
+  c->ports[VC_PEER_PORT_INPUT].type = MMAL_PORT_TYPE_INPUT;
+  c->ports[VC_PEER_PORT_OUTPUT].type = MMAL_PORT_TYPE_OUTPUT;
+
+  cr->status = MMAL_MSG_STATUS_SUCCESS;
+  cr->component_handle = c->handle;
+  cr->input_num = 1;
+  cr->output_num = 1;
+  cr->clock_num = 0;
+}
+
+static void vc_peer_port_to_msg(const struct vc_peer_port *p,
+  struct mmal_port_msg *pm, struct mmal_es_format *format,
+  union mmal_es_specific_format *es)
+{
+  memset(pm, 0, sizeof(*pm));
+  pm->type = p->type;
+  pm->index = p->index;
+  pm->is_enabled = p->enabled;
+  pm->buffer_num_min = VC_PEER_BUFFER_NUM_MIN;
+  pm->buffer_size_min = vc.config.frame_size;
+  pm->buffer_alignment_min = 0;
+  pm->buffer_num_recommended = VC_PEER_BUFFER_NUM_RECOMMENDED;
+  pm->buffer_size_recommended = vc.config.frame_size;
+  pm->buffer_num = p->buffer_num;
+  pm->buffer_size = p->buffer_size;
+  *format = p->format;
+  format->extradata_size = 0;
+  *es = p->es;
+}
+
+static void vc_peer_port_info_get(const struct mmal_msg *m, struct mmal_msg *r)
+{
+  const struct mmal_msg_port_info_get *g = &m->u.port_info_get;
+  struct mmal_msg_port_info_get_reply *gr = &r->u.port_info_get_reply;
+  struct vc_peer_port *p;
+
+  p = vc_peer_port_get_by_type(g->component_handle, g->port_type, g->index);
+  gr->component_handle = g->component_handle;
+  gr->port_type = g->port_type;
+  gr->port_index = g->index;
+  if (!p) {
+    gr->status = MMAL_MSG_STATUS_ENOENT;
+    return;
+  }
+
+  gr->status = MMAL_MSG_STATUS_SUCCESS;
+  gr->found = 1;
+  gr->port_handle = p->handle;
+  vc_peer_port_to_msg(p, &gr->port, &gr->format, &gr->es);
+}
+
+static void vc_peer_port_info_set(const struct mmal_msg *m, struct mmal_msg *r)
+{
+  const struct mmal_msg_port_info_set *s = &m->u.port_info_set;
+  struct mmal_msg_port_info_set_reply *sr = &r->u.port_info_set_reply;
+  struct vc_peer_port *p;
+
+  p = vc_peer_port_get_by_type(s->component_handle, s->port_type,
+    s->port_index);
+  sr->component_handle = s->component_handle;
+  sr->port_type = s->port_type;
+  sr->index = s->port_index;
+  if (!p) {
+    sr->status = MMAL_MSG_STATUS_ENOENT;
+    return;
+  }
+
+  if (s->port.buffer_num)
+    p->buffer_num = s->port.buffer_num;
+  if (s->port.buffer_size)
+    p->buffer_size = s->port.buffer_size;
+  p->format = s->format;
+  p->es = s->es;
+
+  sr->status = MMAL_MSG_STATUS_SUCCESS;
+  sr->found = 1;
+  sr->port_handle = p->handle;
+  vc_peer_port_to_msg(p, &sr->port, &sr->format, &sr->es);
+}
+
+static void vc_peer_buffer_to_host(const struct vc_peer_queued_buffer *qb,
+  uint32_t length, uint32_t flags, int64_t pts)
+{
+  struct mmal_msg r;
+
+  r.u.buffer_from_host = qb->b;
+  r.u.buffer_from_host.buffer_header.length = length;
+  r.u.buffer_from_host.buffer_header.offset = 0;
+  r.u.buffer_from_host.buffer_header.flags = flags;
+  r.u.buffer_from_host.buffer_header.pts = pts;
+  r.u.buffer_from_host.buffer_header.dts = pts;
+
+  r.h = qb->h;
+  r.h.type = MMAL_MSG_TYPE_BUFFER_TO_HOST;
+  r.h.magic = VC_PEER_MMAL_MAGIC;
+  r.h.status = MMAL_MSG_STATUS_SUCCESS;
+  vc_peer_msg_send(VCHIQ_MSG_DATA, VC_PEER_MMAL_PORT, vc.mmal_remoteport, &r,
+    sizeof(r.h) + sizeof(r.u.buffer_from_host));
+}
+
+static void vc_peer_port_flush(struct vc_peer_port *p)
+{
+  while (p->queue_len) {
+    vc_peer_buffer_to_host(&p->queue[p->queue_rd], 0, 0, MMAL_TIME_UNKNOWN);
+    p->queue_rd = (p->queue_rd + 1) % VC_PEER_MAX_BUFFERS;
+    p->queue_len--;
+  }
+}
+
+static void vc_peer_port_action(const struct mmal_msg *m, struct mmal_msg *r)
+{
+  const struct mmal_msg_port_action_handle *a = &m->u.port_action_handle;
+  struct vc_peer_port *p;
+
+  p = vc_peer_port_get(a->component_handle, a->port_handle);
+  if (!p) {
+    r->u.port_action_reply.status = MMAL_MSG_STATUS_ENOENT;
+    return;
+  }
+
+  switch (a->action) {
+    case MMAL_MSG_PORT_ACTION_TYPE_ENABLE:
+      p->enabled = true;
+      break;
+    case MMAL_MSG_PORT_ACTION_TYPE_DISABLE:
+      p->enabled = false;
+      vc_peer_port_flush(p);
+      break;
+    case MMAL_MSG_PORT_ACTION_TYPE_FLUSH:
+      vc_peer_port_flush(p);
+      break;
+    default:
+      break;
+  }
+  r->u.port_action_reply.status = MMAL_MSG_STATUS_SUCCESS;
+}
+
+static void vc_peer_parameter_get(const struct mmal_msg *m, struct mmal_msg *r)
+{
+  const struct mmal_msg_port_parameter_get *g = &m->u.port_parameter_get;
+  struct mmal_msg_port_parameter_get_reply *gr = &r->u.port_parameter_get_reply;
+
+  gr->status = MMAL_MSG_STATUS_SUCCESS;
+  gr->id = g->id;
+  gr->size = 0;
+  if (g->id == MMAL_PARAM_SUPPORTED_ENCODINGS) {
+    gr->value[0] = MMAL_ENCODING_H264;
+    gr->value[1] = MMAL_ENCODING_I420;
+    gr->value[2] = MMAL_ENCODING_RGB24;
+    gr->size = 3 * sizeof(gr->value[0]);
+  }
+}
+
+static struct vc_peer_buffer *vc_peer_port_buffer_get(struct vc_peer_port *p,
+  uint32_t data, bool *first_seen)
+{
+  int i;
+
+  *first_seen = false;
+  for (i = 0; i < p->num_seen; ++i)
+    if (p->seen[i].data == data)
+      return &p->seen[i];
+
+  if (p->num_seen == VC_PEER_MAX_BUFFERS)
+    return NULL;
+
+  *first_seen = true;
+  p->seen[p->num_seen].data = data;
+  p->seen[p->num_seen].emitted = false;
+  return &p->seen[p->num_seen++];
+}
+
+static void vc_peer_latency_add(struct vc_peer_latency *l, uint64_t us)
+{
+  if (!l->count || us < l->min_us)
+    l->min_us = us;
+  if (us > l->max_us)
+    l->max_us = us;
+  l->sum_us += us;
+  l->count++;
+}
+
+static void vc_peer_buffer_from_host(const struct mmal_msg *m)
+{
+  const struct mmal_msg_buffer_from_host *bm = &m->u.buffer_from_host;
+  struct vc_peer_queued_buffer qb = { .h = m->h, .b = *bm };
+  struct vc_peer_port *p;
+  struct vc_peer_buffer *b;
+  bool first_seen;
+
+  p = vc_peer_port_get(bm->drvbuf.component_handle, bm->drvbuf.port_handle);
+  if (!p) {
+    fprintf(stderr, "vc_peer: buffer for unknown port %d\n",
+      bm->drvbuf.port_handle);
+    return;
+  }
+
+  b = vc_peer_port_buffer_get(p, bm->buffer_header.data, &first_seen);
+  if (!b) {
+    fprintf(stderr, "vc_peer: too many buffers on port %d\n", p->handle);
+    return;
+  }
+
+  if (first_seen || p->type != MMAL_PORT_TYPE_OUTPUT) {
+    if (!first_seen)
+      vc.stats.frames_in++;
+    vc_peer_buffer_to_host(&qb, 0, 0, MMAL_TIME_UNKNOWN);
+    return;
+  }
+
+  if (b->emitted) {
+    vc_peer_latency_add(&vc.stats.round_trip,
+      host_time_us() - b->emit_time_us);
+    b->emitted = false;
+  }
+
+  p->queue[(p->queue_rd + p->queue_len) % VC_PEER_MAX_BUFFERS] = qb;
+  p->queue_len++;
+}
+
+static void vc_peer_mmal_msg(const struct mmal_msg *m, size_t size)
+{
+  struct mmal_msg r;
+  size_t reply_sz = 0;
+
+  memset(&r.u, 0, sizeof(r.u));
+
+  switch (m->h.type) {
+    case MMAL_MSG_TYPE_GET_VERSION:
+      r.u.version.major = 15;
+      r.u.version.minimum = 10;
+      reply_sz = sizeof(r.u.version);
+      break;
+    case MMAL_MSG_TYPE_COMPONENT_CREATE:
+      vc_peer_component_create(m, &r);
+      reply_sz = sizeof(r.u.component_create_reply);
+      break;
+    case MMAL_MSG_TYPE_COMPONENT_ENABLE:
+    case MMAL_MSG_TYPE_COMPONENT_DISABLE:
+    case MMAL_MSG_TYPE_COMPONENT_DESTROY: {
+      struct vc_peer_component *c;
+
+      c = vc_peer_component_get(m->u.component_enable.component_handle);
+      r.u.component_enable_reply.status = c ? MMAL_MSG_STATUS_SUCCESS
+        : MMAL_MSG_STATUS_ENOENT;
+      if (c) {
+        c->enabled = m->h.type == MMAL_MSG_TYPE_COMPONENT_ENABLE;
+        if (m->h.type == MMAL_MSG_TYPE_COMPONENT_DESTROY)
+          c->used = false;
+      }
+      reply_sz = sizeof(r.u.component_enable_reply);
+      break;
+    }
+    case MMAL_MSG_TYPE_PORT_INFO_GET:
+      vc_peer_port_info_get(m, &r);
+      reply_sz = sizeof(r.u.port_info_get_reply);
+      break;
+    case MMAL_MSG_TYPE_PORT_INFO_SET:
+      vc_peer_port_info_set(m, &r);
+      reply_sz = sizeof(r.u.port_info_set_reply);
+      break;
+    case MMAL_MSG_TYPE_PORT_ACTION:
+      vc_peer_port_action(m, &r);
+      reply_sz = sizeof(r.u.port_action_reply);
+      break;
+    case MMAL_MSG_TYPE_PORT_PARAMETER_SET:
+      r.u.port_parameter_set_reply.status = MMAL_MSG_STATUS_SUCCESS;
+      reply_sz = sizeof(r.u.port_parameter_set_reply);
+      break;
+    case MMAL_MSG_TYPE_PORT_PARAMETER_GET:
+      vc_peer_parameter_get(m, &r);
+      reply_sz = sizeof(r.u.port_parameter_get_reply);
+      break;
+    case MMAL_MSG_TYPE_BUFFER_FROM_HOST:
+      vc_peer_buffer_from_host(m);
+      return;
+    default:
+      fprintf(stderr, "vc_peer: unsupported mmal message %d\n", m->h.type);
+      return;
+  }
+
+  vc_peer_mmal_reply(m, &r, reply_sz);
+}
+
+static void vc_peer_msg_open(int remoteport, const struct vchiq_header *h)
+{
+  const struct vchiq_msg_open_service *m = (const void *)h->data;
+  short version = m->version;
+
+  if (m->service_id != VC_PEER_MMAL_SERVICE_ID) {
+    fprintf(stderr, "vc_peer: no service %08x\n", m->service_id);
+    vc_peer_msg_send(VCHIQ_MSG_CLOSE, 0, remoteport, NULL, 0);
+    return;
+  }
+
+  vc.mmal_remoteport = remoteport;
+  vc_peer_msg_send(VCHIQ_MSG_OPENACK, VC_PEER_MMAL_PORT, remoteport, &version,
+    sizeof(version));
+}
+
+static void vc_peer_msg_dispatch(const struct vchiq_header *h)
+{
+  int localport = VCHIQ_MSG_DSTPORT(h->msgid);
+  int remoteport = VCHIQ_MSG_SRCPORT(h->msgid);
+
+  vc.stats.msgs_rx++;
+  switch (VCHIQ_MSG_TYPE(h->msgid)) {
+    case VCHIQ_MSG_CONNECT:
+      vc.connected = true;
+      break;
+    case VCHIQ_MSG_OPEN:
+      vc_peer_msg_open(remoteport, h);
+      break;
+    case VCHIQ_MSG_DATA:
+      if (localport == VC_PEER_MMAL_PORT)
+        vc_peer_mmal_msg((const void *)h->data, h->size);
+      else
+        fprintf(stderr, "vc_peer: data for unknown port %d\n", localport);
+      break;
+    default:
+      fprintf(stderr, "vc_peer: unsupported message %08x\n", h->msgid);
+      break;
+  }
+}
+
+static void vc_peer_parse_rx(void)
+{
+  struct vchiq_header *h;
+  int slot_queue_index, slot_index;
+
+  __sync_synchronize();
+  while (vc.rx_pos != vc.remote->tx_pos) {
+    slot_queue_index = vc.rx_pos / VCHIQ_SLOT_SIZE;
+    slot_index =
+      vc.remote->slot_queue[slot_queue_index & VCHIQ_SLOT_QUEUE_MASK];
+    h = (struct vchiq_header *)(vc_peer_slot_data(slot_index)
+      + (vc.rx_pos & VCHIQ_SLOT_MASK));
+
+    vc.rx_pos += VCHIQ_MSG_TOTAL_SIZE(h->size);
+    if (h->msgid != VCHIQ_MSGID_PADDING)
+      vc_peer_msg_dispatch(h);
+
+    if (vc.rx_pos / VCHIQ_SLOT_SIZE != slot_queue_index)
+      vc_peer_release_slot(slot_index);
+    __sync_synchronize();
+  }
+}
+
+static void vc_peer_emit_frame(struct vc_peer_port *p, uint64_t now)
+{
+  struct vc_peer_queued_buffer *qb = &p->queue[p->queue_rd];
+  struct vc_peer_frame_stamp *stamp;
+  struct vc_peer_buffer *b;
+  uint32_t length, flags;
+  bool first_seen;
+
+  length = vc.config.frame_size;
+  if (length > qb->b.buffer_header.alloc_size)
+    length = qb->b.buffer_header.alloc_size;
+
+  /* Both zero-copy handle and bus address are host addresses here */
+  if (length >= sizeof(*stamp)) {
+    stamp = PADDR_UNCACHED_TO_PTR(qb->b.buffer_header.data);
+    stamp->magic = VC_PEER_FRAME_MAGIC;
+    stamp->seq = vc.frame_seq;
+    stamp->emit_time_us = now;
+  }
+
+  flags = MMAL_BUFFER_HEADER_FLAG_FRAME_END;
+  if (vc.config.keyframe_period
+    && !(vc.frame_seq % vc.config.keyframe_period))
+    flags |= MMAL_BUFFER_HEADER_FLAG_KEYFRAME;
+
+  b = vc_peer_port_buffer_get(p, qb->b.buffer_header.data, &first_seen);
+  b->emitted = true;
+  b->emit_time_us = now;
+
+  vc_peer_buffer_to_host(qb, length, flags, now);
+  p->queue_rd = (p->queue_rd + 1) % VC_PEER_MAX_BUFFERS;
+  p->queue_len--;
+  vc.frame_seq++;
+  vc.stats.frames_out++;
+}
+
+static void vc_peer_emit_frames(void)
+{
+  struct vc_peer_port *p;
+  uint64_t now = host_time_us();
+  uint64_t interval;
+  int i;
+
+  if (vc.config.fps) {
+    if (now < vc.next_frame_us)
+      return;
+
+    interval = 1000000 / vc.config.fps;
+    vc.next_frame_us += interval;
+    if (vc.next_frame_us < now)
+      vc.next_frame_us = now + interval;
+  }
+
+  for (i = 0; i < VC_PEER_MAX_COMPONENTS; ++i) {
+    if (!vc.components[i].used)
+      continue;
+
+    p = &vc.components[i].ports[VC_PEER_PORT_OUTPUT];
+    if (!p->enabled || !p->num_seen)
+      continue;
+
+    if (!p->queue_len) {
+      if (vc.config.fps)
+        vc.stats.frames_dropped++;
+      continue;
+    }
+
+    do {
+      vc_peer_emit_frame(p, now);
+    } while (!vc.config.fps && p->queue_len);
+  }
+}
+
+/*
+ * Sleeps until ARM rings the doorbell or next frame is due.
+ */
+static void vc_peer_wait(void)
+{
+  struct timespec ts;
+  uint64_t deadline_us;
+  uint64_t now;
+
+  pthread_mutex_lock(&vc.lock);
+  while (!vc.doorbell && !vc.stop) {
+    if (!vc.config.fps) {
+      pthread_cond_wait(&vc.cond, &vc.lock);
+      continue;
+    }
+
+    now = host_time_us();
+    if (now >= vc.next_frame_us)
+      break;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    deadline_us = ts.tv_sec * 1000000ull + ts.tv_nsec / 1000
+      + (vc.next_frame_us - now);
+    ts.tv_sec = deadline_us / 1000000;
+    ts.tv_nsec = (deadline_us % 1000000) * 1000;
+    if (pthread_cond_timedwait(&vc.cond, &vc.lock, &ts) == ETIMEDOUT)
+      break;
+  }
+  vc.doorbell = false;
+  pthread_mutex_unlock(&vc.lock);
+}
+
+static void *vc_peer_thread(void *arg)
+{
+  vc_peer_msg_send(VCHIQ_MSG_CONNECT, 0, 0, NULL, 0);
+  vc.tx_pending = false;
+  vc_peer_event_signal(&vc.remote->trigger);
+
+  vc.next_frame_us = host_time_us();
+  while (1) {
+    vc_peer_wait();
+    if (vc.stop)
+      break;
+
+    vc.local->trigger.fired = 0;
+    vc.local->recycle.fired = 0;
+    vc_peer_parse_rx();
+    vc_peer_emit_frames();
+
+    if (vc.tx_pending) {
+      vc.tx_pending = false;
+      vc_peer_event_signal(&vc.remote->trigger);
+    }
+  }
+  return NULL;
+}
+
+static void vc_peer_event_init(struct vchiq_event *e)
+{
+  /* VideoCore wants a doorbell for every signalled event */
+  e->armed = 1;
+  e->fired = 0;
+}
+
+void vc_peer_init(const struct vc_peer_config *config)
+{
+  vc.config = *config;
+}
+
+int vc_peer_start(void *slot_mem)
+{
+  int mem_align = (VCHIQ_SLOT_SIZE - (int)(uint64_t)slot_mem) & VCHIQ_SLOT_MASK;
+  struct vchiq_slot_zero *slot_zero = (void *)((char *)slot_mem + mem_align);
+  struct vchiq_shared_state *local;
+  int i, num_slots = 0;
+
+  if (slot_zero->magic != VCHIQ_MAGIC
+    || slot_zero->version_min > VCHIQ_VERSION
+    || slot_zero->slot_size != VCHIQ_SLOT_SIZE) {
+    fprintf(stderr, "vc_peer: bad slot zero\n");
+    return ERR_INVAL;
+  }
+
+  vc.slots = (struct vchiq_slot *)slot_zero;
+  vc.local = local = &slot_zero->master;
+  vc.remote = &slot_zero->slave;
+
+  for (i = local->slot_first; i <= local->slot_last; ++i)
+    local->slot_queue[num_slots++] = i;
+
+  vc_peer_event_init(&local->trigger);
+  vc_peer_event_init(&local->recycle);
+  vc_peer_event_init(&local->sync_trigger);
+  vc_peer_event_init(&local->sync_release);
+  local->tx_pos = 0;
+  local->slot_queue_recycle = num_slots;
+  vc.num_slots = num_slots;
+  local->debug[DEBUG_ENTRIES] = DEBUG_MAX;
+  __sync_synchronize();
+  local->initialised = 1;
+
+  if (pthread_create(&vc.thread, NULL, vc_peer_thread, NULL))
+    return ERR_GENERIC;
+
+  return SUCCESS;
+}
+
+void vc_peer_stop(void)
+{
+  pthread_mutex_lock(&vc.lock);
+  vc.stop = true;
+  pthread_cond_signal(&vc.cond);
+  pthread_mutex_unlock(&vc.lock);
+  pthread_join(vc.thread, NULL);
+}
+
+void vc_peer_doorbell(void)
+{
+  pthread_mutex_lock(&vc.lock);
+  vc.stats.doorbells_rx++;
+  vc.doorbell = true;
+  pthread_cond_signal(&vc.cond);
+  pthread_mutex_unlock(&vc.lock);
+}
+
+void vc_peer_get_stats(struct vc_peer_stats *stats)
+{
+  pthread_mutex_lock(&vc.lock);
+  *stats = vc.stats;
+  stats->slots_recycled = vc.local->slot_queue_recycle - vc.num_slots;
+  pthread_mutex_unlock(&vc.lock);
+}
+
+bool mbox_init_vchiq(uint32_t *vchiq_base)
+{
+  return vc_peer_start(PADDR_UNCACHED_TO_PTR(*vchiq_base)) == SUCCESS;
+}
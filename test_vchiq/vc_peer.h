@@ -0,0 +1,85 @@
+#pragma once
+#include <stdint.h>
+
+/*
+ * Fake VideoCore side of VCHIQ for host benchmarks.
+ *
+ * Peer takes master side of the slot memory, set up by vchiq_slots_init,
+ * answers CONNECT and OPEN for "mmal" service and emulates MMAL components.
+ * Every component has one input and one output port. Buffers sent to output
+ * ports are returned as filled frames at a configured frame rate, buffers
+ * sent to input ports are consumed and returned empty right away.
+ *
+ * Like firmware, first BUFFER_FROM_HOST of every buffer is acknowledged by
+ * returning it empty, service_mmal.c relies on that.
+ */
+
+struct vc_peer_config {
+  /* Frames per second on output ports, 0 - as soon as buffer is available */
+  int fps;
+
+  /* Bytes filled in every output frame */
+  uint32_t frame_size;
+
+  /* Every Nth frame is flagged as keyframe */
+  int keyframe_period;
+};
+
+/*
+ * Written to the start of every output frame, lets consumer measure
+ * delivery latency.
+ */
+struct vc_peer_frame_stamp {
+  uint32_t magic;
+  uint32_t seq;
+  uint64_t emit_time_us;
+};
+
+#define VC_PEER_FRAME_MAGIC 0x46435656
+
+struct vc_peer_latency {
+  uint64_t count;
+  uint64_t min_us;
+  uint64_t max_us;
+  uint64_t sum_us;
+};
+
+struct vc_peer_stats {
+  /* VCHIQ messages received from / sent to ARM */
+  uint64_t msgs_rx;
+  uint64_t msgs_tx;
+
+  /* ARM rang VideoCore doorbell */
+  uint64_t doorbells_rx;
+
+  /* VideoCore raised doorbell interrupt on ARM */
+  uint64_t irqs_tx;
+
+  /* Slots released back to ARM / returned by ARM */
+  uint64_t slots_released;
+  uint64_t slots_recycled;
+
+  /* Times VideoCore had to wait for ARM to recycle a slot */
+  uint64_t tx_stalls;
+
+  uint64_t frames_out;
+  uint64_t frames_in;
+
+  /* Frame was due, but no buffer was queued on the output port */
+  uint64_t frames_dropped;
+
+  /* Output buffer emitted as frame until it is sent back by ARM */
+  struct vc_peer_latency round_trip;
+};
+
+void vc_peer_init(const struct vc_peer_config *config);
+
+/* Attach to slot memory and start peer thread, see mbox_init_vchiq */
+int vc_peer_start(void *slot_mem);
+
+void vc_peer_stop(void);
+
+/* ARM rang ARM_DOORBELL_2 */
+void vc_peer_doorbell(void);
+
+void vc_peer_get_stats(struct vc_peer_stats *stats);
@@ -0,0 +1 @@
+../src/vc/vchiq.c
\ No newline at end of file
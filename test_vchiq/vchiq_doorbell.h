@@ -0,0 +1,38 @@
+#pragma once
+#include <stdbool.h>
+#include <memory_map.h>
+#include "host_os.h"
+#include "vc_peer.h"
+
+/*
+ * Host replacement for src/vc/vchiq_doorbell.h. Ringing ARM_DOORBELL_2 wakes
+ * up the VideoCore peer, the peer raises doorbell 0 interrupt back to ARM
+ * through host_irq_raise.
+ */
+#define BCM2835_IRQNR_ARM_DOORBELL_0 66
+
+typedef void (*irq_func)(void);
+
+static inline void irq_set(int irqnr, irq_func func)
+{
+  host_irq_set(func);
+}
+
+static inline void bcm2835_ic_disable_irq(int irqnr)
+{
+}
+
+static inline void vchiq_doorbell_0_irq_enable(irq_func func)
+{
+  irq_set(BCM2835_IRQNR_ARM_DOORBELL_0, func);
+}
+
+static inline bool vchiq_doorbell_is_triggered(void)
+{
+  return true;
+}
+
+static void vchiq_doorbell_trigger(void)
+{
+  vc_peer_doorbell();
+}
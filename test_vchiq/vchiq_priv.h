@@ -0,0 +1 @@
+../src/vc/vchiq_priv.h
\ No newline at end of file